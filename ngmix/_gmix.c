@@ -15,6 +15,10 @@
 #include <numpy/arrayobject.h> 
 #include "_gmix.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 // exceptions
 static PyObject* GMixRangeError;
@@ -23,6 +27,22 @@ static PyObject* GMixFatalError;
 #define PYGMIX_MAXDIMS 10
 #define PYGMIX_DOFFSET 2
 
+/*
+   number of threads to use for the batch kernels; nthreads <= 0 means
+   use the OpenMP default.  Always 1 when built without OpenMP
+*/
+static int pygmix_get_nthreads(int nthreads)
+{
+#ifdef _OPENMP
+    if (nthreads <= 0) {
+        nthreads=omp_get_max_threads();
+    }
+#else
+    nthreads=1;
+#endif
+    return nthreads;
+}
+
 // for gauss legendre integration
 static const double pygmix_gl_xxi5[5] = {-0.906179845938664,  -0.5384693101056831,  0,  0.5384693101056831,  0.906179845938664};
 static const double pygmix_gl_wwi5[5] = {0.05613434886242515,  0.1133999999968999,  0.1347850723875167,  0.1133999999968999,  0.05613434886242515};
@@ -55,14 +75,15 @@ static int set_gauleg_data(int npoints, const double **xxi, const double **wwi)
 
     return 0 means out of range
 */
-static int g1g2_to_e1e2(double g1, double g2, double *e1, double *e2) {
+/*
+   returns 0 if g is out of bounds, without setting an exception, so this
+   can be called without holding the GIL
+*/
+static int g1g2_to_e1e2_nothrow(double g1, double g2, double *e1, double *e2) {
     double eta=0, e=0, fac=0;
     double g=sqrt(g1*g1 + g2*g2);
 
     if (g >= 1) {
-        char gstr[25];
-        snprintf(gstr,24,"%g", g);
-        PyErr_Format(GMixRangeError, "g out of bounds: %s", gstr);
         return 0;
     }
     if (g == 0.0) {
@@ -86,6 +107,16 @@ static int g1g2_to_e1e2(double g1, double g2, double *e1, double *e2) {
     return 1;
 }
 
+static int g1g2_to_e1e2(double g1, double g2, double *e1, double *e2) {
+    if (!g1g2_to_e1e2_nothrow(g1, g2, e1, e2)) {
+        char gstr[25];
+        snprintf(gstr,24,"%g", sqrt(g1*g1 + g2*g2));
+        PyErr_Format(GMixRangeError, "g out of bounds: %s", gstr);
+        return 0;
+    }
+    return 1;
+}
+
 
 /*
     convert eta1,eta2 to reduced shear g1,g2
@@ -350,6 +381,189 @@ static const double PyGMix_fvals_turb[] = {
 static const double PyGMix_pvals_gauss[] = {1.0};
 static const double PyGMix_fvals_gauss[] = {1.0};
 
+/*
+   Sersic mixtures
+
+   10 gaussian fits to sersic profiles at the nodes below, columns are
+   10 fvals followed by 10 pvals, with the same normalization as the exp
+   and dev tables.  These match _sersic_data_10gauss in gmix.py
+
+   At module load these are interpolated onto a fine, uniform grid in n
+   using a monotone cubic in log(f) and log(p), so gmix_fill only needs a
+   linear interpolation between neighboring rows of the fine grid
+*/
+
+static const double PyGMix_sersic_nvals[PYGMIX_SERSIC_NNODES] = {
+    0.75, 1.0, 1.05, 1.25, 1.5, 2.00, 2.50, 3.00, 3.50, 4.00, 4.50, 5.00, 5.50, 6.00
+};
+
+static const double PyGMix_sersic_data[PYGMIX_SERSIC_NNODES][2*PYGMIX_SERSIC_NGAUSS] = {
+    {0.000249964,  0.00160301,  0.00626292,  0.0192913,  0.0514659,  0.124931,  0.28234,  0.593018,  1.13983,  2.01192,  1.69267e-06,  2.49274e-05,  0.000196065,  0.00113602,  0.00553923,  0.0243836,  0.0958122,  0.287113,  0.434863,  0.15093}, 
+    {0.000141183,  0.00103725,  0.00453358,  0.0154615,  0.0452213,  0.118812,  0.288153,  0.657267,  1.43447,  3.09618,  8.69196e-06,  0.000114263,  0.00083198,  0.00442365,  0.0188262,  0.0653268,  0.177007,  0.32906,  0.317786,  0.0866153}, 
+    {0.000120697,  0.000909617,  0.0040539,  0.0140571,  0.0417659,  0.111547,  0.275608,  0.64312,  1.44609,  3.25247,  1.0192e-05,  0.000132091,  0.000947265,  0.00494159,  0.0205266,  0.0691038,  0.180863,  0.325843,  0.310749,  0.086884}, 
+    {6.39097e-05,  0.000527167,  0.00252544,  0.00935232,  0.0296281,  0.0845536,  0.224712,  0.571277,  1.4312,  3.73464,  1.58929e-05,  0.000195935,  0.00133795,  0.00658759,  0.0254544,  0.0785048,  0.18699,  0.31222,  0.29498,  0.0937132}, 
+    {2.9818e-05,  0.00027051,  0.00140013,  0.0055675,  0.0189225,  0.0581109,  0.167323,  0.466364,  1.3084,  3.997,  2.20616e-05,  0.000258835,  0.00168076,  0.00781816,  0.0283343,  0.0816486,  0.182828,  0.295325,  0.290403,  0.111681}, 
+    {7.18653e-06,  7.68446e-05,  0.00045508,  0.0020511,  0.00789117,  0.0275417,  0.0909392,  0.295217,  0.992545,  3.89542,  2.8716e-05,  0.000317049,  0.00193356,  0.00841468,  0.0284897,  0.0771123,  0.165373,  0.268048,  0.293013,  0.15727}, 
+    {1.98179e-06,  2.47646e-05,  0.000165708,  0.000835235,  0.00358485,  0.0139879,  0.0519524,  0.191828,  0.748381,  3.58525,  2.93838e-05,  0.000317696,  0.00188226,  0.00794749,  0.0261771,  0.0694859,  0.148591,  0.247823,  0.296409,  0.201336}, 
+    {6.50627e-07,  9.20752e-06,  6.82515e-05,  0.00037868,  0.0017871,  0.00768484,  0.0316306,  0.130712,  0.580699,  3.29779,  2.84846e-05,  0.000300823,  0.00174627,  0.00724537,  0.023567,  0.062296,  0.134507,  0.231803,  0.298465,  0.240041}, 
+    {3.70285e-07,  4.94355e-06,  3.70333e-05,  0.000213576,  0.0010627,  0.00486769,  0.0215516,  0.096939,  0.476936,  3.10563,  3.92413e-05,  0.000343401,  0.00182922,  0.00718711,  0.0225433,  0.0583249,  0.125256,  0.219312,  0.296521,  0.268644}, 
+    {2.95933e-07,  3.46867e-06,  2.48365e-05,  0.000143079,  0.000727616,  0.00345813,  0.0160859,  0.0770072,  0.410127,  2.98125,  6.50736e-05,  0.000441826,  0.00208608,  0.00759116,  0.0226025,  0.0565324,  0.11939,  0.209696,  0.292542,  0.289053}, 
+    {2.63657e-07,  2.75208e-06,  1.8623e-05,  0.000105636,  0.000541346,  0.00263354,  0.0126999,  0.0638365,  0.362754,  2.89231,  0.000107377,  0.000578318,  0.00242603,  0.00817028,  0.023058,  0.0556427,  0.11522,  0.202006,  0.288213,  0.304577}, 
+    {2.47725e-07,  2.35418e-06,  1.5056e-05,  8.35572e-05,  0.000427966,  0.0021121,  0.0104602,  0.0546547,  0.327721,  2.82692,  0.000170701,  0.00075224,  0.00283117,  0.00886048,  0.023743,  0.0552981,  0.112159,  0.195717,  0.283881,  0.316588}, 
+    {2.40362e-07,  2.1193e-06,  1.28581e-05,  6.96343e-05,  0.000354659,  0.00176456,  0.00891162,  0.0480232,  0.301129,  2.77845,  0.00026027,  0.000964948,  0.0032944,  0.00963429,  0.0245826,  0.0553232,  0.109883,  0.190484,  0.279651,  0.325921}, 
+    {2.3827e-07,  1.97827e-06,  1.14419e-05,  6.04297e-05,  0.000305109,  0.0015236,  0.00780465,  0.0431059,  0.280569,  2.74262,  0.000381366,  0.00121753,  0.00381056,  0.0104738,  0.0255305,  0.0556082,  0.108184,  0.186068,  0.275568,  0.333157}
+};
+
+// fine grid, filled by sersic_init_table at module load
+static double PyGMix_sersic_fine[PYGMIX_SERSIC_NFINE][2*PYGMIX_SERSIC_NGAUSS];
+
+/*
+   monotone (Fritsch-Carlson) slopes for a piecewise cubic hermite
+   interpolant through the sersic nodes
+*/
+static void sersic_pchip_slopes(const double *x,
+                                double y[PYGMIX_SERSIC_NNODES],
+                                double d[PYGMIX_SERSIC_NNODES])
+{
+    npy_intp k=0, n=PYGMIX_SERSIC_NNODES;
+    double h[PYGMIX_SERSIC_NNODES], delta[PYGMIX_SERSIC_NNODES];
+
+    for (k=0; k<n-1; k++) {
+        h[k] = x[k+1]-x[k];
+        delta[k] = (y[k+1]-y[k])/h[k];
+    }
+
+    for (k=1; k<n-1; k++) {
+        if (delta[k-1]*delta[k] <= 0) {
+            d[k] = 0.0;
+        } else {
+            double w1 = 2*h[k] + h[k-1];
+            double w2 = h[k] + 2*h[k-1];
+            d[k] = (w1+w2)/(w1/delta[k-1] + w2/delta[k]);
+        }
+    }
+
+    // one sided three point estimates at the ends, kept monotone
+    d[0] = ((2*h[0]+h[1])*delta[0] - h[0]*delta[1])/(h[0]+h[1]);
+    if (d[0]*delta[0] <= 0) {
+        d[0]=0.0;
+    } else if (delta[0]*delta[1] <= 0 && fabs(d[0]) > fabs(3*delta[0])) {
+        d[0] = 3*delta[0];
+    }
+
+    d[n-1] = ((2*h[n-2]+h[n-3])*delta[n-2] - h[n-2]*delta[n-3])/(h[n-2]+h[n-3]);
+    if (d[n-1]*delta[n-2] <= 0) {
+        d[n-1]=0.0;
+    } else if (delta[n-2]*delta[n-3] <= 0 && fabs(d[n-1]) > fabs(3*delta[n-2])) {
+        d[n-1] = 3*delta[n-2];
+    }
+}
+
+static void sersic_init_table(void)
+{
+    npy_intp icol=0, k=0, ifine=0, ig=0;
+    double y[PYGMIX_SERSIC_NNODES], d[PYGMIX_SERSIC_NNODES];
+    const double *x=PyGMix_sersic_nvals;
+
+    for (icol=0; icol<2*PYGMIX_SERSIC_NGAUSS; icol++) {
+        for (k=0; k<PYGMIX_SERSIC_NNODES; k++) {
+            y[k] = log(PyGMix_sersic_data[k][icol]);
+        }
+        sersic_pchip_slopes(x, y, d);
+
+        k=0;
+        for (ifine=0; ifine<PYGMIX_SERSIC_NFINE; ifine++) {
+            double n = PYGMIX_SERSIC_NMIN + ifine*PYGMIX_SERSIC_DN;
+            double h=0, t=0, t2=0, t3=0, val=0;
+
+            while (k < PYGMIX_SERSIC_NNODES-2 && n > x[k+1]) {
+                k++;
+            }
+
+            h = x[k+1]-x[k];
+            t = (n-x[k])/h;
+            t2=t*t;
+            t3=t2*t;
+
+            val = (2*t3 - 3*t2 + 1)*y[k]
+                + (t3 - 2*t2 + t)*h*d[k]
+                + (-2*t3 + 3*t2)*y[k+1]
+                + (t3 - t2)*h*d[k+1];
+
+            PyGMix_sersic_fine[ifine][icol] = exp(val);
+        }
+    }
+
+    // same normalization as the other models: sum(p)=1, sum(p*f)=1
+    for (ifine=0; ifine<PYGMIX_SERSIC_NFINE; ifine++) {
+        double *fvals=&PyGMix_sersic_fine[ifine][0];
+        double *pvals=&PyGMix_sersic_fine[ifine][PYGMIX_SERSIC_NGAUSS];
+        double psum=0, pfsum=0;
+
+        for (ig=0; ig<PYGMIX_SERSIC_NGAUSS; ig++) {
+            psum += pvals[ig];
+        }
+        for (ig=0; ig<PYGMIX_SERSIC_NGAUSS; ig++) {
+            pvals[ig] /= psum;
+            pfsum += pvals[ig]*fvals[ig];
+        }
+        for (ig=0; ig<PYGMIX_SERSIC_NGAUSS; ig++) {
+            fvals[ig] /= pfsum;
+        }
+    }
+}
+
+/*
+   get the (p,f) values for the input sersic index
+
+   Returns 0 if n is out of range, setting a GMixRangeError if dothrow
+   is set
+*/
+static int sersic_get_tables(double n, double *fvals, double *pvals, int dothrow)
+{
+    int status=0;
+    npy_intp i=0, ig=0;
+    double x=0, t=0, psum=0, pfsum=0;
+    const double *lo=NULL, *hi=NULL;
+
+    if (!(n >= PYGMIX_SERSIC_NMIN && n <= PYGMIX_SERSIC_NMAX)) {
+        if (dothrow) {
+            char nstr[25];
+            snprintf(nstr,24,"%g", n);
+            PyErr_Format(GMixRangeError, "sersic n out of range: %s", nstr);
+        }
+        goto _sersic_get_tables_bail;
+    }
+
+    x = (n-PYGMIX_SERSIC_NMIN)/PYGMIX_SERSIC_DN;
+    i = (npy_intp) x;
+    if (i > PYGMIX_SERSIC_NFINE-2) {
+        i = PYGMIX_SERSIC_NFINE-2;
+    }
+    t = x-i;
+
+    lo=PyGMix_sersic_fine[i];
+    hi=PyGMix_sersic_fine[i+1];
+
+    for (ig=0; ig<PYGMIX_SERSIC_NGAUSS; ig++) {
+        pvals[ig] = lo[PYGMIX_SERSIC_NGAUSS+ig]
+            + t*(hi[PYGMIX_SERSIC_NGAUSS+ig]-lo[PYGMIX_SERSIC_NGAUSS+ig]);
+        psum += pvals[ig];
+    }
+    for (ig=0; ig<PYGMIX_SERSIC_NGAUSS; ig++) {
+        pvals[ig] /= psum;
+        fvals[ig] = lo[ig] + t*(hi[ig]-lo[ig]);
+        pfsum += pvals[ig]*fvals[ig];
+    }
+    for (ig=0; ig<PYGMIX_SERSIC_NGAUSS; ig++) {
+        fvals[ig] /= pfsum;
+    }
+
+    status=1;
+_sersic_get_tables_bail:
+    return status;
+}
+
 
 /*
    when an error occurs and exception is set. Use goto pattern
@@ -510,6 +724,39 @@ _gmix_fill_simple_bail:
 }
 
 
+/*
+   sersic pars are the simple pars followed by the index n
+*/
+static int gmix_fill_sersic(struct PyGMix_Gauss2D *self,
+                            npy_intp n_gauss,
+                            const double* pars,
+                            npy_intp n_pars)
+{
+    int status=0;
+    double fvals[PYGMIX_SERSIC_NGAUSS], pvals[PYGMIX_SERSIC_NGAUSS];
+
+    if (n_pars != 7) {
+        PyErr_Format(GMixFatalError, 
+                     "sersic pars should be size 7, got %ld", n_pars);
+        goto _gmix_fill_sersic_bail;
+    }
+
+    status=sersic_get_tables(pars[6], fvals, pvals, 1);
+    if (!status) {
+        goto _gmix_fill_sersic_bail;
+    }
+
+    // the first 6 are the same as for the simple models
+    status=gmix_fill_simple(self, n_gauss,
+                            pars, 6,
+                            PyGMIX_GMIX_SERSIC,
+                            fvals,
+                            pvals);
+
+_gmix_fill_sersic_bail:
+    return status;
+}
+
 static int gmix_fill_cm(struct PyGMixCM*self,
                                const double* pars,
                                npy_intp n_pars)
@@ -763,6 +1010,10 @@ static int gmix_fill(struct PyGMix_Gauss2D *self,
                                     PyGMix_pvals_gauss);
             break;
 
+        case PyGMIX_GMIX_SERSIC:
+            status=gmix_fill_sersic(self, n_gauss, pars, n_pars);
+            break;
+
         case PyGMIX_GMIX_COELLIP:
             status=gmix_fill_coellip(self, n_gauss, pars, n_pars);
             break;
@@ -959,377 +1210,861 @@ static PyObject * PyGMix_convolve_fill(PyObject* self, PyObject* args) {
 
 
 
-static PyObject * PyGMix_gmix_set_norms(PyObject* self, PyObject* args) {
-    PyObject* gmix_obj=NULL;
-    npy_intp n_gauss=0;
+/*
+   Prepare a psf mixture for repeated convolutions.  The center and total
+   flux are calculated once, so convolutions with the prepared psf do not
+   need to call gmix_get_cen
+*/
+static int prepare_psf(struct PyGMix_PreparedPSF *self, npy_intp n_prep,
+                       const struct PyGMix_Gauss2D *psf, npy_intp psf_n_gauss)
+{
     int status=0;
+    npy_intp i=0;
+    double psf_rowcen=0, psf_colcen=0, psf_psum=0, psf_ipsum=0;
 
-    struct PyGMix_Gauss2D *gmix=NULL;
+    if (n_prep != psf_n_gauss) {
+        PyErr_Format(GMixFatalError, 
+                     "prepared psf is wrong size %ld, expected %ld",
+                     n_prep, psf_n_gauss);
+        goto _prepare_psf_bail;
+    }
 
-    if (!PyArg_ParseTuple(args, (char*)"O", &gmix_obj)) {
-        return NULL;
+    gmix_get_cen(psf, psf_n_gauss, &psf_rowcen, &psf_colcen, &psf_psum);
+    if (psf_psum == 0) {
+        PyErr_Format(GMixRangeError, "cannot prepare psf with psum == 0");
+        goto _prepare_psf_bail;
     }
+    psf_ipsum=1.0/psf_psum;
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    for (i=0; i<psf_n_gauss; i++) {
+        const struct PyGMix_Gauss2D *psf_gauss=&psf[i];
+        struct PyGMix_PreparedPSF *prep=&self[i];
 
-    status=gmix_set_norms(gmix, n_gauss);
-    if (!status) {
-        // raise an exception
-        return NULL;
-    } else {
-        Py_INCREF(Py_None);
-        return Py_None;
+        prep->p    = psf_gauss->p*psf_ipsum;
+        prep->drow = psf_gauss->row-psf_rowcen;
+        prep->dcol = psf_gauss->col-psf_colcen;
+        prep->irr  = psf_gauss->irr;
+        prep->irc  = psf_gauss->irc;
+        prep->icc  = psf_gauss->icc;
     }
+
+    status=1;
+_prepare_psf_bail:
+    return status;
 }
 
 /*
-   Render the gmix in the input image, without jacobian
-
-   Error checking should be done in python.
+   convolve a single gaussian with the prepared psf, writing
+   psf_n_gauss outputs starting at self.  Norms are not set
 */
-static PyObject * PyGMix_render(PyObject* self, PyObject* args) {
+static inline int convolve_gauss_prepared(struct PyGMix_Gauss2D *self,
+                                          const struct PyGMix_Gauss2D *obj_gauss,
+                                          const struct PyGMix_PreparedPSF *psf,
+                                          npy_intp psf_n_gauss)
+{
+    int status=0;
+    npy_intp ipsf=0;
+
+    for (ipsf=0; ipsf<psf_n_gauss; ipsf++) {
+        const struct PyGMix_PreparedPSF *psf_gauss=&psf[ipsf];
+
+        status=gauss2d_set(&self[ipsf], 
+                           obj_gauss->p*psf_gauss->p,
+                           obj_gauss->row + psf_gauss->drow,
+                           obj_gauss->col + psf_gauss->dcol,
+                           obj_gauss->irr + psf_gauss->irr,
+                           obj_gauss->irc + psf_gauss->irc,
+                           obj_gauss->icc + psf_gauss->icc);
+        if (!status) {
+            break;
+        }
+    }
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    int nsub=0;
-    int fast_exp=0;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    npy_intp rowsub=0, colsub=0;
+    return status;
+}
 
-    struct PyGMix_Gauss2D *gmix=NULL;
-    double *ptr=NULL, stepsize=0, offset=0, areafac=0, tval=0, trow=0, tcol=0;
+static int convolve_fill_prepared(struct PyGMix_Gauss2D *self, npy_intp self_n_gauss,
+                                  const struct PyGMix_Gauss2D *gmix, npy_intp n_gauss,
+                                  const struct PyGMix_PreparedPSF *psf, npy_intp psf_n_gauss)
+{
+    int status=0;
+    npy_intp ntot=0, iobj=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOii", &gmix_obj, &image_obj, &nsub, &fast_exp)) {
-        return NULL;
+    ntot = n_gauss*psf_n_gauss;
+    if (ntot != self_n_gauss) {
+        PyErr_Format(GMixFatalError, 
+                     "target gmix is wrong size %ld, expected %ld",
+                     self_n_gauss, ntot);
+        goto _convolve_fill_prepared_bail;
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
-
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
+    for (iobj=0; iobj<n_gauss; iobj++) {
+        status=convolve_gauss_prepared(&self[iobj*psf_n_gauss],
+                                       &gmix[iobj],
+                                       psf, psf_n_gauss);
+        if (!status) {
+            goto _convolve_fill_prepared_bail;
+        }
     }
 
-    stepsize = 1./nsub;
-    offset = (nsub-1)*stepsize/2.;
-    areafac = 1./(nsub*nsub);
+    status=gmix_set_norms(self, self_n_gauss);
+    if (!status) {
+        goto _convolve_fill_prepared_bail;
+    }
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+    status=1;
+_convolve_fill_prepared_bail:
+    return status;
+}
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
+/*
+   get the (p,f) tables for the simple models
 
-            tval = 0.0;
-            trow = row-offset;
+   returns 0 if the model is not a simple model; no exception is set
+*/
+static int get_simple_tables(int model,
+                             const double **fvals,
+                             const double **pvals)
+{
+    int status=1;
+    switch (model) {
+        case PyGMIX_GMIX_EXP:
+            *fvals=PyGMix_fvals_exp;
+            *pvals=PyGMix_pvals_exp;
+            break;
+        case PyGMIX_GMIX_DEV:
+            *fvals=PyGMix_fvals_dev;
+            *pvals=PyGMix_pvals_dev;
+            break;
+        case PyGMIX_GMIX_TURB:
+            *fvals=PyGMix_fvals_turb;
+            *pvals=PyGMix_pvals_turb;
+            break;
+        case PyGMIX_GMIX_GAUSS:
+            *fvals=PyGMix_fvals_gauss;
+            *pvals=PyGMix_pvals_gauss;
+            break;
+        default:
+            status=0;
+            break;
+    }
+    return status;
+}
 
-            for (rowsub=0; rowsub<nsub; rowsub++) {
-                tcol = col-offset;
-                for (colsub=0; colsub<nsub; colsub++) {
-		  
-                    if (fast_exp) {
-                        tval += PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, trow, tcol);
-                    } else {
-                        tval += PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, trow, tcol);
-                    }
+/*
+   check the inputs for gmix_fill_convolve, setting an exception on error
+*/
+static int gmix_fill_convolve_check(npy_intp self_n_gauss,
+                                    npy_intp n_pars,
+                                    int model,
+                                    npy_intp psf_n_gauss)
+{
+    int status=0, n_gauss=0;
+    const double *fvals=NULL, *pvals=NULL;
 
-                    tcol += stepsize;
-                } // colsub
+    if (model==PyGMIX_GMIX_SERSIC) {
+        if (n_pars != 7) {
+            PyErr_Format(GMixFatalError, 
+                         "sersic pars should be size 7, got %ld", n_pars);
+            goto _gmix_fill_convolve_check_bail;
+        }
+    } else {
+        if (!get_simple_tables(model, &fvals, &pvals)) {
+            PyErr_Format(GMixFatalError, 
+                         "fill convolve only supports simple and sersic "
+                         "models, got %d", model);
+            goto _gmix_fill_convolve_check_bail;
+        }
 
-                trow += stepsize;
-            } // rowsub
+        if (n_pars != 6) {
+            PyErr_Format(GMixFatalError, 
+                         "simple pars should be size 6, got %ld", n_pars);
+            goto _gmix_fill_convolve_check_bail;
+        }
+    }
 
-            // add to existing values
-            ptr=(double*)PyArray_GETPTR2(image_obj,row,col);
-            tval *= areafac;
-            (*ptr) += tval;
-        } // cols
-    } // rows
+    n_gauss=get_n_gauss(model, &status);
+    if (!status) {
+        goto _gmix_fill_convolve_check_bail;
+    }
+    if (self_n_gauss != n_gauss*psf_n_gauss) {
+        PyErr_Format(GMixFatalError, 
+                     "target gmix is wrong size %ld, expected %ld",
+                     self_n_gauss, n_gauss*psf_n_gauss);
+        status=0;
+        goto _gmix_fill_convolve_check_bail;
+    }
 
-    Py_INCREF(Py_None);
-    return Py_None;
+    status=1;
+_gmix_fill_convolve_check_bail:
+    return status;
 }
 
-static PyObject * PyGMix_eval(PyObject* self, PyObject* args) {
-
-    PyObject* gmix_obj=NULL;
-    double row=0, col=0, val=0;
-    npy_intp n_gauss=0;
-
-    struct PyGMix_Gauss2D *gmix=NULL;
+/*
+   Fill a simple or sersic model and convolve it with the prepared psf in
+   one pass, setting the norms.  The unconvolved gaussians only live on the
+   stack.
 
-    if (!PyArg_ParseTuple(args, (char*)"Odd", &gmix_obj, &row, &col)) {
-        return NULL;
+   The inputs must have been checked with gmix_fill_convolve_check.  If
+   dothrow is not set no python exceptions are set, so this can be
+   called without the GIL
+*/
+static int gmix_fill_convolve_core(struct PyGMix_Gauss2D *self,
+                                   const double* pars,
+                                   int model,
+                                   const struct PyGMix_PreparedPSF *psf,
+                                   npy_intp psf_n_gauss,
+                                   int dothrow)
+{
+    int status=0;
+    const double *fvals=NULL, *pvals=NULL;
+    double sersic_fvals[PYGMIX_SERSIC_NGAUSS], sersic_pvals[PYGMIX_SERSIC_NGAUSS];
+    double row=0,col=0,g1=0,g2=0,
+           T=0,counts=0,e1=0,e2=0,
+           T_i_2=0;
+    npy_intp i=0, n_gauss=0;
+    struct PyGMix_Gauss2D obj_gauss={0};
+
+    if (model==PyGMIX_GMIX_SERSIC) {
+        if (!sersic_get_tables(pars[6], sersic_fvals, sersic_pvals, dothrow)) {
+            goto _gmix_fill_convolve_core_bail;
+        }
+        fvals=sersic_fvals;
+        pvals=sersic_pvals;
+        n_gauss=PYGMIX_SERSIC_NGAUSS;
+    } else {
+        get_simple_tables(model, &fvals, &pvals);
+        n_gauss=get_n_gauss(model, &status);
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    row=pars[0];
+    col=pars[1];
+    g1=pars[2];
+    g2=pars[3];
+    T=pars[4];
+    counts=pars[5];
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
+    if (dothrow) {
+        status=g1g2_to_e1e2(g1, g2, &e1, &e2);
+    } else {
+        status=g1g2_to_e1e2_nothrow(g1, g2, &e1, &e2);
+    }
+    if (!status) {
+        goto _gmix_fill_convolve_core_bail;
     }
 
-    val = PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, row, col);
+    for (i=0; i<n_gauss; i++) {
+        T_i_2 = 0.5*T*fvals[i];
 
-    return Py_BuildValue("d", val);
-}
+        gauss2d_set(&obj_gauss,
+                    counts*pvals[i],
+                    row,
+                    col, 
+                    T_i_2*(1-e1), 
+                    T_i_2*e2,
+                    T_i_2*(1+e1));
+
+        status=convolve_gauss_prepared(&self[i*psf_n_gauss],
+                                       &obj_gauss,
+                                       psf, psf_n_gauss);
+        if (!status) {
+            goto _gmix_fill_convolve_core_bail;
+        }
+    }
 
-static PyObject * PyGMix_eval_jacob(PyObject* self, PyObject* args) {
+    for (i=0; i<n_gauss*psf_n_gauss; i++) {
+        status=gauss2d_set_norm(&self[i], dothrow);
+        if (!status) {
+            goto _gmix_fill_convolve_core_bail;
+        }
+    }
 
-    PyObject* gmix_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    double row=0,col=0,val=0,u=0,v=0;
-    npy_intp n_gauss=0;
+    status=1;
 
-    struct PyGMix_Gauss2D *gmix=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+_gmix_fill_convolve_core_bail:
+    return status;
+}
 
-    if (!PyArg_ParseTuple(args, (char*)"OOdd", 
-                          &gmix_obj, &jacob_obj, &row, &col)) {
-        return NULL;
+/*
+   This is equivalent to gmix_fill followed by convolve_fill
+*/
+static int gmix_fill_convolve(struct PyGMix_Gauss2D *self,
+                              npy_intp self_n_gauss,
+                              const double* pars,
+                              npy_intp n_pars,
+                              int model,
+                              const struct PyGMix_PreparedPSF *psf,
+                              npy_intp psf_n_gauss)
+{
+    if (!gmix_fill_convolve_check(self_n_gauss, n_pars, model, psf_n_gauss)) {
+        return 0;
     }
+    return gmix_fill_convolve_core(self, pars, model, psf, psf_n_gauss, 1);
+}
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+/*
+   Fill and convolve n_batch models, one per row of pars.  Each row of the
+   output holds n_out gaussians.
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+   Rows with pars out of range are zeroed and get flags[i]=1, so a sampler
+   can treat them as zero probability; no exceptions are set and this is
+   called without the GIL
+*/
+static void gmix_fill_convolve_batch(struct PyGMix_Gauss2D *self,
+                                     npy_intp n_batch,
+                                     npy_intp n_out,
+                                     const double* pars,
+                                     npy_intp n_pars,
+                                     int model,
+                                     const struct PyGMix_PreparedPSF *psf,
+                                     npy_intp psf_n_gauss,
+                                     npy_int32 *flags,
+                                     int nthreads)
+{
+    npy_intp i=0;
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+#endif
+    for (i=0; i<n_batch; i++) {
+        struct PyGMix_Gauss2D *gmix=&self[i*n_out];
 
-    u=PYGMIX_JACOB_GETU(jacob, row, col);
-    v=PYGMIX_JACOB_GETV(jacob, row, col);
+        if (gmix_fill_convolve_core(gmix, &pars[i*n_pars], model,
+                                    psf, psf_n_gauss, 0)) {
+            flags[i]=0;
+        } else {
+            memset(gmix, 0, n_out*sizeof(struct PyGMix_Gauss2D));
+            flags[i]=1;
+        }
+    }
+}
 
-    val = PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
+/*
+   Update the psf-convolved exp and dev basis for a composite model.  The
+   basis has unit flux in each of the exp and dev halves, with the first
+   6*psf_n_gauss gaussians from exp and the rest from dev, and norms set.
 
-    return Py_BuildValue("d", val);
-}
+   The basis is only remade if the center, shape or T changed since the
+   last call, so calls that only change the flux are cheap
+*/
+static int cm_basis_update(struct PyGMixCMBasis *basis,
+                           struct PyGMix_Gauss2D *bgmix,
+                           npy_intp nb,
+                           const double* pars,
+                           double TdByTe,
+                           double Tfactor,
+                           const struct PyGMix_PreparedPSF *psf,
+                           npy_intp psf_n_gauss)
+{
+    int status=0;
+    double e1=0, e2=0, T=0, T_i_2=0, p=0, f=0;
+    npy_intp i=0;
+    struct PyGMix_Gauss2D obj_gauss={0};
 
+    if (nb != 16*psf_n_gauss) {
+        PyErr_Format(GMixFatalError, 
+                     "cm basis is wrong size %ld, expected %ld",
+                     nb, 16*psf_n_gauss);
+        goto _cm_basis_update_bail;
+    }
 
+    if (basis->valid
+            && basis->row == pars[0]
+            && basis->col == pars[1]
+            && basis->g1 == pars[2]
+            && basis->g2 == pars[3]
+            && basis->T == pars[4]) {
+        status=1;
+        goto _cm_basis_update_bail;
+    }
 
+    basis->valid=0;
 
-/*
-   use approximate integral over pixels, good to fractional error
-   of a part in a thousand
-*/
+    // can set an exception
+    status=g1g2_to_e1e2(pars[2], pars[3], &e1, &e2);
+    if (!status) {
+        goto _cm_basis_update_bail;
+    }
 
-static PyObject * PyGMix_render_gauleg(PyObject* self, PyObject* args) {
+    // same as gmix_fill_cm
+    if (pars[4] == 0.0) {
+        T = 0.0;
+    } else {
+        T = pars[4]*Tfactor;
+    }
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    struct PyGMix_Gauss2D *gmix=NULL;
-    int fast_exp=0;
-    int npoints=0;
+    for (i=0; i<16; i++) {
+        if (i < 6) {
+            p=PyGMix_pvals_exp[i];
+            f=PyGMix_fvals_exp[i];
+        } else {
+            p=PyGMix_pvals_dev[i-6];
+            f=PyGMix_fvals_dev[i-6] * TdByTe;
+        }
 
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    npy_intp rowsub=0, colsub=0;
+        T_i_2 = 0.5*T*f;
 
-    double *ptr=NULL, tval=0;
-    // gauleg parameters
-    double
-           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
-           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
-           wsum=0;
-    const double *xxi=NULL, *wwi=NULL;
+        gauss2d_set(&obj_gauss,
+                    p,
+                    pars[0],
+                    pars[1], 
+                    T_i_2*(1-e1), 
+                    T_i_2*e2,
+                    T_i_2*(1+e1));
 
-    if (!PyArg_ParseTuple(args, (char*)"OOii", 
-                          &gmix_obj, &image_obj, &npoints, &fast_exp)) {
-        return NULL;
+        convolve_gauss_prepared(&bgmix[i*psf_n_gauss],
+                                &obj_gauss,
+                                psf, psf_n_gauss);
     }
 
-    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
-        return NULL;
+    status=gmix_set_norms(bgmix, nb);
+    if (!status) {
+        goto _cm_basis_update_bail;
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    basis->row=pars[0];
+    basis->col=pars[1];
+    basis->g1=pars[2];
+    basis->g2=pars[3];
+    basis->T=pars[4];
+    basis->valid=1;
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+    status=1;
+_cm_basis_update_bail:
+    return status;
+}
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+/*
+   fill the psf-convolved composite model, reusing the cached basis and
+   only rescaling the amplitudes.  Equivalent to gmix_fill_cm followed by
+   convolve_fill
+*/
+static int gmix_fill_cm_convolve(struct PyGMix_Gauss2D *self,
+                                 npy_intp self_n_gauss,
+                                 struct PyGMixCMBasis *basis,
+                                 struct PyGMix_Gauss2D *bgmix,
+                                 npy_intp nb,
+                                 const double* pars,
+                                 npy_intp n_pars,
+                                 double fracdev,
+                                 double TdByTe,
+                                 double Tfactor,
+                                 const struct PyGMix_PreparedPSF *psf,
+                                 npy_intp psf_n_gauss)
+{
+    int status=0;
+    npy_intp i=0, nexp=0;
+    double exp_amp=0, dev_amp=0;
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
+    if (n_pars != 6) {
+        PyErr_Format(GMixFatalError, 
+                     "composite pars should be size 6, got %ld", n_pars);
+        goto _gmix_fill_cm_convolve_bail;
+    }
+    if (self_n_gauss != 16*psf_n_gauss) {
+        PyErr_Format(GMixFatalError, 
+                     "target gmix is wrong size %ld, expected %ld",
+                     self_n_gauss, 16*psf_n_gauss);
+        goto _gmix_fill_cm_convolve_bail;
+    }
 
-            // integrate over the pixel
+    status=cm_basis_update(basis, bgmix, nb, pars, TdByTe, Tfactor,
+                           psf, psf_n_gauss);
+    if (!status) {
+        goto _gmix_fill_cm_convolve_bail;
+    }
 
-            rowmax = row + 0.5;
-            rowmin = row - 0.5;
-            colmax = col + 0.5;
-            colmin = col - 0.5;
+    nexp = 6*psf_n_gauss;
+    exp_amp = pars[5]*(1.0-fracdev);
+    dev_amp = pars[5]*fracdev;
 
-            frow1 = (rowmax-rowmin)*0.5; // always 0.5.
-            frow2 = (rowmax+rowmin)*0.5; // always row
-            fcol1 = (colmax-colmin)*0.5; // always 0.5
-            fcol2 = (colmax+colmin)*0.5; // always col
+    for (i=0; i<self_n_gauss; i++) {
+        struct PyGMix_Gauss2D *gauss=&self[i];
 
-            wsum = 0.0;
-            tval = 0.0;
+        *gauss = bgmix[i];
+        if (i < nexp) {
+            gauss->p *= exp_amp;
+        } else {
+            gauss->p *= dev_amp;
+        }
+        gauss->pnorm = gauss->p*gauss->norm;
+    }
 
-            for (rowsub=0; rowsub<npoints; rowsub++) {
-                trow = frow1*xxi[rowsub] + frow2;
-                wrow = wwi[rowsub];
-                for (colsub=0; colsub<npoints; colsub++) {
-                    tcol = fcol1*xxi[colsub] + fcol2;
-                    wcol = wwi[colsub];
-		    
-                    if (fast_exp) {
-                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, trow, tcol);
-                    } else {
-                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, trow, tcol);
-                    }
+    status=1;
+_gmix_fill_cm_convolve_bail:
+    return status;
+}
 
-                    wsum += wrow*wcol;
+static PyObject * PyGMix_gmix_fill_cm_convolve(PyObject* self, PyObject* args) {
+    PyObject* gmix_obj=NULL;
+    PyObject* basis_obj=NULL;
+    PyObject* bgmix_obj=NULL;
+    PyObject* pars_obj=NULL;
+    PyObject* prep_obj=NULL;
+    double fracdev=0, TdByTe=0, Tfactor=0;
 
-                } // colsub
-            } // rowsub
+    if (!PyArg_ParseTuple(args, (char*)"OOOOdddO",
+                          &gmix_obj, 
+                          &basis_obj,
+                          &bgmix_obj,
+                          &pars_obj,
+                          &fracdev,
+                          &TdByTe,
+                          &Tfactor,
+                          &prep_obj)) {
 
-            // add to existing values
-            ptr=(double*)PyArray_GETPTR2(image_obj,row,col);
+        return NULL;
+    }
 
-            // since we are averaging, we don't multiply by frow1*fcol1
-            tval /= wsum;
+    if (!gmix_fill_cm_convolve((struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj),
+                               PyArray_SIZE(gmix_obj),
+                               (struct PyGMixCMBasis* ) PyArray_DATA(basis_obj),
+                               (struct PyGMix_Gauss2D* ) PyArray_DATA(bgmix_obj),
+                               PyArray_SIZE(bgmix_obj),
+                               (double *) PyArray_DATA(pars_obj),
+                               PyArray_SIZE(pars_obj),
+                               fracdev, TdByTe, Tfactor,
+                               (struct PyGMix_PreparedPSF* ) PyArray_DATA(prep_obj),
+                               PyArray_SIZE(prep_obj))) {
+        // raise an exception
+        return NULL;
+    }
 
-            (*ptr) += tval;
+    Py_RETURN_NONE;
+}
 
-        } // cols
-    } // rows
+/*
+   For fitting fracdev linearly.  With E and D the unit flux exp and dev
+   basis images and F the flux, the model is
 
-    Py_INCREF(Py_None);
-    return Py_None;
-}
+       F*E + fracdev*F*(D-E)
 
-static PyObject * PyGMix_render_jacob_gauleg(PyObject* self, PyObject* args) {
+   so with X = F*(D-E)*sqrt(w) and Y = (data - F*E)*sqrt(w),
+   fdiff = fracdev*X - Y and the best fracdev is X.Y/X.X, as in
+   FracdevFitter.
 
-    PyObject* gmix_obj=NULL;
+   X and Y are filled for all pixels of the image, starting at
+   the input start position; pixels with zero weight are set to zero.
+   The basis is updated as for gmix_fill_cm_convolve, all in one pass
+   over the pixels
+*/
+static PyObject * PyGMix_cm_fill_fracdev_xy(PyObject* self, PyObject* args) {
+    PyObject* basis_obj=NULL;
+    PyObject* bgmix_obj=NULL;
+    PyObject* pars_obj=NULL;
+    PyObject* prep_obj=NULL;
     PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
     PyObject* jacob_obj=NULL;
-    struct PyGMix_Gauss2D *gmix=NULL;
+    PyObject* X_obj=NULL;
+    PyObject* Y_obj=NULL;
+    double TdByTe=0, Tfactor=0;
+    long start=0;
+
+    struct PyGMixCMBasis *basis=NULL;
+    struct PyGMix_Gauss2D *bgmix=NULL, *dgmix=NULL;
+    struct PyGMix_PreparedPSF *prep=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
-    int fast_exp=0;
-    int npoints=0;
-
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    npy_intp rowsub=0, colsub=0;
-
-    double *ptr=NULL, tval=0;
+    const double *pars=NULL;
+    double *X=NULL, *Y=NULL;
+    npy_intp nb=0, psf_n_gauss=0, nexp=0, ndev=0,
+             n_row=0, n_col=0, row=0, col=0, ipix=0;
+    double u=0, v=0, ivar=0, ierr=0, data=0, counts=0,
+           eval=0, dval=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOddOOOOOOl",
+                          &basis_obj,
+                          &bgmix_obj,
+                          &pars_obj,
+                          &TdByTe,
+                          &Tfactor,
+                          &prep_obj,
+                          &image_obj,
+                          &weight_obj,
+                          &jacob_obj,
+                          &X_obj,
+                          &Y_obj,
+                          &start)) {
 
-    // gauleg parameters
-    double
-           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
-           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
-           wsum=0;
-    const double *xxi=NULL, *wwi=NULL;
+        return NULL;
+    }
 
-    double u=0,v=0;
+    basis=(struct PyGMixCMBasis* ) PyArray_DATA(basis_obj);
+    bgmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(bgmix_obj);
+    nb=PyArray_SIZE(bgmix_obj);
+    prep=(struct PyGMix_PreparedPSF* ) PyArray_DATA(prep_obj);
+    psf_n_gauss=PyArray_SIZE(prep_obj);
 
-    if (!PyArg_ParseTuple(args, (char*)"OOiOi",
-                          &gmix_obj, &image_obj, &npoints, &jacob_obj, &fast_exp)) {
+    if (PyArray_SIZE(pars_obj) != 6) {
+        PyErr_Format(GMixFatalError, 
+                     "composite pars should be size 6, got %ld",
+                     PyArray_SIZE(pars_obj));
         return NULL;
     }
+    pars=(double *) PyArray_DATA(pars_obj);
 
-    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
+    if (start + n_row*n_col > PyArray_SIZE(X_obj)
+            || start + n_row*n_col > PyArray_SIZE(Y_obj)) {
+        PyErr_Format(GMixFatalError, 
+                     "X and Y too small for image: %ld", PyArray_SIZE(X_obj));
         return NULL;
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
-
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+    if (!cm_basis_update(basis, bgmix, nb, pars, TdByTe, Tfactor,
+                         prep, psf_n_gauss)) {
         return NULL;
     }
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    nexp = 6*psf_n_gauss;
+    ndev = 10*psf_n_gauss;
+    dgmix = &bgmix[nexp];
+    counts = pars[5];
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    X=(double *) PyArray_DATA(X_obj) + start;
+    Y=(double *) PyArray_DATA(Y_obj) + start;
 
     for (row=0; row < n_row; row++) {
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+
         for (col=0; col < n_col; col++) {
 
-            // integrate over the pixel
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                ierr=sqrt(ivar);
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
-            rowmax = row + 0.5;
-            rowmin = row - 0.5;
-            colmax = col + 0.5;
-            colmin = col - 0.5;
+                eval = counts*PYGMIX_GMIX_EVAL(bgmix, nexp, v, u);
+                dval = counts*PYGMIX_GMIX_EVAL(dgmix, ndev, v, u);
 
-            frow1 = (rowmax-rowmin)*0.5; // always 0.5.
-            frow2 = (rowmax+rowmin)*0.5; // always row
-            fcol1 = (colmax-colmin)*0.5; // always 0.5
-            fcol2 = (colmax+colmin)*0.5; // always col
+                X[ipix] = (dval-eval)*ierr;
+                Y[ipix] = (data-eval)*ierr;
+            } else {
+                X[ipix] = 0.0;
+                Y[ipix] = 0.0;
+            }
 
-            wsum = 0.0;
-            tval = 0.0;
+            ipix++;
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
+        }
+    }
 
-            for (rowsub=0; rowsub<npoints; rowsub++) {
-                trow = frow1*xxi[rowsub] + frow2;
-                wrow = wwi[rowsub];
+    Py_RETURN_NONE;
+}
 
-                for (colsub=0; colsub<npoints; colsub++) {
-                    tcol = fcol1*xxi[colsub] + fcol2;
-                    wcol = wwi[colsub];
+static PyObject * PyGMix_prepare_psf(PyObject* self, PyObject* args) {
+    PyObject* prep_obj=NULL;
+    PyObject* psf_gmix_obj=NULL;
 
-                    u=PYGMIX_JACOB_GETU(jacob, trow, tcol);
-                    v=PYGMIX_JACOB_GETV(jacob, trow, tcol);
+    struct PyGMix_PreparedPSF *prep=NULL;
+    struct PyGMix_Gauss2D *psf_gmix=NULL;
+    npy_intp n_prep=0, psf_n_gauss=0;
 
-                    if (fast_exp) {
-                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, v, u);
-                    } else {
-                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
-                    }
+    if (!PyArg_ParseTuple(args, (char*)"OO",
+                          &prep_obj,
+                          &psf_gmix_obj)) {
 
-                    wsum += wrow*wcol;
+        return NULL;
+    }
 
-                } // colsub
-            } // rowsub
+    prep=(struct PyGMix_PreparedPSF* ) PyArray_DATA(prep_obj);
+    n_prep =PyArray_SIZE(prep_obj);
 
-            // add to existing values
-            ptr=(double*)PyArray_GETPTR2(image_obj,row,col);
+    psf_gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(psf_gmix_obj);
+    psf_n_gauss =PyArray_SIZE(psf_gmix_obj);
 
-            // since we are averaging, we don't multiply by frow1*fcol1
-            tval /= wsum;
+    if (!prepare_psf(prep, n_prep, psf_gmix, psf_n_gauss)) {
+        // raise an exception
+        return NULL;
+    }
 
-            (*ptr) += tval;
+    Py_RETURN_NONE;
+}
 
-        } // cols
-    } // rows
+static PyObject * PyGMix_convolve_fill_prepared(PyObject* self, PyObject* args) {
+    PyObject* self_gmix_obj=NULL;
+    PyObject* gmix_obj=NULL;
+    PyObject* prep_obj=NULL;
 
-    Py_INCREF(Py_None);
-    return Py_None;
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_PreparedPSF *prep=NULL;
+    struct PyGMix_Gauss2D *self_gmix=NULL;
+    npy_intp self_n_gauss=0, n_gauss=0, psf_n_gauss=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOO",
+                          &self_gmix_obj,
+                          &gmix_obj, 
+                          &prep_obj)) {
+
+        return NULL;
+    }
+
+    self_gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(self_gmix_obj);
+    self_n_gauss =PyArray_SIZE(self_gmix_obj);
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    prep=(struct PyGMix_PreparedPSF* ) PyArray_DATA(prep_obj);
+    psf_n_gauss =PyArray_SIZE(prep_obj);
+
+    if (!convolve_fill_prepared(self_gmix, self_n_gauss,
+                                gmix, n_gauss,
+                                prep, psf_n_gauss)) {
+        // raise an exception
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
 }
 
+static PyObject * PyGMix_gmix_fill_convolve(PyObject* self, PyObject* args) {
+    PyObject* gmix_obj=NULL;
+    PyObject* pars_obj=NULL;
+    PyObject* prep_obj=NULL;
+    int model=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_PreparedPSF *prep=NULL;
+    const double* pars=NULL;
+    npy_intp n_gauss=0, n_pars=0, psf_n_gauss=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOiO",
+                          &gmix_obj, 
+                          &pars_obj,
+                          &model,
+                          &prep_obj)) {
+
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    pars=(double *) PyArray_DATA(pars_obj);
+    n_pars = PyArray_SIZE(pars_obj);
+
+    prep=(struct PyGMix_PreparedPSF* ) PyArray_DATA(prep_obj);
+    psf_n_gauss =PyArray_SIZE(prep_obj);
+
+    if (!gmix_fill_convolve(gmix, n_gauss,
+                            pars, n_pars, model,
+                            prep, psf_n_gauss)) {
+        // raise an exception
+        return NULL;
+    }
 
+    Py_RETURN_NONE;
+}
 
 
 /*
-   Render the gmix in the input image, with jacobian
+   gmix is [N, n_out] and pars is [N, npars], both C contiguous; flags is
+   [N] int32
+*/
+static PyObject * PyGMix_gmix_fill_convolve_batch(PyObject* self, PyObject* args) {
+    PyObject* gmix_obj=NULL;
+    PyObject* pars_obj=NULL;
+    PyObject* prep_obj=NULL;
+    PyObject* flags_obj=NULL;
+    int model=0, nthreads=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_PreparedPSF *prep=NULL;
+    const double* pars=NULL;
+    npy_int32 *flags=NULL;
+    npy_intp n_batch=0, n_out=0, n_pars=0, psf_n_gauss=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOiOOi",
+                          &gmix_obj, 
+                          &pars_obj,
+                          &model,
+                          &prep_obj,
+                          &flags_obj,
+                          &nthreads)) {
+
+        return NULL;
+    }
+
+    n_batch=PyArray_DIM(gmix_obj, 0);
+    n_out=PyArray_DIM(gmix_obj, 1);
+    n_pars=PyArray_DIM(pars_obj, 1);
+
+    if (PyArray_DIM(pars_obj, 0) != n_batch
+            || PyArray_SIZE(flags_obj) != n_batch) {
+        PyErr_Format(GMixFatalError, 
+                     "pars and flags must have %ld rows", n_batch);
+        return NULL;
+    }
+
+    prep=(struct PyGMix_PreparedPSF* ) PyArray_DATA(prep_obj);
+    psf_n_gauss =PyArray_SIZE(prep_obj);
+
+    if (!gmix_fill_convolve_check(n_out, n_pars, model, psf_n_gauss)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    pars=(double *) PyArray_DATA(pars_obj);
+    flags=(npy_int32 *) PyArray_DATA(flags_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+    gmix_fill_convolve_batch(gmix, n_batch, n_out,
+                             pars, n_pars, model,
+                             prep, psf_n_gauss,
+                             flags, nthreads);
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * PyGMix_gmix_set_norms(PyObject* self, PyObject* args) {
+    PyObject* gmix_obj=NULL;
+    npy_intp n_gauss=0;
+    int status=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+
+    if (!PyArg_ParseTuple(args, (char*)"O", &gmix_obj)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    status=gmix_set_norms(gmix, n_gauss);
+    if (!status) {
+        // raise an exception
+        return NULL;
+    } else {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+}
+
+/*
+   Render the gmix in the input image, without jacobian
 
    Error checking should be done in python.
 */
-static PyObject * PyGMix_render_jacob(PyObject* self, PyObject* args) {
+static PyObject * PyGMix_render(PyObject* self, PyObject* args) {
 
     PyObject* gmix_obj=NULL;
     PyObject* image_obj=NULL;
-    PyObject* jacob_obj=NULL;
     int nsub=0;
     int fast_exp=0;
     npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
     npy_intp rowsub=0, colsub=0;
 
     struct PyGMix_Gauss2D *gmix=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
-
-    double *ptr=NULL, u=0, v=0, stepsize=0, ustepsize=0, vstepsize=0,
-           offset=0, areafac=0, tval=0,trow=0, lowcol=0;
+    double *ptr=NULL, stepsize=0, offset=0, areafac=0, tval=0, trow=0, tcol=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOiOi", 
-                          &gmix_obj, &image_obj, &nsub, &jacob_obj, &fast_exp)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOii", &gmix_obj, &image_obj, &nsub, &fast_exp)) {
         return NULL;
     }
 
@@ -1340,14 +2075,9 @@ static PyObject * PyGMix_render_jacob(PyObject* self, PyObject* args) {
         return NULL;
     }
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
-
     stepsize = 1./nsub;
     offset = (nsub-1)*stepsize/2.;
     areafac = 1./(nsub*nsub);
-    // sub-steps while moving along column direction
-    ustepsize = stepsize*jacob->dudcol;
-    vstepsize = stepsize*jacob->dvdcol;
 
     n_row=PyArray_DIM(image_obj, 0);
     n_col=PyArray_DIM(image_obj, 1);
@@ -1357,22 +2087,18 @@ static PyObject * PyGMix_render_jacob(PyObject* self, PyObject* args) {
 
             tval = 0.0;
             trow = row-offset;
-            lowcol = col-offset;
 
             for (rowsub=0; rowsub<nsub; rowsub++) {
-                u=PYGMIX_JACOB_GETU(jacob, trow, lowcol);
-                v=PYGMIX_JACOB_GETV(jacob, trow, lowcol);
-
+                tcol = col-offset;
                 for (colsub=0; colsub<nsub; colsub++) {
 		  
                     if (fast_exp) {
-                        tval += PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, v, u);
+                        tval += PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, trow, tcol);
                     } else {
-                        tval += PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
+                        tval += PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, trow, tcol);
                     }
 
-                    u += ustepsize;
-                    v += vstepsize;
+                    tcol += stepsize;
                 } // colsub
 
                 trow += stepsize;
@@ -1389,71 +2115,42 @@ static PyObject * PyGMix_render_jacob(PyObject* self, PyObject* args) {
     return Py_None;
 }
 
+static PyObject * PyGMix_eval(PyObject* self, PyObject* args) {
 
-/*
-   Calculate the image mean, accounting for weight function.
-*/
-
-static PyObject * PyGMix_get_image_mean(PyObject* self, PyObject* args) {
-
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    npy_intp n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    PyObject* gmix_obj=NULL;
+    double row=0, col=0, val=0;
+    npy_intp n_gauss=0;
 
-    double data=0, ivar=0;
-    double wsum=0, imsum=0, wmean=0;
+    struct PyGMix_Gauss2D *gmix=NULL;
 
-    if (!PyArg_ParseTuple(args, (char*)"OO", &image_obj, &weight_obj)) {
+    if (!PyArg_ParseTuple(args, (char*)"Odd", &gmix_obj, &row, &col)) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
-
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
-
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-                wsum += ivar;
-                imsum += ivar*data;
-            }
-        }
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
     }
 
-    if (wsum > 0) {
-        wmean = imsum/wsum;
-    }
+    val = PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, row, col);
 
-    return Py_BuildValue("d", wmean);
+    return Py_BuildValue("d", val);
 }
 
-
-/*
-   Calculate the sum needed for the model s/n
-
-   This is s2n_sum = sum(model_i^2 * ivar_i)
-
-   The s/n will be sqrt(s2n_sum)
-*/
-static PyObject * PyGMix_get_model_s2n_sum(PyObject* self, PyObject* args) {
+static PyObject * PyGMix_eval_jacob(PyObject* self, PyObject* args) {
 
     PyObject* gmix_obj=NULL;
-    PyObject* weight_obj=NULL;
     PyObject* jacob_obj=NULL;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    double row=0,col=0,val=0,u=0,v=0;
+    npy_intp n_gauss=0;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Gauss2D *gmix=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
 
-    double ivar=0, u=0, v=0;
-    double model_val=0;
-    double s2n_sum=0;
-
-    if (!PyArg_ParseTuple(args, (char*)"OOO", 
-                          &gmix_obj, &weight_obj, &jacob_obj)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOdd", 
+                          &gmix_obj, &jacob_obj, &row, &col)) {
         return NULL;
     }
 
@@ -1464,69 +2161,49 @@ static PyObject * PyGMix_get_model_s2n_sum(PyObject* self, PyObject* args) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(weight_obj, 0);
-    n_col=PyArray_DIM(weight_obj, 1);
-
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    for (row=0; row < n_row; row++) {
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+    u=PYGMIX_JACOB_GETU(jacob, row, col);
+    v=PYGMIX_JACOB_GETV(jacob, row, col);
 
-        for (col=0; col < n_col; col++) {
-
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-
-                s2n_sum += model_val*model_val*ivar;
-            }
-
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
-
-        }
-    }
+    val = PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
 
-    return Py_BuildValue("d", s2n_sum);
+    return Py_BuildValue("d", val);
 }
 
-/*
-
-   Same as above but also calculating Ts2n sums
-
-   Calculate the sum needed for the model s/n
-
-   This is s2n_sum = sum(model_i^2 * ivar_i)
-
-   The s/n will be sqrt(s2n_sum)
-
-   Also the sums need for var(T)  This is Mike's approximate formula, which
-   I have verified (ignoring covariance between numerator and denominator)
 
-   var(T) =
-   Sum (w_p^2 r_p^4 / var_p) / (Sum (w_p^2 / var_p))^2 + (Sum (w_p^2 r_p^2 / var_p))^2 / (Sum (w_p^2 / var_p))^3
 
 
+/*
+   use approximate integral over pixels, good to fractional error
+   of a part in a thousand
 */
 
-static PyObject * PyGMix_get_model_s2n_Tvar_sums(PyObject* self, PyObject* args) {
+static PyObject * PyGMix_render_gauleg(PyObject* self, PyObject* args) {
 
     PyObject* gmix_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
+    PyObject* image_obj=NULL;
+    struct PyGMix_Gauss2D *gmix=NULL;
+    int fast_exp=0;
+    int npoints=0;
+
     npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    npy_intp rowsub=0, colsub=0;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+    double *ptr=NULL, tval=0;
+    // gauleg parameters
+    double
+           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
+           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
+           wsum=0;
+    const double *xxi=NULL, *wwi=NULL;
 
-    double ivar=0, u=0, v=0;
-    double model_val=0;
-    double s2n_sum=0, r4sum=0, r2sum=0, r2=0, r4=0, m2=0;
-    double rowcen=0, colcen=0, psum=0, rowmod=0, colmod=0;
+    if (!PyArg_ParseTuple(args, (char*)"OOii", 
+                          &gmix_obj, &image_obj, &npoints, &fast_exp)) {
+        return NULL;
+    }
 
-    if (!PyArg_ParseTuple(args, (char*)"OOO", 
-                          &gmix_obj, &weight_obj, &jacob_obj)) {
+    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
         return NULL;
     }
 
@@ -1537,166 +2214,186 @@ static PyObject * PyGMix_get_model_s2n_Tvar_sums(PyObject* self, PyObject* args)
         return NULL;
     }
 
-    gmix_get_cen(gmix, n_gauss, &rowcen, &colcen, &psum);
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-    n_row=PyArray_DIM(weight_obj, 0);
-    n_col=PyArray_DIM(weight_obj, 1);
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+            // integrate over the pixel
 
-    for (row=0; row < n_row; row++) {
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+            rowmax = row + 0.5;
+            rowmin = row - 0.5;
+            colmax = col + 0.5;
+            colmin = col - 0.5;
 
-        for (col=0; col < n_col; col++) {
+            frow1 = (rowmax-rowmin)*0.5; // always 0.5.
+            frow2 = (rowmax+rowmin)*0.5; // always row
+            fcol1 = (colmax-colmin)*0.5; // always 0.5
+            fcol2 = (colmax+colmin)*0.5; // always col
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-                m2 = model_val*model_val;
+            wsum = 0.0;
+            tval = 0.0;
 
-                s2n_sum += m2*ivar;
+            for (rowsub=0; rowsub<npoints; rowsub++) {
+                trow = frow1*xxi[rowsub] + frow2;
+                wrow = wwi[rowsub];
+                for (colsub=0; colsub<npoints; colsub++) {
+                    tcol = fcol1*xxi[colsub] + fcol2;
+                    wcol = wwi[colsub];
+		    
+                    if (fast_exp) {
+                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, trow, tcol);
+                    } else {
+                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, trow, tcol);
+                    }
 
-                rowmod=u-rowcen;
-                colmod=v-colcen;
+                    wsum += wrow*wcol;
 
-                r2 = rowmod*rowmod + colmod*colmod;
-                r4 = r2*r2;
-                r4sum += m2 * r4 * ivar;
-                r2sum += m2 * r2 * ivar;
-            }
+                } // colsub
+            } // rowsub
 
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
+            // add to existing values
+            ptr=(double*)PyArray_GETPTR2(image_obj,row,col);
 
-        }
-    }
+            // since we are averaging, we don't multiply by frow1*fcol1
+            tval /= wsum;
 
-    return Py_BuildValue("ddd", s2n_sum, r2sum, r4sum);
+            (*ptr) += tval;
+
+        } // cols
+    } // rows
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-/*
-   with alternate weight
-*/
-static PyObject * PyGMix_get_model_s2n_Tvar_sums_altweight(PyObject* self, PyObject* args) {
+static PyObject * PyGMix_render_jacob_gauleg(PyObject* self, PyObject* args) {
 
     PyObject* gmix_obj=NULL;
-    PyObject* wgmix_obj=NULL;
-    PyObject* weight_obj=NULL;
+    PyObject* image_obj=NULL;
     PyObject* jacob_obj=NULL;
-    npy_intp n_gauss=0, wn_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Gauss2D *wgmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Gauss2D *gmix=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
+    int fast_exp=0;
+    int npoints=0;
 
-    double ivar=0, u=0, v=0;
-    double model_val=0, wval=0;
-    double s2n_sum=0, r4sum=0, r2sum=0, r2=0, r4=0, m2=0;
-    double rowcen=0, colcen=0, psum=0, rowmod=0, colmod=0;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    npy_intp rowsub=0, colsub=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOO", 
-                          &gmix_obj, &wgmix_obj, &weight_obj, &jacob_obj)) {
-        return NULL;
-    }
+    double *ptr=NULL, tval=0;
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    // gauleg parameters
+    double
+           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
+           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
+           wsum=0;
+    const double *xxi=NULL, *wwi=NULL;
 
-    wgmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(wgmix_obj);
-    wn_gauss=PyArray_SIZE(wgmix_obj);
+    double u=0,v=0;
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOiOi",
+                          &gmix_obj, &image_obj, &npoints, &jacob_obj, &fast_exp)) {
         return NULL;
     }
-    if (!gmix_set_norms_if_needed(wgmix, wn_gauss)) {
+
+    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
         return NULL;
     }
 
-    gmix_get_cen(gmix, n_gauss, &rowcen, &colcen, &psum);
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-    n_row=PyArray_DIM(weight_obj, 0);
-    n_col=PyArray_DIM(weight_obj, 1);
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
 
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    for (row=0; row < n_row; row++) {
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
+    for (row=0; row < n_row; row++) {
         for (col=0; col < n_col; col++) {
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-                wval=PYGMIX_GMIX_EVAL(wgmix, wn_gauss, v, u);
+            // integrate over the pixel
 
-                m2 = wval*model_val;
+            rowmax = row + 0.5;
+            rowmin = row - 0.5;
+            colmax = col + 0.5;
+            colmin = col - 0.5;
 
-                s2n_sum += m2*ivar;
+            frow1 = (rowmax-rowmin)*0.5; // always 0.5.
+            frow2 = (rowmax+rowmin)*0.5; // always row
+            fcol1 = (colmax-colmin)*0.5; // always 0.5
+            fcol2 = (colmax+colmin)*0.5; // always col
 
-                rowmod=u-rowcen;
-                colmod=v-colcen;
+            wsum = 0.0;
+            tval = 0.0;
 
-                r2 = rowmod*rowmod + colmod*colmod;
-                r4 = r2*r2;
-                r4sum += m2 * r4 * ivar;
-                r2sum += m2 * r2 * ivar;
-            }
+            for (rowsub=0; rowsub<npoints; rowsub++) {
+                trow = frow1*xxi[rowsub] + frow2;
+                wrow = wwi[rowsub];
 
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
+                for (colsub=0; colsub<npoints; colsub++) {
+                    tcol = fcol1*xxi[colsub] + fcol2;
+                    wcol = wwi[colsub];
 
-        }
-    }
+                    u=PYGMIX_JACOB_GETU(jacob, trow, tcol);
+                    v=PYGMIX_JACOB_GETV(jacob, trow, tcol);
 
-    return Py_BuildValue("ddd", s2n_sum, r2sum, r4sum);
-}
+                    if (fast_exp) {
+                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, v, u);
+                    } else {
+                        tval += wrow*wcol*PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
+                    }
 
+                    wsum += wrow*wcol;
 
+                } // colsub
+            } // rowsub
 
-/*
+            // add to existing values
+            ptr=(double*)PyArray_GETPTR2(image_obj,row,col);
 
-Get the weighted moments of the image, using the input gaussian
-mixture as the weight function.  The moments are *not* normalized
+            // since we are averaging, we don't multiply by frow1*fcol1
+            tval /= wsum;
 
-See the get_weighted_moments method in gmix.py
+            (*ptr) += tval;
 
-*/
-static PyObject * PyGMix_get_weighted_moments(PyObject* self, PyObject* args) {
+        } // cols
+    } // rows
 
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    PyObject* gmix_obj=NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
-    PyObject* pars_obj=NULL;
-    PyObject* pcov_obj=NULL;
-    double rmax=0, rmaxsq=0;
 
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+
+/*
+   Render the gmix in the input image, with jacobian
+
+   Error checking should be done in python.
+*/
+static PyObject * PyGMix_render_jacob(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    int nsub=0;
+    int fast_exp=0;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    npy_intp rowsub=0, colsub=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
-    double *pars=NULL, *pcov=NULL;
-    double F[6];
 
-    double
-        u=0, v=0, umod=0, vmod=0,
-        wdata=0, data=0, weight=0, w2=0, wsum=0,
-        s2n_numer=0, s2n_denom=0,
-        ivar=0, var=0,
-        ucen=0, vcen=0, psum=0, rsq=0;
-    int flags=0, i=0, j=0;
+    double *ptr=NULL, u=0, v=0, stepsize=0, ustepsize=0, vstepsize=0,
+           offset=0, areafac=0, tval=0,trow=0, lowcol=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOd", 
-                          &image_obj,
-                          &weight_obj,
-                          &jacob_obj,
-                          &gmix_obj,
-                          &pars_obj,
-                          &pcov_obj,
-                          &rmax)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOiOi", 
+                          &gmix_obj, &image_obj, &nsub, &jacob_obj, &fast_exp)) {
         return NULL;
     }
 
@@ -1707,1915 +2404,1947 @@ static PyObject * PyGMix_get_weighted_moments(PyObject* self, PyObject* args) {
         return NULL;
     }
 
-    gmix_get_cen(gmix, n_gauss, &vcen, &ucen, &psum);
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    stepsize = 1./nsub;
+    offset = (nsub-1)*stepsize/2.;
+    areafac = 1./(nsub*nsub);
+    // sub-steps while moving along column direction
+    ustepsize = stepsize*jacob->dudcol;
+    vstepsize = stepsize*jacob->dvdcol;
 
     n_row=PyArray_DIM(image_obj, 0);
     n_col=PyArray_DIM(image_obj, 1);
 
-    rmaxsq=rmax*rmax;
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+            tval = 0.0;
+            trow = row-offset;
+            lowcol = col-offset;
 
-    pars=PyArray_DATA(pars_obj); // pars[6]
-    pcov=PyArray_DATA(pcov_obj); // pcov[6,6]
+            for (rowsub=0; rowsub<nsub; rowsub++) {
+                u=PYGMIX_JACOB_GETU(jacob, trow, lowcol);
+                v=PYGMIX_JACOB_GETV(jacob, trow, lowcol);
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
+                for (colsub=0; colsub<nsub; colsub++) {
+		  
+                    if (fast_exp) {
+                        tval += PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, v, u);
+                    } else {
+                        tval += PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
+                    }
 
-            // sky coordinates relative to the jacobian center
-            v=PYGMIX_JACOB_GETV(jacob, row, col);
-            u=PYGMIX_JACOB_GETU(jacob, row, col);
+                    u += ustepsize;
+                    v += vstepsize;
+                } // colsub
 
-            rsq = u*u + v*v;
+                trow += stepsize;
+            } // rowsub
 
-            if (rsq > rmaxsq) {
-                continue;
-            }
+            // add to existing values
+            ptr=(double*)PyArray_GETPTR2(image_obj,row,col);
+            tval *= areafac;
+            (*ptr) += tval;
+        } // cols
+    } // rows
 
-            data = *( (double*)PyArray_GETPTR2(image_obj,row,col) );
-            ivar = *( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
-            if (ivar <= 0.0) {
-                flags = 1;
-                goto _getmom_bail;
-            }
 
-            var=1.0/ivar;
+/*
+   Calculate the image mean, accounting for weight function.
+*/
 
-            // evaluate the gaussian mixture at the specified location
-            //weight=PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
-            //weight=PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, v, u);
-            weight=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+static PyObject * PyGMix_get_image_mean(PyObject* self, PyObject* args) {
 
-            // sky coordinates relative to the gaussian mixture center
-            vmod = v-vcen;
-            umod = u-ucen;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    npy_intp n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-            wdata = weight*data;
-            w2 = weight*weight;
-            wsum += weight;
+    double data=0, ivar=0;
+    double wsum=0, imsum=0, wmean=0;
 
-            // for the s/n sums
-            s2n_numer += wdata*ivar;
-            s2n_denom += w2*ivar;
+    if (!PyArg_ParseTuple(args, (char*)"OO", &image_obj, &weight_obj)) {
+        return NULL;
+    }
 
-            F[0] = vmod;
-            F[1] = umod;
-            F[2] = umod*umod - vmod*vmod;
-            F[3] = 2*vmod*umod;
-            F[4] = umod*umod + vmod*vmod;
-            F[5] = 1.0;
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-            for (i=0; i<6; i++) {
-                pars[i] += wdata*F[i];
-                for (j=0; j<6; j++) {
-                    pcov[i + 6*j] += w2*var*F[i]*F[j];
-                }
-            }
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
+
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
+                wsum += ivar;
+                imsum += ivar*data;
+            }
         }
     }
 
-_getmom_bail:
+    if (wsum > 0) {
+        wmean = imsum/wsum;
+    }
 
-    return Py_BuildValue("iddd", flags, wsum, s2n_numer, s2n_denom);
+    return Py_BuildValue("d", wmean);
 }
 
 
 /*
-   weighted moments of one gaussian mixture with another
+   Calculate the sum needed for the model s/n
+
+   This is s2n_sum = sum(model_i^2 * ivar_i)
+
+   The s/n will be sqrt(s2n_sum)
 */
-static PyObject * PyGMix_get_weighted_gmix_moments(PyObject* self, PyObject* args) {
+static PyObject * PyGMix_get_model_s2n_sum(PyObject* self, PyObject* args) {
 
-    // arguments
     PyObject* gmix_obj=NULL;
-    PyObject* wt_gmix_obj=NULL;
+    PyObject* weight_obj=NULL;
     PyObject* jacob_obj=NULL;
-    int n_row=0, n_col=0;
-    PyObject* pars_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-    // for unpacking input arrays
-    npy_intp n_gauss=0, wt_n_gauss=0;
-    struct PyGMix_Gauss2D *gmix=NULL;
-    struct PyGMix_Gauss2D *wt_gmix=NULL;
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
-    double *pars=NULL;
 
-    // local variables
-    int i=0, row=0, col=0;
-    double u=0, v=0, umod=0, vmod=0;
-    double model_val=0, wmodel, weight=0, wsum=0;
-    double wt_ucen=0, wt_vcen=0, wt_psum=0;
-    double F[6];
+    double ivar=0, u=0, v=0;
+    double model_val=0;
+    double s2n_sum=0;
 
-    if (!PyArg_ParseTuple(
-            args, (char*)"OOOiiO", 
-            &gmix_obj,
-            &wt_gmix_obj,
-            &jacob_obj,
-            &n_row,
-            &n_col,
-            &pars_obj
-        ) ) {
+    if (!PyArg_ParseTuple(args, (char*)"OOO", 
+                          &gmix_obj, &weight_obj, &jacob_obj)) {
         return NULL;
     }
 
-    // unpack the input and output arrays
     gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
     n_gauss=PyArray_SIZE(gmix_obj);
+
     if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
         return NULL;
     }
 
-    wt_gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_gmix_obj);
-    wt_n_gauss=PyArray_SIZE(wt_gmix_obj);
-    if (!gmix_set_norms_if_needed(wt_gmix, wt_n_gauss)) {
-        return NULL;
-    }
+    n_row=PyArray_DIM(weight_obj, 0);
+    n_col=PyArray_DIM(weight_obj, 1);
 
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    pars=PyArray_DATA(pars_obj); // pars[6]
-
-    // center of the weight gmix
-    gmix_get_cen(wt_gmix, wt_n_gauss, &wt_vcen, &wt_ucen, &wt_psum);
-
     for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
-            // sky coordinates relative to the jacobian center
-            v=PYGMIX_JACOB_GETV(jacob, row, col);
-            u=PYGMIX_JACOB_GETU(jacob, row, col);
-
-            model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-
-            // evaluate the gaussian mixture at the specified location
-            weight=PYGMIX_GMIX_EVAL_FULL(wt_gmix, wt_n_gauss, v, u);
-
-            // sky coordinates relative to the gaussian mixture center
-            vmod = v-wt_vcen;
-            umod = u-wt_ucen;
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-            wmodel = weight*model_val;
-            wsum += weight;
+        for (col=0; col < n_col; col++) {
 
-            F[0] = vmod;
-            F[1] = umod;
-            F[2] = umod*umod - vmod*vmod;
-            F[3] = 2*vmod*umod;
-            F[4] = umod*umod + vmod*vmod;
-            F[5] = 1.0;
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-            for (i=0; i<6; i++) {
-                pars[i] += wmodel*F[i];
+                s2n_sum += model_val*model_val*ivar;
             }
 
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
+
         }
     }
 
-    return Py_BuildValue("d", wsum);
+    return Py_BuildValue("d", s2n_sum);
 }
 
-static PyObject * PyGMix_get_unweighted_moments(PyObject* self, PyObject* args) {
+/*
 
-    PyObject
-        *im_obj=NULL,
-        *jacob_obj=NULL,
+   Same as above but also calculating Ts2n sums
 
-        *pars_obj=NULL;
+   Calculate the sum needed for the model s/n
 
-    double
-        u=0, v=0,
-        data=0,
-        F[6]={0},
-        *pars=NULL;
+   This is s2n_sum = sum(model_i^2 * ivar_i)
 
-    npy_intp n_row=0, n_col=0, row=0, col=0;
+   The s/n will be sqrt(s2n_sum)
 
+   Also the sums need for var(T)  This is Mike's approximate formula, which
+   I have verified (ignoring covariance between numerator and denominator)
+
+   var(T) =
+   Sum (w_p^2 r_p^4 / var_p) / (Sum (w_p^2 / var_p))^2 + (Sum (w_p^2 r_p^2 / var_p))^2 / (Sum (w_p^2 / var_p))^3
+
+
+*/
+
+static PyObject * PyGMix_get_model_s2n_Tvar_sums(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
 
-    int i=0;
+    double ivar=0, u=0, v=0;
+    double model_val=0;
+    double s2n_sum=0, r4sum=0, r2sum=0, r2=0, r4=0, m2=0;
+    double rowcen=0, colcen=0, psum=0, rowmod=0, colmod=0;
 
     if (!PyArg_ParseTuple(args, (char*)"OOO", 
-                          &im_obj,
-                          &jacob_obj,
-                          &pars_obj)) {
+                          &gmix_obj, &weight_obj, &jacob_obj)) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(im_obj, 0);
-    n_col=PyArray_DIM(im_obj, 1);
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
 
-    pars=PyArray_DATA(pars_obj); // [6]
+    gmix_get_cen(gmix, n_gauss, &rowcen, &colcen, &psum);
+
+    n_row=PyArray_DIM(weight_obj, 0);
+    n_col=PyArray_DIM(weight_obj, 1);
+
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
     for (row=0; row < n_row; row++) {
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+
         for (col=0; col < n_col; col++) {
 
-            // sky coordinates relative to the jacobian center
-            v=PYGMIX_JACOB_GETV(jacob, row, col);
-            u=PYGMIX_JACOB_GETU(jacob, row, col);
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+                m2 = model_val*model_val;
 
-            data = *( (double*)PyArray_GETPTR2(im_obj,row,col) );
+                s2n_sum += m2*ivar;
 
-            F[0] = v;
-            F[1] = u;
-            F[2] = u*u - v*v;
-            F[3] = 2*v*u;
-            F[4] = u*u + v*v;
-            F[5] = 1.0;
+                rowmod=u-rowcen;
+                colmod=v-colcen;
 
-            for (i=0; i<6; i++) {
-                pars[i] += data*F[i];
+                r2 = rowmod*rowmod + colmod*colmod;
+                r4 = r2*r2;
+                r4sum += m2 * r4 * ivar;
+                r2sum += m2 * r2 * ivar;
             }
 
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
+
         }
     }
 
-    Py_RETURN_NONE;
+    return Py_BuildValue("ddd", s2n_sum, r2sum, r4sum);
 }
 
-#define printfc(c) printf("%g%c%gi",creal(c),(cimag(c)>=0.0f)? '+':'\0',cimag(c))
-
 /*
-   get k-space moments
-
+   with alternate weight
 */
+static PyObject * PyGMix_get_model_s2n_Tvar_sums_altweight(PyObject* self, PyObject* args) {
 
-// weighted moments with a weight image
-// the weight should already be applied to the input images,
-// and is only used for calculating variance
-
-static PyObject * PyGMix_get_kweighted_moments_image(PyObject* self, PyObject* args) {
-
-    // inputs
-    PyObject
-        *kr_obj=NULL,
-        *ki_obj=NULL,
-        *jacob_obj=NULL,
-
-        *wtr_obj=NULL,
-        *wti_obj=NULL,
+    PyObject* gmix_obj=NULL;
+    PyObject* wgmix_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    npy_intp n_gauss=0, wn_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-        *pars_real_obj=NULL,
-        *pars_imag_obj=NULL,
-        *pars_cov_obj=NULL;
-    double var=0;
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Gauss2D *wgmix=NULL;//, *gauss=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
 
-    // local vars
-    double
-        u=0, v=0,
-        rdata=0, idata=0,
-        wrdata=0, widata=0,
-        w2=0,
-        *pars_real=NULL, *pars_imag=NULL,
-        *pcov=NULL;
-
-    double complex
-        data=0, weight=0,
-        F[6]={0},
-        pars[6]={0};
-
-    npy_intp n_row=0, n_col=0, row=0, col=0;
+    double ivar=0, u=0, v=0;
+    double model_val=0, wval=0;
+    double s2n_sum=0, r4sum=0, r2sum=0, r2=0, r4=0, m2=0;
+    double rowcen=0, colcen=0, psum=0, rowmod=0, colmod=0;
 
-    int i=0, j=0;
+    if (!PyArg_ParseTuple(args, (char*)"OOOO", 
+                          &gmix_obj, &wgmix_obj, &weight_obj, &jacob_obj)) {
+        return NULL;
+    }
 
-    if (!PyArg_ParseTuple(args, (char*)"OOdOOOOOO", 
-                          &kr_obj,
-                          &ki_obj,
-                          &var,             // variance in each pixel
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-                          &jacob_obj,
+    wgmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(wgmix_obj);
+    wn_gauss=PyArray_SIZE(wgmix_obj);
 
-                          &wtr_obj,
-                          &wti_obj,
-                          
-                          &pars_real_obj,
-                          &pars_imag_obj,
-                          &pars_cov_obj)) {
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
+    if (!gmix_set_norms_if_needed(wgmix, wn_gauss)) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(kr_obj, 0);
-    n_col=PyArray_DIM(kr_obj, 1);
+    gmix_get_cen(gmix, n_gauss, &rowcen, &colcen, &psum);
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    n_row=PyArray_DIM(weight_obj, 0);
+    n_col=PyArray_DIM(weight_obj, 1);
 
-    pars_real=PyArray_DATA(pars_real_obj); // [6]
-    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
-    pcov=PyArray_DATA(pars_cov_obj); // [6,6]
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
     for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
-
-            // sky coordinates relative to the jacobian center
-            v=PYGMIX_JACOB_GETV(jacob, row, col);
-            u=PYGMIX_JACOB_GETU(jacob, row, col);
-
-            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
-            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
-
-            wrdata = *( (double*)PyArray_GETPTR2(wtr_obj,row,col) );
-            widata = *( (double*)PyArray_GETPTR2(wti_obj,row,col) );
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-            data = rdata + I * idata;
-            weight = wrdata + I * widata;
+        for (col=0; col < n_col; col++) {
 
-            w2 = weight*weight*var;
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+                wval=PYGMIX_GMIX_EVAL(wgmix, wn_gauss, v, u);
 
-            F[0] = v*I;
-            F[1] = u*I;
-            F[2] = u*u - v*v;
-            F[3] = 2*v*u;
-            F[4] = u*u + v*v;
-            F[5] = 1.0;
+                m2 = wval*model_val;
 
-            for (i=0; i<6; i++) {
-                pars[i] += data*F[i];
-                for (j=0; j<6; j++) {
-                    double val=creal(w2*F[i]*conj(F[j]));
+                s2n_sum += m2*ivar;
 
-                    if (isnan(val)) {
-                        val = 0;
-                    }
+                rowmod=u-rowcen;
+                colmod=v-colcen;
 
-                    pcov[i + 6*j] += val;
-                }
+                r2 = rowmod*rowmod + colmod*colmod;
+                r4 = r2*r2;
+                r4sum += m2 * r4 * ivar;
+                r2sum += m2 * r2 * ivar;
             }
 
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
+
         }
     }
 
-    for (i=0; i<6; i++) {
-        pars_real[i] = creal(pars[i]);
-        pars_imag[i] = cimag(pars[i]);
-    }
-    Py_RETURN_NONE;
+    return Py_BuildValue("ddd", s2n_sum, r2sum, r4sum);
 }
 
 
 
 /*
 
-   weight is product of two gaussians
-*/
-
-static PyObject * PyGMix_get_kweighted_moments_2gauss(PyObject* self, PyObject* args) {
+Get the weighted moments of the image, using the input gaussian
+mixture as the weight function.  The moments are *not* normalized
 
-    PyObject
-        *kr_obj=NULL,
-        *ki_obj=NULL,
-        *var_obj=NULL,
-        *jacob_obj=NULL,
+See the get_weighted_moments method in gmix.py
 
-        *pars_real_obj=NULL,
-        *pars_imag_obj=NULL,
-        *pcov_obj=NULL;
+*/
+static PyObject * PyGMix_get_weighted_moments(PyObject* self, PyObject* args) {
 
-    double
-        rowshift=0, colshift=0,
-        sigma1=0, sigmasq1=0,
-        sigma2=0, sigmasq2=0,
-        arg=0;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* gmix_obj=NULL;
 
-    double complex
-        shift=0, data=0, weight=0, wdata=0,
-        F[6]={0},
-        pars[6]={0};
+    PyObject* pars_obj=NULL;
+    PyObject* pcov_obj=NULL;
+    double rmax=0, rmaxsq=0;
 
-    npy_intp n_row=0, n_col=0, row=0, col=0;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
-    double
-        *pars_real=NULL,
-        *pars_imag=NULL,
-        *pcov=NULL;
+    double *pars=NULL, *pcov=NULL;
+    double F[6];
 
     double
-        rdata=0, idata=0,
-        u=0, v=0,
-        w2=0,
-        var=0;
-
-
-    struct PyGMix_Gauss2D gauss1={0};
-    struct PyGMix_Gauss2D gauss2={0};
-
-    int i=0, j=0;
+        u=0, v=0, umod=0, vmod=0,
+        wdata=0, data=0, weight=0, w2=0, wsum=0,
+        s2n_numer=0, s2n_denom=0,
+        ivar=0, var=0,
+        ucen=0, vcen=0, psum=0, rsq=0;
+    int flags=0, i=0, j=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOdddd", 
-                          &kr_obj,
-                          &ki_obj,
-                          &var_obj,
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOd", 
+                          &image_obj,
+                          &weight_obj,
                           &jacob_obj,
-                          &pars_real_obj,
-                          &pars_imag_obj,
+                          &gmix_obj,
+                          &pars_obj,
                           &pcov_obj,
-                          &sigma1,
-                          &sigma2,
-                          &rowshift,
-                          &colshift)) {
+                          &rmax)) {
         return NULL;
     }
 
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-    sigmasq1 = sigma1*sigma1;
-    sigmasq2 = sigma2*sigma2;
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
 
-    n_row=PyArray_DIM(kr_obj, 0);
-    n_col=PyArray_DIM(kr_obj, 1);
+    gmix_get_cen(gmix, n_gauss, &vcen, &ucen, &psum);
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-    pars_real=PyArray_DATA(pars_real_obj); // [6]
-    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
-    pcov=PyArray_DATA(pcov_obj); // [6,6]
+    rmaxsq=rmax*rmax;
 
-    gauss2d_set(&gauss1, 1.0, 0.0, 0.0, sigmasq1, 0.0, sigmasq1);
-    gauss2d_set(&gauss2, 1.0, 0.0, 0.0, sigmasq2, 0.0, sigmasq2);
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    if (!gauss2d_set_norm_throw(&gauss1)) {
-        return NULL;
-    }
-    if (!gauss2d_set_norm_throw(&gauss2)) {
-        return NULL;
-    }
+    pars=PyArray_DATA(pars_obj); // pars[6]
+    pcov=PyArray_DATA(pcov_obj); // pcov[6,6]
 
     for (row=0; row < n_row; row++) {
         for (col=0; col < n_col; col++) {
 
-
             // sky coordinates relative to the jacobian center
             v=PYGMIX_JACOB_GETV(jacob, row, col);
             u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-            // this is the power spectrum of the noise
-            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
+            rsq = u*u + v*v;
 
-            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
-            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
+            if (rsq > rmaxsq) {
+                continue;
+            }
 
-            data = rdata + I*idata;
+            data = *( (double*)PyArray_GETPTR2(image_obj,row,col) );
+            ivar = *( (double*)PyArray_GETPTR2(weight_obj,row,col) );
 
-            // roll the phase of the weight according to the real space shift
-            arg = v*rowshift + u*colshift;
-            shift = cos(arg) - I*sin(arg);
+            if (ivar <= 0.0) {
+                flags = 1;
+                goto _getmom_bail;
+            }
 
-            // weight is real, but we will shift it
-            weight = PYGMIX_GMIX_EVAL_FAST(&gauss1, 1, v, u);
-            weight *= PYGMIX_GMIX_EVAL_FAST(&gauss2, 1, v, u);
+            var=1.0/ivar;
 
-            w2 = weight*weight;
+            // evaluate the gaussian mixture at the specified location
+            //weight=PYGMIX_GMIX_EVAL_FULL(gmix, n_gauss, v, u);
+            //weight=PYGMIX_GMIX_EVAL_FAST(gmix, n_gauss, v, u);
+            weight=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+
+            // sky coordinates relative to the gaussian mixture center
+            vmod = v-vcen;
+            umod = u-ucen;
 
-            weight = weight*shift;
             wdata = weight*data;
+            w2 = weight*weight;
+            wsum += weight;
 
-            F[0] = v*I;
-            F[1] = u*I;
-            F[2] = u*u - v*v;
-            F[3] = 2*v*u;
-            F[4] = u*u + v*v;
+            // for the s/n sums
+            s2n_numer += wdata*ivar;
+            s2n_denom += w2*ivar;
+
+            F[0] = vmod;
+            F[1] = umod;
+            F[2] = umod*umod - vmod*vmod;
+            F[3] = 2*vmod*umod;
+            F[4] = umod*umod + vmod*vmod;
             F[5] = 1.0;
 
             for (i=0; i<6; i++) {
                 pars[i] += wdata*F[i];
-
                 for (j=0; j<6; j++) {
-
-                    double val=creal(w2*var*F[i]*conj(F[j]));
-
-                    if (isnan(val)) {
-                        val = 0;
-                    }
-                    pcov[i + 6*j] += val;
-
+                    pcov[i + 6*j] += w2*var*F[i]*F[j];
                 }
             }
 
         }
     }
 
-    for (i=0; i<6; i++) {
-        pars_real[i] = creal(pars[i]);
-        pars_imag[i] = cimag(pars[i]);
-    }
+_getmom_bail:
 
-    Py_RETURN_NONE;
+    return Py_BuildValue("iddd", flags, wsum, s2n_numer, s2n_denom);
 }
 
+/*
 
-static PyObject * PyGMix_get_kweighted_moments_gauss(PyObject* self, PyObject* args) {
+Get the weighted moments of the image for K weight functions in a
+single pass over the pixels.  The coordinates, data and variance of
+each pixel are shared between the weights
 
-    PyObject
-        *kr_obj=NULL,
-        *ki_obj=NULL,
-        *var_obj=NULL,
-        *jacob_obj=NULL,
+The gaussians for all weights are in a single array, with weight k
+in the range offsets[k] to offsets[k+1].  pars is [K,6], pcov [K,6,6]
+and wsum, s2n_numer and s2n_denom have K entries.  For each weight the
+results are the same as from get_weighted_moments
 
-        *pars_real_obj=NULL,
-        *pars_imag_obj=NULL,
-        *pcov_obj=NULL;
+*/
+static PyObject * PyGMix_get_weighted_moments_multi(PyObject* self, PyObject* args) {
 
-    double
-        rowshift=0, colshift=0,
-        sigma_sq,
-        //sigma1=0, sigmasq1=0,
-        //sigma2=0, sigmasq2=0,
-        arg=0,
-        ksq=0,
-        maxrad=0, maxrad2=0;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* gmix_obj=NULL;
+    PyObject* offsets_obj=NULL;
 
-    double complex
-        shift=0, data=0, weight=0, wdata=0,
-        F[6]={0},
-        pars[6]={0};
+    PyObject* pars_obj=NULL;
+    PyObject* pcov_obj=NULL;
+    PyObject* wsum_obj=NULL;
+    PyObject* s2n_numer_obj=NULL;
+    PyObject* s2n_denom_obj=NULL;
+    double rmax=0, rmaxsq=0;
 
-    npy_intp n_row=0, n_col=0, row=0, col=0;
+    npy_intp n_weights=0, n_gauss=0, n_row=0, n_col=0, row=0, col=0, k=0;
 
+    struct PyGMix_Gauss2D *gmix=NULL, *gm=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
-    double
-        *pars_real=NULL,
-        *pars_imag=NULL,
-        *pcov=NULL;
+    const npy_int64 *offsets=NULL;
+    double *pars=NULL, *pcov=NULL, *wsum=NULL;
+    double *s2n_numer=NULL, *s2n_denom=NULL;
+    double *tpars=NULL, *tpcov=NULL;
+    double F[6];
+    double vcen[PYGMIX_WMOM_MAXWEIGHTS], ucen[PYGMIX_WMOM_MAXWEIGHTS];
 
     double
-        rdata=0, idata=0,
-        u=0, v=0,
-        w2=0,
-        var=0;
-
-
-    struct PyGMix_Gauss2D gauss={0};
-    /*
-    struct PyGMix_Gauss2D gauss1={0};
-    struct PyGMix_Gauss2D gauss2={0};
-    */
-
-    int i=0, j=0;
+        u=0, v=0, umod=0, vmod=0,
+        wdata=0, data=0, weight=0, w2=0,
+        ivar=0, var=0,
+        psum=0, rsq=0;
+    int flags=0, i=0, j=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOddd", 
-                          &kr_obj,
-                          &ki_obj,
-                          &var_obj,
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOOOOd", 
+                          &image_obj,
+                          &weight_obj,
                           &jacob_obj,
-                          &pars_real_obj,
-                          &pars_imag_obj,
+                          &gmix_obj,
+                          &offsets_obj,
+                          &pars_obj,
                           &pcov_obj,
-                          &sigma_sq,
-                          &rowshift,
-                          &colshift)) {
+                          &wsum_obj,
+                          &s2n_numer_obj,
+                          &s2n_denom_obj,
+                          &rmax)) {
         return NULL;
     }
 
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-    /*
-    sigmasq1 = sigma1*sigma1;
-    sigmasq2 = sigma2*sigma2;
-    */
+    offsets=(const npy_int64 *) PyArray_DATA(offsets_obj);
+    n_weights=PyArray_SIZE(offsets_obj)-1;
 
-    n_row=PyArray_DIM(kr_obj, 0);
-    n_col=PyArray_DIM(kr_obj, 1);
+    if (n_weights < 1 || n_weights > PYGMIX_WMOM_MAXWEIGHTS) {
+        PyErr_Format(GMixFatalError, 
+                     "need 1 to %d weights, got %ld",
+                     PYGMIX_WMOM_MAXWEIGHTS, n_weights);
+        return NULL;
+    }
+    if (PyArray_SIZE(pars_obj) != 6*n_weights
+            || PyArray_SIZE(pcov_obj) != 36*n_weights
+            || PyArray_SIZE(wsum_obj) != n_weights
+            || PyArray_SIZE(s2n_numer_obj) != n_weights
+            || PyArray_SIZE(s2n_denom_obj) != n_weights) {
+        PyErr_Format(GMixFatalError, 
+                     "outputs must have %ld weights", n_weights);
+        return NULL;
+    }
 
+    for (k=0; k<n_weights; k++) {
+        if (offsets[k] < 0 || offsets[k] >= offsets[k+1]
+                || offsets[k+1] > n_gauss) {
+            PyErr_Format(GMixFatalError, 
+                         "bad gaussian offsets for weight %ld", k);
+            return NULL;
+        }
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+        gm=&gmix[offsets[k]];
+        if (!gmix_set_norms_if_needed(gm, offsets[k+1]-offsets[k])) {
+            return NULL;
+        }
 
-    maxrad = jacob->row0*jacob->sdet;
-    maxrad2 = maxrad*maxrad;
+        gmix_get_cen(gm, offsets[k+1]-offsets[k], &vcen[k], &ucen[k], &psum);
+    }
 
-    pars_real=PyArray_DATA(pars_real_obj); // [6]
-    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
-    pcov=PyArray_DATA(pcov_obj); // [6,6]
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-    gauss2d_set(&gauss, 1.0, 0.0, 0.0, sigma_sq, 0.0, sigma_sq);
-    if (!gauss2d_set_norm_throw(&gauss)) {
-        return NULL;
-    }
+    rmaxsq=rmax*rmax;
+
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    pars=PyArray_DATA(pars_obj); // pars[K,6]
+    pcov=PyArray_DATA(pcov_obj); // pcov[K,6,6]
+    wsum=PyArray_DATA(wsum_obj);
+    s2n_numer=PyArray_DATA(s2n_numer_obj);
+    s2n_denom=PyArray_DATA(s2n_denom_obj);
 
     for (row=0; row < n_row; row++) {
         for (col=0; col < n_col; col++) {
 
-
             // sky coordinates relative to the jacobian center
             v=PYGMIX_JACOB_GETV(jacob, row, col);
             u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-            ksq = v*v + u*u;
-            if (ksq > maxrad2) {
+            rsq = u*u + v*v;
+
+            if (rsq > rmaxsq) {
                 continue;
             }
 
-            // this is the power spectrum of the noise
-            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
+            data = *( (double*)PyArray_GETPTR2(image_obj,row,col) );
+            ivar = *( (double*)PyArray_GETPTR2(weight_obj,row,col) );
 
-            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
-            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
+            if (ivar <= 0.0) {
+                flags = 1;
+                goto _getmom_multi_bail;
+            }
 
-            data = rdata + I*idata;
+            var=1.0/ivar;
 
-            // roll the phase of the weight according to the real space shift
-            arg = v*rowshift + u*colshift;
-            shift = cos(arg) - I*sin(arg);
+            for (k=0; k<n_weights; k++) {
 
-            // weight is real, but we will shift it
-            weight = PYGMIX_GMIX_EVAL_FAST(&gauss, 1, v, u);
-            //weight = PYGMIX_GMIX_EVAL_FULL(&gauss, 1, v, u);
-            //weight = PYGMIX_GMIX_EVAL_FAST(&gauss1, 1, v, u);
-            //weight *= PYGMIX_GMIX_EVAL_FAST(&gauss2, 1, v, u);
+                gm=&gmix[offsets[k]];
+                weight=PYGMIX_GMIX_EVAL(gm, offsets[k+1]-offsets[k], v, u);
 
-            w2 = weight*weight;
+                // nothing to add; common for the smaller weights
+                if (weight == 0.0) {
+                    continue;
+                }
 
-            weight = weight*shift;
-            wdata = weight*data;
+                // sky coordinates relative to the gaussian mixture center
+                vmod = v-vcen[k];
+                umod = u-ucen[k];
+
+                wdata = weight*data;
+                w2 = weight*weight;
+                wsum[k] += weight;
+
+                // for the s/n sums
+                s2n_numer[k] += wdata*ivar;
+                s2n_denom[k] += w2*ivar;
+
+                F[0] = vmod;
+                F[1] = umod;
+                F[2] = umod*umod - vmod*vmod;
+                F[3] = 2*vmod*umod;
+                F[4] = umod*umod + vmod*vmod;
+                F[5] = 1.0;
+
+                tpars = &pars[6*k];
+                tpcov = &pcov[36*k];
+                for (i=0; i<6; i++) {
+                    tpars[i] += wdata*F[i];
+                    for (j=0; j<6; j++) {
+                        tpcov[i + 6*j] += w2*var*F[i]*F[j];
+                    }
+                }
+            }
 
-            F[0] = v*I;
-            F[1] = u*I;
-            F[2] = u*u - v*v;
-            F[3] = 2*v*u;
-            F[4] = u*u + v*v;
-            F[5] = 1.0;
+        }
+    }
 
-            for (i=0; i<6; i++) {
-                pars[i] += wdata*F[i];
+_getmom_multi_bail:
 
-                for (j=0; j<6; j++) {
+    return Py_BuildValue("i", flags);
+}
 
-                    double val=creal(w2*var*F[i]*conj(F[j]));
 
-                    if (isnan(val)) {
-                        val = 0;
-                    }
-                    pcov[i + 6*j] += val;
+/*
+   weighted moments of one gaussian mixture with another
+*/
+static PyObject * PyGMix_get_weighted_gmix_moments(PyObject* self, PyObject* args) {
 
-                }
-            }
+    // arguments
+    PyObject* gmix_obj=NULL;
+    PyObject* wt_gmix_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    int n_row=0, n_col=0;
+    PyObject* pars_obj=NULL;
 
-        }
+    // for unpacking input arrays
+    npy_intp n_gauss=0, wt_n_gauss=0;
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_Gauss2D *wt_gmix=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
+    double *pars=NULL;
+
+    // local variables
+    int i=0, row=0, col=0;
+    double u=0, v=0, umod=0, vmod=0;
+    double model_val=0, wmodel, weight=0, wsum=0;
+    double wt_ucen=0, wt_vcen=0, wt_psum=0;
+    double F[6];
+
+    if (!PyArg_ParseTuple(
+            args, (char*)"OOOiiO", 
+            &gmix_obj,
+            &wt_gmix_obj,
+            &jacob_obj,
+            &n_row,
+            &n_col,
+            &pars_obj
+        ) ) {
+        return NULL;
     }
 
-    for (i=0; i<6; i++) {
-        pars_real[i] = creal(pars[i]);
-        pars_imag[i] = cimag(pars[i]);
+    // unpack the input and output arrays
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
     }
 
-    Py_RETURN_NONE;
-}
+    wt_gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_gmix_obj);
+    wt_n_gauss=PyArray_SIZE(wt_gmix_obj);
+    if (!gmix_set_norms_if_needed(wt_gmix, wt_n_gauss)) {
+        return NULL;
+    }
 
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
+    pars=PyArray_DATA(pars_obj); // pars[6]
 
+    // center of the weight gmix
+    gmix_get_cen(wt_gmix, wt_n_gauss, &wt_vcen, &wt_ucen, &wt_psum);
 
-/*
-   sigma is in real space
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
+            // sky coordinates relative to the jacobian center
+            v=PYGMIX_JACOB_GETV(jacob, row, col);
+            u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-   note the weight goes to zero beyond kmax=sqrt(2*N)/sigma.
-   We also allow sending a kmax argument, designed to let the
-   user force a circular aperture in case the weight is larger
-   than the image
+            model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-*/
+            // evaluate the gaussian mixture at the specified location
+            weight=PYGMIX_GMIX_EVAL_FULL(wt_gmix, wt_n_gauss, v, u);
 
+            // sky coordinates relative to the gaussian mixture center
+            vmod = v-wt_vcen;
+            umod = u-wt_ucen;
 
+            wmodel = weight*model_val;
+            wsum += weight;
 
-static PyObject * PyGMix_get_ksigma_weighted_moments(PyObject* self, PyObject* args) {
+            F[0] = vmod;
+            F[1] = umod;
+            F[2] = umod*umod - vmod*vmod;
+            F[3] = 2*vmod*umod;
+            F[4] = umod*umod + vmod*vmod;
+            F[5] = 1.0;
+
+            for (i=0; i<6; i++) {
+                pars[i] += wmodel*F[i];
+            }
+
+        }
+    }
+
+    return Py_BuildValue("d", wsum);
+}
+
+static PyObject * PyGMix_get_unweighted_moments(PyObject* self, PyObject* args) {
 
     PyObject
-        *kr_obj=NULL,
-        *ki_obj=NULL,
-        *var_obj=NULL,
+        *im_obj=NULL,
         *jacob_obj=NULL,
 
-        *pars_real_obj=NULL,
-        *pars_imag_obj=NULL,
-        *pcov_obj=NULL;
+        *pars_obj=NULL;
 
     double
-        rowshift=0, colshift=0,
-        sigmasq=0,
-        kmax=0, kmaxsq=0,
-        N=4.0,
-        arg=0;
-
-    double complex
-        shift=0, data=0, weight=0, wdata=0,
+        u=0, v=0,
+        data=0,
         F[6]={0},
-        pars[6]={0};
+        *pars=NULL;
 
     npy_intp n_row=0, n_col=0, row=0, col=0;
 
     struct PyGMix_Jacobian *jacob=NULL;
-    double
-        *pars_real=NULL,
-        *pars_imag=NULL,
-        *pcov=NULL;
-
-    double
-        rdata=0, idata=0,
-        u=0, v=0,
-        w2=0,
-        var=0,
-        ksq=0;
 
-    int i=0, j=0;
+    int i=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOddd", 
-                          &kr_obj,
-                          &ki_obj,
-                          &var_obj,
+    if (!PyArg_ParseTuple(args, (char*)"OOO", 
+                          &im_obj,
                           &jacob_obj,
-                          &pars_real_obj,
-                          &pars_imag_obj,
-                          &pcov_obj,
-                          &kmax,
-                          &rowshift,
-                          &colshift)) {
+                          &pars_obj)) {
         return NULL;
     }
 
-    //sigmasq = sigma*sigma;
-    // weight goes to zero beyond here
-    //kmaxsq = 2.0*N/sigmasq;
-
-    kmaxsq = kmax*kmax;
-
-    sigmasq = 2.0*N/kmaxsq;
-
-    // can also have a 
-
-    n_row=PyArray_DIM(kr_obj, 0);
-    n_col=PyArray_DIM(kr_obj, 1);
+    n_row=PyArray_DIM(im_obj, 0);
+    n_col=PyArray_DIM(im_obj, 1);
 
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    pars_real=PyArray_DATA(pars_real_obj); // [6]
-    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
-    pcov=PyArray_DATA(pcov_obj); // [6,6]
+    pars=PyArray_DATA(pars_obj); // [6]
 
     for (row=0; row < n_row; row++) {
         for (col=0; col < n_col; col++) {
 
-
             // sky coordinates relative to the jacobian center
             v=PYGMIX_JACOB_GETV(jacob, row, col);
             u=PYGMIX_JACOB_GETU(jacob, row, col);
 
+            data = *( (double*)PyArray_GETPTR2(im_obj,row,col) );
 
-            ksq = u*u + v*v;
+            F[0] = v;
+            F[1] = u;
+            F[2] = u*u - v*v;
+            F[3] = 2*v*u;
+            F[4] = u*u + v*v;
+            F[5] = 1.0;
 
-            if (ksq > kmaxsq) {
-                continue;
+            for (i=0; i<6; i++) {
+                pars[i] += data*F[i];
             }
 
-            // this is the power spectrum of the noise
-            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
-
-            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
-            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
-
-            data = rdata + I*idata;
-
-            // roll the phase of the weight according to the real space shift
-            arg = v*rowshift + u*colshift;
-            shift = cos(arg) - I*sin(arg);
+        }
+    }
 
-            // weight is real, but we will shift it
-            weight = 1.0 - ksq * sigmasq/(2*N);
+    Py_RETURN_NONE;
+}
 
-            // note N=4, so unroll this
-            weight = weight*weight*weight*weight;
-            w2 = weight*weight;
+#define printfc(c) printf("%g%c%gi",creal(c),(cimag(c)>=0.0f)? '+':'\0',cimag(c))
 
-            weight = weight*shift;
-            wdata = weight*data;
+/*
+   The phase shift exp(-i k.x0) for a real space shift x0 advances by a
+   constant rotation as we step along a row of the k grid, since u and v
+   change by dudcol and dvdcol.  Get the phase at column zero of the row and
+   the per-column rotation, so the inner loop only needs a complex multiply.
 
+   Re-seeding on every row keeps the accumulated round off negligible
+*/
+static inline void kshift_row_init(const struct PyGMix_Jacobian *jacob,
+                                   npy_intp row,
+                                   double rowshift,
+                                   double colshift,
+                                   double complex *shift,
+                                   double complex *dshift)
+{
+    double u=0, v=0, arg=0, darg=0;
 
-            F[0] = v*I;
-            F[1] = u*I;
-            F[2] = u*u - v*v;
-            F[3] = 2*v*u;
-            F[4] = u*u + v*v;
-            F[5] = 1.0;
+    u=PYGMIX_JACOB_GETU(jacob, row, 0);
+    v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-            for (i=0; i<6; i++) {
-                pars[i] += wdata*F[i];
+    arg = v*rowshift + u*colshift;
+    darg = jacob->dvdcol*rowshift + jacob->dudcol*colshift;
 
-                for (j=0; j<6; j++) {
+    *shift = cos(arg) - I*sin(arg);
+    *dshift = cos(darg) - I*sin(darg);
+}
 
-                    double val=creal(w2*var*F[i]*conj(F[j]));
+/*
+   Hermitian half planes
 
-                    if (isnan(val)) {
-                        val = 0;
-                    }
-                    pcov[i + 6*j] += val;
+   The k space images are transforms of real images, so F(-k) = conj(F(k)).
+   The half-plane versions of the kernels take the u >= 0 columns only, in
+   the layout of a real FFT: rows are centered as for the full plane images,
+   column zero is u=0 and, for an even full width, the last column is the
+   Nyquist frequency.  The jacobian should have col0=0.
 
-                }
-            }
+   Each column in the interior of the half plane stands in for itself and
+   its conjugate partner, whose contribution to moment sums, covariances and
+   chi^2 is the complex conjugate of its own, so we count it twice and keep
+   the real part.  The u=0 and Nyquist columns hold their own partners.
 
-        }
-    }
+   ncol_full is the width of the full plane; send 0 for full plane inputs
+*/
+static inline double khalf_col_mult(npy_intp col, npy_intp ncol_full)
+{
+    double mult=2.0;
 
-    for (i=0; i<6; i++) {
-        pars_real[i] = creal(pars[i]);
-        pars_imag[i] = cimag(pars[i]);
+    if (ncol_full <= 0) {
+        // full plane input
+        mult=1.0;
+    } else if (col == 0) {
+        mult=1.0;
+    } else if ( (ncol_full % 2) == 0 && col == ncol_full/2 ) {
+        mult=1.0;
     }
 
-    Py_RETURN_NONE;
+    return mult;
 }
 
+/*
+   get k-space moments
 
-static PyObject * PyGMix_get_ksigma_weighted_moments_ps(PyObject* self, PyObject* args) {
-
-    PyObject
-        *amp_obj=NULL,
-        *var_obj=NULL,
-        *jacob_obj=NULL,
+*/
 
-        *pars_obj=NULL,
-        *pcov_obj=NULL;
+// weighted moments with a weight image
+// the weight should already be applied to the input images,
+// and is only used for calculating variance
 
+static void kweighted_moments_image_sums(PyObject* kr_obj,
+                                         PyObject* ki_obj,
+                                         double var,
+                                         const struct PyGMix_Jacobian *jacob,
+                                         PyObject* wtr_obj,
+                                         PyObject* wti_obj,
+                                         npy_intp ncol_full,
+                                         double complex *pars,
+                                         double *pcov)
+{
     double
-        sigmasq=0,
-        kmax=0, kmaxsq=0,
-        N=4.0,
-        data=0, weight=0, wdata=0,
-        F[6]={0};
-
-    npy_intp n_row=0, n_col=0, row=0, col=0;
-
-    struct PyGMix_Jacobian *jacob=NULL;
-    double
-        *pars=NULL,
-        *pcov=NULL,
         u=0, v=0,
+        rdata=0, idata=0,
+        wrdata=0, widata=0,
         w2=0,
-        var=0,
-        ksq=0;
-
-    int i=0, j=0;
-
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOd", 
-                          &amp_obj,
-                          &var_obj,
-                          &jacob_obj,
-                          &pars_obj,
-                          &pcov_obj,
-                          &kmax)) {
-        return NULL;
-    }
-
-    //sigmasq = sigma*sigma;
-    // weight goes to zero beyond here
-    //kmaxsq = 2.0*N/sigmasq;
-
-    kmaxsq = kmax*kmax;
+        mult=0;
 
-    sigmasq = 2.0*N/kmaxsq;
+    double complex
+        data=0, weight=0,
+        F[6]={0};
 
-    n_row=PyArray_DIM(amp_obj, 0);
-    n_col=PyArray_DIM(amp_obj, 1);
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    int i=0, j=0;
 
-    pars=PyArray_DATA(pars_obj); // [6]
-    pcov=PyArray_DATA(pcov_obj); // [6,6]
+    n_row=PyArray_DIM(kr_obj, 0);
+    n_col=PyArray_DIM(kr_obj, 1);
 
     for (row=0; row < n_row; row++) {
         for (col=0; col < n_col; col++) {
 
+            mult=khalf_col_mult(col, ncol_full);
 
             // sky coordinates relative to the jacobian center
             v=PYGMIX_JACOB_GETV(jacob, row, col);
             u=PYGMIX_JACOB_GETU(jacob, row, col);
 
+            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
+            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
 
-            ksq = u*u + v*v;
-
-            if (ksq > kmaxsq) {
-                continue;
-            }
-
-            // this is the power spectrum of the noise
-            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
-
-            data = *( (double*)PyArray_GETPTR2(amp_obj,row,col) );
-
-            weight = 1.0 - ksq * sigmasq/(2*N);
-
-            // note N=4, so unroll this
-            weight = weight*weight*weight*weight;
-
-            // for PS we square it
-            weight *= weight;
+            wrdata = *( (double*)PyArray_GETPTR2(wtr_obj,row,col) );
+            widata = *( (double*)PyArray_GETPTR2(wti_obj,row,col) );
 
-            w2 = weight*weight;
+            data = rdata + I * idata;
+            weight = wrdata + I * widata;
 
-            wdata = weight*data;
+            w2 = weight*weight*var;
 
-            F[0] = v;
-            F[1] = u;
+            F[0] = v*I;
+            F[1] = u*I;
             F[2] = u*u - v*v;
             F[3] = 2*v*u;
             F[4] = u*u + v*v;
             F[5] = 1.0;
 
             for (i=0; i<6; i++) {
-                pars[i] += wdata*F[i];
-
+                if (mult == 1.0) {
+                    pars[i] += data*F[i];
+                } else {
+                    // the conjugate partner cancels the imaginary part
+                    pars[i] += mult*creal(data*F[i]);
+                }
                 for (j=0; j<6; j++) {
-
-                    double val=w2*var*F[i]*F[j];
+                    double val=mult*creal(w2*F[i]*conj(F[j]));
 
                     if (isnan(val)) {
                         val = 0;
                     }
-                    pcov[i + 6*j] += val;
 
+                    pcov[i + 6*j] += val;
                 }
             }
 
         }
     }
-
-
-    Py_RETURN_NONE;
 }
 
+static PyObject * PyGMix_get_kweighted_moments_image(PyObject* self, PyObject* args) {
 
+    // inputs
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *jacob_obj=NULL,
 
+        *wtr_obj=NULL,
+        *wti_obj=NULL,
 
-/*
-   Calculate the loglike between the gmix and the input image
-
-   Error checking should be done in python.
-*/
-static PyObject * PyGMix_get_loglike(PyObject* self, PyObject* args) {
-
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pars_cov_obj=NULL;
+    double var=0;
     struct PyGMix_Jacobian *jacob=NULL;
 
-    double data=0, ivar=0, u=0, v=0;
-    double model_val=0, diff=0;
-    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
+    // local vars
+    double
+        *pars_real=NULL, *pars_imag=NULL,
+        *pcov=NULL;
 
-    long npix = 0;
+    double complex pars[6]={0};
 
-    PyObject* retval=NULL;
+    int i=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOO", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj)) {
-        return NULL;
-    }
+    if (!PyArg_ParseTuple(args, (char*)"OOdOOOOOO", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var,             // variance in each pixel
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+                          &jacob_obj,
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+                          &wtr_obj,
+                          &wti_obj,
+                          
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pars_cov_obj)) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
-
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    for (row=0; row < n_row; row++) {
-        //u=jacob->dudrow*(row - jacob->row0) + jacob->dudcol*(0 - jacob->col0);
-        //v=jacob->dvdrow*(row - jacob->row0) + jacob->dvdcol*(0 - jacob->col0);
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
-
-        for (col=0; col < n_col; col++) {
-
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-
-                diff = model_val-data;
-                loglike += diff*diff*ivar;
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
-
-                npix += 1;
-            }
+    pars_real=PyArray_DATA(pars_real_obj); // [6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
+    pcov=PyArray_DATA(pars_cov_obj); // [6,6]
 
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
+    kweighted_moments_image_sums(kr_obj, ki_obj, var, jacob,
+                                 wtr_obj, wti_obj,
+                                 0,
+                                 pars, pcov);
 
-        }
+    for (i=0; i<6; i++) {
+        pars_real[i] = creal(pars[i]);
+        pars_imag[i] = cimag(pars[i]);
     }
-
-    loglike *= (-0.5);
-
-    // fill in the retval
-    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
-    return retval;
+    Py_RETURN_NONE;
 }
 
-static PyObject * PyGMix_get_loglike_gauleg(PyObject* self, PyObject* args) {
+/*
+   same as get_kweighted_moments_image but for half-plane inputs; the
+   imaginary parts of the moments cancel and are returned as zero
+*/
+static PyObject * PyGMix_get_kweighted_moments_image_half(PyObject* self, PyObject* args) {
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    int npoints=0;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    // inputs
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *jacob_obj=NULL,
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+        *wtr_obj=NULL,
+        *wti_obj=NULL,
 
-    double data=0, ivar=0, u=0, v=0;
-    double model_val=0, diff=0;
-    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pars_cov_obj=NULL;
+    double var=0;
+    int ncol_full=0;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-    // gauleg parameters
-    npy_intp rowsub=0, colsub=0;
+    // local vars
     double
-           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
-           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
-           wsum=0;
-    const double *xxi=NULL, *wwi=NULL;
+        *pars_real=NULL, *pars_imag=NULL,
+        *pcov=NULL;
 
-    long npix = 0;
+    double complex pars[6]={0};
 
-    PyObject* retval=NULL;
+    int i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOdOOOOOOi", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var,             // variance in each pixel
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOi", 
-                          &gmix_obj,
-                          &image_obj,
-                          &weight_obj,
                           &jacob_obj,
-                          &npoints)) {
-        return NULL;
-    }
 
-    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
+                          &wtr_obj,
+                          &wti_obj,
+                          
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pars_cov_obj,
+                          &ncol_full)) {
         return NULL;
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+    pars_real=PyArray_DATA(pars_real_obj); // [6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
+    pcov=PyArray_DATA(pars_cov_obj); // [6,6]
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+    kweighted_moments_image_sums(kr_obj, ki_obj, var, jacob,
+                                 wtr_obj, wti_obj,
+                                 ncol_full,
+                                 pars, pcov);
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    for (i=0; i<6; i++) {
+        pars_real[i] = creal(pars[i]);
+        pars_imag[i] = 0.0;
+    }
+    Py_RETURN_NONE;
+}
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
 
-                // integrate the model over the pixel
-                model_val=0;
-                wsum=0;
-
-                rowmax = row + 0.5;
-                rowmin = row - 0.5;
-                colmax = col + 0.5;
-                colmin = col - 0.5;
-
-                frow1 = (rowmax-rowmin)*0.5; // always 0.5.
-                frow2 = (rowmax+rowmin)*0.5; // always row
-                fcol1 = (colmax-colmin)*0.5; // always 0.5
-                fcol2 = (colmax+colmin)*0.5; // always col
+/*
 
-                for (rowsub=0; rowsub<npoints; rowsub++) {
-                    trow = frow1*xxi[rowsub] + frow2;
-                    wrow = wwi[rowsub];
-                    for (colsub=0; colsub<npoints; colsub++) {
-                        tcol = fcol1*xxi[colsub] + fcol2;
-                        wcol = wwi[colsub];
+   weight is product of two gaussians
+*/
 
-                        u=PYGMIX_JACOB_GETU(jacob, trow, tcol);
-                        v=PYGMIX_JACOB_GETV(jacob, trow, tcol);
+static PyObject * PyGMix_get_kweighted_moments_2gauss(PyObject* self, PyObject* args) {
 
-                        model_val += wrow*wcol*PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-                        wsum += wrow*wcol;
-                    }
-                }
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *var_obj=NULL,
+        *jacob_obj=NULL,
 
-                model_val /= wsum;
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pcov_obj=NULL;
 
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+    double
+        rowshift=0, colshift=0,
+        sigma1=0, sigmasq1=0,
+        sigma2=0, sigmasq2=0,
+        arg=0;
 
-                diff = model_val-data;
-                loglike += diff*diff*ivar;
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
+    double complex
+        shift=0, data=0, weight=0, wdata=0,
+        F[6]={0},
+        pars[6]={0};
 
-                npix += 1;
-            }
-        }
-    }
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
-    loglike *= (-0.5);
+    struct PyGMix_Jacobian *jacob=NULL;
+    double
+        *pars_real=NULL,
+        *pars_imag=NULL,
+        *pcov=NULL;
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
-    return retval;
-}
+    double
+        rdata=0, idata=0,
+        u=0, v=0,
+        w2=0,
+        var=0;
 
 
+    struct PyGMix_Gauss2D gauss1={0};
+    struct PyGMix_Gauss2D gauss2={0};
 
-/*
-   Calculate the loglike between the gmix and the input image
+    int i=0, j=0;
 
-   only evaluate the loglike within the specified circular aperture, centered
-   on the canonical center of the jacobian.  This only makes sense if the
-   jacobian center is near the true center
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOdddd", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var_obj,
+                          &jacob_obj,
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pcov_obj,
+                          &sigma1,
+                          &sigma2,
+                          &rowshift,
+                          &colshift)) {
+        return NULL;
+    }
 
-   Error checking should be done in python.
-*/
-static PyObject * PyGMix_get_loglike_aper(PyObject* self, PyObject* args) {
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    double aperture=0, ap2=0, rad2=0;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    sigmasq1 = sigma1*sigma1;
+    sigmasq2 = sigma2*sigma2;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+    n_row=PyArray_DIM(kr_obj, 0);
+    n_col=PyArray_DIM(kr_obj, 1);
 
-    double data=0, ivar=0, u=0, v=0;
-    double model_val=0, diff=0;
-    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    long npix=0;
+    pars_real=PyArray_DATA(pars_real_obj); // [6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
+    pcov=PyArray_DATA(pcov_obj); // [6,6]
 
-    PyObject* retval=NULL;
+    gauss2d_set(&gauss1, 1.0, 0.0, 0.0, sigmasq1, 0.0, sigmasq1);
+    gauss2d_set(&gauss2, 1.0, 0.0, 0.0, sigmasq2, 0.0, sigmasq2);
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOd", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj, &aperture)) {
+    if (!gauss2d_set_norm_throw(&gauss1)) {
         return NULL;
     }
-
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
-
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+    if (!gauss2d_set_norm_throw(&gauss2)) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    ap2=aperture*aperture;
-    for (row=0; row < n_row; row++) {
-        //u=jacob->dudrow*(row - jacob->row0) + jacob->dudcol*(0 - jacob->col0);
-        //v=jacob->dvdrow*(row - jacob->row0) + jacob->dvdcol*(0 - jacob->col0);
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+            // sky coordinates relative to the jacobian center
+            v=PYGMIX_JACOB_GETV(jacob, row, col);
+            u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-        for (col=0; col < n_col; col++) {
+            // this is the power spectrum of the noise
+            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
 
-            // distance from jacobian center
-            rad2=u*u + v*v;
-            if (rad2 <= ap2) {
+            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
+            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
 
-                ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-                if ( ivar > 0.0) {
-                    data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+            data = rdata + I*idata;
 
-                    model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+            // roll the phase of the weight according to the real space shift
+            arg = v*rowshift + u*colshift;
+            shift = cos(arg) - I*sin(arg);
 
-                    diff = model_val-data;
-                    loglike += diff*diff*ivar;
-                    s2n_numer += data*model_val*ivar;
-                    s2n_denom += model_val*model_val*ivar;
+            // weight is real, but we will shift it
+            weight = PYGMIX_GMIX_EVAL_FAST(&gauss1, 1, v, u);
+            weight *= PYGMIX_GMIX_EVAL_FAST(&gauss2, 1, v, u);
 
-                    npix += 1;
-                }
+            w2 = weight*weight;
+
+            weight = weight*shift;
+            wdata = weight*data;
+
+            F[0] = v*I;
+            F[1] = u*I;
+            F[2] = u*u - v*v;
+            F[3] = 2*v*u;
+            F[4] = u*u + v*v;
+            F[5] = 1.0;
+
+            for (i=0; i<6; i++) {
+                pars[i] += wdata*F[i];
+
+                for (j=0; j<6; j++) {
+
+                    double val=creal(w2*var*F[i]*conj(F[j]));
+
+                    if (isnan(val)) {
+                        val = 0;
+                    }
+                    pcov[i + 6*j] += val;
 
+                }
             }
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
 
         }
     }
 
-    loglike *= (-0.5);
+    for (i=0; i<6; i++) {
+        pars_real[i] = creal(pars[i]);
+        pars_imag[i] = cimag(pars[i]);
+    }
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
-    return retval;
+    Py_RETURN_NONE;
 }
 
 
+static PyObject * PyGMix_get_kweighted_moments_gauss(PyObject* self, PyObject* args) {
 
-/*
-   Calculate the loglike between the input image and the model image,
-   subtracting off the mean in each case
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *var_obj=NULL,
+        *jacob_obj=NULL,
 
-   Error checking should be done in python.
-*/
-static PyObject * PyGMix_get_loglike_images_margsky(PyObject* self, PyObject* args) {
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pcov_obj=NULL;
 
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* model_image_obj=NULL;
-    npy_intp n_row=0, n_col=0, row=0, col=0;
+    double
+        rowshift=0, colshift=0,
+        sigma_sq,
+        //sigma1=0, sigmasq1=0,
+        //sigma2=0, sigmasq2=0,
+        arg=0,
+        ksq=0,
+        maxrad=0, maxrad2=0;
 
-    double image_mean=0, model_mean=0;
-    double data=0, ivar=0, data_mod=0, model_mod=0;
-    double model_val=0, diff=0;
-    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
+    double complex
+        shift=0, data=0, weight=0, wdata=0,
+        F[6]={0},
+        pars[6]={0};
 
-    long npix=0;
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
-    PyObject* retval=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
+    double
+        *pars_real=NULL,
+        *pars_imag=NULL,
+        *pcov=NULL;
 
-    if (!PyArg_ParseTuple(args, (char*)"OdOOd", 
-                          &image_obj, &image_mean, &weight_obj, &model_image_obj, &model_mean)) {
-        return NULL;
-    }
+    double
+        rdata=0, idata=0,
+        u=0, v=0,
+        w2=0,
+        var=0;
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
-
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                data      = *( (double*)PyArray_GETPTR2(image_obj,row,col) );
-                model_val = *( (double*)PyArray_GETPTR2(model_image_obj,row,col) );
-
-                data_mod=data-image_mean;
-                model_mod=model_val-model_mean;
+    struct PyGMix_Gauss2D gauss={0};
+    /*
+    struct PyGMix_Gauss2D gauss1={0};
+    struct PyGMix_Gauss2D gauss2={0};
+    */
 
-                diff = model_mod - data_mod;
-                loglike += diff*diff*ivar;
-                s2n_numer += data_mod*model_mod*ivar;
-                s2n_denom += model_mod*model_mod*ivar;
+    int i=0, j=0;
 
-                npix += 1;
-            }
-        }
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOddd", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var_obj,
+                          &jacob_obj,
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pcov_obj,
+                          &sigma_sq,
+                          &rowshift,
+                          &colshift)) {
+        return NULL;
     }
 
-    loglike *= (-0.5);
-
-    // fill in the retval
-    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
-    return retval;
-}
-
 
-static PyObject * PyGMix_get_loglike_sub(PyObject* self, PyObject* args) {
+    /*
+    sigmasq1 = sigma1*sigma1;
+    sigmasq2 = sigma2*sigma2;
+    */
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0, colsub=0, rowsub=0;
+    n_row=PyArray_DIM(kr_obj, 0);
+    n_col=PyArray_DIM(kr_obj, 1);
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
 
-    double data=0, ivar=0, u=0, v=0;
-    double stepsize=0, ustepsize=0, vstepsize=0, offset=0, areafac=0;
-    double model_val=0, diff=0;
-    double trow=0, lowcol=0, s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
-    int nsub=0;
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    long npix=0;
+    maxrad = jacob->row0*jacob->sdet;
+    maxrad2 = maxrad*maxrad;
 
-    PyObject* retval=NULL;
+    pars_real=PyArray_DATA(pars_real_obj); // [6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
+    pcov=PyArray_DATA(pcov_obj); // [6,6]
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOi", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj, &nsub)) {
+    gauss2d_set(&gauss, 1.0, 0.0, 0.0, sigma_sq, 0.0, sigma_sq);
+    if (!gauss2d_set_norm_throw(&gauss)) {
         return NULL;
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
-
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    stepsize = 1./nsub;
-    offset = (nsub-1)*stepsize/2.;
-    areafac = 1./(nsub*nsub);
-    ustepsize = stepsize*jacob->dudcol;
-    vstepsize = stepsize*jacob->dvdcol;
+            // sky coordinates relative to the jacobian center
+            v=PYGMIX_JACOB_GETV(jacob, row, col);
+            u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+            ksq = v*v + u*u;
+            if (ksq > maxrad2) {
+                continue;
+            }
 
+            // this is the power spectrum of the noise
+            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
+            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
+            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
+            data = rdata + I*idata;
 
-                npix += 1;
+            // roll the phase of the weight according to the real space shift
+            arg = v*rowshift + u*colshift;
+            shift = cos(arg) - I*sin(arg);
 
-                trow = row-offset;
-                lowcol = col-offset;
+            // weight is real, but we will shift it
+            weight = PYGMIX_GMIX_EVAL_FAST(&gauss, 1, v, u);
+            //weight = PYGMIX_GMIX_EVAL_FULL(&gauss, 1, v, u);
+            //weight = PYGMIX_GMIX_EVAL_FAST(&gauss1, 1, v, u);
+            //weight *= PYGMIX_GMIX_EVAL_FAST(&gauss2, 1, v, u);
 
-                model_val=0.;
-                for (rowsub=0; rowsub<nsub; rowsub++) {
-                    u=PYGMIX_JACOB_GETU(jacob, trow, lowcol);
-                    v=PYGMIX_JACOB_GETV(jacob, trow, lowcol);
+            w2 = weight*weight;
 
-                    for (colsub=0; colsub<nsub; colsub++) {
+            weight = weight*shift;
+            wdata = weight*data;
 
-                        model_val += PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+            F[0] = v*I;
+            F[1] = u*I;
+            F[2] = u*u - v*v;
+            F[3] = 2*v*u;
+            F[4] = u*u + v*v;
+            F[5] = 1.0;
 
-                        u += ustepsize;
-                        v += vstepsize;
-                    } // colsub
+            for (i=0; i<6; i++) {
+                pars[i] += wdata*F[i];
 
-                    trow += stepsize;
-                } // rowsub
+                for (j=0; j<6; j++) {
 
-                model_val *= areafac;
+                    double val=creal(w2*var*F[i]*conj(F[j]));
 
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+                    if (isnan(val)) {
+                        val = 0;
+                    }
+                    pcov[i + 6*j] += val;
 
-                diff = model_val-data;
-                loglike += diff*diff*ivar;
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
+                }
             }
 
         }
     }
 
-    loglike *= (-0.5);
+    for (i=0; i<6; i++) {
+        pars_real[i] = creal(pars[i]);
+        pars_imag[i] = cimag(pars[i]);
+    }
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
-    return retval;
+    Py_RETURN_NONE;
 }
 
 
+
+
 /*
-   Calculate the loglike between the gmix and the input image
+   sigma is in real space
+
+   note the weight goes to zero beyond kmax=sqrt(2*N)/sigma.
+   We also allow sending a kmax argument, designed to let the
+   user force a circular aperture in case the weight is larger
+   than the image
 
-   Error checking should be done in python.
-   
-   logfactor = log(gamma((nu+1)/2)/(gamma(nu/2)*sqrt(pi*nu)))
 */
-static PyObject * PyGMix_get_loglike_robust(PyObject* self, PyObject* args) {
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    double nu;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
 
-    double data=0, ivar=0, u=0, v=0;
-    double model_val=0, diff=0;
-    double s2n_numer=0.0, s2n_denom=0.0, loglike=0.0, nupow=0, logfactor=0;
+static void ksigma_weighted_moments_sums(PyObject* kr_obj,
+                                         PyObject* ki_obj,
+                                         PyObject* var_obj,
+                                         const struct PyGMix_Jacobian *jacob,
+                                         double kmax,
+                                         double rowshift,
+                                         double colshift,
+                                         npy_intp ncol_full,
+                                         double complex *pars,
+                                         double *pcov)
+{
+    double
+        sigmasq=0,
+        kmaxsq=0,
+        N=4.0;
 
-    long npix=0;
+    double complex
+        shift=0, rowphase=0, dshift=0,
+        data=0, weight=0, wdata=0,
+        F[6]={0};
 
-    PyObject* retval=NULL;
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOd", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj, 
-                          &nu)) {
-        return NULL;
-    }
+    double
+        rdata=0, idata=0,
+        u=0, v=0,
+        w2=0,
+        var=0,
+        ksq=0,
+        mult=0;
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    int i=0, j=0;
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+    //sigmasq = sigma*sigma;
+    // weight goes to zero beyond here
+    //kmaxsq = 2.0*N/sigmasq;
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+    kmaxsq = kmax*kmax;
+
+    sigmasq = 2.0*N/kmaxsq;
+
+    // can also have a 
+
+    n_row=PyArray_DIM(kr_obj, 0);
+    n_col=PyArray_DIM(kr_obj, 1);
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
-    
-    logfactor = lgamma((nu+1.0)/2.0) - lgamma(nu/2.0) - 0.5*log(M_PI*nu);
-    nupow = -0.5*(nu+1.0);
-    
     for (row=0; row < n_row; row++) {
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+
+        // phase of the weight according to the real space shift
+        kshift_row_init(jacob, row, rowshift, colshift, &rowphase, &dshift);
 
         for (col=0; col < n_col; col++) {
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+            // advance the phase even for pixels we skip
+            shift = rowphase;
+            rowphase *= dshift;
 
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+            // sky coordinates relative to the jacobian center
+            v=PYGMIX_JACOB_GETV(jacob, row, col);
+            u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-                diff = model_val-data;
-                loglike += logfactor + nupow*log(1.0+diff*diff*ivar/nu);
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
 
-                npix += 1;
-            }
+            ksq = u*u + v*v;
 
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
+            if (ksq > kmaxsq) {
+                continue;
+            }
 
-        }
-    }
+            mult=khalf_col_mult(col, ncol_full);
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
+            // this is the power spectrum of the noise
+            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
 
-    return retval;
-}
+            rdata = *( (double*)PyArray_GETPTR2(kr_obj,row,col) );
+            idata = *( (double*)PyArray_GETPTR2(ki_obj,row,col) );
 
-/*
-   Fill the input fdiff=(model-data)/err, return s2n_numer, s2n_denom
+            data = rdata + I*idata;
 
-   Error checking should be done in python.
-*/
-static PyObject * PyGMix_fill_fdiff(PyObject* self, PyObject* args) {
+            // weight is real, but we will shift it
+            weight = 1.0 - ksq * sigmasq/(2*N);
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    PyObject* fdiff_obj=NULL;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    int start=0;
+            // note N=4, so unroll this
+            weight = weight*weight*weight*weight;
+            w2 = weight*weight;
 
-    long npix=0;
+            weight = weight*shift;
+            wdata = weight*data;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
 
-    double data=0, ivar=0, ierr=0, u=0, v=0, *fdiff_ptr=NULL;
-    double model_val=0;
-    double s2n_numer=0.0, s2n_denom=0.0;
+            F[0] = v*I;
+            F[1] = u*I;
+            F[2] = u*u - v*v;
+            F[3] = 2*v*u;
+            F[4] = u*u + v*v;
+            F[5] = 1.0;
 
-    PyObject* retval=NULL;
+            for (i=0; i<6; i++) {
+                if (mult == 1.0) {
+                    pars[i] += wdata*F[i];
+                } else {
+                    // the conjugate partner cancels the imaginary part
+                    pars[i] += mult*creal(wdata*F[i]);
+                }
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOi", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj,
-                          &fdiff_obj, &start)) {
-        return NULL;
-    }
+                for (j=0; j<6; j++) {
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+                    double val=mult*creal(w2*var*F[i]*conj(F[j]));
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+                    if (isnan(val)) {
+                        val = 0;
+                    }
+                    pcov[i + 6*j] += val;
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+                }
+            }
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+        }
+    }
+}
 
-    // we might start somewhere after the priors
-    // note fdiff is 1-d
-    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
+static PyObject * PyGMix_get_ksigma_weighted_moments(PyObject* self, PyObject* args) {
 
-    for (row=0; row < n_row; row++) {
-        u=PYGMIX_JACOB_GETU(jacob, row, 0);
-        v=PYGMIX_JACOB_GETV(jacob, row, 0);
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *var_obj=NULL,
+        *jacob_obj=NULL,
 
-        for (col=0; col < n_col; col++) {
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pcov_obj=NULL;
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
-                ierr=sqrt(ivar);
+    double
+        rowshift=0, colshift=0,
+        kmax=0;
 
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+    double complex pars[6]={0};
 
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+    struct PyGMix_Jacobian *jacob=NULL;
+    double
+        *pars_real=NULL,
+        *pars_imag=NULL,
+        *pcov=NULL;
 
-                (*fdiff_ptr) = (model_val-data)*ierr;
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
+    int i=0;
 
-                npix += 1;
-            } else {
-                (*fdiff_ptr) = 0.0;
-            }
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOddd", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var_obj,
+                          &jacob_obj,
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pcov_obj,
+                          &kmax,
+                          &rowshift,
+                          &colshift)) {
+        return NULL;
+    }
 
-            fdiff_ptr++;
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-            u += jacob->dudcol;
-            v += jacob->dvdcol;
+    pars_real=PyArray_DATA(pars_real_obj); // [6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
+    pcov=PyArray_DATA(pcov_obj); // [6,6]
 
-        }
+    ksigma_weighted_moments_sums(kr_obj, ki_obj, var_obj, jacob,
+                                 kmax, rowshift, colshift,
+                                 0,
+                                 pars, pcov);
+
+    for (i=0; i<6; i++) {
+        pars_real[i] = creal(pars[i]);
+        pars_imag[i] = cimag(pars[i]);
     }
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT3(s2n_numer, s2n_denom, npix);
-    return retval;
+    Py_RETURN_NONE;
 }
 
-static PyObject * PyGMix_fill_fdiff_gauleg(PyObject* self, PyObject* args) {
+/*
+   same as get_ksigma_weighted_moments but for half-plane inputs; the
+   imaginary parts of the moments cancel and are returned as zero
+*/
+static PyObject * PyGMix_get_ksigma_weighted_moments_half(PyObject* self, PyObject* args) {
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    PyObject* fdiff_obj=NULL;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    int start=0,npoints=0;
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *var_obj=NULL,
+        *jacob_obj=NULL,
 
-    long npix=0;
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pcov_obj=NULL;
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+    double
+        rowshift=0, colshift=0,
+        kmax=0;
+    int ncol_full=0;
 
-    double data=0, ivar=0, ierr=0, u=0, v=0, *fdiff_ptr=NULL;
-    double model_val=0;
-    double s2n_numer=0.0, s2n_denom=0.0;
+    double complex pars[6]={0};
 
-    // gauleg parameters
-    npy_intp rowsub=0, colsub=0;
+    struct PyGMix_Jacobian *jacob=NULL;
     double
-           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
-           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
-           wsum=0;
-    const double *xxi=NULL, *wwi=NULL;
-
+        *pars_real=NULL,
+        *pars_imag=NULL,
+        *pcov=NULL;
 
-    PyObject* retval=NULL;
+    int i=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOii", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj,
-                          &fdiff_obj, &start,&npoints)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOdddi", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var_obj,
+                          &jacob_obj,
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pcov_obj,
+                          &kmax,
+                          &rowshift,
+                          &colshift,
+                          &ncol_full)) {
         return NULL;
     }
 
-    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
-        return NULL;
-    }
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    pars_real=PyArray_DATA(pars_real_obj); // [6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [6]
+    pcov=PyArray_DATA(pcov_obj); // [6,6]
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+    ksigma_weighted_moments_sums(kr_obj, ki_obj, var_obj, jacob,
+                                 kmax, rowshift, colshift,
+                                 ncol_full,
+                                 pars, pcov);
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+    for (i=0; i<6; i++) {
+        pars_real[i] = creal(pars[i]);
+        pars_imag[i] = 0.0;
+    }
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    Py_RETURN_NONE;
+}
 
-    // we might start somewhere after the priors
-    // note fdiff is 1-d
-    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
+/*
+   ksigma weighted moments for a set of images on the same k grid, such
+   as the metacal noshear/1p/1m/2p/2m variants.
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
+   The images and noise power spectra are [nvar, nrow, ncol] arrays.  The
+   weight, phase and moment functions F are computed once per k pixel and
+   all variants are accumulated in the same pass.
 
-                // integrate the model over the pixel
-                model_val=0;
-                wsum = 0.0;
+   pars_real and pars_imag are [nvar, 6] and are overwritten; pcov is
+   [nvar, 6, 6] and is added to, so should be zeroed.
 
-                rowmax = row + 0.5;
-                rowmin = row - 0.5;
-                colmax = col + 0.5;
-                colmin = col - 0.5;
+   ncol_full is for half-plane input, send 0 for the full plane
+*/
 
-                frow1 = (rowmax-rowmin)*0.5; // always 0.5.
-                frow2 = (rowmax+rowmin)*0.5; // always row
-                fcol1 = (colmax-colmin)*0.5; // always 0.5
-                fcol2 = (colmax+colmin)*0.5; // always col
+static PyObject * PyGMix_get_ksigma_weighted_moments_multi(PyObject* self, PyObject* args) {
 
-                for (rowsub=0; rowsub<npoints; rowsub++) {
-                    trow = frow1*xxi[rowsub] + frow2;
-                    wrow = wwi[rowsub];
-                    for (colsub=0; colsub<npoints; colsub++) {
-                        tcol = fcol1*xxi[colsub] + fcol2;
-                        wcol = wwi[colsub];
+    PyObject
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *var_obj=NULL,
+        *jacob_obj=NULL,
 
-                        u=PYGMIX_JACOB_GETU(jacob, trow, tcol);
-                        v=PYGMIX_JACOB_GETV(jacob, trow, tcol);
+        *pars_real_obj=NULL,
+        *pars_imag_obj=NULL,
+        *pcov_obj=NULL;
 
-                        model_val += wrow*wcol*PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
-                        wsum += wrow*wcol;
+    double
+        rowshift=0, colshift=0,
+        sigmasq=0,
+        kmax=0, kmaxsq=0,
+        N=4.0;
+    int ncol_full=0;
 
-                    }
-                }
+    double complex
+        shift=0, rowphase=0, dshift=0,
+        data=0, weight=0, wdata=0,
+        F[6]={0};
 
-                model_val /= wsum;
+    npy_intp n_var=0, n_row=0, n_col=0, ivar=0, row=0, col=0;
 
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
-                ierr=sqrt(ivar);
+    struct PyGMix_Jacobian *jacob=NULL;
+    double
+        *pars_real=NULL,
+        *pars_imag=NULL,
+        *pcov=NULL;
 
-                (*fdiff_ptr) = (model_val-data)*ierr;
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
-
-                npix += 1;
-            } else {
-                (*fdiff_ptr) = 0.0;
-            }
+    double
+        rdata=0, idata=0,
+        u=0, v=0,
+        w2=0,
+        var=0,
+        ksq=0,
+        mult=0,
+        G[36]={0};
 
-            fdiff_ptr++;
+    int i=0, j=0;
 
-        }
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOdddi", 
+                          &kr_obj,
+                          &ki_obj,
+                          &var_obj,
+                          &jacob_obj,
+                          &pars_real_obj,
+                          &pars_imag_obj,
+                          &pcov_obj,
+                          &kmax,
+                          &rowshift,
+                          &colshift,
+                          &ncol_full)) {
+        return NULL;
     }
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT3(s2n_numer, s2n_denom, npix);
-    return retval;
-}
-
+    kmaxsq = kmax*kmax;
+    sigmasq = 2.0*N/kmaxsq;
 
-/*
-   Fill the input fdiff=(model-data)/err, return s2n_numer, s2n_denom
-   with sub-pixel integration
+    n_var=PyArray_DIM(kr_obj, 0);
+    n_row=PyArray_DIM(kr_obj, 1);
+    n_col=PyArray_DIM(kr_obj, 2);
 
-   Error checking should be done in python.
-*/
-static PyObject * PyGMix_fill_fdiff_sub(PyObject* self, PyObject* args) {
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    PyObject* fdiff_obj=NULL;
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    int start=0, nsub=0;
+    pars_real=PyArray_DATA(pars_real_obj); // [nvar, 6]
+    pars_imag=PyArray_DATA(pars_imag_obj); // [nvar, 6]
+    pcov=PyArray_DATA(pcov_obj); // [nvar, 6, 6]
 
-    long npix=0;
+    memset(pars_real, 0, n_var*6*sizeof(double));
+    memset(pars_imag, 0, n_var*6*sizeof(double));
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+    for (row=0; row < n_row; row++) {
 
-    double data=0, ivar=0, ierr=0, u=0, v=0, *fdiff_ptr=NULL;
-    double model_val=0;
-    double s2n_numer=0.0, s2n_denom=0.0;
-    double stepsize=0, ustepsize=0, vstepsize=0, 
-           offset=0, areafac=0, trow=0, lowcol=0;
-    npy_intp rowsub=0, colsub=0;
+        // phase of the weight according to the real space shift
+        kshift_row_init(jacob, row, rowshift, colshift, &rowphase, &dshift);
 
-    PyObject* retval=NULL;
+        for (col=0; col < n_col; col++) {
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOii", 
-                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj,
-                          &fdiff_obj, &start, &nsub)) {
-        return NULL;
-    }
+            // advance the phase even for pixels we skip
+            shift = rowphase;
+            rowphase *= dshift;
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+            // sky coordinates relative to the jacobian center
+            v=PYGMIX_JACOB_GETV(jacob, row, col);
+            u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+            ksq = u*u + v*v;
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+            if (ksq > kmaxsq) {
+                continue;
+            }
 
-    stepsize = 1./nsub;
-    offset = (nsub-1)*stepsize/2.;
-    areafac = 1./(nsub*nsub);
-    ustepsize = stepsize*jacob->dudcol;
-    vstepsize = stepsize*jacob->dvdcol;
+            mult=khalf_col_mult(col, ncol_full);
 
-    n_row=PyArray_DIM(image_obj, 0);
-    n_col=PyArray_DIM(image_obj, 1);
+            // the weight and moment functions are common to all
+            // the variants
 
+            weight = 1.0 - ksq * sigmasq/(2*N);
 
-    // we might start somewhere after the priors
-    // note fdiff is 1-d
-    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
+            // note N=4, so unroll this
+            weight = weight*weight*weight*weight;
+            w2 = weight*weight;
 
-    for (row=0; row < n_row; row++) {
-        for (col=0; col < n_col; col++) {
+            weight = weight*shift;
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
+            F[0] = v*I;
+            F[1] = u*I;
+            F[2] = u*u - v*v;
+            F[3] = 2*v*u;
+            F[4] = u*u + v*v;
+            F[5] = 1.0;
 
-                npix += 1;
+            for (i=0; i<6; i++) {
+                for (j=0; j<6; j++) {
+                    G[i + 6*j] = mult*w2*creal(F[i]*conj(F[j]));
+                }
+            }
 
-                trow = row-offset;
-                lowcol = col-offset;
+            for (ivar=0; ivar < n_var; ivar++) {
+                double *tpars_real = &pars_real[ivar*6];
+                double *tpars_imag = &pars_imag[ivar*6];
+                double *tpcov = &pcov[ivar*36];
 
-                model_val=0.;
-                for (rowsub=0; rowsub<nsub; rowsub++) {
-                    u=PYGMIX_JACOB_GETU(jacob, trow, lowcol);
-                    v=PYGMIX_JACOB_GETV(jacob, trow, lowcol);
+                // this is the power spectrum of the noise
+                var = *( (double*)PyArray_GETPTR3(var_obj,ivar,row,col) );
 
-                    for (colsub=0; colsub<nsub; colsub++) {
+                rdata = *( (double*)PyArray_GETPTR3(kr_obj,ivar,row,col) );
+                idata = *( (double*)PyArray_GETPTR3(ki_obj,ivar,row,col) );
 
-                        model_val += PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+                data = rdata + I*idata;
+                wdata = weight*data;
 
-                        u += ustepsize;
-                        v += vstepsize;
-                    } // colsub
+                for (i=0; i<6; i++) {
+                    double complex tval = wdata*F[i];
+                    if (mult == 1.0) {
+                        tpars_real[i] += creal(tval);
+                        tpars_imag[i] += cimag(tval);
+                    } else {
+                        // the conjugate partner cancels the imaginary part
+                        tpars_real[i] += mult*creal(tval);
+                    }
 
-                    trow += stepsize;
-                } // rowsub
+                    for (j=0; j<6; j++) {
 
-                model_val *= areafac;
+                        double val=var*G[i + 6*j];
 
-                ierr=sqrt(ivar);
-                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+                        if (isnan(val)) {
+                            val = 0;
+                        }
+                        tpcov[i + 6*j] += val;
 
-                (*fdiff_ptr) = (model_val-data)*ierr;
-                s2n_numer += data*model_val*ivar;
-                s2n_denom += model_val*model_val*ivar;
-            } else {
-                (*fdiff_ptr) = 0.0;
+                    }
+                }
             }
 
-            fdiff_ptr++;
-
         }
     }
 
-    // fill in the retval
-    PYGMIX_PACK_RESULT3(s2n_numer, s2n_denom, npix);
-    return retval;
+    Py_RETURN_NONE;
 }
 
 
-
-
-/*
-   k-space
-
-   Fill the input fdiff=(model-data)/err, return s2n_numer, s2n_denom
-
-   Error checking should be done in python.
-*/
-static PyObject * PyGMix_fill_fdiffk(PyObject* self, PyObject* args) {
+static PyObject * PyGMix_get_ksigma_weighted_moments_ps(PyObject* self, PyObject* args) {
 
     PyObject
-        *gmix_obj=NULL,
-        *kr_obj=NULL,
-        *ki_obj=NULL,
-        *weight_obj=NULL,
+        *amp_obj=NULL,
+        *var_obj=NULL,
         *jacob_obj=NULL,
-        *fdiff_obj=NULL; // size 2*image size
 
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
-    int start=0;
+        *pars_obj=NULL,
+        *pcov_obj=NULL;
 
-    long npix=0;
+    double
+        sigmasq=0,
+        kmax=0, kmaxsq=0,
+        N=4.0,
+        data=0, weight=0, wdata=0,
+        F[6]={0};
 
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
+    struct PyGMix_Jacobian *jacob=NULL;
     double
-        rdata=0, idata=0,
-        rowshift=0, colshift=0,
-        arg,
-        *fdiff_ptr=NULL,
-        ivar=0, u=0, v=0,
-        s2n_sum=0.0;
-
-    double complex
-        shift=0, data=0, model_val=0, fdiff=0;
+        *pars=NULL,
+        *pcov=NULL,
+        u=0, v=0,
+        w2=0,
+        var=0,
+        ksq=0;
 
+    int i=0, j=0;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOddi", 
-                          &gmix_obj,
-                          &kr_obj,
-                          &ki_obj,
-                          &weight_obj,
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOd", 
+                          &amp_obj,
+                          &var_obj,
                           &jacob_obj,
-                          &fdiff_obj,
-                          &rowshift,
-                          &colshift,
-                          &start)) {
+                          &pars_obj,
+                          &pcov_obj,
+                          &kmax)) {
         return NULL;
     }
 
-    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
-    n_gauss=PyArray_SIZE(gmix_obj);
+    //sigmasq = sigma*sigma;
+    // weight goes to zero beyond here
+    //kmaxsq = 2.0*N/sigmasq;
 
-    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
-        return NULL;
-    }
+    kmaxsq = kmax*kmax;
 
-    n_row=PyArray_DIM(kr_obj, 0);
-    n_col=PyArray_DIM(kr_obj, 1);
+    sigmasq = 2.0*N/kmaxsq;
+
+    n_row=PyArray_DIM(amp_obj, 0);
+    n_col=PyArray_DIM(amp_obj, 1);
 
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    // we might start somewhere after the priors
-    // note fdiff is 1-d
-    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
+    pars=PyArray_DATA(pars_obj); // [6]
+    pcov=PyArray_DATA(pcov_obj); // [6,6]
 
     for (row=0; row < n_row; row++) {
-
         for (col=0; col < n_col; col++) {
 
 
-            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
-            if ( ivar > 0.0) {
+            // sky coordinates relative to the jacobian center
+            v=PYGMIX_JACOB_GETV(jacob, row, col);
+            u=PYGMIX_JACOB_GETU(jacob, row, col);
 
-                rdata=*( (double*)PyArray_GETPTR2(kr_obj,row,col) );
-                idata=*( (double*)PyArray_GETPTR2(ki_obj,row,col) );
 
-                data = rdata + I*idata;
+            ksq = u*u + v*v;
 
-                u=PYGMIX_JACOB_GETU(jacob, row, col);
-                v=PYGMIX_JACOB_GETV(jacob, row, col);
-                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+            if (ksq > kmaxsq) {
+                continue;
+            }
 
-                // we want a scalar, but data is inherently complex, so just
-                // do the model based one
+            // this is the power spectrum of the noise
+            var = *( (double*)PyArray_GETPTR2(var_obj,row,col) );
 
-                s2n_sum += creal(model_val)*creal(model_val)*2*ivar;
+            data = *( (double*)PyArray_GETPTR2(amp_obj,row,col) );
 
-                // roll the phase of the model according to the real space shift
-                arg = v*rowshift + u*colshift;
-                shift = cos(arg) - I*sin(arg);
-                // this would gain us 20%
-                //shift = (1.0 - 0.5*arg*arg) - I*(arg  - (1.0/6.0)*arg*arg*arg);
+            weight = 1.0 - ksq * sigmasq/(2*N);
 
-                model_val = model_val * shift;
+            // note N=4, so unroll this
+            weight = weight*weight*weight*weight;
 
-                // complex fdiff
-                fdiff = (model_val-data)*sqrt(ivar);
+            // for PS we square it
+            weight *= weight;
 
-                // fill the output fdiff with both real and image components.  Just
-                // put them next to one another
-                fdiff_ptr[0] = creal(fdiff);
-                fdiff_ptr[1] = cimag(fdiff);
+            w2 = weight*weight;
 
-                npix += 1;
-            } else {
-                fdiff_ptr[0] = 0.0;
-                fdiff_ptr[1] = 0.0;
-            }
+            wdata = weight*data;
 
-            fdiff_ptr += 2;
+            F[0] = v;
+            F[1] = u;
+            F[2] = u*u - v*v;
+            F[3] = 2*v*u;
+            F[4] = u*u + v*v;
+            F[5] = 1.0;
+
+            for (i=0; i<6; i++) {
+                pars[i] += wdata*F[i];
+
+                for (j=0; j<6; j++) {
+
+                    double val=w2*var*F[i]*F[j];
+
+                    if (isnan(val)) {
+                        val = 0;
+                    }
+                    pcov[i + 6*j] += val;
+
+                }
+            }
 
         }
     }
 
-    return Py_BuildValue("di", s2n_sum, npix);
+
+    Py_RETURN_NONE;
 }
 
-static PyObject * PyGMix_get_loglikek(PyObject* self, PyObject* args) {
 
-    PyObject
-        *gmix_obj=NULL,
-        *kr_obj=NULL,
-        *ki_obj=NULL,
-        *weight_obj=NULL,
-        *jacob_obj=NULL;
 
-    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-    long npix=0;
+/*
+   Calculate the loglike between the gmix and the input image
+
+   Error checking should be done in python.
+*/
+static PyObject * PyGMix_get_loglike(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
     struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
     struct PyGMix_Jacobian *jacob=NULL;
 
-    double
-        loglike=0,
-        rdata=0, idata=0,
-        rowshift=0, colshift=0,
-        arg,
-        ivar=0, u=0, v=0,
-        s2n_sum=0.0,
-        absdiffsq=0;
+    double data=0, ivar=0, u=0, v=0;
+    double model_val=0, diff=0;
+    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
 
-    double complex
-        shift=0, data=0, model_val=0, diff=0;
+    long npix = 0;
 
+    PyObject* retval=NULL;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOdd", 
-                          &gmix_obj,
-                          &kr_obj,
-                          &ki_obj,
-                          &weight_obj,
-                          &jacob_obj,
-                          &rowshift,
-                          &colshift)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOOO", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj)) {
         return NULL;
     }
 
@@ -3626,334 +4355,267 @@ static PyObject * PyGMix_get_loglikek(PyObject* self, PyObject* args) {
         return NULL;
     }
 
-    n_row=PyArray_DIM(kr_obj, 0);
-    n_col=PyArray_DIM(kr_obj, 1);
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
     jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
     for (row=0; row < n_row; row++) {
+        //u=jacob->dudrow*(row - jacob->row0) + jacob->dudcol*(0 - jacob->col0);
+        //v=jacob->dvdrow*(row - jacob->row0) + jacob->dvdcol*(0 - jacob->col0);
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
         for (col=0; col < n_col; col++) {
 
-
             ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
             if ( ivar > 0.0) {
-
-                rdata=*( (double*)PyArray_GETPTR2(kr_obj,row,col) );
-                idata=*( (double*)PyArray_GETPTR2(ki_obj,row,col) );
-
-                data = rdata + I*idata;
-
-                u=PYGMIX_JACOB_GETU(jacob, row, col);
-                v=PYGMIX_JACOB_GETV(jacob, row, col);
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
                 model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-                // we want a scalar, but data is inherently complex, so just
-                // do the model based one
-
-                s2n_sum += creal(model_val)*creal(model_val)*2*ivar;
-
-                // roll the phase of the model according to the real space shift
-                arg = v*rowshift + u*colshift;
-                shift = cos(arg) - I*sin(arg);
-
-                model_val = model_val * shift;
-
-                // complex diff
                 diff = model_val-data;
-
-                // for the loglike, we want the square of the absolute diff
-                absdiffsq = cabs(diff);
-                absdiffsq *= absdiffsq;
-                loglike += absdiffsq*2*ivar;
+                loglike += diff*diff*ivar;
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
 
                 npix += 1;
             }
 
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
+
         }
     }
 
     loglike *= (-0.5);
 
-    return Py_BuildValue("ddi", loglike, s2n_sum, npix);
+    // fill in the retval
+    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
+    return retval;
 }
 
-
-
-
 /*
- *
-   Expectation maximization image fitting
- *
- */
-
-
-static void em_clear_sums(struct PyGMix_EM_Sums *sums, npy_intp n_gauss)
-{
-    memset(sums, 0, n_gauss*sizeof(struct PyGMix_EM_Sums));
-}
+   Fill the pixels with nonzero weight.  pixels must have room for all
+   such pixels; the number filled is returned
+*/
+static PyObject * PyGMix_fill_pixels(PyObject* self, PyObject* args) {
 
-/*
-static void em_sums_print(const struct PyGMix_EM_Sums *sums, npy_intp n_gauss)
-{
-    npy_intp i=0;
-    for (i=0; i<n_gauss; i++) {
-        const struct PyGMix_EM_Sums *sum=&sums[i];
+    PyObject* pixels_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    npy_intp n_row=0, n_col=0, row=0, col=0, npix_max=0;
 
-        fprintf(stderr,"%ld: %g %g %g %g %g %g %g %g %g %g %g %g\n",
-                i+1,
-                sum->gi,
-                sum->trowsum,
-                sum->tcolsum,
-                sum->tu2sum,
-                sum->tuvsum,
-                sum->tv2sum,
+    struct PyGMix_Pixel *pixels=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-                sum->pnew,
-                sum->rowsum,
-                sum->colsum,
-                sum->u2sum,
-                sum->uvsum,
-                sum->v2sum);
+    double ivar=0, u=0, v=0;
+    long npix = 0;
 
+    if (!PyArg_ParseTuple(args, (char*)"OOOO", 
+                          &pixels_obj, &image_obj, &weight_obj, &jacob_obj)) {
+        return NULL;
     }
-}
-*/
 
-/*
+    pixels=(struct PyGMix_Pixel* ) PyArray_DATA(pixels_obj);
+    npix_max=PyArray_SIZE(pixels_obj);
 
-   note for em we immediately set the normalization, unlike shear measurements
-   where we allow T <= 0.0
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-*/
-static 
-int em_set_gmix_from_sums(struct PyGMix_Gauss2D *gmix,
-                           npy_intp n_gauss,
-                           const struct PyGMix_EM_Sums *sums)
-{
-    int status=0;
-    npy_intp i=0;
-    for (i=0; i<n_gauss; i++) {
-        const struct PyGMix_EM_Sums *sum=&sums[i];
-        struct PyGMix_Gauss2D *gauss=&gmix[i];
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-        double p=sum->pnew;
-        double pinv=1.0/p;
+    for (row=0; row < n_row; row++) {
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-        status=gauss2d_set(gauss,
-                           p,
-                           sum->rowsum*pinv,
-                           sum->colsum*pinv,
-                           sum->v2sum*pinv,
-                           sum->uvsum*pinv,
-                           sum->u2sum*pinv);
+        for (col=0; col < n_col; col++) {
 
-        status=gauss2d_set_norm_throw(gauss);
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                if (npix >= npix_max) {
+                    PyErr_Format(GMixFatalError, 
+                                 "pixels array too small: %ld", npix_max);
+                    return NULL;
+                }
 
-        // an exception will be set
-        if (!status) {
-            goto _em_set_gmix_from_sums_bail;
+                pixels[npix].u = u;
+                pixels[npix].v = v;
+                pixels[npix].val = *( (double*)PyArray_GETPTR2(image_obj,row,col) );
+                pixels[npix].ivar = ivar;
+                npix += 1;
+            }
+
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
         }
     }
-    status=1;
 
-_em_set_gmix_from_sums_bail:
-    return status;
+    return Py_BuildValue("l", npix);
 }
 
-
 /*
-   input gmix is guess and will eventually hold the final
-   stage of the iteration
+   add the log likelihood for each of n_batch mixtures to loglike.  Rows
+   with nonzero flags are skipped.
+
+   The pixels are processed in tiles small enough to stay in cache while
+   they are used for a block of mixtures.  Blocks are distributed over the
+   threads; no exceptions are set, so this is called without the GIL
 */
-static int em_run(PyObject* image_obj,
-                  double sky,
-                  double counts,
-                  const struct PyGMix_Jacobian* jacob,
-                  struct PyGMix_Gauss2D *gmix, // holds the guess
-                  npy_intp n_gauss,
-                  struct PyGMix_EM_Sums *sums,
-                  double tol,
-                  long maxiter,
-                  long *numiter,
-                  double *frac_diff)
+static void get_loglike_batch(const struct PyGMix_Gauss2D *gmix,
+                              npy_intp n_batch,
+                              npy_intp n_gauss,
+                              const npy_int32 *flags,
+                              const struct PyGMix_Pixel *pixels,
+                              npy_intp npix,
+                              double *loglike,
+                              int nthreads)
 {
-    int status=0;
-    double skysum=0;
-    npy_intp row=0, col=0, i=0;
+    npy_intp n_block=0, iblock=0, block_size=0;
 
-    npy_intp n_row=PyArray_DIM(image_obj, 0);
-    npy_intp n_col=PyArray_DIM(image_obj, 1);
-    npy_intp n_points=PyArray_SIZE(image_obj);
+    block_size = PYGMIX_BATCH_GMIX_BYTES/(n_gauss*sizeof(struct PyGMix_Gauss2D));
+    if (block_size < 1) {
+        block_size=1;
+    } else if (block_size > PYGMIX_BATCH_NSAMPLE_BLOCK) {
+        block_size=PYGMIX_BATCH_NSAMPLE_BLOCK;
+    }
 
-    double scale=jacob->sdet;
-    double area = n_points*scale*scale;
+    n_block = (n_batch + block_size - 1)/block_size;
 
-    double nsky = sky/counts;
-    double psky = sky/(counts/area);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+#endif
+    for (iblock=0; iblock<n_block; iblock++) {
+        npy_intp start=0, end=0, i=0, tile=0, tile_end=0, ipix=0;
+        double chi2sum[PYGMIX_BATCH_NSAMPLE_BLOCK]={0};
+
+        start = iblock*block_size;
+        end = start + block_size;
+        if (end > n_batch) {
+            end=n_batch;
+        }
 
-    double T=0, T_last=-9999.0, igrat=0;
-    double 
-        e1=0, e2=0, e1_last=-9999, e2_last=-9999,
-        e1diff=0, e2diff=0;
+        for (tile=0; tile<npix; tile += PYGMIX_BATCH_NPIX_TILE) {
+            tile_end = tile + PYGMIX_BATCH_NPIX_TILE;
+            if (tile_end > npix) {
+                tile_end=npix;
+            }
 
-    (*numiter)=0;
-    while ( (*numiter) < maxiter) {
-        skysum=0.0;
-        em_clear_sums(sums, n_gauss);
+            for (i=start; i<end; i++) {
+                // the eval macro takes a non-const pointer
+                struct PyGMix_Gauss2D *gm=(struct PyGMix_Gauss2D *) &gmix[i*n_gauss];
+                double chi2=0;
 
-        for (row=0; row<n_row; row++) {
+                if (flags[i] != 0) {
+                    continue;
+                }
 
-            double u=PYGMIX_JACOB_GETU(jacob, row, 0);
-            double v=PYGMIX_JACOB_GETV(jacob, row, 0);
+                for (ipix=tile; ipix<tile_end; ipix++) {
+                    const struct PyGMix_Pixel *pixel=&pixels[ipix];
+                    double model_val=PYGMIX_GMIX_EVAL(gm, n_gauss, pixel->v, pixel->u);
+                    double diff = model_val-pixel->val;
+                    chi2 += diff*diff*pixel->ivar;
+                }
+                chi2sum[i-start] += chi2;
+            }
+        }
 
-            for (col=0; col<n_col; col++) {
+        for (i=start; i<end; i++) {
+            if (flags[i] == 0) {
+                loglike[i] += -0.5*chi2sum[i-start];
+            }
+        }
+    }
+}
 
-                double gtot=0.0;
-                double imnorm=*(double*)PyArray_GETPTR2(image_obj,row,col);
+/*
+   gmix is [N, n_gauss] with norms set, e.g. from gmix_fill_convolve_batch,
+   flags and loglike are [N].  The loglike for each row is added to
+   loglike
+*/
+static PyObject * PyGMix_get_loglike_batch(PyObject* self, PyObject* args) {
 
-                imnorm /= counts;
+    PyObject* gmix_obj=NULL;
+    PyObject* flags_obj=NULL;
+    PyObject* pixels_obj=NULL;
+    PyObject* loglike_obj=NULL;
+    int nthreads=0;
 
-                for (i=0; i<n_gauss; i++) {
-                    struct PyGMix_EM_Sums *sum=&sums[i];
-                    const struct PyGMix_Gauss2D *gauss=&gmix[i];
+    const struct PyGMix_Gauss2D *gmix=NULL;
+    const npy_int32 *flags=NULL;
+    const struct PyGMix_Pixel *pixels=NULL;
+    double *loglike=NULL;
+    npy_intp n_batch=0, n_gauss=0, npix=0;
 
-                    // Mike suggests the correct convention is u->x->row and v->y->col
-                    //double udiff = u-gauss->row;
-                    //double vdiff = v-gauss->col;
-                    double vdiff = v-gauss->row;
-                    double udiff = u-gauss->col;
+    if (!PyArg_ParseTuple(args, (char*)"OOOOi", 
+                          &gmix_obj, &flags_obj, &pixels_obj, &loglike_obj,
+                          &nthreads)) {
+        return NULL;
+    }
 
-                    double u2 = udiff*udiff;
-                    double v2 = vdiff*vdiff;
-                    double uv = udiff*vdiff;
+    n_batch=PyArray_DIM(gmix_obj, 0);
+    n_gauss=PyArray_DIM(gmix_obj, 1);
 
-                    //double chi2=
-                    //    gauss->dcc*u2 + gauss->drr*v2 - 2.0*gauss->drc*uv;
-                    double chi2=
-                        gauss->dcc*v2 + gauss->drr*u2 - 2.0*gauss->drc*uv;
+    if (PyArray_SIZE(flags_obj) != n_batch
+            || PyArray_SIZE(loglike_obj) != n_batch) {
+        PyErr_Format(GMixFatalError, 
+                     "flags and loglike must have %ld elements", n_batch);
+        return NULL;
+    }
 
-                    if (chi2 < PYGMIX_MAX_CHI2 && chi2 >= 0.0) {
-                        sum->gi = gauss->pnorm*expd( -0.5*chi2 );
-                    } else {
-                        sum->gi = 0.0;
-                    }
-                    gtot += sum->gi;
-                    sum->trowsum = v*sum->gi;
-                    sum->tcolsum = u*sum->gi;
-                    sum->tv2sum  = v2*sum->gi;
-                    sum->tuvsum  = uv*sum->gi;
-                    sum->tu2sum  = u2*sum->gi;
+    gmix=(const struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    flags=(const npy_int32 *) PyArray_DATA(flags_obj);
+    pixels=(const struct PyGMix_Pixel* ) PyArray_DATA(pixels_obj);
+    npix=PyArray_SIZE(pixels_obj);
+    loglike=(double *) PyArray_DATA(loglike_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
 
-                } // gaussians
+    Py_BEGIN_ALLOW_THREADS
+    get_loglike_batch(gmix, n_batch, n_gauss, flags,
+                      pixels, npix, loglike, nthreads);
+    Py_END_ALLOW_THREADS
 
-                gtot += nsky;
+    Py_RETURN_NONE;
+}
 
-                if (gtot == 0) {
-                    PyErr_Format(GMixRangeError, "em gtot = 0");
-                    goto _em_run_bail;
-                }
+static PyObject * PyGMix_get_loglike_gauleg(PyObject* self, PyObject* args) {
 
-                igrat = imnorm/gtot;
-                for (i=0; i<n_gauss; i++) {
-                    struct PyGMix_EM_Sums *sum=&sums[i];
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    int npoints=0;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-                    // wtau is gi[pix]/gtot[pix]*imnorm[pix]
-                    // which is Dave's tau*imnorm = wtau
-                    double wtau = sum->gi*igrat;
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-                    sum->pnew += wtau;
+    double data=0, ivar=0, u=0, v=0;
+    double model_val=0, diff=0;
+    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
 
-                    // row*gi/gtot*imnorm;
-                    sum->rowsum += sum->trowsum*igrat;
-                    sum->colsum += sum->tcolsum*igrat;
-                    sum->u2sum  += sum->tu2sum*igrat;
-                    sum->uvsum  += sum->tuvsum*igrat;
-                    sum->v2sum  += sum->tv2sum*igrat;
+    // gauleg parameters
+    npy_intp rowsub=0, colsub=0;
+    double
+           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
+           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
+           wsum=0;
+    const double *xxi=NULL, *wwi=NULL;
 
-                }
-
-                skysum += nsky*imnorm/gtot;
-                u += jacob->dudcol;
-                v += jacob->dvdcol;
-            } //cols
-        } // rows
-
-
-        status=em_set_gmix_from_sums(gmix, n_gauss, sums);
-        if (!status) {
-            goto _em_run_bail;
-            break;
-        }
-
-        psky = skysum;
-        nsky = psky/area;
-
-        status=gmix_get_e1e2T(gmix, n_gauss, &e1, &e2, &T);
-        if (!status) {
-            PyErr_Format(GMixRangeError, "em psum = 0");
-            goto _em_run_bail;
-            break;
-        }
-
-        (*frac_diff) = fabs((T-T_last)/T);
-        e1diff=fabs(e1-e1_last);
-        e2diff=fabs(e2-e2_last);
-
-        /*
-        if ( (*frac_diff) < tol) {
-            break;
-        }
-        */
-        if ( 
-                  (*frac_diff < tol)
-               && (e1diff < tol)
-               && (e2diff < tol)
-           )
-        {
-            break;
-        }
-
-        T_last = T;
-        e1_last = e1;
-        e2_last = e2;
-
-        (*numiter) += 1;
-
-    } // iteration
-
-    status=1;
-_em_run_bail:
-    return status;
-}
-
-static PyObject * PyGMix_em_run(PyObject* self, PyObject* args) {
-
-    PyObject* gmix_obj=NULL;
-    PyObject* image_obj=NULL;
-    //PyObject* weight_obj=NULL;
-    PyObject* jacob_obj=NULL;
-    PyObject* sums_obj=NULL;
-    double sky=0, counts=0, tol=0;
-    long maxiter=0;
-    npy_intp n_gauss=0;
-
-    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
-    struct PyGMix_Jacobian *jacob=NULL;
-    struct PyGMix_EM_Sums* sums=NULL;
-    long numiter=0;
-    double frac_diff=0;
-    int status=0;
+    long npix = 0;
 
+    PyObject* retval=NULL;
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOOOdddl", 
+    if (!PyArg_ParseTuple(args, (char*)"OOOOi", 
                           &gmix_obj,
                           &image_obj,
-                          //&weight_obj,
+                          &weight_obj,
                           &jacob_obj,
-                          &sums_obj,
-                          &sky, &counts, &tol, &maxiter)) {
+                          &npoints)) {
+        return NULL;
+    }
+
+    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
         return NULL;
     }
 
@@ -3964,2015 +4626,6164 @@ static PyObject * PyGMix_em_run(PyObject* self, PyObject* args) {
         return NULL;
     }
 
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
-    sums=(struct PyGMix_EM_Sums* )  PyArray_DATA(sums_obj);
-
-    status=em_run(image_obj,
-                  sky,
-                  counts,
-                  jacob,
-                  gmix,
-                  n_gauss,
-                  sums,
-                  tol,
-                  maxiter,
-                  &numiter,
-                  &frac_diff);
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-    if (!status) {
-        // raise an exception
-        return NULL;
-    } else {
-        PyObject* retval=PyTuple_New(2);
-        PyTuple_SetItem(retval,0,PyLong_FromLong(numiter));
-        PyTuple_SetItem(retval,1,PyFloat_FromDouble(frac_diff));
-        return retval;
-    }
-}
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-/*
-	for now straight conversion of the fortran
-*/
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
 
+                // integrate the model over the pixel
+                model_val=0;
+                wsum=0;
 
+                rowmax = row + 0.5;
+                rowmin = row - 0.5;
+                colmax = col + 0.5;
+                colmin = col - 0.5;
 
-#define ADMOM_EDGE 0x1
-#define ADMOM_SHIFT 0x2
-#define ADMOM_FAINT 0x4
-#define ADMOM_SMALL 0x8
-#define ADMOM_DET 0x10
-#define ADMOM_MAXIT 0x20
+                frow1 = (rowmax-rowmin)*0.5; // always 0.5.
+                frow2 = (rowmax+rowmin)*0.5; // always row
+                fcol1 = (colmax-colmin)*0.5; // always 0.5
+                fcol2 = (colmax+colmin)*0.5; // always col
 
-struct Admom {
-    int maxit;
-    double shiftmax;
-    double etol;
-    double Ttol;
-};
+                for (rowsub=0; rowsub<npoints; rowsub++) {
+                    trow = frow1*xxi[rowsub] + frow2;
+                    wrow = wwi[rowsub];
+                    for (colsub=0; colsub<npoints; colsub++) {
+                        tcol = fcol1*xxi[colsub] + fcol2;
+                        wcol = wwi[colsub];
 
-/*
-struct AdmomMask {
-    ssize_t rowmin;
-    ssize_t rowmax;
-    ssize_t colmin;
-    ssize_t colmax;
-};
-*/
+                        u=PYGMIX_JACOB_GETU(jacob, trow, tcol);
+                        v=PYGMIX_JACOB_GETV(jacob, trow, tcol);
 
-/*
-struct AdmomSums {
-    double fsum;     // weight*data
-    double vsum;     // weight*v*data
-    double usum;     // weight*u*data
-    double vvsum;     // weight*v*v*data
-    double vusum;     // weight*v*u*data
-    double uusum;     // weight*u*u*data
-    double wsqsum;     // weight*weight
-};
-*/
+                        model_val += wrow*wcol*PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+                        wsum += wrow*wcol;
+                    }
+                }
 
-struct AdmomResult {
-    int flags;
+                model_val /= wsum;
 
-    int numiter;
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
-    int nimage;
-    int npix;
+                diff = model_val-data;
+                loglike += diff*diff*ivar;
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
 
-    double wsum;
+                npix += 1;
+            }
+        }
+    }
 
-    double sums[6];
+    loglike *= (-0.5);
 
-    // cov of above
-    double sums_cov[36];
+    // fill in the retval
+    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
+    return retval;
+}
 
-    double pars[6];
 
-};
 
 /*
-static void admom_sums_clear(struct AdmomSums *self)
-{
-    memset(self, 0, sizeof(struct AdmomSums));
-}
-*/
+   Calculate the loglike between the gmix and the input image
 
-static inline void admom_clear_result(struct AdmomResult *self)
-{
-    memset(self, 0, sizeof(struct AdmomResult));
-}
+   only evaluate the loglike within the specified circular aperture, centered
+   on the canonical center of the jacobian.  This only makes sense if the
+   jacobian center is near the true center
 
+   Error checking should be done in python.
+*/
+static PyObject * PyGMix_get_loglike_aper(PyObject* self, PyObject* args) {
 
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    double aperture=0, ap2=0, rad2=0;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-/* 
-   calculate the mask covering a certain number
-   of sigma around the center.
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-   For the edge flagging
-*/
-/*
-static void admom_get_mask(const struct Admom *self,
-                           const struct PyGMix_Gauss2D *gauss,
-                           const struct PyGMix_Jacobian *jacob,
-                           npy_intp n_row, npy_intp n_col,
-                           struct AdmomMask *mask,
-                           )
-{
-    double grad=0;
-    double rlow=0,rhigh=0,clow=0,chigh=0;
-    double vlow=0,vhigh=0,vlow=0,vhigh=0;
-    double iscale=0.0;
+    double data=0, ivar=0, u=0, v=0;
+    double model_val=0, diff=0;
+    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
 
-    // sdet is the scale in arcsec/pixel
-    iscale = 1.0/jacob->sdet;
+    long npix=0;
 
-    self->info_flags=0;
+    PyObject* retval=NULL;
 
-    // in pixels
-    grad = self->nsigma*sqrt(fmax(gauss->irr,gauss->icc));
+    if (!PyArg_ParseTuple(args, (char*)"OOOOd", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj, &aperture)) {
+        return NULL;
+    }
 
-    vlow  = gauss->row-grad-0.5;
-    vhigh = gauss->row+grad+0.5;
-    ulow  = gauss->col-grad-0.5;
-    uhigh = gauss->col+grad+0.5;
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-    // keep track of when our bounding box hits an edge
-    if ( (rlow < 0) || (rhigh > n_row-1)
-         (clow < 0) || (chigh > n_col-1) ) {
-        self->info_flags |= ADMOM_EDGE;
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
     }
 
-    mask->rowmin = lround(fmax( rlow,0.) );
-    mask->rowmax = lround(fmin( rhigh, ((double)n_row)-1 ) );
-
-    mask->colmin = lround(fmax( clow,0.) );
-    mask->colmax = lround(fmin( chigh, ((double)n_col)-1 ) );
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-}
-*/
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-/*
-   get sums for the center
+    ap2=aperture*aperture;
+    for (row=0; row < n_row; row++) {
+        //u=jacob->dudrow*(row - jacob->row0) + jacob->dudcol*(0 - jacob->col0);
+        //v=jacob->dvdrow*(row - jacob->row0) + jacob->dvdcol*(0 - jacob->col0);
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-   also set the flux sum while we are at it
-*/
+        for (col=0; col < n_col; col++) {
 
-static void admom_censums(
-          const struct Admom *self,
-          const PyObject* image,
-          const struct PyGMix_Jacobian *jacob,
-          const struct PyGMix_Gauss2D *wt,
-          struct AdmomResult *res)
+            // distance from jacobian center
+            rad2=u*u + v*v;
+            if (rad2 <= ap2) {
 
-{
+                ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+                if ( ivar > 0.0) {
+                    data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
-    npy_intp n_row=0, n_col=0, irow=0, icol=0;
-    double 
-        u=0, v=0,
-        weight=0, data=0, wdata=0;
+                    model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-    n_row=PyArray_DIM(image, 0);
-    n_col=PyArray_DIM(image, 1);
+                    diff = model_val-data;
+                    loglike += diff*diff*ivar;
+                    s2n_numer += data*model_val*ivar;
+                    s2n_denom += model_val*model_val*ivar;
 
-    // get the weighted center
-    for (irow=0; irow<n_row; irow++) {
-        for (icol=0; icol<n_col; icol++) {
-            // v->row and u->col in calculations
-            v=PYGMIX_JACOB_GETV(jacob, irow, icol);
-            u=PYGMIX_JACOB_GETU(jacob, irow, icol);
-
-            data=*( (double*)PyArray_GETPTR2(image,irow,icol) );
-            weight=PYGMIX_GAUSS_EVAL(wt, v, u);
+                    npix += 1;
+                }
 
-            wdata=weight*data;
+            }
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
 
-            res->npix += 1;
-            res->sums[0] += wdata*v;
-            res->sums[1] += wdata*u;
-            res->sums[5] += wdata;
+        }
+    }
 
-        } // cols
-    } // rows
+    loglike *= (-0.5);
 
+    // fill in the retval
+    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
+    return retval;
 }
 
-static void admom_momsums(
-          const struct Admom *self,
-          const PyObject* image,
-          const PyObject* ivarim,
-          const struct PyGMix_Jacobian *jacob,
-          const struct PyGMix_Gauss2D *wt,
-          struct AdmomResult* res)
-
-{
 
-    npy_intp n_row=0, n_col=0, irow=0, icol=0;
-    int i=0, j=0;
-    double 
-        u=0, v=0,
-        vcen=0, ucen=0,
-        vmod=0, umod=0,
-        ivar=0,var=0,
-        weight=0, w2=0,data=0, wdata=0;
-    double *sums=NULL, *sums_cov=NULL;
-    double F[6];
 
-    sums=res->sums;
-    sums_cov=res->sums_cov;
+/*
+   Calculate the loglike between the input image and the model image,
+   subtracting off the mean in each case
 
-    n_row=PyArray_DIM(image, 0);
-    n_col=PyArray_DIM(image, 1);
+   Error checking should be done in python.
+*/
+static PyObject * PyGMix_get_loglike_images_margsky(PyObject* self, PyObject* args) {
 
-    // row->v col->u
-    vcen=wt->row;
-    ucen=wt->col;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* model_image_obj=NULL;
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
-    // get the weighted center
-    for (irow=0; irow<n_row; irow++) {
-        for (icol=0; icol<n_col; icol++) {
+    double image_mean=0, model_mean=0;
+    double data=0, ivar=0, data_mod=0, model_mod=0;
+    double model_val=0, diff=0;
+    double s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
 
-            // sky coordinates relative to the jacobian center
-            v=PYGMIX_JACOB_GETV(jacob, irow, icol);
-            u=PYGMIX_JACOB_GETU(jacob, irow, icol);
+    long npix=0;
 
-            data = *( (double*)PyArray_GETPTR2(image,irow,icol) );
-            ivar = *( (double*)PyArray_GETPTR2(ivarim,irow,icol) );
+    PyObject* retval=NULL;
 
-            var=1.0/ivar;
+    if (!PyArg_ParseTuple(args, (char*)"OdOOd", 
+                          &image_obj, &image_mean, &weight_obj, &model_image_obj, &model_mean)) {
+        return NULL;
+    }
 
-            // evaluate the gaussian at the specified location
-            weight=PYGMIX_GAUSS_EVAL(wt, v, u);
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-            // sky coordinates relative to the gaussian mixture center
-            vmod = v-vcen;
-            umod = u-ucen;
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-            wdata = weight*data;
-            w2 = weight*weight;
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                data      = *( (double*)PyArray_GETPTR2(image_obj,row,col) );
+                model_val = *( (double*)PyArray_GETPTR2(model_image_obj,row,col) );
 
-            F[0] = v;
-            F[1] = u;
-            F[2] = umod*umod - vmod*vmod;
-            F[3] = 2*vmod*umod;
-            F[4] = umod*umod + vmod*vmod;
-            F[5] = 1.0;
+                data_mod=data-image_mean;
+                model_mod=model_val-model_mean;
 
-            res->wsum += weight;
-            res->npix += 1;
+                diff = model_mod - data_mod;
+                loglike += diff*diff*ivar;
+                s2n_numer += data_mod*model_mod*ivar;
+                s2n_denom += model_mod*model_mod*ivar;
 
-            for (i=0; i<6; i++) {
-                sums[i] += wdata*F[i];
-                for (j=0; j<6; j++) {
-                    sums_cov[i + 6*j] += w2*var*F[i]*F[j];
-                }
+                npix += 1;
             }
+        }
+    }
 
-        } // cols
-    } // rows
+    loglike *= (-0.5);
 
+    // fill in the retval
+    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
+    return retval;
 }
 
-/*
-   set a new weight function
 
-   Since these are weighted moments, the following would hold
-   for gaussians
+static PyObject * PyGMix_get_loglike_sub(PyObject* self, PyObject* args) {
 
-       Cinv_meas = Cinv_true + Cinv_weight
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0, colsub=0, rowsub=0;
 
-   So for the next iteration, subtract the covariance
-   matrix of the weight
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-*/
+    double data=0, ivar=0, u=0, v=0;
+    double stepsize=0, ustepsize=0, vstepsize=0, offset=0, areafac=0;
+    double model_val=0, diff=0;
+    double trow=0, lowcol=0, s2n_numer=0.0, s2n_denom=0.0, loglike = 0.0;
+    int nsub=0;
 
-static int take_adaptive_step(
-          double Wrr, double Wrc, double Wcc,
-          double Irr, double Irc, double Icc,
-          double *NewIrr, double *NewIrc, double *NewIcc)
-{
-    int flags=0;
+    long npix=0;
 
-    double 
-        Nrr=0, Ncc=0, Nrc=0,
-        detn=0, idetn=0,
-        detm=0, idetm=0,
-        detw=0, idetw=0;
+    PyObject* retval=NULL;
 
-    // measured moments
-    detm = Irr*Icc - Irc*Irc;
-    if (detm <= PYGMIX_LOW_DETVAL) {
-        //printf("detm too small: %g\n", detm);
-        flags=ADMOM_DET;
-        goto adaptive_step_bail;
+    if (!PyArg_ParseTuple(args, (char*)"OOOOi", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj, &nsub)) {
+        return NULL;
     }
 
-    detw = Wrr*Wcc - Wrc*Wrc;
-    if (detw <= PYGMIX_LOW_DETVAL) {
-        //printf("detw too small: %g\n", detw);
-        flags=ADMOM_DET;
-        goto adaptive_step_bail;
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
     }
 
-    idetw=1.0/detw;
-    idetm=1.0/detm;
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-    // Nrr etc. are actually of the inverted covariance matrix
-    Nrr =  Icc*idetm - Wcc*idetw;
-    Ncc =  Irr*idetm - Wrr*idetw;
-    Nrc = -Irc*idetm + Wrc*idetw;
-    detn = Nrr*Ncc - Nrc*Nrc;
+    stepsize = 1./nsub;
+    offset = (nsub-1)*stepsize/2.;
+    areafac = 1./(nsub*nsub);
+    ustepsize = stepsize*jacob->dudcol;
+    vstepsize = stepsize*jacob->dvdcol;
 
-    if (detn <= PYGMIX_LOW_DETVAL) {
-        //printf("detn too small: %g\n", detn);
-        flags=ADMOM_DET;
-        goto adaptive_step_bail;
-    }
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-    // now set from the inverted matrix
-    idetn=1./detn;
-    *NewIrr =  Ncc*idetn;
-    *NewIcc =  Nrr*idetn;
-    *NewIrc = -Nrc*idetn;
 
-adaptive_step_bail:
-    return flags;
-}
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
 
+                npix += 1;
 
-static int take_adaptive_step_wt(
-          struct PyGMix_Gauss2D *wt,
-          double Irr, double Irc, double Icc)
-{
+                trow = row-offset;
+                lowcol = col-offset;
 
-    int flags=0;
-    flags=take_adaptive_step(
-        wt->irr, wt->irc, wt->icc,
-        Irr, Irc, Icc,
-        &wt->irr, &wt->irc, &wt->icc
-    );
+                model_val=0.;
+                for (rowsub=0; rowsub<nsub; rowsub++) {
+                    u=PYGMIX_JACOB_GETU(jacob, trow, lowcol);
+                    v=PYGMIX_JACOB_GETV(jacob, trow, lowcol);
 
-    wt->det = wt->irr*wt->icc - wt->irc*wt->irc;
+                    for (colsub=0; colsub<nsub; colsub++) {
 
-    return flags;
-}
+                        model_val += PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
+                        u += ustepsize;
+                        v += vstepsize;
+                    } // colsub
 
+                    trow += stepsize;
+                } // rowsub
 
-static void admom(
+                model_val *= areafac;
 
-          const struct Admom *self,
-          const PyObject* image,
-          const PyObject* ivarim,
-          const struct PyGMix_Jacobian *jacob,
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
-          // weight should initially hold the guess
-          const struct PyGMix_Gauss2D *wtin,
+                diff = model_val-data;
+                loglike += diff*diff*ivar;
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
+            }
 
-          struct AdmomResult *res
-	)
+        }
+    }
 
-{
+    loglike *= (-0.5);
 
-    struct PyGMix_Gauss2D wt={0};
-    double 
-        roworig=0, colorig=0,
-        e1old=-9999, e2old=-9999, Told=-9999.0,
-        Irr=0, Irc=0, Icc, M1=0, M2=0, T=0, e1=0, e2=0;
+    // fill in the retval
+    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
+    return retval;
+}
 
-    int i=0;
 
-    wt = *wtin;
+/*
+   Calculate the loglike between the gmix and the input image
 
-    res->flags=0;
+   Error checking should be done in python.
+   
+   logfactor = log(gamma((nu+1)/2)/(gamma(nu/2)*sqrt(pi*nu)))
+*/
+static PyObject * PyGMix_get_loglike_robust(PyObject* self, PyObject* args) {
 
-    roworig=wt.row;
-    colorig=wt.col;
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    double nu;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
 
-    for (i=0; i<self->maxit; i++) {
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-        // not throwing an exception
-        if (!gauss2d_set_norm(&wt,0) ) {
-            res->flags |= ADMOM_DET;
-            goto admom_bail;
-        }
-
-        // First the center
-        admom_clear_result(res);
-        admom_censums(self, image, jacob, &wt, res);
-        if (res->sums[5] <= 0.0) {
-            res->flags |= ADMOM_FAINT;
-            goto admom_bail;
-        }
-
-        wt.row = res->sums[0]/res->sums[5];
-        wt.col = res->sums[1]/res->sums[5];
+    double data=0, ivar=0, u=0, v=0;
+    double model_val=0, diff=0;
+    double s2n_numer=0.0, s2n_denom=0.0, loglike=0.0, nupow=0, logfactor=0;
 
-        // bail if the center shifted too far
-        if ( ( fabs(wt.row-roworig) > self->shiftmax)
-             ||
-             ( fabs(wt.col-colorig) > self->shiftmax)
-             ) {
-            res->flags |= ADMOM_SHIFT;
-            goto admom_bail;
-        }
+    long npix=0;
 
-        // now the rest of the moment sums
-        admom_clear_result(res);
-        admom_momsums(self, image, ivarim, jacob, &wt, res);
+    PyObject* retval=NULL;
 
-        if (res->sums[5] <= 0.0) {
-            res->flags |= ADMOM_FAINT;
-            goto admom_bail;
-        }
+    if (!PyArg_ParseTuple(args, (char*)"OOOOd", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj, 
+                          &nu)) {
+        return NULL;
+    }
 
-        // look for convergence
-        M1 = res->sums[2]/res->sums[5];
-        M2 = res->sums[3]/res->sums[5];
-        T  = res->sums[4]/res->sums[5];
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-        Irr = 0.5*(T - M1);
-        Icc = 0.5*(T + M1);
-        Irc = 0.5*M2;
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
 
-        if (T <= 0.0) {
-            res->flags |= ADMOM_SMALL;
-            goto admom_bail;
-        }
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-        e1 = (Icc - Irr)/T;
-        e2 = 2*Irc/T;
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    
+    logfactor = lgamma((nu+1.0)/2.0) - lgamma(nu/2.0) - 0.5*log(M_PI*nu);
+    nupow = -0.5*(nu+1.0);
+    
+    for (row=0; row < n_row; row++) {
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-        if ( 
-                ( fabs(e1-e1old) < self->etol)
-                &&
-                ( fabs(e2-e2old) < self->etol)
-                &&
-                ( fabs(T/Told-1.) < self->Ttol)
-           )  {
+        for (col=0; col < n_col; col++) {
 
-            res->pars[0] = wt.row;
-            res->pars[1] = wt.col;
-            res->pars[2] = wt.icc - wt.irr;
-            res->pars[3] = 2.0*wt.irc;
-            res->pars[4] = wt.icc + wt.irr;
-            //res->pars[5] = res->sums[5]/res->wsum;
-            res->pars[5] = 1.0;
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
-            break;
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-        } else {
-            // take the adaptive step
+                diff = model_val-data;
+                loglike += logfactor + nupow*log(1.0+diff*diff*ivar/nu);
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
 
-            res->flags |= take_adaptive_step_wt(&wt, Irr, Irc, Icc);
-            if (res->flags != 0) {
-                goto admom_bail;
+                npix += 1;
             }
 
-            e1old=e1;
-            e2old=e2;
-            Told=T;
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
 
         }
-
     }
 
-admom_bail:
-
-    res->nimage=1;
-    res->numiter = i;
-
-    if (res->numiter==self->maxit) {
-        res->flags |= ADMOM_MAXIT;
-    }
+    // fill in the retval
+    PYGMIX_PACK_RESULT4(loglike, s2n_numer, s2n_denom, npix);
 
-    return;
+    return retval;
 }
 
-
 /*
- these only do the covariance matrix, still need
- to call gauss2d_set_norm to finalize
- */
-static inline void admom_convolve(
-          struct PyGMix_Gauss2D *self,
-          const struct PyGMix_Gauss2D *psf)
-{
-    self->irr += psf->irr;
-    self->irc += psf->irc;
-    self->icc += psf->icc;
+   Fill the input fdiff=(model-data)/err, return s2n_numer, s2n_denom
 
-    self->det = self->irr*self->icc - self->irc*self->irc;
-}
+   Error checking should be done in python.
+*/
+static PyObject * PyGMix_fill_fdiff(PyObject* self, PyObject* args) {
 
-static inline void admom_deconvolve(
-          struct PyGMix_Gauss2D *self,
-          const struct PyGMix_Gauss2D *psf)
-{
-    self->irr -= psf->irr;
-    self->irc -= psf->irc;
-    self->icc -= psf->icc;
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* fdiff_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    int start=0;
 
-    self->det = self->irr*self->icc - self->irc*self->irc;
-}
+    long npix=0;
 
-// only check the determinant is exactly zero
-// these are all sums, not divided by flux
-static int take_adaptive_step_nocheck(
-          double Wrr, double Wrc, double Wcc,
-          double Irr, double Irc, double Icc,
-          double *NewIrr, double *NewIrc, double *NewIcc)
-{
-    int flags=0;
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-    double 
-        Nrr=0, Ncc=0, Nrc=0,
-        detn=0, idetn=0,
-        detm=0, idetm=0,
-        detw=0, idetw=0;
+    double data=0, ivar=0, ierr=0, u=0, v=0, *fdiff_ptr=NULL;
+    double model_val=0;
+    double s2n_numer=0.0, s2n_denom=0.0;
 
-    // measured moments
-    detm = Irr*Icc - Irc*Irc;
-    if (detm == 0.0) {
-        printf("detm zero\n");
-        flags=ADMOM_DET;
-        goto adaptive_step_bail;
-    }
+    PyObject* retval=NULL;
 
-    detw = Wrr*Wcc - Wrc*Wrc;
-    if (detw == 0.0) {
-        printf("detw zero\n");
-        flags=ADMOM_DET;
-        goto adaptive_step_bail;
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOi", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj,
+                          &fdiff_obj, &start)) {
+        return NULL;
     }
 
-    idetw=1.0/detw;
-    idetm=1.0/detm;
-
-    // Nrr etc. are actually of the inverted covariance matrix
-    Nrr =  Icc*idetm - Wcc*idetw;
-    Ncc =  Irr*idetm - Wrr*idetw;
-    Nrc = -Irc*idetm + Wrc*idetw;
-    detn = Nrr*Ncc - Nrc*Nrc;
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-    if (detn == PYGMIX_LOW_DETVAL) {
-        printf("detn zero\n");
-        flags=ADMOM_DET;
-        goto adaptive_step_bail;
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
     }
 
-    // now set from the inverted matrix
-    idetn=1./detn;
-    *NewIrr =  Ncc*idetn;
-    *NewIcc =  Nrr*idetn;
-    *NewIrc = -Nrc*idetn;
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-adaptive_step_bail:
-    return flags;
-}
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
+    // we might start somewhere after the priors
+    // note fdiff is 1-d
+    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
 
-static inline int
-admom_get_deconvolved_moments(
-          const struct PyGMix_Gauss2D *wt,  // should already be psf convolved
-          const struct PyGMix_Gauss2D *psf,
-          double Irr, double Irc, double Icc, // measured values
-          double *Irr0, double *Irc0, double *Icc0)
-{
-    int flags=0;
+    for (row=0; row < n_row; row++) {
+        u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        v=PYGMIX_JACOB_GETV(jacob, row, 0);
 
-    flags=take_adaptive_step(
-        wt->irr, wt->irc, wt->icc,
-        Irr, Irc, Icc,
-        Irr0, Irc0, Icc0
-    );
+        for (col=0; col < n_col; col++) {
 
-    (*Irr0) -= psf->irr;
-    (*Irc0) -= psf->irc;
-    (*Icc0) -= psf->icc;
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+                ierr=sqrt(ivar);
 
-    return flags;
-}
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-static inline int
-admom_get_deconvolved_moments_nocheck(
-          const struct PyGMix_Gauss2D *wt,  // should already be psf convolved
-          const struct PyGMix_Gauss2D *psf,
-          double M1sum, double M2sum, double Tsum, double Fsum, // measured values
-          double *Irrsum0, double *Ircsum0, double *Iccsum0)
-{
-    int flags=0;
+                (*fdiff_ptr) = (model_val-data)*ierr;
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
 
-    double Irrsum=0, Iccsum=0, Ircsum=0;
+                npix += 1;
+            } else {
+                (*fdiff_ptr) = 0.0;
+            }
 
-    Irrsum = 0.5*(Tsum - M1sum);
-    Iccsum = 0.5*(Tsum + M1sum);
-    Ircsum = 0.5*M2sum;
+            fdiff_ptr++;
 
-    flags=take_adaptive_step_nocheck(
-        wt->irr*Fsum, wt->irc*Fsum, wt->icc*Fsum,
-        Irrsum, Ircsum, Iccsum,
-        Irrsum0, Ircsum0, Iccsum0
-    );
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
 
-    (*Irrsum0) -= psf->irr*Fsum;
-    (*Ircsum0) -= psf->irc*Fsum;
-    (*Iccsum0) -= psf->icc*Fsum;
+        }
+    }
 
-    return flags;
+    // fill in the retval
+    PYGMIX_PACK_RESULT3(s2n_numer, s2n_denom, npix);
+    return retval;
 }
 
-static int admom_set_norm(struct PyGMix_Gauss2D *self)
-{
-    int status=0;
-    double idet=0;
+static PyObject * PyGMix_fill_fdiff_gauleg(PyObject* self, PyObject* args) {
 
-    if (self->det < PYGMIX_LOW_DETVAL) {
-        printf("weight det low: %g\n", self->det);
-        status=0;
-    } else {
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* fdiff_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    int start=0,npoints=0;
 
-        idet=1.0/self->det;
-        self->drr = self->irr*idet;
-        self->drc = self->irc*idet;
-        self->dcc = self->icc*idet;
-        self->norm = 1./(2*M_PI*sqrt(self->det));
+    long npix=0;
 
-        self->pnorm = self->p*self->norm;
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-        self->norm_set=1;
-        status=1;
+    double data=0, ivar=0, ierr=0, u=0, v=0, *fdiff_ptr=NULL;
+    double model_val=0;
+    double s2n_numer=0.0, s2n_denom=0.0;
+
+    // gauleg parameters
+    npy_intp rowsub=0, colsub=0;
+    double
+           trow=0,rowmin=0,rowmax=0,frow1=0,frow2=0,wrow=0,
+           tcol=0,colmin=0,colmax=0,fcol1=0,fcol2=0,wcol=0,
+           wsum=0;
+    const double *xxi=NULL, *wwi=NULL;
+
+
+    PyObject* retval=NULL;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOii", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj,
+                          &fdiff_obj, &start,&npoints)) {
+        return NULL;
     }
 
-    return status;
+    if (!set_gauleg_data(npoints, &xxi, &wwi)) {
+        return NULL;
+    }
 
-}
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-/*
-static void admom_multi_deconv(
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
 
-          const struct Admom *self,
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
-          // eventually will be lists of images, jacobians, and psfs
-          const PyObject** im_list,
-          const PyObject** ivarim_list,
-          const struct PyGMix_Gauss2D** psf_list,
-          const struct PyGMix_Jacobian** jacob_list,
-          int nimage,
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-          // weight should initially hold the guess
-          const struct PyGMix_Gauss2D *wtin,
+    // we might start somewhere after the priors
+    // note fdiff is 1-d
+    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
 
-          struct AdmomResult *res
-	)
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-{
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
 
-    struct PyGMix_Gauss2D wt={0};
-    double 
-        roworig=0, colorig=0,
-        e1old=-9999, e2old=-9999, Told=-9999.0,
-        Irr=0, Irc=0, Icc, M1=0, M2=0, T=0, e1=0, e2=0,
-        Irrsum=0, Ircsum=0, Iccsum=0,
-        Irrsum0=0, Ircsum0=0, Iccsum0=0;
+                // integrate the model over the pixel
+                model_val=0;
+                wsum = 0.0;
 
-    int i=0, j=0;
+                rowmax = row + 0.5;
+                rowmin = row - 0.5;
+                colmax = col + 0.5;
+                colmin = col - 0.5;
 
-    wt = *wtin;
+                frow1 = (rowmax-rowmin)*0.5; // always 0.5.
+                frow2 = (rowmax+rowmin)*0.5; // always row
+                fcol1 = (colmax-colmin)*0.5; // always 0.5
+                fcol2 = (colmax+colmin)*0.5; // always col
 
-    res->flags=0;
+                for (rowsub=0; rowsub<npoints; rowsub++) {
+                    trow = frow1*xxi[rowsub] + frow2;
+                    wrow = wwi[rowsub];
+                    for (colsub=0; colsub<npoints; colsub++) {
+                        tcol = fcol1*xxi[colsub] + fcol2;
+                        wcol = wwi[colsub];
 
-    roworig=wt.row;
-    colorig=wt.col;
+                        u=PYGMIX_JACOB_GETU(jacob, trow, tcol);
+                        v=PYGMIX_JACOB_GETV(jacob, trow, tcol);
 
-    for (i=0; i<self->maxit; i++) {
+                        model_val += wrow*wcol*PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+                        wsum += wrow*wcol;
 
+                    }
+                }
 
-        // First the center, using overall sums to get the center in sky coords
+                model_val /= wsum;
 
-        admom_clear_result(res);
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
+                ierr=sqrt(ivar);
 
-        for (j=0; j<nimage; j++) {
-            admom_convolve(&wt, psf_list[j]);
+                (*fdiff_ptr) = (model_val-data)*ierr;
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
 
-            // we won't need to test these again during this iteration
-            if (!admom_set_norm(&wt) ) {
-                res->flags |= ADMOM_DET;
-                goto admom_bail;
+                npix += 1;
+            } else {
+                (*fdiff_ptr) = 0.0;
             }
 
-            admom_censums(self, im_list[j], jacob_list[j], &wt, res);
-            admom_deconvolve(&wt, psf_list[j]);
-        }
+            fdiff_ptr++;
 
-        if (res->sums[5] <= 0.0) {
-            res->flags |= ADMOM_FAINT;
-            goto admom_bail;
         }
+    }
 
-        wt.row = res->sums[0]/res->sums[5];
-        wt.col = res->sums[1]/res->sums[5];
+    // fill in the retval
+    PYGMIX_PACK_RESULT3(s2n_numer, s2n_denom, npix);
+    return retval;
+}
 
-        // bail if the center shifted too far
-        if ( ( fabs(wt.row-roworig) > self->shiftmax)
-             ||
-             ( fabs(wt.col-colorig) > self->shiftmax)
-             ) {
-            res->flags |= ADMOM_SHIFT;
-            goto admom_bail;
-        }
 
-        // now the rest of the moment sums. This will require
-        // some intermediate values for each image to be
-        // calculated and averaged
+/*
+   Fill the input fdiff=(model-data)/err, return s2n_numer, s2n_denom
+   with sub-pixel integration
 
-        Irrsum=Ircsum=Iccsum=0;
-        Irrsum0=Ircsum0=Iccsum0=0;
-        for (j=0; j<nimage; j++) {
-            admom_clear_result(res);
+   Error checking should be done in python.
+*/
+static PyObject * PyGMix_fill_fdiff_sub(PyObject* self, PyObject* args) {
 
-            admom_convolve(&wt, psf_list[j]);
-            admom_set_norm(&wt);
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* fdiff_obj=NULL;
+    npy_intp n_gauss=0, n_row=0, n_col=0, row=0, col=0;//, igauss=0;
+    int start=0, nsub=0;
 
-            admom_momsums(self,
-                          im_list[j], ivarim_list[j], jacob_list[j],
-                          &wt, res);
+    long npix=0;
 
-            if (res->sums[5] <= 0.0) {
-                res->flags = ADMOM_FAINT;
-                goto admom_bail;
-            }
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-            M1 = res->sums[2]/res->sums[5];
-            M2 = res->sums[3]/res->sums[5];
-            T  = res->sums[4]/res->sums[5];
+    double data=0, ivar=0, ierr=0, u=0, v=0, *fdiff_ptr=NULL;
+    double model_val=0;
+    double s2n_numer=0.0, s2n_denom=0.0;
+    double stepsize=0, ustepsize=0, vstepsize=0, 
+           offset=0, areafac=0, trow=0, lowcol=0;
+    npy_intp rowsub=0, colsub=0;
 
-            Irr = 0.5*(T - M1);
-            Icc = 0.5*(T + M1);
-            Irc = 0.5*M2;
+    PyObject* retval=NULL;
 
-            Irrsum += Irr;
-            Ircsum += Irc;
-            Iccsum += Icc;
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOii", 
+                          &gmix_obj, &image_obj, &weight_obj, &jacob_obj,
+                          &fdiff_obj, &start, &nsub)) {
+        return NULL;
+    }
 
-            // now deconvolved covar, which we will average over
-            // the exposures, for the adaptive step
-            res->flags = admom_get_deconvolved_moments(
-                &wt, psf_list[j],
-                Irr, Irc, Icc,
-                &Irr, &Irc, &Icc
-            );
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
 
-            if (res->flags!=0) {
-                goto admom_bail;
-            }
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
 
-            Irrsum0 += Irr;
-            Ircsum0 += Irc;
-            Iccsum0 += Icc;
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
 
-            admom_deconvolve(&wt, psf_list[j]);
+    stepsize = 1./nsub;
+    offset = (nsub-1)*stepsize/2.;
+    areafac = 1./(nsub*nsub);
+    ustepsize = stepsize*jacob->dudcol;
+    vstepsize = stepsize*jacob->dvdcol;
 
-        }
+    n_row=PyArray_DIM(image_obj, 0);
+    n_col=PyArray_DIM(image_obj, 1);
 
 
-        // look for convergence in mean of the convolved
-        // moments, since T could be zero for the deconvolved
-        // moments
-        Irr = Irrsum/nimage;
-        Irc = Ircsum/nimage;
-        Icc = Iccsum/nimage;
-        T = Irr+Icc;
-
-        if (T <= 0.0) {
-            res->flags = ADMOM_SMALL;
-            goto admom_bail;
-        }
+    // we might start somewhere after the priors
+    // note fdiff is 1-d
+    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
 
-        e1 = (Icc - Irr)/T;
-        e2 = 2*Irc/T;
+    for (row=0; row < n_row; row++) {
+        for (col=0; col < n_col; col++) {
 
-        if ( 
-                ( fabs(e1-e1old) < self->etol)
-                &&
-                ( fabs(e2-e2old) < self->etol)
-                &&
-                ( fabs(T/Told-1.) < self->Ttol)
-           )  {
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
 
-            res->pars[0] = wt.row;
-            res->pars[1] = wt.col;
-            res->pars[2] = wt.icc - wt.irr;
-            res->pars[3] = 2.0*wt.irc;
-            res->pars[4] = wt.icc + wt.irr;
-            //res->pars[5] = res->sums[5]/res->wsum;
-            res->pars[5] = 1.0;
+                npix += 1;
 
-            break;
+                trow = row-offset;
+                lowcol = col-offset;
 
-        } else {
+                model_val=0.;
+                for (rowsub=0; rowsub<nsub; rowsub++) {
+                    u=PYGMIX_JACOB_GETU(jacob, trow, lowcol);
+                    v=PYGMIX_JACOB_GETV(jacob, trow, lowcol);
 
-            // use mean of the deconvolved, adaptive stepped moments
-            // from each image
+                    for (colsub=0; colsub<nsub; colsub++) {
 
-            Irr = Irrsum0/nimage;
-            Irc = Ircsum0/nimage;
-            Icc = Iccsum0/nimage;
-            gauss2d_set(&wt, 1.0, wt.row, wt.col, Irr, Irc, Icc);
+                        model_val += PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-            e1old=e1;
-            e2old=e2;
-            Told=T;
+                        u += ustepsize;
+                        v += vstepsize;
+                    } // colsub
 
-        }
+                    trow += stepsize;
+                } // rowsub
 
-    }
+                model_val *= areafac;
 
-admom_bail:
+                ierr=sqrt(ivar);
+                data=*( (double*)PyArray_GETPTR2(image_obj,row,col) );
 
-    res->nimage=nimage;
+                (*fdiff_ptr) = (model_val-data)*ierr;
+                s2n_numer += data*model_val*ivar;
+                s2n_denom += model_val*model_val*ivar;
+            } else {
+                (*fdiff_ptr) = 0.0;
+            }
 
-    res->numiter = i;
-    if (res->flags != 0) {
-        // we exited with a goto
-        res->numiter+=1;
-    }
+            fdiff_ptr++;
 
-    if (res->numiter==self->maxit) {
-        res->flags = ADMOM_MAXIT;
+        }
     }
 
-    return;
+    // fill in the retval
+    PYGMIX_PACK_RESULT3(s2n_numer, s2n_denom, npix);
+    return retval;
 }
-*/
 
-static void admom_multi(
 
-          const struct Admom *self,
 
-          // eventually will be lists of images, jacobians
-          const PyObject** im_list,
-          const PyObject** ivarim_list,
-          const struct PyGMix_Jacobian** jacob_list,
-          int nimage,
 
-          // weight should initially hold the guess
-          const struct PyGMix_Gauss2D *wtin,
+/*
+   k-space
 
-          struct AdmomResult *res
-	)
+   Fill the input fdiff=(model-data)/err, return s2n_numer, s2n_denom
 
+   Error checking should be done in python.
+*/
+static void fill_fdiffk_core(struct PyGMix_Gauss2D *gmix,
+                             npy_intp n_gauss,
+                             PyObject* kr_obj,
+                             PyObject* ki_obj,
+                             PyObject* weight_obj,
+                             const struct PyGMix_Jacobian *jacob,
+                             double *fdiff_ptr,
+                             double rowshift,
+                             double colshift,
+                             npy_intp ncol_full,
+                             double *s2n_sum,
+                             long *npix)
 {
+    npy_intp n_row=0, n_col=0, row=0, col=0;
 
-    struct PyGMix_Gauss2D wt={0};
-    double 
-        roworig=0, colorig=0,
-        e1old=-9999, e2old=-9999, Told=-9999.0,
-        Irr=0, Irc=0, Icc, M1=0, M2=0, T=0, e1=0, e2=0;
+    double
+        rdata=0, idata=0,
+        ivar=0, u=0, v=0,
+        mult=0;
 
-    int i=0, j=0;
+    double complex
+        shift=0, dshift=0, data=0, model_val=0, fdiff=0;
 
-    wt = *wtin;
+    n_row=PyArray_DIM(kr_obj, 0);
+    n_col=PyArray_DIM(kr_obj, 1);
 
-    res->flags=0;
+    for (row=0; row < n_row; row++) {
 
-    roworig=wt.row;
-    colorig=wt.col;
+        // phase of the model according to the real space shift
+        kshift_row_init(jacob, row, rowshift, colshift, &shift, &dshift);
 
-    for (i=0; i<self->maxit; i++) {
+        for (col=0; col < n_col; col++) {
 
-        if (!gauss2d_set_norm(&wt,0) ) {
-            res->flags |= ADMOM_DET;
-            goto admom_multi_bail;
-        }
 
-        // First the center, using overall sums to get the center in sky coords
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
 
-        admom_clear_result(res);
+                // for half planes, the conjugate partner contributes
+                // the same chi^2
+                mult=khalf_col_mult(col, ncol_full);
 
-        for (j=0; j<nimage; j++) {
-            admom_censums(self, im_list[j], jacob_list[j], &wt, res);
-        }
+                rdata=*( (double*)PyArray_GETPTR2(kr_obj,row,col) );
+                idata=*( (double*)PyArray_GETPTR2(ki_obj,row,col) );
 
-        if (res->sums[5] <= 0.0) {
-            res->flags |= ADMOM_FAINT;
-            goto admom_multi_bail;
-        }
+                data = rdata + I*idata;
 
-        wt.row = res->sums[0]/res->sums[5];
-        wt.col = res->sums[1]/res->sums[5];
+                u=PYGMIX_JACOB_GETU(jacob, row, col);
+                v=PYGMIX_JACOB_GETV(jacob, row, col);
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
 
-        // bail if the center shifted too far
-        if ( ( fabs(wt.row-roworig) > self->shiftmax)
-             ||
-             ( fabs(wt.col-colorig) > self->shiftmax)
-             ) {
-            res->flags |= ADMOM_SHIFT;
-            goto admom_multi_bail;
-        }
+                // we want a scalar, but data is inherently complex, so just
+                // do the model based one
 
-        // now the rest of the moment sums. This will require
-        // some intermediate values for each image to be
-        // calculated and averaged
+                (*s2n_sum) += mult*creal(model_val)*creal(model_val)*2*ivar;
 
-        admom_clear_result(res);
+                model_val = model_val * shift;
 
-        for (j=0; j<nimage; j++) {
-            admom_momsums(self,
-                          im_list[j], ivarim_list[j], jacob_list[j],
-                          &wt, res);
-        }
+                // complex fdiff
+                fdiff = (model_val-data)*sqrt(mult*ivar);
 
-        if (res->sums[5] <= 0.0) {
-            res->flags |= ADMOM_FAINT;
-            goto admom_multi_bail;
-        }
+                // fill the output fdiff with both real and image components.  Just
+                // put them next to one another
+                fdiff_ptr[0] = creal(fdiff);
+                fdiff_ptr[1] = cimag(fdiff);
 
-        // look for convergence
-        T  = res->sums[4]/res->sums[5];
+                (*npix) += (long) mult;
+            } else {
+                fdiff_ptr[0] = 0.0;
+                fdiff_ptr[1] = 0.0;
+            }
 
-        if (T <= 0.0) {
-            res->flags |= ADMOM_SMALL;
-            goto admom_multi_bail;
+            fdiff_ptr += 2;
+
+            shift *= dshift;
         }
+    }
+}
 
-        e1 = res->sums[2]/res->sums[4];
-        e2 = res->sums[3]/res->sums[4];
+static PyObject * PyGMix_fill_fdiffk(PyObject* self, PyObject* args) {
 
-        if ( 
-                ( fabs(e1-e1old) < self->etol)
-                &&
-                ( fabs(e2-e2old) < self->etol)
-                &&
-                ( fabs(T/Told-1.) < self->Ttol)
-           )  {
+    PyObject
+        *gmix_obj=NULL,
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *weight_obj=NULL,
+        *jacob_obj=NULL,
+        *fdiff_obj=NULL; // size 2*image size
 
-            res->pars[0] = wt.row;
-            res->pars[1] = wt.col;
-            res->pars[2] = wt.icc - wt.irr;
-            res->pars[3] = 2.0*wt.irc;
-            res->pars[4] = wt.icc + wt.irr;
-            res->pars[5] = res->sums[5]/res->wsum;
+    npy_intp n_gauss=0;
+    int start=0;
 
-            break;
+    long npix=0;
 
-        } else {
-            // take the adaptive step: deweight the moments
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
 
-            M1 = res->sums[2]/res->sums[5];
-            M2 = res->sums[3]/res->sums[5];
-            Irr = 0.5*(T - M1);
-            Icc = 0.5*(T + M1);
-            Irc = 0.5*M2;
+    double
+        rowshift=0, colshift=0,
+        *fdiff_ptr=NULL,
+        s2n_sum=0.0;
 
-            res->flags |= take_adaptive_step_wt(&wt, Irr, Irc, Icc);
-            if (res->flags != 0) {
-                goto admom_multi_bail;
-            }
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOddi", 
+                          &gmix_obj,
+                          &kr_obj,
+                          &ki_obj,
+                          &weight_obj,
+                          &jacob_obj,
+                          &fdiff_obj,
+                          &rowshift,
+                          &colshift,
+                          &start)) {
+        return NULL;
+    }
 
-            e1old=e1;
-            e2old=e2;
-            Told=T;
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    // we might start somewhere after the priors
+    // note fdiff is 1-d
+    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
+
+    fill_fdiffk_core(gmix, n_gauss,
+                     kr_obj, ki_obj, weight_obj, jacob,
+                     fdiff_ptr,
+                     rowshift, colshift,
+                     0,
+                     &s2n_sum, &npix);
+
+    return Py_BuildValue("di", s2n_sum, npix);
+}
+
+/*
+   same as fill_fdiffk but for half-plane inputs.  The fdiff for the
+   interior columns is scaled by sqrt(2) so the sum of squares matches that
+   of the full plane, and npix counts the full plane pixels
+*/
+static PyObject * PyGMix_fill_fdiffk_half(PyObject* self, PyObject* args) {
+
+    PyObject
+        *gmix_obj=NULL,
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *weight_obj=NULL,
+        *jacob_obj=NULL,
+        *fdiff_obj=NULL; // size 2*image size
+
+    npy_intp n_gauss=0;
+    int start=0, ncol_full=0;
+
+    long npix=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
+
+    double
+        rowshift=0, colshift=0,
+        *fdiff_ptr=NULL,
+        s2n_sum=0.0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOddii", 
+                          &gmix_obj,
+                          &kr_obj,
+                          &ki_obj,
+                          &weight_obj,
+                          &jacob_obj,
+                          &fdiff_obj,
+                          &rowshift,
+                          &colshift,
+                          &start,
+                          &ncol_full)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    // we might start somewhere after the priors
+    // note fdiff is 1-d
+    fdiff_ptr=(double *)PyArray_GETPTR1(fdiff_obj,start);
+
+    fill_fdiffk_core(gmix, n_gauss,
+                     kr_obj, ki_obj, weight_obj, jacob,
+                     fdiff_ptr,
+                     rowshift, colshift,
+                     ncol_full,
+                     &s2n_sum, &npix);
+
+    return Py_BuildValue("dl", s2n_sum, npix);
+}
+
+/*
+   k-space log likelihood, see fill_fdiffk_core
+*/
+static void get_loglikek_core(struct PyGMix_Gauss2D *gmix,
+                              npy_intp n_gauss,
+                              PyObject* kr_obj,
+                              PyObject* ki_obj,
+                              PyObject* weight_obj,
+                              const struct PyGMix_Jacobian *jacob,
+                              double rowshift,
+                              double colshift,
+                              npy_intp ncol_full,
+                              double *loglike,
+                              double *s2n_sum,
+                              long *npix)
+{
+    npy_intp n_row=0, n_col=0, row=0, col=0;
+
+    double
+        rdata=0, idata=0,
+        ivar=0, u=0, v=0,
+        mult=0,
+        absdiffsq=0;
+
+    double complex
+        shift=0, dshift=0, data=0, model_val=0, diff=0;
+
+    n_row=PyArray_DIM(kr_obj, 0);
+    n_col=PyArray_DIM(kr_obj, 1);
+
+    for (row=0; row < n_row; row++) {
+
+        // phase of the model according to the real space shift
+        kshift_row_init(jacob, row, rowshift, colshift, &shift, &dshift);
+
+        for (col=0; col < n_col; col++) {
+
+
+            ivar=*( (double*)PyArray_GETPTR2(weight_obj,row,col) );
+            if ( ivar > 0.0) {
+
+                // for half planes, the conjugate partner contributes
+                // the same chi^2
+                mult=khalf_col_mult(col, ncol_full);
+
+                rdata=*( (double*)PyArray_GETPTR2(kr_obj,row,col) );
+                idata=*( (double*)PyArray_GETPTR2(ki_obj,row,col) );
+
+                data = rdata + I*idata;
+
+                u=PYGMIX_JACOB_GETU(jacob, row, col);
+                v=PYGMIX_JACOB_GETV(jacob, row, col);
+                model_val=PYGMIX_GMIX_EVAL(gmix, n_gauss, v, u);
+
+                // we want a scalar, but data is inherently complex, so just
+                // do the model based one
+
+                (*s2n_sum) += mult*creal(model_val)*creal(model_val)*2*ivar;
+
+                model_val = model_val * shift;
+
+                // complex diff
+                diff = model_val-data;
+
+                // for the loglike, we want the square of the absolute diff
+                absdiffsq = cabs(diff);
+                absdiffsq *= absdiffsq;
+                (*loglike) += mult*absdiffsq*2*ivar;
+
+                (*npix) += (long) mult;
+            }
+
+            shift *= dshift;
+        }
+    }
+
+    (*loglike) *= (-0.5);
+}
+
+static PyObject * PyGMix_get_loglikek(PyObject* self, PyObject* args) {
+
+    PyObject
+        *gmix_obj=NULL,
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *weight_obj=NULL,
+        *jacob_obj=NULL;
+
+    npy_intp n_gauss=0;
+
+    long npix=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
+
+    double
+        loglike=0,
+        rowshift=0, colshift=0,
+        s2n_sum=0.0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOdd", 
+                          &gmix_obj,
+                          &kr_obj,
+                          &ki_obj,
+                          &weight_obj,
+                          &jacob_obj,
+                          &rowshift,
+                          &colshift)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    get_loglikek_core(gmix, n_gauss,
+                      kr_obj, ki_obj, weight_obj, jacob,
+                      rowshift, colshift,
+                      0,
+                      &loglike, &s2n_sum, &npix);
+
+    return Py_BuildValue("ddl", loglike, s2n_sum, npix);
+}
+
+/*
+   same as get_loglikek but for half-plane inputs.  The interior columns
+   are counted twice, so the result matches that of the full plane
+*/
+static PyObject * PyGMix_get_loglikek_half(PyObject* self, PyObject* args) {
+
+    PyObject
+        *gmix_obj=NULL,
+        *kr_obj=NULL,
+        *ki_obj=NULL,
+        *weight_obj=NULL,
+        *jacob_obj=NULL;
+
+    npy_intp n_gauss=0;
+    int ncol_full=0;
+
+    long npix=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_Jacobian *jacob=NULL;
+
+    double
+        loglike=0,
+        rowshift=0, colshift=0,
+        s2n_sum=0.0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOddi", 
+                          &gmix_obj,
+                          &kr_obj,
+                          &ki_obj,
+                          &weight_obj,
+                          &jacob_obj,
+                          &rowshift,
+                          &colshift,
+                          &ncol_full)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!gmix_set_norms_if_needed(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    get_loglikek_core(gmix, n_gauss,
+                      kr_obj, ki_obj, weight_obj, jacob,
+                      rowshift, colshift,
+                      ncol_full,
+                      &loglike, &s2n_sum, &npix);
+
+    return Py_BuildValue("ddl", loglike, s2n_sum, npix);
+}
+
+
+
+
+/*
+ *
+   Expectation maximization image fitting
+ *
+ */
+
+
+static void em_clear_sums(struct PyGMix_EM_Sums *sums, npy_intp n_gauss)
+{
+    memset(sums, 0, n_gauss*sizeof(struct PyGMix_EM_Sums));
+}
+
+#ifdef _OPENMP
+// only used to reduce the per thread sums
+static void em_add_sums(struct PyGMix_EM_Sums *sums,
+                        const struct PyGMix_EM_Sums *tsums,
+                        npy_intp n_gauss)
+{
+    npy_intp i=0;
+    for (i=0; i<n_gauss; i++) {
+        sums[i].pnew   += tsums[i].pnew;
+        sums[i].rowsum += tsums[i].rowsum;
+        sums[i].colsum += tsums[i].colsum;
+        sums[i].u2sum  += tsums[i].u2sum;
+        sums[i].uvsum  += tsums[i].uvsum;
+        sums[i].v2sum  += tsums[i].v2sum;
+    }
+}
+#endif
+
+/*
+static void em_sums_print(const struct PyGMix_EM_Sums *sums, npy_intp n_gauss)
+{
+    npy_intp i=0;
+    for (i=0; i<n_gauss; i++) {
+        const struct PyGMix_EM_Sums *sum=&sums[i];
+
+        fprintf(stderr,"%ld: %g %g %g %g %g %g\n",
+                i+1,
+                sum->pnew,
+                sum->rowsum,
+                sum->colsum,
+                sum->u2sum,
+                sum->uvsum,
+                sum->v2sum);
+
+    }
+}
+*/
+
+/*
+
+   note for em we immediately set the normalization, unlike shear measurements
+   where we allow T <= 0.0
+
+*/
+static 
+int em_set_gmix_from_sums(struct PyGMix_Gauss2D *gmix,
+                           npy_intp n_gauss,
+                           const struct PyGMix_EM_Sums *sums,
+                           int dothrow)
+{
+    int status=0;
+    npy_intp i=0;
+    for (i=0; i<n_gauss; i++) {
+        const struct PyGMix_EM_Sums *sum=&sums[i];
+        struct PyGMix_Gauss2D *gauss=&gmix[i];
+
+        double p=sum->pnew;
+        double pinv=1.0/p;
+
+        status=gauss2d_set(gauss,
+                           p,
+                           sum->rowsum*pinv,
+                           sum->colsum*pinv,
+                           sum->v2sum*pinv,
+                           sum->uvsum*pinv,
+                           sum->u2sum*pinv);
+
+        status=gauss2d_set_norm(gauss, dothrow);
+
+        // an exception will be set if dothrow
+        if (!status) {
+            goto _em_set_gmix_from_sums_bail;
+        }
+    }
+    status=1;
+
+_em_set_gmix_from_sums_bail:
+    return status;
+}
+
+/*
+   the data for em, either an image or a list of the pixels with nonzero
+   weight as made by fill_pixels.  For the pixels, the data are optionally
+   weighted by ivar, and the part of the mixture not covered by the pixels
+   is filled in from the model; see em_impute_missing
+
+   counts is the sum of the data, weighted by ivar if use_ivar, and area
+   the total area of the pixels used
+*/
+struct PyGMix_EM_Data {
+    // the image, NULL when using pixels
+    const char *image;
+    npy_intp n_row;
+    npy_intp n_col;
+    npy_intp row_stride;
+    npy_intp col_stride;
+
+    const struct PyGMix_Pixel *pixels;
+    npy_intp npix;
+    int use_ivar;
+    const struct PyGMix_Jacobian* jacob;
+    double counts;
+    double area;
+};
+
+static void em_data_set_image(struct PyGMix_EM_Data *data,
+                              PyObject* image_obj)
+{
+    data->image      = PyArray_BYTES(image_obj);
+    data->n_row      = PyArray_DIM(image_obj, 0);
+    data->n_col      = PyArray_DIM(image_obj, 1);
+    data->row_stride = PyArray_STRIDE(image_obj, 0);
+    data->col_stride = PyArray_STRIDE(image_obj, 1);
+}
+
+/*
+   the e step for a single pixel, adding to the input sums
+
+   The per-pixel scratch (gi and the centered moments) is held per
+   component in local arrays, separate from the sums.  The gaussian
+   parameters are in separate arrays in gpars, [row, col, drr, drc, dcc,
+   pnorm] each of length n_gauss
+
+   If loglike is not NULL, imnorm*log(gtot) is added to it.  If osums is
+   not NULL, the moments of the model itself, gi*pixarea, are added to it
+
+   Returns 0 if the total was zero
+*/
+static inline int em_estep_pixel(double u,
+                                 double v,
+                                 double imnorm,
+                                 double nsky,
+                                 const double *gpars,
+                                 npy_intp n_gauss,
+                                 struct PyGMix_EM_Sums *sums,
+                                 double *skysum,
+                                 double *loglike,
+                                 struct PyGMix_EM_Sums *osums,
+                                 double pixarea)
+{
+    // scratch on a given pixel
+    double gi[PYGMIX_EM_MAXGAUSS], u2[PYGMIX_EM_MAXGAUSS],
+           uv[PYGMIX_EM_MAXGAUSS], v2[PYGMIX_EM_MAXGAUSS];
+
+    const double
+        *grow   = &gpars[0],
+        *gcol   = &gpars[n_gauss],
+        *gdrr   = &gpars[2*n_gauss],
+        *gdrc   = &gpars[3*n_gauss],
+        *gdcc   = &gpars[4*n_gauss],
+        *gpnorm = &gpars[5*n_gauss];
+
+    double gtot=0.0, igrat=0.0;
+    npy_intp i=0;
+
+    // Mike suggests the correct convention is u->x->row and v->y->col
+    for (i=0; i<n_gauss; i++) {
+        double vdiff = v-grow[i];
+        double udiff = u-gcol[i];
+        double chi2=0;
+
+        u2[i] = udiff*udiff;
+        v2[i] = vdiff*vdiff;
+        uv[i] = udiff*vdiff;
+
+        chi2=gdcc[i]*v2[i] + gdrr[i]*u2[i] - 2.0*gdrc[i]*uv[i];
+
+        if (chi2 < PYGMIX_MAX_CHI2 && chi2 >= 0.0) {
+            gi[i] = gpnorm[i]*expd( -0.5*chi2 );
+        } else {
+            gi[i] = 0.0;
+        }
+    }
+
+    for (i=0; i<n_gauss; i++) {
+        gtot += gi[i];
+    }
+    gtot += nsky;
+
+    if (gtot == 0) {
+        return 0;
+    }
+
+    igrat = imnorm/gtot;
+    for (i=0; i<n_gauss; i++) {
+        struct PyGMix_EM_Sums *sum=&sums[i];
+
+        // wtau is gi[pix]/gtot[pix]*imnorm[pix]
+        // which is Dave's tau*imnorm = wtau
+        sum->pnew   += gi[i]*igrat;
+
+        // row*gi/gtot*imnorm;
+        sum->rowsum += v*gi[i]*igrat;
+        sum->colsum += u*gi[i]*igrat;
+        sum->u2sum  += u2[i]*gi[i]*igrat;
+        sum->uvsum  += uv[i]*gi[i]*igrat;
+        sum->v2sum  += v2[i]*gi[i]*igrat;
+    }
+
+    (*skysum) += nsky*imnorm/gtot;
+    if (loglike) {
+        (*loglike) += imnorm*log(gtot);
+    }
+
+    if (osums) {
+        for (i=0; i<n_gauss; i++) {
+            struct PyGMix_EM_Sums *sum=&osums[i];
+            double gval=gi[i]*pixarea;
+
+            sum->pnew   += gval;
+            sum->rowsum += v*gval;
+            sum->colsum += u*gval;
+            sum->u2sum  += u2[i]*gval;
+            sum->uvsum  += uv[i]*gval;
+            sum->v2sum  += v2[i]*gval;
+        }
+    }
+
+    return 1;
+}
+
+/*
+   the e step for units [beg, end), rows of the image or elements of the
+   pixel list, adding to the input sums.  For the pixel list the model
+   moments are added to osums
+
+   Returns 0 if the total was zero on some pixel
+*/
+static int em_estep_range(const struct PyGMix_EM_Data *data,
+                          double nsky,
+                          const double *gpars,
+                          npy_intp n_gauss,
+                          npy_intp beg,
+                          npy_intp end,
+                          struct PyGMix_EM_Sums *sums,
+                          double *skysum,
+                          double *loglike,
+                          struct PyGMix_EM_Sums *osums)
+{
+    const struct PyGMix_Jacobian* jacob=data->jacob;
+    double pixarea=jacob->det;
+    double imnorm=0;
+    npy_intp row=0, col=0, ipix=0;
+
+    if (data->pixels) {
+        for (ipix=beg; ipix<end; ipix++) {
+            const struct PyGMix_Pixel *pixel=&data->pixels[ipix];
+
+            imnorm = pixel->val;
+            if (data->use_ivar) {
+                imnorm *= pixel->ivar;
+            }
+            imnorm /= data->counts;
+
+            if (!em_estep_pixel(pixel->u, pixel->v, imnorm, nsky,
+                                gpars, n_gauss, sums, skysum, loglike,
+                                osums, pixarea)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    for (row=beg; row<end; row++) {
+
+        const char *rowptr = data->image + row*data->row_stride;
+        double u=PYGMIX_JACOB_GETU(jacob, row, 0);
+        double v=PYGMIX_JACOB_GETV(jacob, row, 0);
+
+        for (col=0; col<data->n_col; col++) {
+
+            imnorm=*(const double*)(rowptr + col*data->col_stride);
+            imnorm /= data->counts;
+
+            if (!em_estep_pixel(u, v, imnorm, nsky,
+                                gpars, n_gauss, sums, skysum, loglike,
+                                NULL, pixarea)) {
+                return 0;
+            }
+
+            u += jacob->dudcol;
+            v += jacob->dvdcol;
+        } //cols
+    } // rows
+
+    return 1;
+}
+
+/*
+   one pass over the data, accumulating the sums for the next iteration
+   and the sky sum
+
+   The rows of the image, or the pixel list, are split into contiguous
+   blocks, one per thread, each with its own sums.  These are added in
+   thread order, so the result only depends on nthreads.
+
+   The log likelihood at the input parameters is calculated if loglike is
+   not NULL.  For the pixel list, osums gets the moments of the model
+   over the pixels
+
+   Does not use the python api.  Returns 0 if the total was zero on
+   some pixel
+*/
+static int em_estep(const struct PyGMix_EM_Data *data,
+                    double nsky,
+                    const struct PyGMix_Gauss2D *gmix,
+                    npy_intp n_gauss,
+                    struct PyGMix_EM_Sums *sums,
+                    double *skysum,
+                    double *loglike,
+                    struct PyGMix_EM_Sums *osums,
+                    int nthreads)
+{
+    double gpars[6*PYGMIX_EM_MAXGAUSS];
+    npy_intp n_units=0;
+    npy_intp i=0;
+    int status=1;
+
+    for (i=0; i<n_gauss; i++) {
+        gpars[i]           = gmix[i].row;
+        gpars[i+n_gauss]   = gmix[i].col;
+        gpars[i+2*n_gauss] = gmix[i].drr;
+        gpars[i+3*n_gauss] = gmix[i].drc;
+        gpars[i+4*n_gauss] = gmix[i].dcc;
+        gpars[i+5*n_gauss] = gmix[i].pnorm;
+    }
+
+    em_clear_sums(sums, n_gauss);
+    (*skysum)=0.0;
+    if (loglike) {
+        (*loglike)=0.0;
+    }
+
+    if (data->pixels) {
+        n_units = data->npix;
+        em_clear_sums(osums, n_gauss);
+    } else {
+        n_units = data->n_row;
+        osums=NULL;
+    }
+
+    if (nthreads > n_units) {
+        nthreads = n_units;
+    }
+
+    if (nthreads <= 1) {
+        return em_estep_range(data, nsky, gpars, n_gauss,
+                              0, n_units, sums, skysum, loglike, osums);
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(nthreads)
+    {
+        struct PyGMix_EM_Sums tsums[PYGMIX_EM_MAXGAUSS],
+                              tosums[PYGMIX_EM_MAXGAUSS];
+        double tskysum=0.0, tloglike=0.0;
+        int tstatus=0;
+
+        int ithread=omp_get_thread_num(), nthr=omp_get_num_threads();
+        npy_intp beg = (n_units*ithread)/nthr;
+        npy_intp end = (n_units*(ithread+1))/nthr;
+
+        em_clear_sums(tsums, n_gauss);
+        em_clear_sums(tosums, n_gauss);
+        tstatus=em_estep_range(data, nsky, gpars, n_gauss,
+                               beg, end, tsums, &tskysum,
+                               loglike ? &tloglike : NULL,
+                               osums ? tosums : NULL);
+
+        // thread i does iteration i
+        #pragma omp for ordered schedule(static,1)
+        for (i=0; i<nthr; i++) {
+            #pragma omp ordered
+            {
+                em_add_sums(sums, tsums, n_gauss);
+                if (osums) {
+                    em_add_sums(osums, tosums, n_gauss);
+                }
+                (*skysum) += tskysum;
+                if (loglike) {
+                    (*loglike) += tloglike;
+                }
+                status &= tstatus;
+            }
+        }
+    }
+#endif
+
+    return status;
+}
+
+/*
+   For the pixel list, the part of the mixture not covered by the pixels,
+   masked or off the stamp, is treated as missing data and filled in with
+   its expectation under the current mixture.  Otherwise the fit would be
+   pulled away from the masked region.
+
+   The moments of each gaussian over the whole plane are known, so the
+   missing part is those minus the moments over the pixels, osums.  With
+   fmiss the missing fraction of the flux, the observed sums are scaled by
+   1-fmiss so the total is still unity.  The log likelihood is that of the
+   observed pixels, with the model renormalized over them.
+
+   Returns 0 if all of the mixture is missing
+*/
+static int em_impute_missing(const struct PyGMix_Gauss2D *gmix,
+                             npy_intp n_gauss,
+                             struct PyGMix_EM_Sums *sums,
+                             struct PyGMix_EM_Sums *osums,
+                             double *skysum,
+                             double *loglike)
+{
+    double fmiss=0, fobs=0;
+    npy_intp i=0;
+
+    for (i=0; i<n_gauss; i++) {
+        const struct PyGMix_Gauss2D *gauss=&gmix[i];
+        struct PyGMix_EM_Sums *osum=&osums[i];
+
+        // osums now holds the missing part
+        osum->pnew   = gauss->p - osum->pnew;
+        osum->rowsum = gauss->p*gauss->row - osum->rowsum;
+        osum->colsum = gauss->p*gauss->col - osum->colsum;
+        osum->u2sum  = gauss->p*gauss->icc - osum->u2sum;
+        osum->uvsum  = gauss->p*gauss->irc - osum->uvsum;
+        osum->v2sum  = gauss->p*gauss->irr - osum->v2sum;
+
+        fmiss += osum->pnew;
+    }
+
+    // the pixel sums can slightly exceed the integral for a fully
+    // covered mixture
+    if (fmiss <= 0.0) {
+        return 1;
+    }
+    if (fmiss >= 1.0) {
+        return 0;
+    }
+
+    fobs = 1.0-fmiss;
+    for (i=0; i<n_gauss; i++) {
+        struct PyGMix_EM_Sums *sum=&sums[i];
+        const struct PyGMix_EM_Sums *osum=&osums[i];
+
+        sum->pnew   = fobs*sum->pnew   + osum->pnew;
+        sum->rowsum = fobs*sum->rowsum + osum->rowsum;
+        sum->colsum = fobs*sum->colsum + osum->colsum;
+        sum->u2sum  = fobs*sum->u2sum  + osum->u2sum;
+        sum->uvsum  = fobs*sum->uvsum  + osum->uvsum;
+        sum->v2sum  = fobs*sum->v2sum  + osum->v2sum;
+    }
+    (*skysum) *= fobs;
+
+    if (loglike) {
+        (*loglike) -= log(fobs);
+    }
+    return 1;
+}
+
+/*
+   a single em iteration, the e step at the input gmix and sky followed by
+   setting the gmix and sky from the sums
+
+   loglike, if not NULL, is set to the log likelihood at the input
+   parameters.
+
+   Does not use the python api; on failure errmsg is set and 0 returned
+*/
+static int em_step(const struct PyGMix_EM_Data *data,
+                   struct PyGMix_Gauss2D *gmix,
+                   npy_intp n_gauss,
+                   struct PyGMix_EM_Sums *sums,
+                   double *nsky,
+                   double *loglike,
+                   int nthreads,
+                   const char **errmsg)
+{
+    struct PyGMix_EM_Sums osums[PYGMIX_EM_MAXGAUSS];
+    double skysum=0;
+
+    if (!em_estep(data, *nsky, gmix, n_gauss, sums, &skysum,
+                  loglike, osums, nthreads)) {
+        (*errmsg) = "em gtot = 0";
+        return 0;
+    }
+
+    if (data->pixels) {
+        if (!em_impute_missing(gmix, n_gauss, sums, osums, &skysum, loglike)) {
+            (*errmsg) = "em mixture is entirely masked";
+            return 0;
+        }
+    }
+
+    if (!em_set_gmix_from_sums(gmix, n_gauss, sums, 0)) {
+        (*errmsg) = "em gauss2d det too low";
+        return 0;
+    }
+
+    (*nsky) = skysum/data->area;
+    return 1;
+}
+
+/*
+   the em parameters as a vector, [p, row, col, irr, irc, icc] for each
+   gaussian, followed by the fraction of the flux in the sky
+*/
+static void em_get_pars(const struct PyGMix_Gauss2D *gmix,
+                        npy_intp n_gauss,
+                        double nsky,
+                        double area,
+                        double *pars)
+{
+    npy_intp i=0;
+    for (i=0; i<n_gauss; i++) {
+        const struct PyGMix_Gauss2D *gauss=&gmix[i];
+        double *gpars=&pars[6*i];
+
+        gpars[0] = gauss->p;
+        gpars[1] = gauss->row;
+        gpars[2] = gauss->col;
+        gpars[3] = gauss->irr;
+        gpars[4] = gauss->irc;
+        gpars[5] = gauss->icc;
+    }
+    pars[6*n_gauss] = nsky*area;
+}
+
+/*
+   returns 0 if the parameters are not a valid mixture, e.g. from a bad
+   extrapolation.  Does not set an exception
+*/
+static int em_set_pars(struct PyGMix_Gauss2D *gmix,
+                       npy_intp n_gauss,
+                       const double *pars,
+                       double area,
+                       double *nsky)
+{
+    npy_intp i=0;
+    for (i=0; i<n_gauss; i++) {
+        struct PyGMix_Gauss2D *gauss=&gmix[i];
+        const double *gpars=&pars[6*i];
+
+        if (gpars[0] <= 0.0) {
+            return 0;
+        }
+
+        gauss2d_set(gauss,
+                    gpars[0],
+                    gpars[1],
+                    gpars[2],
+                    gpars[3],
+                    gpars[4],
+                    gpars[5]);
+
+        if (!gauss2d_set_norm(gauss, 0)) {
+            return 0;
+        }
+    }
+
+    if (pars[6*n_gauss] < 0.0) {
+        return 0;
+    }
+    (*nsky) = pars[6*n_gauss]/area;
+    return 1;
+}
+
+/*
+   input gmix is guess and will eventually hold the final
+   stage of the iteration
+
+   nsky is the initial sky divided by the counts
+
+   Does not use the python api; on failure errmsg is set and 0 returned
+*/
+static int em_run(const struct PyGMix_EM_Data *data,
+                  double nsky,
+                  struct PyGMix_Gauss2D *gmix, // holds the guess
+                  npy_intp n_gauss,
+                  struct PyGMix_EM_Sums *sums,
+                  double tol,
+                  long maxiter,
+                  int nthreads,
+                  long *numiter,
+                  double *frac_diff,
+                  const char **errmsg)
+{
+    int status=0;
+
+    double T=0, T_last=-9999.0;
+    double 
+        e1=0, e2=0, e1_last=-9999, e2_last=-9999,
+        e1diff=0, e2diff=0;
+
+    (*numiter)=0;
+    while ( (*numiter) < maxiter) {
+
+        status=em_step(data, gmix, n_gauss, sums, &nsky, NULL,
+                       nthreads, errmsg);
+        if (!status) {
+            goto _em_run_bail;
+        }
+
+        status=gmix_get_e1e2T(gmix, n_gauss, &e1, &e2, &T);
+        if (!status) {
+            (*errmsg) = "em psum = 0";
+            goto _em_run_bail;
+            break;
+        }
+
+        (*frac_diff) = fabs((T-T_last)/T);
+        e1diff=fabs(e1-e1_last);
+        e2diff=fabs(e2-e2_last);
+
+        /*
+        if ( (*frac_diff) < tol) {
+            break;
+        }
+        */
+        if ( 
+                  (*frac_diff < tol)
+               && (e1diff < tol)
+               && (e2diff < tol)
+           )
+        {
+            break;
+        }
+
+        T_last = T;
+        e1_last = e1;
+        e2_last = e2;
+
+        (*numiter) += 1;
+
+    } // iteration
+
+    status=1;
+_em_run_bail:
+    return status;
+}
+
+/*
+   em accelerated with the SQUAREM method (Varadhan & Roland 2008, scheme
+   S3).  Each iteration makes two em steps from pars0, extrapolates along
+
+       pars' = pars0 - 2 alpha r + alpha^2 v,  alpha = -|r|/|v|
+
+   with r = pars1-pars0, v = pars2-2 pars1+pars0, and makes a final em step
+   from there.  If the extrapolated mixture is invalid, or its likelihood is
+   less than that at pars0, the final step is from pars2 instead, which is
+   plain em
+
+   The convergence criteria are the same as em_run, applied between
+   iterations.  npass is the number of passes over the data
+
+   Does not use the python api; on failure errmsg is set and 0 returned
+*/
+static int em_run_squarem(const struct PyGMix_EM_Data *data,
+                          double nsky,
+                          struct PyGMix_Gauss2D *gmix, // holds the guess
+                          npy_intp n_gauss,
+                          struct PyGMix_EM_Sums *sums,
+                          double tol,
+                          long maxiter,
+                          int nthreads,
+                          long *numiter,
+                          long *npass,
+                          double *frac_diff,
+                          const char **errmsg)
+{
+    const char *xerrmsg=NULL;
+    int status=0, accepted=0;
+    double pars0[6*PYGMIX_EM_MAXGAUSS+1],
+           pars1[6*PYGMIX_EM_MAXGAUSS+1],
+           pars2[6*PYGMIX_EM_MAXGAUSS+1];
+    npy_intp npars=6*n_gauss+1, k=0;
+
+    double area = data->area;
+
+    double loglike0=0, loglike=0;
+    double alpha=0, rsum=0, vsum=0;
+
+    double T=0, T_last=-9999.0;
+    double 
+        e1=0, e2=0, e1_last=-9999, e2_last=-9999,
+        e1diff=0, e2diff=0;
+
+    (*numiter)=0;
+    (*npass)=0;
+    while ( (*numiter) < maxiter) {
+
+        em_get_pars(gmix, n_gauss, nsky, area, pars0);
+        status=em_step(data, gmix, n_gauss, sums,
+                       &nsky, &loglike0, nthreads, errmsg);
+        (*npass) += 1;
+        if (!status) {
+            goto _em_run_squarem_bail;
+        }
+
+        em_get_pars(gmix, n_gauss, nsky, area, pars1);
+        status=em_step(data, gmix, n_gauss, sums,
+                       &nsky, NULL, nthreads, errmsg);
+        (*npass) += 1;
+        if (!status) {
+            goto _em_run_squarem_bail;
+        }
+
+        em_get_pars(gmix, n_gauss, nsky, area, pars2);
+
+        rsum=0.0;
+        vsum=0.0;
+        for (k=0; k<npars; k++) {
+            double r = pars1[k]-pars0[k];
+            double v = pars2[k]-2.0*pars1[k]+pars0[k];
+            rsum += r*r;
+            vsum += v*v;
+        }
+
+        alpha=-1.0;
+        if (vsum > 0.0) {
+            alpha = -sqrt(rsum/vsum);
+        }
+
+        accepted=0;
+        if (alpha < -1.0) {
+            // pars1 now holds the extrapolated parameters
+            for (k=0; k<npars; k++) {
+                double r = pars1[k]-pars0[k];
+                double v = pars2[k]-2.0*pars1[k]+pars0[k];
+                pars1[k] = pars0[k] - 2.0*alpha*r + alpha*alpha*v;
+            }
+
+            if (em_set_pars(gmix, n_gauss, pars1, area, &nsky)) {
+                // failure here just means we fall back
+                accepted=em_step(data, gmix, n_gauss, sums,
+                                 &nsky, &loglike, nthreads, &xerrmsg);
+                (*npass) += 1;
+
+                if (accepted && loglike < loglike0) {
+                    accepted=0;
+                }
+            }
+        }
+
+        if (!accepted) {
+            // always valid, these came from an em step
+            em_set_pars(gmix, n_gauss, pars2, area, &nsky);
+            status=em_step(data, gmix, n_gauss, sums,
+                           &nsky, NULL, nthreads, errmsg);
+            (*npass) += 1;
+            if (!status) {
+                goto _em_run_squarem_bail;
+            }
+        }
+
+        status=gmix_get_e1e2T(gmix, n_gauss, &e1, &e2, &T);
+        if (!status) {
+            (*errmsg) = "em psum = 0";
+            goto _em_run_squarem_bail;
+        }
+
+        (*frac_diff) = fabs((T-T_last)/T);
+        e1diff=fabs(e1-e1_last);
+        e2diff=fabs(e2-e2_last);
+
+        if ( 
+                  (*frac_diff < tol)
+               && (e1diff < tol)
+               && (e2diff < tol)
+           )
+        {
+            break;
+        }
+
+        T_last = T;
+        e1_last = e1;
+        e2_last = e2;
+
+        (*numiter) += 1;
+
+    } // iteration
+
+    status=1;
+_em_run_squarem_bail:
+    return status;
+}
+
+/*
+   check the number of gaussians and set the norms of the guess
+*/
+static int em_check_guess(struct PyGMix_Gauss2D *gmix, npy_intp n_gauss)
+{
+    if (n_gauss > PYGMIX_EM_MAXGAUSS) {
+        PyErr_Format(GMixFatalError, 
+                     "em supports at most %d gaussians, got %ld",
+                     PYGMIX_EM_MAXGAUSS, n_gauss);
+        return 0;
+    }
+
+    return gmix_set_norms_if_needed(gmix, n_gauss);
+}
+
+static PyObject * PyGMix_em_run(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    //PyObject* weight_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* sums_obj=NULL;
+    double sky=0, counts=0, tol=0;
+    long maxiter=0;
+    int nthreads=0;
+    npy_intp n_gauss=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;//, *gauss=NULL;
+    struct PyGMix_EM_Data data={0};
+    struct PyGMix_EM_Sums* sums=NULL;
+    long numiter=0;
+    double frac_diff=0, scale=0;
+    const char *errmsg=NULL;
+    int status=0;
+
+
+    // weight object is currently ignored
+    if (!PyArg_ParseTuple(args, (char*)"OOOOdddli", 
+                          &gmix_obj,
+                          &image_obj,
+                          //&weight_obj,
+                          &jacob_obj,
+                          &sums_obj,
+                          &sky, &counts, &tol, &maxiter,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!em_check_guess(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    em_data_set_image(&data, image_obj);
+    data.jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    data.counts=counts;
+    scale=data.jacob->sdet;
+    data.area=PyArray_SIZE(image_obj)*scale*scale;
+
+    sums=(struct PyGMix_EM_Sums* )  PyArray_DATA(sums_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+    status=em_run(&data,
+                  sky/counts,
+                  gmix,
+                  n_gauss,
+                  sums,
+                  tol,
+                  maxiter,
+                  nthreads,
+                  &numiter,
+                  &frac_diff,
+                  &errmsg);
+    Py_END_ALLOW_THREADS
+
+    if (!status) {
+        PyErr_Format(GMixRangeError, "%s", errmsg);
+        return NULL;
+    } else {
+        PyObject* retval=PyTuple_New(2);
+        PyTuple_SetItem(retval,0,PyLong_FromLong(numiter));
+        PyTuple_SetItem(retval,1,PyFloat_FromDouble(frac_diff));
+        return retval;
+    }
+}
+
+static PyObject * PyGMix_em_run_squarem(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* sums_obj=NULL;
+    double sky=0, counts=0, tol=0;
+    long maxiter=0;
+    int nthreads=0;
+    npy_intp n_gauss=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_EM_Data data={0};
+    struct PyGMix_EM_Sums* sums=NULL;
+    long numiter=0, npass=0;
+    double frac_diff=0, scale=0;
+    const char *errmsg=NULL;
+    int status=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOdddli", 
+                          &gmix_obj,
+                          &image_obj,
+                          &jacob_obj,
+                          &sums_obj,
+                          &sky, &counts, &tol, &maxiter,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!em_check_guess(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    em_data_set_image(&data, image_obj);
+    data.jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    data.counts=counts;
+    scale=data.jacob->sdet;
+    data.area=PyArray_SIZE(image_obj)*scale*scale;
+
+    sums=(struct PyGMix_EM_Sums* )  PyArray_DATA(sums_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+    status=em_run_squarem(&data,
+                          sky/counts,
+                          gmix,
+                          n_gauss,
+                          sums,
+                          tol,
+                          maxiter,
+                          nthreads,
+                          &numiter,
+                          &npass,
+                          &frac_diff,
+                          &errmsg);
+    Py_END_ALLOW_THREADS
+
+    if (!status) {
+        PyErr_Format(GMixRangeError, "%s", errmsg);
+        return NULL;
+    } else {
+        PyObject* retval=PyTuple_New(3);
+        PyTuple_SetItem(retval,0,PyLong_FromLong(numiter));
+        PyTuple_SetItem(retval,1,PyFloat_FromDouble(frac_diff));
+        PyTuple_SetItem(retval,2,PyLong_FromLong(npass));
+        return retval;
+    }
+}
+
+/*
+   em using only the pixels with nonzero weight, as made by fill_pixels
+
+   The counts are the sum over the pixels, weighted by ivar if use_ivar,
+   and the sky is uniform over the area of the pixels.  The input sky is
+   per pixel, as for em_run.  The mixture outside of the pixels is filled
+   in from the model, see em_impute_missing.  If accelerate is set, SQUAREM
+   is used
+
+   returns (numiter, fdiff, npass)
+*/
+static PyObject * PyGMix_em_run_pixels(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* pixels_obj=NULL;
+    PyObject* jacob_obj=NULL;
+    PyObject* sums_obj=NULL;
+    double sky=0, tol=0;
+    long maxiter=0;
+    int use_ivar=0, accelerate=0, nthreads=0;
+    npy_intp n_gauss=0, ipix=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+    struct PyGMix_EM_Data data={0};
+    struct PyGMix_EM_Sums* sums=NULL;
+    long numiter=0, npass=0;
+    double frac_diff=0, scale=0, counts=0, nsky=0;
+    const char *errmsg=NULL;
+    int status=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOddliii", 
+                          &gmix_obj,
+                          &pixels_obj,
+                          &jacob_obj,
+                          &sums_obj,
+                          &sky, &tol, &maxiter,
+                          &use_ivar, &accelerate, &nthreads)) {
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    n_gauss=PyArray_SIZE(gmix_obj);
+
+    if (!em_check_guess(gmix, n_gauss)) {
+        return NULL;
+    }
+
+    data.pixels=(const struct PyGMix_Pixel* ) PyArray_DATA(pixels_obj);
+    data.npix=PyArray_SIZE(pixels_obj);
+    data.use_ivar=use_ivar;
+    data.jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+
+    for (ipix=0; ipix<data.npix; ipix++) {
+        const struct PyGMix_Pixel *pixel=&data.pixels[ipix];
+        counts += pixel->val;
+        if (use_ivar) {
+            data.counts += pixel->val*pixel->ivar;
+        }
+    }
+    if (!use_ivar) {
+        data.counts = counts;
+    }
+
+    if (data.npix == 0 || counts <= 0.0 || data.counts <= 0.0) {
+        PyErr_Format(GMixRangeError, "em counts <= 0");
+        return NULL;
+    }
+
+    scale=data.jacob->sdet;
+    data.area=data.npix*scale*scale;
+
+    // the sky as a fraction of the counts, per pixel
+    nsky = sky/counts;
+
+    sums=(struct PyGMix_EM_Sums* )  PyArray_DATA(sums_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+    if (accelerate) {
+        status=em_run_squarem(&data, nsky, gmix, n_gauss, sums,
+                              tol, maxiter, nthreads,
+                              &numiter, &npass, &frac_diff, &errmsg);
+    } else {
+        status=em_run(&data, nsky, gmix, n_gauss, sums,
+                      tol, maxiter, nthreads,
+                      &numiter, &frac_diff, &errmsg);
+        npass = (numiter < maxiter) ? numiter+1 : maxiter;
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!status) {
+        PyErr_Format(GMixRangeError, "%s", errmsg);
+        return NULL;
+    } else {
+        PyObject* retval=PyTuple_New(3);
+        PyTuple_SetItem(retval,0,PyLong_FromLong(numiter));
+        PyTuple_SetItem(retval,1,PyFloat_FromDouble(frac_diff));
+        PyTuple_SetItem(retval,2,PyLong_FromLong(npass));
+        return retval;
+    }
+}
+
+
+/*
+   run em on a stack of images [N, nrow, ncol], each with its own jacobian,
+   guess, sky and counts.  The guesses gmix [N, n_gauss] will hold the
+   result.  The images are split between threads, one thread per image
+
+   numiter, npass (int64) fdiff (float64) and flags (int32) are [N]. flags
+   is set to 1 where em failed
+*/
+static PyObject * PyGMix_em_run_batch(PyObject* self, PyObject* args) {
+
+    PyObject* gmix_obj=NULL;
+    PyObject* images_obj=NULL;
+    PyObject* jacobs_obj=NULL;
+    PyObject* sky_obj=NULL;
+    PyObject* counts_obj=NULL;
+    PyObject* numiter_obj=NULL;
+    PyObject* npass_obj=NULL;
+    PyObject* fdiff_obj=NULL;
+    PyObject* flags_obj=NULL;
+    double tol=0;
+    long maxiter=0;
+    int accelerate=0, nthreads=0;
+
+    struct PyGMix_Gauss2D *gmix=NULL;
+    const struct PyGMix_Jacobian *jacobs=NULL;
+    const double *sky=NULL, *counts=NULL;
+    npy_int64 *numiter=NULL, *npass=NULL;
+    double *fdiff=NULL;
+    npy_int32 *flags=NULL;
+    npy_intp n_batch=0, n_gauss=0, n_row=0, n_col=0, i=0;
+    npy_intp row_stride=0, col_stride=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOdliOOOOi", 
+                          &gmix_obj,
+                          &images_obj,
+                          &jacobs_obj,
+                          &sky_obj,
+                          &counts_obj,
+                          &tol, &maxiter, &accelerate,
+                          &numiter_obj, &npass_obj, &fdiff_obj, &flags_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    n_batch=PyArray_DIM(images_obj, 0);
+    n_row=PyArray_DIM(images_obj, 1);
+    n_col=PyArray_DIM(images_obj, 2);
+    row_stride=PyArray_STRIDE(images_obj, 1);
+    col_stride=PyArray_STRIDE(images_obj, 2);
+
+    if (PyArray_DIM(gmix_obj, 0) != n_batch
+            || PyArray_SIZE(jacobs_obj) != n_batch
+            || PyArray_SIZE(sky_obj) != n_batch
+            || PyArray_SIZE(counts_obj) != n_batch
+            || PyArray_SIZE(numiter_obj) != n_batch
+            || PyArray_SIZE(npass_obj) != n_batch
+            || PyArray_SIZE(fdiff_obj) != n_batch
+            || PyArray_SIZE(flags_obj) != n_batch) {
+        PyErr_Format(GMixFatalError, 
+                     "all inputs must have %ld images", n_batch);
+        return NULL;
+    }
+
+    n_gauss=PyArray_DIM(gmix_obj, 1);
+    if (n_gauss > PYGMIX_EM_MAXGAUSS) {
+        PyErr_Format(GMixFatalError, 
+                     "em supports at most %d gaussians, got %ld",
+                     PYGMIX_EM_MAXGAUSS, n_gauss);
+        return NULL;
+    }
+
+    gmix=(struct PyGMix_Gauss2D* ) PyArray_DATA(gmix_obj);
+    jacobs=(const struct PyGMix_Jacobian* ) PyArray_DATA(jacobs_obj);
+    sky=(const double *) PyArray_DATA(sky_obj);
+    counts=(const double *) PyArray_DATA(counts_obj);
+    numiter=(npy_int64 *) PyArray_DATA(numiter_obj);
+    npass=(npy_int64 *) PyArray_DATA(npass_obj);
+    fdiff=(double *) PyArray_DATA(fdiff_obj);
+    flags=(npy_int32 *) PyArray_DATA(flags_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+#endif
+    for (i=0; i<n_batch; i++) {
+        struct PyGMix_EM_Sums sums[PYGMIX_EM_MAXGAUSS];
+        struct PyGMix_EM_Data data={0};
+        struct PyGMix_Gauss2D *gm=&gmix[i*n_gauss];
+        const char *errmsg=NULL;
+        long tnumiter=0, tnpass=0;
+        double tfdiff=0, scale=0;
+        npy_intp k=0;
+        int status=1;
+
+        data.image=(const char *) PyArray_GETPTR3(images_obj, i, 0, 0);
+        data.n_row=n_row;
+        data.n_col=n_col;
+        data.row_stride=row_stride;
+        data.col_stride=col_stride;
+        data.jacob=&jacobs[i];
+        data.counts=counts[i];
+        scale=data.jacob->sdet;
+        data.area=n_row*n_col*scale*scale;
+
+        if (counts[i] <= 0.0) {
+            status=0;
+        }
+        for (k=0; k<n_gauss && status; k++) {
+            status=gauss2d_set_norm(&gm[k], 0);
+        }
+
+        if (status) {
+            if (accelerate) {
+                status=em_run_squarem(&data, sky[i]/counts[i], gm, n_gauss,
+                                      sums, tol, maxiter, 1,
+                                      &tnumiter, &tnpass, &tfdiff, &errmsg);
+            } else {
+                status=em_run(&data, sky[i]/counts[i], gm, n_gauss,
+                              sums, tol, maxiter, 1,
+                              &tnumiter, &tfdiff, &errmsg);
+                tnpass = (tnumiter < maxiter) ? tnumiter+1 : maxiter;
+            }
+        }
+
+        numiter[i] = tnumiter;
+        npass[i] = tnpass;
+        fdiff[i] = tfdiff;
+        flags[i] = status ? 0 : 1;
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+
+/*
+	for now straight conversion of the fortran
+*/
+
+
+
+#define ADMOM_EDGE 0x1
+#define ADMOM_SHIFT 0x2
+#define ADMOM_FAINT 0x4
+#define ADMOM_SMALL 0x8
+#define ADMOM_DET 0x10
+#define ADMOM_MAXIT 0x20
+
+struct Admom {
+    int maxit;
+    double shiftmax;
+    double etol;
+    double Ttol;
+
+    // use anderson acceleration for the adaptive step
+    int accelerate;
+};
+
+struct AdmomMask {
+    npy_intp rowmin;
+    npy_intp rowmax;
+    npy_intp colmin;
+    npy_intp colmax;
+};
+
+/*
+   an image and its inverse variance, possibly a window into a larger
+   image.  No python objects are held, so the sums can be done without
+   the GIL
+
+   ivar can be NULL when only the center sums are needed
+*/
+struct AdmomImage {
+    const char *image;
+    const char *ivar;
+    npy_intp n_row;
+    npy_intp n_col;
+    npy_intp row_stride;
+    npy_intp col_stride;
+    npy_intp ivar_row_stride;
+    npy_intp ivar_col_stride;
+};
+
+#define ADMOM_IMAGE_GET(im, row, col) \
+    ( *(const double *) ( (im)->image                 \
+                          + (row)*(im)->row_stride    \
+                          + (col)*(im)->col_stride ) )
+
+#define ADMOM_IVAR_GET(im, row, col) \
+    ( *(const double *) ( (im)->ivar                       \
+                          + (row)*(im)->ivar_row_stride    \
+                          + (col)*(im)->ivar_col_stride ) )
+
+// the weight is evaluated in chunks of this many columns
+#define ADMOM_ROW_CHUNK 64
+
+/*
+   one epoch for the multi-epoch admom: either an image view and its
+   jacobian, or a list of pixels as made by fill_pixels, in which case
+   pixels is not NULL
+*/
+struct AdmomEpoch {
+    struct AdmomImage image;
+    const struct PyGMix_Jacobian *jacob;
+
+    const struct PyGMix_Pixel *pixels;
+    npy_intp npix;
+};
+
+#define ADMOM_MAX_EPOCHS 1000
+
+/*
+struct AdmomSums {
+    double fsum;     // weight*data
+    double vsum;     // weight*v*data
+    double usum;     // weight*u*data
+    double vvsum;     // weight*v*v*data
+    double vusum;     // weight*v*u*data
+    double uusum;     // weight*u*u*data
+    double wsqsum;     // weight*weight
+};
+*/
+
+struct AdmomResult {
+    int flags;
+
+    // non-fatal conditions, e.g. ADMOM_EDGE
+    int info_flags;
+
+    int numiter;
+
+    int nimage;
+    int npix;
+
+    double wsum;
+
+    double sums[6];
+
+    // cov of above
+    double sums_cov[36];
+
+    double pars[6];
+
+};
+
+/*
+static void admom_sums_clear(struct AdmomSums *self)
+{
+    memset(self, 0, sizeof(struct AdmomSums));
+}
+*/
+
+static inline void admom_clear_result(struct AdmomResult *self)
+{
+    memset(self, 0, sizeof(struct AdmomResult));
+}
+
+
+
+/* 
+   calculate the window covering the region where the weight is non-zero,
+   chi^2 < PYGMIX_MAX_CHI2, around the current center
+
+   The ellipse is mapped into pixel coordinates through the inverse
+   jacobian, so rotated and sheared jacobians are handled.  The
+   returned bounding box is clipped to the stamp; ADMOM_EDGE is
+   returned if the clipping happened, otherwise zero
+
+   If the window cannot be calculated the full stamp is used
+*/
+static int admom_get_mask(const struct PyGMix_Gauss2D *wt,
+                          const struct PyGMix_Jacobian *jacob,
+                          npy_intp n_row, npy_intp n_col,
+                          struct AdmomMask *mask)
+{
+    int flags=0;
+    double
+        jdet=0, ijdet=0,
+        drdv=0, drdu=0, dcdv=0, dcdu=0,
+        rcen=0, ccen=0,
+        rvar=0, cvar=0,
+        rrad=0, crad=0,
+        rlow=0, rhigh=0, clow=0, chigh=0,
+        rmax=0, cmax=0;
+
+    mask->rowmin = 0;
+    mask->rowmax = n_row-1;
+    mask->colmin = 0;
+    mask->colmax = n_col-1;
+
+    jdet = jacob->dvdrow*jacob->dudcol - jacob->dvdcol*jacob->dudrow;
+    if (jdet == 0.0) {
+        goto admom_get_mask_bail;
+    }
+    ijdet = 1.0/jdet;
+
+    // inverse jacobian, (v,u) -> (row,col)
+    drdv =  jacob->dudcol*ijdet;
+    drdu = -jacob->dvdcol*ijdet;
+    dcdv = -jacob->dudrow*ijdet;
+    dcdu =  jacob->dvdrow*ijdet;
+
+    rcen = jacob->row0 + drdv*wt->row + drdu*wt->col;
+    ccen = jacob->col0 + dcdv*wt->row + dcdu*wt->col;
+
+    // variance of the weight in the pixel row and column directions
+    rvar = drdv*drdv*wt->irr + 2*drdv*drdu*wt->irc + drdu*drdu*wt->icc;
+    cvar = dcdv*dcdv*wt->irr + 2*dcdv*dcdu*wt->irc + dcdu*dcdu*wt->icc;
+
+    if (!(rvar > 0.0) || !(cvar > 0.0)) {
+        goto admom_get_mask_bail;
+    }
+
+    // small pad so pixels on the boundary are not lost to roundoff
+    rrad = sqrt(PYGMIX_MAX_CHI2*rvar) + 1.0e-6;
+    crad = sqrt(PYGMIX_MAX_CHI2*cvar) + 1.0e-6;
+
+    rlow  = rcen-rrad;
+    rhigh = rcen+rrad;
+    clow  = ccen-crad;
+    chigh = ccen+crad;
+
+    rmax = (double) (n_row-1);
+    cmax = (double) (n_col-1);
+
+    // keep track of when our bounding box hits an edge
+    if ( (rlow < 0) || (rhigh > rmax)
+            || (clow < 0) || (chigh > cmax) ) {
+        flags |= ADMOM_EDGE;
+    }
+
+    // empty windows, rowmin > rowmax, are allowed
+    mask->rowmin = (npy_intp) ceil( fmin( fmax(rlow, 0.), rmax+1 ) );
+    mask->rowmax = (npy_intp) floor( fmax( fmin(rhigh, rmax), -1. ) );
+
+    mask->colmin = (npy_intp) ceil( fmin( fmax(clow, 0.), cmax+1 ) );
+    mask->colmax = (npy_intp) floor( fmax( fmin(chigh, cmax), -1. ) );
+
+admom_get_mask_bail:
+    return flags;
+}
+
+static void admom_image_set(struct AdmomImage *self,
+                            const PyObject* image,
+                            const PyObject* ivarim)
+{
+    self->image           = PyArray_BYTES(image);
+    self->n_row           = PyArray_DIM(image, 0);
+    self->n_col           = PyArray_DIM(image, 1);
+    self->row_stride      = PyArray_STRIDE(image, 0);
+    self->col_stride      = PyArray_STRIDE(image, 1);
+
+    self->ivar            = PyArray_BYTES(ivarim);
+    self->ivar_row_stride = PyArray_STRIDE(ivarim, 0);
+    self->ivar_col_stride = PyArray_STRIDE(ivarim, 1);
+}
+
+/*
+   evaluate the weight for ncol pixels of a row, starting at colmin,
+   also saving the v,u coordinates
+
+   there are no dependencies between pixels, so this can be vectorized
+*/
+static inline void admom_eval_row(const struct PyGMix_Gauss2D *wt,
+                                  const struct PyGMix_Jacobian *jacob,
+                                  npy_intp irow,
+                                  npy_intp colmin,
+                                  npy_intp ncol,
+                                  double *v,
+                                  double *u,
+                                  double *weight)
+{
+    npy_intp k=0;
+
+#ifdef _OPENMP
+    #pragma omp simd
+#endif
+    for (k=0; k<ncol; k++) {
+        v[k]=PYGMIX_JACOB_GETV(jacob, irow, colmin+k);
+        u[k]=PYGMIX_JACOB_GETU(jacob, irow, colmin+k);
+        weight[k]=PYGMIX_GAUSS_EVAL(wt, v[k], u[k]);
+    }
+}
+
+/*
+   get sums for the center
+
+   also set the flux sum while we are at it
+*/
+
+static void admom_censums(
+          const struct Admom *self,
+          const struct AdmomImage *image,
+          const struct PyGMix_Jacobian *jacob,
+          const struct PyGMix_Gauss2D *wt,
+          struct AdmomResult *res)
+
+{
+
+    npy_intp irow=0, icol=0, col0=0, ncol=0, k=0;
+    double 
+        data=0, wdata=0;
+    double v[ADMOM_ROW_CHUNK], u[ADMOM_ROW_CHUNK], weight[ADMOM_ROW_CHUNK];
+    struct AdmomMask mask={0};
+
+    res->info_flags |= admom_get_mask(wt, jacob,
+                                      image->n_row, image->n_col, &mask);
+
+    // npix counts the full stamp, not just the window
+    res->npix += image->n_row*image->n_col;
+
+    // get the weighted center
+    for (irow=mask.rowmin; irow<=mask.rowmax; irow++) {
+        for (col0=mask.colmin; col0<=mask.colmax; col0+=ADMOM_ROW_CHUNK) {
+
+            ncol = mask.colmax-col0+1;
+            if (ncol > ADMOM_ROW_CHUNK) {
+                ncol = ADMOM_ROW_CHUNK;
+            }
+
+            // v->row and u->col in calculations
+            admom_eval_row(wt, jacob, irow, col0, ncol, v, u, weight);
+
+            for (k=0; k<ncol; k++) {
+                icol = col0+k;
+
+                data=ADMOM_IMAGE_GET(image, irow, icol);
+
+                wdata=weight[k]*data;
+
+                res->sums[0] += wdata*v[k];
+                res->sums[1] += wdata*u[k];
+                res->sums[5] += wdata;
+            }
+
+        } // cols
+    } // rows
+
+}
+
+/*
+   add a single pixel to the moment sums; v,u are sky coordinates
+   relative to the jacobian center and vcen,ucen the weight center
+*/
+static inline void admom_momsums_add(double v, double u,
+                                     double data, double ivar,
+                                     double weight,
+                                     double vcen, double ucen,
+                                     struct AdmomResult* res)
+{
+    int i=0, j=0;
+    double
+        vmod=0, umod=0,
+        var=0, w2=0, wdata=0;
+    double F[6];
+    double *sums=res->sums, *sums_cov=res->sums_cov;
+
+    var=1.0/ivar;
+
+    // sky coordinates relative to the gaussian mixture center
+    vmod = v-vcen;
+    umod = u-ucen;
+
+    wdata = weight*data;
+    w2 = weight*weight;
+
+    F[0] = v;
+    F[1] = u;
+    F[2] = umod*umod - vmod*vmod;
+    F[3] = 2*vmod*umod;
+    F[4] = umod*umod + vmod*vmod;
+    F[5] = 1.0;
+
+    res->wsum += weight;
+
+    for (i=0; i<6; i++) {
+        sums[i] += wdata*F[i];
+        for (j=0; j<6; j++) {
+            sums_cov[i + 6*j] += w2*var*F[i]*F[j];
+        }
+    }
+}
+
+static void admom_momsums(
+          const struct Admom *self,
+          const struct AdmomImage *image,
+          const struct PyGMix_Jacobian *jacob,
+          const struct PyGMix_Gauss2D *wt,
+          struct AdmomResult* res)
+
+{
+
+    npy_intp irow=0, icol=0, col0=0, ncol=0, k=0;
+    double 
+        vcen=0, ucen=0,
+        ivar=0, data=0;
+    double vrow[ADMOM_ROW_CHUNK], urow[ADMOM_ROW_CHUNK];
+    double wrow[ADMOM_ROW_CHUNK];
+    struct AdmomMask mask={0};
+
+    res->info_flags |= admom_get_mask(wt, jacob,
+                                      image->n_row, image->n_col, &mask);
+
+    // npix counts the full stamp, not just the window
+    res->npix += image->n_row*image->n_col;
+
+    // row->v col->u
+    vcen=wt->row;
+    ucen=wt->col;
+
+    // get the weighted center
+    for (irow=mask.rowmin; irow<=mask.rowmax; irow++) {
+      for (col0=mask.colmin; col0<=mask.colmax; col0+=ADMOM_ROW_CHUNK) {
+
+        ncol = mask.colmax-col0+1;
+        if (ncol > ADMOM_ROW_CHUNK) {
+            ncol = ADMOM_ROW_CHUNK;
+        }
+
+        // sky coordinates relative to the jacobian center, and the
+        // weight evaluated at those locations
+        admom_eval_row(wt, jacob, irow, col0, ncol, vrow, urow, wrow);
+
+        for (k=0; k<ncol; k++) {
+            icol = col0+k;
+
+            data = ADMOM_IMAGE_GET(image, irow, icol);
+            ivar = ADMOM_IVAR_GET(image, irow, icol);
+
+            admom_momsums_add(vrow[k], urow[k], data, ivar, wrow[k],
+                              vcen, ucen, res);
+
+        } // chunk
+      } // cols
+    } // rows
+
+}
+
+/*
+   center and moment sums for pixels as made by fill_pixels.  All the
+   pixels are counted in npix, as for a stamp
+*/
+static void admom_censums_pixels(
+          const struct Admom *self,
+          const struct PyGMix_Pixel *pixels,
+          npy_intp npix,
+          const struct PyGMix_Gauss2D *wt,
+          struct AdmomResult *res)
+{
+    npy_intp ipix=0;
+    double weight=0, wdata=0;
+    const struct PyGMix_Pixel *pixel=NULL;
+
+    res->npix += npix;
+
+    for (ipix=0; ipix<npix; ipix++) {
+        pixel = &pixels[ipix];
+
+        weight=PYGMIX_GAUSS_EVAL(wt, pixel->v, pixel->u);
+        if (weight == 0.0) {
+            continue;
+        }
+
+        wdata=weight*pixel->val;
+
+        res->sums[0] += wdata*pixel->v;
+        res->sums[1] += wdata*pixel->u;
+        res->sums[5] += wdata;
+    }
+}
+
+static void admom_momsums_pixels(
+          const struct Admom *self,
+          const struct PyGMix_Pixel *pixels,
+          npy_intp npix,
+          const struct PyGMix_Gauss2D *wt,
+          struct AdmomResult *res)
+{
+    npy_intp ipix=0;
+    double weight=0;
+    const struct PyGMix_Pixel *pixel=NULL;
+
+    res->npix += npix;
+
+    for (ipix=0; ipix<npix; ipix++) {
+        pixel = &pixels[ipix];
+
+        weight=PYGMIX_GAUSS_EVAL(wt, pixel->v, pixel->u);
+        if (weight == 0.0) {
+            continue;
+        }
+
+        admom_momsums_add(pixel->v, pixel->u, pixel->val, pixel->ivar,
+                          weight, wt->row, wt->col, res);
+    }
+}
+
+/*
+   set a new weight function
+
+   Since these are weighted moments, the following would hold
+   for gaussians
+
+       Cinv_meas = Cinv_true + Cinv_weight
+
+   So for the next iteration, subtract the covariance
+   matrix of the weight
+
+*/
+
+static int take_adaptive_step(
+          double Wrr, double Wrc, double Wcc,
+          double Irr, double Irc, double Icc,
+          double *NewIrr, double *NewIrc, double *NewIcc)
+{
+    int flags=0;
+
+    double 
+        Nrr=0, Ncc=0, Nrc=0,
+        detn=0, idetn=0,
+        detm=0, idetm=0,
+        detw=0, idetw=0;
+
+    // measured moments
+    detm = Irr*Icc - Irc*Irc;
+    if (detm <= PYGMIX_LOW_DETVAL) {
+        //printf("detm too small: %g\n", detm);
+        flags=ADMOM_DET;
+        goto adaptive_step_bail;
+    }
+
+    detw = Wrr*Wcc - Wrc*Wrc;
+    if (detw <= PYGMIX_LOW_DETVAL) {
+        //printf("detw too small: %g\n", detw);
+        flags=ADMOM_DET;
+        goto adaptive_step_bail;
+    }
+
+    idetw=1.0/detw;
+    idetm=1.0/detm;
+
+    // Nrr etc. are actually of the inverted covariance matrix
+    Nrr =  Icc*idetm - Wcc*idetw;
+    Ncc =  Irr*idetm - Wrr*idetw;
+    Nrc = -Irc*idetm + Wrc*idetw;
+    detn = Nrr*Ncc - Nrc*Nrc;
+
+    if (detn <= PYGMIX_LOW_DETVAL) {
+        //printf("detn too small: %g\n", detn);
+        flags=ADMOM_DET;
+        goto adaptive_step_bail;
+    }
+
+    // now set from the inverted matrix
+    idetn=1./detn;
+    *NewIrr =  Ncc*idetn;
+    *NewIcc =  Nrr*idetn;
+    *NewIrc = -Nrc*idetn;
+
+adaptive_step_bail:
+    return flags;
+}
+
+
+
+static int take_adaptive_step_wt(
+          struct PyGMix_Gauss2D *wt,
+          double Irr, double Irc, double Icc)
+{
+
+    int flags=0;
+    flags=take_adaptive_step(
+        wt->irr, wt->irc, wt->icc,
+        Irr, Irc, Icc,
+        &wt->irr, &wt->irc, &wt->icc
+    );
+
+    wt->det = wt->irr*wt->icc - wt->irc*wt->irc;
+
+    return flags;
+}
+
+
+/*
+   Anderson acceleration of the adaptive step, with depth one
+
+   The adaptive step is a fixed point iteration x -> G(x) for the
+   weight covariance x = (irr, irc, icc).  Using the differences of the
+   last two iterates dx and of their residuals df, f = G(x)-x, the
+   accelerated weight is
+
+       G(x) - (dx + df) gamma,   gamma = df.f / df.df
+
+   where gamma minimizes |f - df gamma|.  If the accelerated weight is
+   not positive definite, or df is too small to solve for gamma, the
+   plain step G(x) is kept and the history is cleared
+*/
+
+struct AdmomAnderson {
+    int have_prev;
+    int have_diff;
+    double xprev[3];
+    double fprev[3];
+    double dx[3];
+    double df[3];
+};
+
+/*
+   x holds the weight covariance before the adaptive step, and wt
+   holds the result of the step, G(x).  The covariance of wt is
+   replaced by the accelerated value if it is acceptable
+*/
+static void admom_anderson_step(struct AdmomAnderson *self,
+                                const double *x,
+                                struct PyGMix_Gauss2D *wt)
+{
+    double
+        g[3]={0}, f[3]={0}, xnew[3]={0},
+        dfdf=0, dff=0, fsq=0, gamma=0, det=0;
+    int k=0;
+
+    g[0]=wt->irr;
+    g[1]=wt->irc;
+    g[2]=wt->icc;
+
+    for (k=0; k<3; k++) {
+        f[k] = g[k]-x[k];
+    }
+
+    if (self->have_prev) {
+        for (k=0; k<3; k++) {
+            self->dx[k] = x[k]-self->xprev[k];
+            self->df[k] = f[k]-self->fprev[k];
+        }
+        self->have_diff=1;
+    }
+
+    for (k=0; k<3; k++) {
+        self->xprev[k]=x[k];
+        self->fprev[k]=f[k];
+    }
+    self->have_prev=1;
+
+    if (!self->have_diff) {
+        return;
+    }
+
+    for (k=0; k<3; k++) {
+        dfdf += self->df[k]*self->df[k];
+        dff  += self->df[k]*f[k];
+        fsq  += f[k]*f[k];
+    }
+
+    // singular: the residual did not change between the iterations
+    if (dfdf <= 0.0 || dfdf <= 1.0e-24*fsq) {
+        self->have_diff=0;
+        return;
+    }
+
+    gamma = dff/dfdf;
+
+    for (k=0; k<3; k++) {
+        xnew[k] = g[k] - gamma*(self->dx[k] + self->df[k]);
+    }
+
+    det = xnew[0]*xnew[2] - xnew[1]*xnew[1];
+    if (xnew[0] <= 0.0 || xnew[2] <= 0.0 || det <= PYGMIX_LOW_DETVAL) {
+        // fall back to the plain step
+        self->have_diff=0;
+        return;
+    }
+
+    wt->irr = xnew[0];
+    wt->irc = xnew[1];
+    wt->icc = xnew[2];
+    wt->det = det;
+}
+
+
+
+static void admom(
+
+          const struct Admom *self,
+          const struct AdmomImage *image,
+          const struct PyGMix_Jacobian *jacob,
+
+          // weight should initially hold the guess
+          const struct PyGMix_Gauss2D *wtin,
+
+          struct AdmomResult *res
+	)
+
+{
+
+    struct PyGMix_Gauss2D wt={0};
+    struct AdmomAnderson anderson={0};
+    double 
+        roworig=0, colorig=0,
+        e1old=-9999, e2old=-9999, Told=-9999.0,
+        Irr=0, Irc=0, Icc, M1=0, M2=0, T=0, e1=0, e2=0;
+    double wold[3]={0};
+
+    int i=0;
+
+    wt = *wtin;
+
+    res->flags=0;
+
+    roworig=wt.row;
+    colorig=wt.col;
+
+    for (i=0; i<self->maxit; i++) {
+
+        // not throwing an exception
+        if (!gauss2d_set_norm(&wt,0) ) {
+            res->flags |= ADMOM_DET;
+            goto admom_bail;
+        }
+
+        // First the center
+        admom_clear_result(res);
+        admom_censums(self, image, jacob, &wt, res);
+        if (res->sums[5] <= 0.0) {
+            res->flags |= ADMOM_FAINT;
+            goto admom_bail;
+        }
+
+        wt.row = res->sums[0]/res->sums[5];
+        wt.col = res->sums[1]/res->sums[5];
+
+        // bail if the center shifted too far
+        if ( ( fabs(wt.row-roworig) > self->shiftmax)
+             ||
+             ( fabs(wt.col-colorig) > self->shiftmax)
+             ) {
+            res->flags |= ADMOM_SHIFT;
+            goto admom_bail;
+        }
+
+        // now the rest of the moment sums
+        admom_clear_result(res);
+        admom_momsums(self, image, jacob, &wt, res);
+
+        if (res->sums[5] <= 0.0) {
+            res->flags |= ADMOM_FAINT;
+            goto admom_bail;
+        }
+
+        // look for convergence
+        M1 = res->sums[2]/res->sums[5];
+        M2 = res->sums[3]/res->sums[5];
+        T  = res->sums[4]/res->sums[5];
+
+        Irr = 0.5*(T - M1);
+        Icc = 0.5*(T + M1);
+        Irc = 0.5*M2;
+
+        if (T <= 0.0) {
+            res->flags |= ADMOM_SMALL;
+            goto admom_bail;
+        }
+
+        e1 = (Icc - Irr)/T;
+        e2 = 2*Irc/T;
+
+        if ( 
+                ( fabs(e1-e1old) < self->etol)
+                &&
+                ( fabs(e2-e2old) < self->etol)
+                &&
+                ( fabs(T/Told-1.) < self->Ttol)
+           )  {
+
+            res->pars[0] = wt.row;
+            res->pars[1] = wt.col;
+            res->pars[2] = wt.icc - wt.irr;
+            res->pars[3] = 2.0*wt.irc;
+            res->pars[4] = wt.icc + wt.irr;
+            //res->pars[5] = res->sums[5]/res->wsum;
+            res->pars[5] = 1.0;
+
+            break;
+
+        } else {
+            // take the adaptive step
+
+            wold[0]=wt.irr;
+            wold[1]=wt.irc;
+            wold[2]=wt.icc;
+
+            res->flags |= take_adaptive_step_wt(&wt, Irr, Irc, Icc);
+            if (res->flags != 0) {
+                goto admom_bail;
+            }
+
+            if (self->accelerate) {
+                admom_anderson_step(&anderson, wold, &wt);
+            }
+
+            e1old=e1;
+            e2old=e2;
+            Told=T;
+
+        }
+
+    }
+
+admom_bail:
+
+    res->nimage=1;
+    res->numiter = i;
+
+    if (res->numiter==self->maxit) {
+        res->flags |= ADMOM_MAXIT;
+    }
+
+    return;
+}
+
+
+/*
+ these only do the covariance matrix, still need
+ to call gauss2d_set_norm to finalize
+ */
+static inline void admom_convolve(
+          struct PyGMix_Gauss2D *self,
+          const struct PyGMix_Gauss2D *psf)
+{
+    self->irr += psf->irr;
+    self->irc += psf->irc;
+    self->icc += psf->icc;
+
+    self->det = self->irr*self->icc - self->irc*self->irc;
+}
+
+static inline void admom_deconvolve(
+          struct PyGMix_Gauss2D *self,
+          const struct PyGMix_Gauss2D *psf)
+{
+    self->irr -= psf->irr;
+    self->irc -= psf->irc;
+    self->icc -= psf->icc;
+
+    self->det = self->irr*self->icc - self->irc*self->irc;
+}
+
+// only check the determinant is exactly zero
+// these are all sums, not divided by flux
+static int take_adaptive_step_nocheck(
+          double Wrr, double Wrc, double Wcc,
+          double Irr, double Irc, double Icc,
+          double *NewIrr, double *NewIrc, double *NewIcc)
+{
+    int flags=0;
+
+    double 
+        Nrr=0, Ncc=0, Nrc=0,
+        detn=0, idetn=0,
+        detm=0, idetm=0,
+        detw=0, idetw=0;
+
+    // measured moments
+    detm = Irr*Icc - Irc*Irc;
+    if (detm == 0.0) {
+        printf("detm zero\n");
+        flags=ADMOM_DET;
+        goto adaptive_step_bail;
+    }
+
+    detw = Wrr*Wcc - Wrc*Wrc;
+    if (detw == 0.0) {
+        printf("detw zero\n");
+        flags=ADMOM_DET;
+        goto adaptive_step_bail;
+    }
+
+    idetw=1.0/detw;
+    idetm=1.0/detm;
+
+    // Nrr etc. are actually of the inverted covariance matrix
+    Nrr =  Icc*idetm - Wcc*idetw;
+    Ncc =  Irr*idetm - Wrr*idetw;
+    Nrc = -Irc*idetm + Wrc*idetw;
+    detn = Nrr*Ncc - Nrc*Nrc;
+
+    if (detn == PYGMIX_LOW_DETVAL) {
+        printf("detn zero\n");
+        flags=ADMOM_DET;
+        goto adaptive_step_bail;
+    }
+
+    // now set from the inverted matrix
+    idetn=1./detn;
+    *NewIrr =  Ncc*idetn;
+    *NewIcc =  Nrr*idetn;
+    *NewIrc = -Nrc*idetn;
+
+adaptive_step_bail:
+    return flags;
+}
+
+
+static inline int
+admom_get_deconvolved_moments(
+          const struct PyGMix_Gauss2D *wt,  // should already be psf convolved
+          const struct PyGMix_Gauss2D *psf,
+          double Irr, double Irc, double Icc, // measured values
+          double *Irr0, double *Irc0, double *Icc0)
+{
+    int flags=0;
+
+    flags=take_adaptive_step(
+        wt->irr, wt->irc, wt->icc,
+        Irr, Irc, Icc,
+        Irr0, Irc0, Icc0
+    );
+
+    (*Irr0) -= psf->irr;
+    (*Irc0) -= psf->irc;
+    (*Icc0) -= psf->icc;
+
+    return flags;
+}
+
+
+static inline int
+admom_get_deconvolved_moments_nocheck(
+          const struct PyGMix_Gauss2D *wt,  // should already be psf convolved
+          const struct PyGMix_Gauss2D *psf,
+          double M1sum, double M2sum, double Tsum, double Fsum, // measured values
+          double *Irrsum0, double *Ircsum0, double *Iccsum0)
+{
+    int flags=0;
+
+    double Irrsum=0, Iccsum=0, Ircsum=0;
+
+    Irrsum = 0.5*(Tsum - M1sum);
+    Iccsum = 0.5*(Tsum + M1sum);
+    Ircsum = 0.5*M2sum;
+
+    flags=take_adaptive_step_nocheck(
+        wt->irr*Fsum, wt->irc*Fsum, wt->icc*Fsum,
+        Irrsum, Ircsum, Iccsum,
+        Irrsum0, Ircsum0, Iccsum0
+    );
+
+    (*Irrsum0) -= psf->irr*Fsum;
+    (*Ircsum0) -= psf->irc*Fsum;
+    (*Iccsum0) -= psf->icc*Fsum;
+
+    return flags;
+}
+
+static int admom_set_norm(struct PyGMix_Gauss2D *self)
+{
+    int status=0;
+    double idet=0;
+
+    if (self->det < PYGMIX_LOW_DETVAL) {
+        printf("weight det low: %g\n", self->det);
+        status=0;
+    } else {
+
+        idet=1.0/self->det;
+        self->drr = self->irr*idet;
+        self->drc = self->irc*idet;
+        self->dcc = self->icc*idet;
+        self->norm = 1./(2*M_PI*sqrt(self->det));
+
+        self->pnorm = self->p*self->norm;
+
+        self->norm_set=1;
+        status=1;
+    }
+
+    return status;
+
+}
+
+/*
+   get the center or moment sums for each epoch, with the epochs
+   split between threads.  The sums for epoch j are put in epoch_res[j],
+   to be combined in order with admom_reduce_epochs so the result does
+   not depend on the number of threads
+
+   If psfs is not NULL, the weight is convolved with the psf of each
+   epoch.  Returns 0 if the norm could not be set for the weight, in
+   which case the sums are not complete
+*/
+static int admom_epoch_sums(const struct Admom *self,
+                            const struct AdmomEpoch *epochs,
+                            const struct PyGMix_Gauss2D **psfs,
+                            int nimage,
+                            const struct PyGMix_Gauss2D *wt,
+                            int domom,
+                            struct AdmomResult *epoch_res,
+                            int nthreads)
+{
+    int j=0, status=1;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads) if(nthreads > 1) reduction(&&:status)
+#endif
+    for (j=0; j<nimage; j++) {
+        const struct AdmomEpoch *epoch=&epochs[j];
+        struct AdmomResult *eres=&epoch_res[j];
+        struct PyGMix_Gauss2D twt=*wt;
+
+        admom_clear_result(eres);
+
+        if (psfs) {
+            admom_convolve(&twt, psfs[j]);
+            if (!admom_set_norm(&twt) ) {
+                status = 0;
+                continue;
+            }
+        }
+
+        if (epoch->pixels) {
+            if (domom) {
+                admom_momsums_pixels(self, epoch->pixels, epoch->npix,
+                                     &twt, eres);
+            } else {
+                admom_censums_pixels(self, epoch->pixels, epoch->npix,
+                                     &twt, eres);
+            }
+        } else {
+            if (domom) {
+                admom_momsums(self, &epoch->image, epoch->jacob,
+                              &twt, eres);
+            } else {
+                admom_censums(self, &epoch->image, epoch->jacob,
+                              &twt, eres);
+            }
+        }
+    }
+
+    return status;
+}
+
+/*
+   add the epoch sums into res, in order
+*/
+static void admom_reduce_epochs(const struct AdmomResult *epoch_res,
+                                int nimage,
+                                struct AdmomResult *res)
+{
+    int i=0, j=0;
+    const struct AdmomResult *eres=NULL;
+
+    for (j=0; j<nimage; j++) {
+        eres=&epoch_res[j];
+
+        res->info_flags |= eres->info_flags;
+        res->npix += eres->npix;
+        res->wsum += eres->wsum;
+
+        for (i=0; i<6; i++) {
+            res->sums[i] += eres->sums[i];
+        }
+        for (i=0; i<36; i++) {
+            res->sums_cov[i] += eres->sums_cov[i];
+        }
+    }
+}
+
+/*
+static void admom_multi_deconv(
+
+          const struct Admom *self,
+
+          // eventually will be lists of images, jacobians, and psfs
+          const PyObject** im_list,
+          const PyObject** ivarim_list,
+          const struct PyGMix_Gauss2D** psf_list,
+          const struct PyGMix_Jacobian** jacob_list,
+          int nimage,
+
+          // weight should initially hold the guess
+          const struct PyGMix_Gauss2D *wtin,
+
+          struct AdmomResult *res
+	)
+
+{
+
+    struct PyGMix_Gauss2D wt={0};
+    double 
+        roworig=0, colorig=0,
+        e1old=-9999, e2old=-9999, Told=-9999.0,
+        Irr=0, Irc=0, Icc, M1=0, M2=0, T=0, e1=0, e2=0,
+        Irrsum=0, Ircsum=0, Iccsum=0,
+        Irrsum0=0, Ircsum0=0, Iccsum0=0;
+
+    int i=0, j=0;
+
+    wt = *wtin;
+
+    res->flags=0;
+
+    roworig=wt.row;
+    colorig=wt.col;
+
+    for (i=0; i<self->maxit; i++) {
+
+
+        // First the center, using overall sums to get the center in sky coords
+
+        admom_clear_result(res);
+
+        for (j=0; j<nimage; j++) {
+            admom_convolve(&wt, psf_list[j]);
+
+            // we won't need to test these again during this iteration
+            if (!admom_set_norm(&wt) ) {
+                res->flags |= ADMOM_DET;
+                goto admom_bail;
+            }
+
+            admom_censums(self, im_list[j], jacob_list[j], &wt, res);
+            admom_deconvolve(&wt, psf_list[j]);
+        }
+
+        if (res->sums[5] <= 0.0) {
+            res->flags |= ADMOM_FAINT;
+            goto admom_bail;
+        }
+
+        wt.row = res->sums[0]/res->sums[5];
+        wt.col = res->sums[1]/res->sums[5];
+
+        // bail if the center shifted too far
+        if ( ( fabs(wt.row-roworig) > self->shiftmax)
+             ||
+             ( fabs(wt.col-colorig) > self->shiftmax)
+             ) {
+            res->flags |= ADMOM_SHIFT;
+            goto admom_bail;
+        }
+
+        // now the rest of the moment sums. This will require
+        // some intermediate values for each image to be
+        // calculated and averaged
+
+        Irrsum=Ircsum=Iccsum=0;
+        Irrsum0=Ircsum0=Iccsum0=0;
+        for (j=0; j<nimage; j++) {
+            admom_clear_result(res);
+
+            admom_convolve(&wt, psf_list[j]);
+            admom_set_norm(&wt);
+
+            admom_momsums(self,
+                          im_list[j], ivarim_list[j], jacob_list[j],
+                          &wt, res);
+
+            if (res->sums[5] <= 0.0) {
+                res->flags = ADMOM_FAINT;
+                goto admom_bail;
+            }
+
+            M1 = res->sums[2]/res->sums[5];
+            M2 = res->sums[3]/res->sums[5];
+            T  = res->sums[4]/res->sums[5];
+
+            Irr = 0.5*(T - M1);
+            Icc = 0.5*(T + M1);
+            Irc = 0.5*M2;
+
+            Irrsum += Irr;
+            Ircsum += Irc;
+            Iccsum += Icc;
+
+            // now deconvolved covar, which we will average over
+            // the exposures, for the adaptive step
+            res->flags = admom_get_deconvolved_moments(
+                &wt, psf_list[j],
+                Irr, Irc, Icc,
+                &Irr, &Irc, &Icc
+            );
+
+            if (res->flags!=0) {
+                goto admom_bail;
+            }
+
+            Irrsum0 += Irr;
+            Ircsum0 += Irc;
+            Iccsum0 += Icc;
+
+            admom_deconvolve(&wt, psf_list[j]);
+
+        }
+
+
+        // look for convergence in mean of the convolved
+        // moments, since T could be zero for the deconvolved
+        // moments
+        Irr = Irrsum/nimage;
+        Irc = Ircsum/nimage;
+        Icc = Iccsum/nimage;
+        T = Irr+Icc;
+
+        if (T <= 0.0) {
+            res->flags = ADMOM_SMALL;
+            goto admom_bail;
+        }
+
+        e1 = (Icc - Irr)/T;
+        e2 = 2*Irc/T;
+
+        if ( 
+                ( fabs(e1-e1old) < self->etol)
+                &&
+                ( fabs(e2-e2old) < self->etol)
+                &&
+                ( fabs(T/Told-1.) < self->Ttol)
+           )  {
+
+            res->pars[0] = wt.row;
+            res->pars[1] = wt.col;
+            res->pars[2] = wt.icc - wt.irr;
+            res->pars[3] = 2.0*wt.irc;
+            res->pars[4] = wt.icc + wt.irr;
+            //res->pars[5] = res->sums[5]/res->wsum;
+            res->pars[5] = 1.0;
+
+            break;
+
+        } else {
+
+            // use mean of the deconvolved, adaptive stepped moments
+            // from each image
+
+            Irr = Irrsum0/nimage;
+            Irc = Ircsum0/nimage;
+            Icc = Iccsum0/nimage;
+            gauss2d_set(&wt, 1.0, wt.row, wt.col, Irr, Irc, Icc);
+
+            e1old=e1;
+            e2old=e2;
+            Told=T;
+
+        }
+
+    }
+
+admom_bail:
+
+    res->nimage=nimage;
+
+    res->numiter = i;
+    if (res->flags != 0) {
+        // we exited with a goto
+        res->numiter+=1;
+    }
+
+    if (res->numiter==self->maxit) {
+        res->flags = ADMOM_MAXIT;
+    }
+
+    return;
+}
+*/
+
+static void admom_multi(
+
+          const struct Admom *self,
+
+          const struct AdmomEpoch *epochs,
+          int nimage,
+
+          // weight should initially hold the guess
+          const struct PyGMix_Gauss2D *wtin,
+
+          struct AdmomResult *res,
+
+          // scratch for the sums from each epoch, nimage entries
+          struct AdmomResult *epoch_res,
+          int nthreads
+	)
+
+{
+
+    struct PyGMix_Gauss2D wt={0};
+    struct AdmomAnderson anderson={0};
+    double 
+        roworig=0, colorig=0,
+        e1old=-9999, e2old=-9999, Told=-9999.0,
+        Irr=0, Irc=0, Icc, M1=0, M2=0, T=0, e1=0, e2=0;
+    double wold[3]={0};
+
+    int i=0;
+
+    wt = *wtin;
+
+    res->flags=0;
+
+    roworig=wt.row;
+    colorig=wt.col;
+
+    for (i=0; i<self->maxit; i++) {
+
+        if (!gauss2d_set_norm(&wt,0) ) {
+            res->flags |= ADMOM_DET;
+            goto admom_multi_bail;
+        }
+
+        // First the center, using overall sums to get the center in sky coords
+
+        admom_clear_result(res);
+
+        admom_epoch_sums(self, epochs, NULL, nimage, &wt, 0,
+                         epoch_res, nthreads);
+        admom_reduce_epochs(epoch_res, nimage, res);
+
+        if (res->sums[5] <= 0.0) {
+            res->flags |= ADMOM_FAINT;
+            goto admom_multi_bail;
+        }
+
+        wt.row = res->sums[0]/res->sums[5];
+        wt.col = res->sums[1]/res->sums[5];
+
+        // bail if the center shifted too far
+        if ( ( fabs(wt.row-roworig) > self->shiftmax)
+             ||
+             ( fabs(wt.col-colorig) > self->shiftmax)
+             ) {
+            res->flags |= ADMOM_SHIFT;
+            goto admom_multi_bail;
+        }
+
+        // now the rest of the moment sums. This will require
+        // some intermediate values for each image to be
+        // calculated and averaged
+
+        admom_clear_result(res);
+
+        admom_epoch_sums(self, epochs, NULL, nimage, &wt, 1,
+                         epoch_res, nthreads);
+        admom_reduce_epochs(epoch_res, nimage, res);
+
+        if (res->sums[5] <= 0.0) {
+            res->flags |= ADMOM_FAINT;
+            goto admom_multi_bail;
+        }
+
+        // look for convergence
+        T  = res->sums[4]/res->sums[5];
+
+        if (T <= 0.0) {
+            res->flags |= ADMOM_SMALL;
+            goto admom_multi_bail;
+        }
+
+        e1 = res->sums[2]/res->sums[4];
+        e2 = res->sums[3]/res->sums[4];
+
+        if ( 
+                ( fabs(e1-e1old) < self->etol)
+                &&
+                ( fabs(e2-e2old) < self->etol)
+                &&
+                ( fabs(T/Told-1.) < self->Ttol)
+           )  {
+
+            res->pars[0] = wt.row;
+            res->pars[1] = wt.col;
+            res->pars[2] = wt.icc - wt.irr;
+            res->pars[3] = 2.0*wt.irc;
+            res->pars[4] = wt.icc + wt.irr;
+            res->pars[5] = res->sums[5]/res->wsum;
+
+            break;
+
+        } else {
+            // take the adaptive step: deweight the moments
+
+            M1 = res->sums[2]/res->sums[5];
+            M2 = res->sums[3]/res->sums[5];
+            Irr = 0.5*(T - M1);
+            Icc = 0.5*(T + M1);
+            Irc = 0.5*M2;
+
+            wold[0]=wt.irr;
+            wold[1]=wt.irc;
+            wold[2]=wt.icc;
+
+            res->flags |= take_adaptive_step_wt(&wt, Irr, Irc, Icc);
+            if (res->flags != 0) {
+                goto admom_multi_bail;
+            }
+
+            if (self->accelerate) {
+                admom_anderson_step(&anderson, wold, &wt);
+            }
+
+            e1old=e1;
+            e2old=e2;
+            Told=T;
+
+        }
+
+    }
+
+admom_multi_bail:
+
+    res->nimage=nimage;
+
+    res->numiter = i;
+    if (res->flags != 0) {
+        // we exited with a goto
+        res->numiter+=1;
+    }
+
+    if (res->numiter==self->maxit) {
+        res->flags = ADMOM_MAXIT;
+    }
+
+    return;
+}
+
+
+
+
+static void admom_multi_deconv_nocheck(
+
+          const struct Admom *self,
+
+          const struct AdmomEpoch *epochs,
+          const struct PyGMix_Gauss2D** psf_list,
+          int nimage,
+
+          // weight should initially hold the guess
+          const struct PyGMix_Gauss2D *wtin,
+
+          struct AdmomResult *res,
+
+          // scratch for the sums from each epoch, nimage entries
+          struct AdmomResult *epoch_res,
+          int nthreads
+	)
+
+{
+
+    struct PyGMix_Gauss2D wt={0}, twt={0};
+    const struct AdmomResult *eres=NULL;
+    double 
+        roworig=0, colorig=0,
+        e1old=-9999, e2old=-9999, Told=-9999.0,
+        Irr=0, Irc=0, Icc,
+        //M1=0, M2=0,
+        T=0, e1=0, e2=0,
+        M1sum=0, M2sum=0, Tsum=0, Fsum=0,
+        tIrrsum=0, tIrcsum=0, tIccsum=0,
+        Irrsum0=0, Ircsum0=0, Iccsum0=0;
+
+    int i=0, j=0, nuse=0;
+
+    wt = *wtin;
+
+    res->flags=0;
+
+    roworig=wt.row;
+    colorig=wt.col;
+
+    for (i=0; i<self->maxit; i++) {
+
+
+        // First the center, using overall sums to get the center in sky coords
+
+        admom_clear_result(res);
+
+        // the weight is convolved with the psf of each epoch
+        // we won't need to test the norm again during this iteration
+        if (!admom_epoch_sums(self, epochs, psf_list, nimage, &wt, 0,
+                              epoch_res, nthreads)) {
+            res->flags |= ADMOM_DET;
+            goto admom_bail;
+        }
+        admom_reduce_epochs(epoch_res, nimage, res);
+
+        if (res->sums[5] <= 0.0) {
+            res->flags |= ADMOM_FAINT;
+            goto admom_bail;
+        }
+
+        wt.row = res->sums[0]/res->sums[5];
+        wt.col = res->sums[1]/res->sums[5];
+
+        // bail if the center shifted too far
+        if ( ( fabs(wt.row-roworig) > self->shiftmax)
+             ||
+             ( fabs(wt.col-colorig) > self->shiftmax)
+             ) {
+            res->flags |= ADMOM_SHIFT;
+            goto admom_bail;
+        }
+
+        // now the rest of the moment sums. This will require
+        // some intermediate values for each image to be
+        // calculated and averaged
+
+        Irrsum0=Ircsum0=Iccsum0=0;
+        M1sum=M2sum=Tsum=Fsum=0;
+        nuse=0;
+
+        admom_epoch_sums(self, epochs, psf_list, nimage, &wt, 1,
+                         epoch_res, nthreads);
+
+        admom_clear_result(res);
+        admom_reduce_epochs(epoch_res, nimage, res);
+
+        for (j=0; j<nimage; j++) {
+            eres = &epoch_res[j];
+
+            twt = wt;
+            admom_convolve(&twt, psf_list[j]);
+
+            if (eres->sums[5] < 0.0) {
+                printf("Fsum: %g\n", eres->sums[5]);
+                continue;
+            }
+
+            // we need normalized moments to psf correct
+            /*
+            if (res->sums[5] <= 0.0) {
+                res->flags = ADMOM_FAINT;
+                goto admom_bail;
+            }
+            */
+
+            M1sum += eres->sums[2];
+            M2sum += eres->sums[3];
+            Tsum  += eres->sums[4];
+            Fsum  += eres->sums[5];
+
+            // now deconvolved covar, which we will average over
+            // the exposures, for the adaptive step
+
+            /*
+            M1 = res->sums[2]/res->sums[5];
+            M2 = res->sums[3]/res->sums[5];
+            T  = res->sums[4]/res->sums[5];
+            res->flags = admom_get_deconvolved_moments_nocheck(
+                &wt, psf_list[j],
+                M1, M2, T,
+                &Irr, &Irc, &Icc
+            );
+            */
+            res->flags = admom_get_deconvolved_moments_nocheck(
+                &twt, psf_list[j],
+                eres->sums[2], eres->sums[3], eres->sums[4],
+                //M1, M2, T,
+                //1.0,
+                eres->sums[5],
+                &tIrrsum, &tIrcsum, &tIccsum
+            );
+
+            if (res->flags!=0) {
+                goto admom_bail;
+            }
+
+            Irrsum0 += tIrrsum;
+            Ircsum0 += tIrcsum;
+            Iccsum0 += tIccsum;
+
+            nuse +=1;
+        }
+
+        if (Fsum <= 0.0) {
+            res->flags = ADMOM_FAINT;
+            goto admom_bail;
+        }
+        if (Tsum <= 0.0) {
+            res->flags = ADMOM_SMALL;
+            goto admom_bail;
+        }
+
+        // look for convergence in mean of the convolved
+        // moments, since T could be zero for the deconvolved
+        // moments
+
+        e1 = M1sum/Tsum;
+        e2 = M2sum/Tsum;
+        T  = Tsum/Fsum;
+
+        if ( 
+                ( fabs(e1-e1old) < self->etol)
+                &&
+                ( fabs(e2-e2old) < self->etol)
+                &&
+                ( fabs(T/Told-1.) < self->Ttol)
+           )  {
+
+            // deconvolved weight
+            res->pars[0] = wt.row;
+            res->pars[1] = wt.col;
+            res->pars[2] = wt.icc - wt.irr;
+            res->pars[3] = 2.0*wt.irc;
+            res->pars[4] = wt.icc + wt.irr;
+            res->pars[5] = res->sums[5]/res->wsum;
+
+            break;
+
+        } else {
+
+            // use mean of the deconvolved, adaptive stepped moments
+            // from each image
+
+            Irr = Irrsum0/Fsum;
+            Irc = Ircsum0/Fsum;
+            Icc = Iccsum0/Fsum;
+            //Irr = Irrsum0/nuse;
+            //Irc = Ircsum0/nuse;
+            //Icc = Iccsum0/nuse;
+            gauss2d_set(&wt, 1.0, wt.row, wt.col, Irr, Irc, Icc);
+
+            e1old=e1;
+            e2old=e2;
+            Told=T;
+
+        }
+
+    }
+
+admom_bail:
+
+    res->nimage=nimage;
+
+    res->numiter = i;
+    if (res->flags != 0) {
+        // we exited with a goto
+        res->numiter+=1;
+    }
+
+    if (res->numiter==self->maxit) {
+        res->flags = ADMOM_MAXIT;
+    }
+
+    return;
+}
+
+
+
+
+static PyObject * PyGMix_admom(PyObject* self, PyObject* args) {
+
+    PyObject* admom_obj=NULL;
+
+    // the weight gaussian
+    PyObject* wt_obj=NULL;
+
+    PyObject* image_obj=NULL;
+    PyObject* ivarim_obj=NULL;
+    PyObject* jacob_obj=NULL;
+
+    PyObject* res_obj=NULL;
+
+    struct PyGMix_Gauss2D *wt=NULL;
+
+    struct PyGMix_Jacobian *jacob=NULL;
+
+    struct Admom *admom_conf =NULL;
+    struct AdmomResult *res=NULL;
+    struct AdmomImage image={0};
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOO", 
+                          &admom_obj,
+                          &image_obj,
+                          &ivarim_obj,
+                          &jacob_obj,
+                          &wt_obj,
+                          &res_obj)) {
+        return NULL;
+    }
+
+    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
+    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
+    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
+    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+
+    admom_image_set(&image, image_obj, ivarim_obj);
+
+    Py_BEGIN_ALLOW_THREADS
+    admom(admom_conf, &image, jacob, wt, res);
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+/*
+   run admom on a batch of objects, split between threads with the GIL
+   released
+
+   images and ivars are [N, nrow, ncol] stacks of stamps, and jacobs, wts
+   and res have N entries
+*/
+static PyObject * PyGMix_admom_batch(PyObject* self, PyObject* args) {
+
+    PyObject* admom_obj=NULL;
+    PyObject* images_obj=NULL;
+    PyObject* ivars_obj=NULL;
+    PyObject* jacobs_obj=NULL;
+    PyObject* wts_obj=NULL;
+    PyObject* res_obj=NULL;
+    int nthreads=0;
+
+    const struct Admom *admom_conf =NULL;
+    const struct PyGMix_Gauss2D *wts=NULL;
+    const struct PyGMix_Jacobian *jacobs=NULL;
+    struct AdmomResult *res=NULL;
+    npy_intp n_batch=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOi", 
+                          &admom_obj,
+                          &images_obj,
+                          &ivars_obj,
+                          &jacobs_obj,
+                          &wts_obj,
+                          &res_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    n_batch=PyArray_DIM(images_obj, 0);
+
+    if (PyArray_DIM(ivars_obj, 0) != n_batch
+            || PyArray_SIZE(jacobs_obj) != n_batch
+            || PyArray_SIZE(wts_obj) != n_batch
+            || PyArray_SIZE(res_obj) != n_batch) {
+        PyErr_Format(GMixFatalError, 
+                     "all inputs must have %ld objects", n_batch);
+        return NULL;
+    }
+
+    admom_conf=(const struct Admom* ) PyArray_DATA(admom_obj);
+    wts=(const struct PyGMix_Gauss2D* ) PyArray_DATA(wts_obj);
+    jacobs=(const struct PyGMix_Jacobian* ) PyArray_DATA(jacobs_obj);
+    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+#endif
+    for (i=0; i<n_batch; i++) {
+        struct AdmomImage image={0};
+
+        image.image           = PyArray_GETPTR3(images_obj, i, 0, 0);
+        image.n_row           = PyArray_DIM(images_obj, 1);
+        image.n_col           = PyArray_DIM(images_obj, 2);
+        image.row_stride      = PyArray_STRIDE(images_obj, 1);
+        image.col_stride      = PyArray_STRIDE(images_obj, 2);
+
+        image.ivar            = PyArray_GETPTR3(ivars_obj, i, 0, 0);
+        image.ivar_row_stride = PyArray_STRIDE(ivars_obj, 1);
+        image.ivar_col_stride = PyArray_STRIDE(ivars_obj, 2);
+
+        admom(admom_conf, &image, &jacobs[i], &wts[i], &res[i]);
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+/*
+   run admom on objects in a single large image, split between threads
+   with the GIL released
+
+   windows is [N, 4] int64 holding rowmin, colmin, nrow, ncol for each
+   object, which is clipped to the image.  The sums only use pixels in
+   the window; the jacobians are with respect to the full image
+*/
+static PyObject * PyGMix_admom_batch_windows(PyObject* self, PyObject* args) {
+
+    PyObject* admom_obj=NULL;
+    PyObject* image_obj=NULL;
+    PyObject* ivar_obj=NULL;
+    PyObject* windows_obj=NULL;
+    PyObject* jacobs_obj=NULL;
+    PyObject* wts_obj=NULL;
+    PyObject* res_obj=NULL;
+    int nthreads=0;
+
+    const struct Admom *admom_conf =NULL;
+    const struct PyGMix_Gauss2D *wts=NULL;
+    const struct PyGMix_Jacobian *jacobs=NULL;
+    const npy_int64 *windows=NULL;
+    struct AdmomResult *res=NULL;
+    struct AdmomImage full={0};
+    npy_intp n_batch=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOi", 
+                          &admom_obj,
+                          &image_obj,
+                          &ivar_obj,
+                          &windows_obj,
+                          &jacobs_obj,
+                          &wts_obj,
+                          &res_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    n_batch=PyArray_SIZE(jacobs_obj);
+
+    if (PyArray_DIM(windows_obj, 0) != n_batch
+            || PyArray_SIZE(windows_obj) != 4*n_batch
+            || PyArray_SIZE(wts_obj) != n_batch
+            || PyArray_SIZE(res_obj) != n_batch) {
+        PyErr_Format(GMixFatalError, 
+                     "all inputs must have %ld objects", n_batch);
+        return NULL;
+    }
+
+    admom_conf=(const struct Admom* ) PyArray_DATA(admom_obj);
+    windows=(const npy_int64* ) PyArray_DATA(windows_obj);
+    wts=(const struct PyGMix_Gauss2D* ) PyArray_DATA(wts_obj);
+    jacobs=(const struct PyGMix_Jacobian* ) PyArray_DATA(jacobs_obj);
+    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    admom_image_set(&full, image_obj, ivar_obj);
+
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+#endif
+    for (i=0; i<n_batch; i++) {
+        struct AdmomImage image=full;
+        struct PyGMix_Jacobian jacob=jacobs[i];
+        npy_intp rowmin=0, colmin=0, rowmax=0, colmax=0;
+
+        rowmin = windows[4*i+0];
+        colmin = windows[4*i+1];
+        rowmax = rowmin + windows[4*i+2] - 1;
+        colmax = colmin + windows[4*i+3] - 1;
+
+        if (rowmin < 0) rowmin=0;
+        if (colmin < 0) colmin=0;
+        if (rowmax > full.n_row-1) rowmax=full.n_row-1;
+        if (colmax > full.n_col-1) colmax=full.n_col-1;
+
+        // a view of the window, with the jacobian center relative to it
+        image.n_row = rowmax-rowmin+1;
+        image.n_col = colmax-colmin+1;
+        if (image.n_row < 0) image.n_row=0;
+        if (image.n_col < 0) image.n_col=0;
+
+        image.image += rowmin*full.row_stride + colmin*full.col_stride;
+        image.ivar  += rowmin*full.ivar_row_stride
+                       + colmin*full.ivar_col_stride;
+
+        jacob.row0 -= rowmin;
+        jacob.col0 -= colmin;
+
+        admom(admom_conf, &image, &jacob, &wts[i], &res[i]);
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+/*
+   set up the epochs from python lists of images, inverse variance
+   images and jacobians.  Returns 0 and sets an exception on error
+*/
+static int admom_epochs_from_lists(struct AdmomEpoch *epochs,
+                                   PyObject* image_obj,
+                                   PyObject* ivarim_obj,
+                                   PyObject* jacob_obj,
+                                   Py_ssize_t nimage,
+                                   PyObject* epoch_res_obj)
+{
+    PyObject* tmp=NULL;
+    Py_ssize_t i=0;
+
+    if (nimage > ADMOM_MAX_EPOCHS) {
+        PyErr_Format(GMixFatalError, 
+                     "admom supports at most %d images, got %ld",
+                     ADMOM_MAX_EPOCHS, nimage);
+        return 0;
+    }
+    if (PyArray_SIZE(epoch_res_obj) < nimage) {
+        PyErr_Format(GMixFatalError, 
+                     "epoch scratch has %ld entries, need %ld",
+                     PyArray_SIZE(epoch_res_obj), nimage);
+        return 0;
+    }
+
+    for (i=0; i<nimage; i++) {
+        admom_image_set(&epochs[i].image,
+                        PyList_GetItem(image_obj, i),
+                        PyList_GetItem(ivarim_obj, i));
+
+        tmp = PyList_GetItem(jacob_obj, i);
+        epochs[i].jacob = (const struct PyGMix_Jacobian* ) PyArray_DATA(tmp);
+        epochs[i].pixels = NULL;
+        epochs[i].npix = 0;
+    }
+
+    return 1;
+}
+
+static PyObject * PyGMix_admom_multi_deconv(PyObject* self, PyObject* args) {
+
+    PyObject* admom_obj=NULL;
+
+    // the weight gaussian
+    PyObject* wt_obj=NULL;
+    PyObject* psfs_obj=NULL;
+
+    PyObject* image_obj=NULL;
+    PyObject* ivarim_obj=NULL;
+    PyObject* jacob_obj=NULL;
+
+    PyObject* res_obj=NULL;
+    PyObject* epoch_res_obj=NULL;
+    int nthreads=0;
+
+    struct PyGMix_Gauss2D *wt=NULL;
+
+    struct Admom *admom_conf =NULL;
+    struct AdmomResult *res=NULL, *epoch_res=NULL;
+
+    // just for packing in pointers from the python lists
+    PyObject* tmp=NULL;
+    struct PyGMix_Gauss2D *tgauss=NULL;
+
+    struct AdmomEpoch epochs[ADMOM_MAX_EPOCHS];
+    const struct PyGMix_Gauss2D* psf_list[ADMOM_MAX_EPOCHS]={0};
+
+    Py_ssize_t nimage=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOOi", 
+                          &admom_obj,
+                          &image_obj,
+                          &ivarim_obj,
+                          &psfs_obj,
+                          &jacob_obj,
+                          &wt_obj,
+                          &res_obj,
+                          &epoch_res_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    nimage = PyList_Size(image_obj);
+
+    if (!admom_epochs_from_lists(epochs, image_obj, ivarim_obj, jacob_obj,
+                                 nimage, epoch_res_obj)) {
+        return NULL;
+    }
+
+    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
+    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
+    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+    epoch_res=(struct AdmomResult* ) PyArray_DATA(epoch_res_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    for (i=0; i<nimage; i++) {
+        tmp = PyList_GetItem(psfs_obj, i);
+        tgauss=(struct PyGMix_Gauss2D* ) PyArray_DATA(tmp);
+        psf_list[i] = tgauss;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    //admom_multi_deconv(
+    admom_multi_deconv_nocheck(
+        admom_conf,
+        epochs,
+        psf_list,
+        (int)nimage,
+        wt,
+        res,
+        epoch_res,
+        nthreads
+    );
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+
+
+
+
+static PyObject * PyGMix_admom_multi(PyObject* self, PyObject* args) {
+
+    PyObject* admom_obj=NULL;
+
+    // the weight gaussian
+    PyObject* wt_obj=NULL;
+
+    PyObject* image_obj=NULL;
+    PyObject* ivarim_obj=NULL;
+    PyObject* jacob_obj=NULL;
+
+    PyObject* res_obj=NULL;
+    PyObject* epoch_res_obj=NULL;
+    int nthreads=0;
+
+    struct PyGMix_Gauss2D *wt=NULL;
+
+    struct Admom *admom_conf =NULL;
+    struct AdmomResult *res=NULL, *epoch_res=NULL;
+
+    struct AdmomEpoch epochs[ADMOM_MAX_EPOCHS];
+
+    Py_ssize_t nimage=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOOi", 
+                          &admom_obj,
+                          &image_obj,
+                          &ivarim_obj,
+                          &jacob_obj,
+                          &wt_obj,
+                          &res_obj,
+                          &epoch_res_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    nimage = PyList_Size(image_obj);
+
+    if (!admom_epochs_from_lists(epochs, image_obj, ivarim_obj, jacob_obj,
+                                 nimage, epoch_res_obj)) {
+        return NULL;
+    }
+
+    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
+    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
+    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+    epoch_res=(struct AdmomResult* ) PyArray_DATA(epoch_res_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+    admom_multi(
+        admom_conf,
+        epochs,
+        (int)nimage,
+        wt,
+        res,
+        epoch_res,
+        nthreads
+    );
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+/*
+   multi-epoch admom using pixels as made by fill_pixels.  The pixels for
+   all epochs are in a single array, with epoch j in the range
+   offsets[j] to offsets[j+1]
+*/
+static PyObject * PyGMix_admom_multi_pixels(PyObject* self, PyObject* args) {
+
+    PyObject* admom_obj=NULL;
+    PyObject* pixels_obj=NULL;
+    PyObject* offsets_obj=NULL;
+    PyObject* wt_obj=NULL;
+    PyObject* res_obj=NULL;
+    PyObject* epoch_res_obj=NULL;
+    int nthreads=0;
+
+    struct PyGMix_Gauss2D *wt=NULL;
+    const struct PyGMix_Pixel *pixels=NULL;
+    const npy_int64 *offsets=NULL;
+
+    struct Admom *admom_conf =NULL;
+    struct AdmomResult *res=NULL, *epoch_res=NULL;
+
+    struct AdmomEpoch epochs[ADMOM_MAX_EPOCHS];
+
+    npy_intp nimage=0, npix=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOi", 
+                          &admom_obj,
+                          &pixels_obj,
+                          &offsets_obj,
+                          &wt_obj,
+                          &res_obj,
+                          &epoch_res_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    nimage = PyArray_SIZE(offsets_obj)-1;
+    npix = PyArray_SIZE(pixels_obj);
+
+    if (nimage < 1 || nimage > ADMOM_MAX_EPOCHS) {
+        PyErr_Format(GMixFatalError, 
+                     "admom supports 1 to %d images, got %ld",
+                     ADMOM_MAX_EPOCHS, nimage);
+        return NULL;
+    }
+    if (PyArray_SIZE(epoch_res_obj) < nimage) {
+        PyErr_Format(GMixFatalError, 
+                     "epoch scratch has %ld entries, need %ld",
+                     PyArray_SIZE(epoch_res_obj), nimage);
+        return NULL;
+    }
+
+    pixels=(const struct PyGMix_Pixel* ) PyArray_DATA(pixels_obj);
+    offsets=(const npy_int64* ) PyArray_DATA(offsets_obj);
+
+    for (i=0; i<nimage; i++) {
+        if (offsets[i] < 0 || offsets[i] > offsets[i+1]
+                || offsets[i+1] > npix) {
+            PyErr_Format(GMixFatalError, 
+                         "bad pixel offsets for image %ld", i);
+            return NULL;
+        }
+
+        memset(&epochs[i], 0, sizeof(struct AdmomEpoch));
+        epochs[i].pixels = &pixels[offsets[i]];
+        epochs[i].npix = offsets[i+1]-offsets[i];
+    }
+
+    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
+    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
+    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+    epoch_res=(struct AdmomResult* ) PyArray_DATA(epoch_res_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+    admom_multi(
+        admom_conf,
+        epochs,
+        (int)nimage,
+        wt,
+        res,
+        epoch_res,
+        nthreads
+    );
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+/*
+   convert log pars to linear pars
+   pars 4: are converted
+*/
+static 
+PyObject * PyGMix_convert_simple_double_logpars(PyObject* self, PyObject* args) {
+
+    PyObject* logpars_obj=NULL;
+    PyObject* pars_obj=NULL;
+    int i, npars;
+    double *logpars=NULL, *pars=NULL;
+
+    // weight object is currently ignored
+    if (!PyArg_ParseTuple(args, (char*)"OO", 
+                          &logpars_obj,
+                          &pars_obj)) {
+        return NULL;
+    }
+
+    logpars=PyArray_DATA(logpars_obj);
+    pars=PyArray_DATA(pars_obj);
+
+    npars=PyArray_SIZE(logpars_obj);
+
+    for (i=0; i<npars; i++) {
+        if (i < 4) {
+        //if (i != 4) {
+            pars[i] = logpars[i];
+        } else {
+            pars[i] = pow(10.0, logpars[i]);
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+/*
+   convert log pars to linear pars, pulling out a specific band
+
+   no error checking done here
+*/
+static 
+PyObject * PyGMix_convert_simple_double_logpars_band(PyObject* self, PyObject* args) {
+
+    PyObject* logpars_obj=NULL;
+    PyObject* pars_obj=NULL;
+    int band=0;
+    double *logpars=NULL, *pars=NULL;
+
+    // weight object is currently ignored
+    if (!PyArg_ParseTuple(args, (char*)"OOi", 
+                          &logpars_obj,
+                          &pars_obj,
+                          &band)) {
+        return NULL;
+    }
+
+    logpars=PyArray_DATA(logpars_obj);
+    pars=PyArray_DATA(pars_obj);
+
+    pars[0] = logpars[0];
+    pars[1] = logpars[1];
+    pars[2] = logpars[2];
+    pars[3] = logpars[3];
+    pars[4] = exp( logpars[4] );
+    pars[5] = exp( logpars[5+band] );
+    //pars[5] = logpars[5+band];
+
+    Py_RETURN_NONE;
+}
+
+
+/*
+   convert eta pars to g1,g2 pars
+
+   no error checking done here
+*/
+static 
+PyObject * PyGMix_convert_simple_eta2g_band(PyObject* self, PyObject* args) {
+
+    PyObject* etapars_obj=NULL;
+    PyObject* gpars_obj=NULL;
+    int band=0;
+    double *etapars=NULL, *gpars=NULL;
+    double g1=0, g2=0;
+    int status=0;
+
+    // weight object is currently ignored
+    if (!PyArg_ParseTuple(args, (char*)"OOi", 
+                          &etapars_obj,
+                          &gpars_obj,
+                          &band)) {
+        return NULL;
+    }
+
+    etapars=PyArray_DATA(etapars_obj);
+    gpars=PyArray_DATA(gpars_obj);
+
+    status=eta1eta2_to_g1g2(etapars[2], etapars[3], &g1, &g2);
+
+
+    gpars[0] = etapars[0];
+    gpars[1] = etapars[1];
+    gpars[2] = g1;
+    gpars[3] = g2;
+    gpars[4] = etapars[4];
+    gpars[5] = etapars[5+band];
+
+    return Py_BuildValue("i", status);
+}
+
+
+
+/*
+
+   full-covariance, nd-gaussian evaluations
+
+   can do either log or linear
+       log_pnorms, means, icovars, tmp_lnprob, x, dolog
+
+   make sure they are arrays from python
+*/
+
+static int gmixnd_get_prob_args_check(PyObject* log_pnorms,
+                                      PyObject* means,
+                                      PyObject* icovars,
+                                      PyObject* tmp_lnprob,
+                                      PyObject* pars,
+                                      npy_intp *n_gauss,
+                                      int *n_dim)
+{
+    int status=0, n_dim_means=0, n_dim_icovars=0;
+    npy_intp n_pars=0, n_tmp=0;
+
+    n_dim_means=PyArray_NDIM(means);
+    if (n_dim_means != 2) {
+        PyErr_Format(GMixFatalError, "means dim must be 2, got %d", n_dim_means);
+        goto _gmixnd_get_prob_args_check_bail;
+    }
+    n_dim_icovars=PyArray_NDIM(icovars);
+    if (n_dim_icovars != 3) {
+        PyErr_Format(GMixFatalError, "icovars dim must be 3, got %d", n_dim_icovars);
+        goto _gmixnd_get_prob_args_check_bail;
+    }
+
+    (*n_gauss)=PyArray_SIZE(log_pnorms);
+    (*n_dim)=PyArray_DIM(means,1);
+
+    if (*n_dim > 10) {
+        PyErr_Format(GMixFatalError, "dim must be <= 10, got %d", *n_dim);
+        goto _gmixnd_get_prob_args_check_bail;
+    }
+
+    n_pars=PyArray_SIZE(pars);
+    if (n_pars != (*n_dim)) {
+        PyErr_Format(GMixFatalError, "n_dim is %d but n_pars is %ld",
+                     (*n_dim), n_pars);
+        goto _gmixnd_get_prob_args_check_bail;
+    }
+    n_tmp=PyArray_SIZE(tmp_lnprob);
+    if (n_tmp != (*n_gauss)) {
+        PyErr_Format(GMixFatalError, "n_gauss is %ld but n_tmp_lnprob is %ld",
+                     (*n_gauss), n_tmp);
+        goto _gmixnd_get_prob_args_check_bail;
+    }
+
+    status=1;
+_gmixnd_get_prob_args_check_bail:
+    return status;
+}
+
+static 
+PyObject * PyGMix_gmixnd_get_prob_scalar(PyObject* self, PyObject* args) {
+
+    PyObject* log_pnorms=NULL;
+    PyObject* means=NULL;
+    PyObject* icovars=NULL;
+    PyObject* tmp_lnprob=NULL;
+    PyObject* pars=NULL;
+    PyObject* use=NULL; // which components to include
+
+    double* tmp_lnprob_ptr=NULL;
+    npy_int32* use_ptr=NULL;
+
+    // up to 10 dims allowed
+    double xdiff[10];
+    int dolog=0;
+    npy_intp i=0, n_gauss=0;
+    double p=0.0, retval=0;
+    double lnpmax=-9.99e9, logpnorm=0, chi2=0, lnp=0, par=0, mean=0, icov=0;
+    int n_dim=0, idim1=0, idim2=0;
+
+    // weight object is currently ignored
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOi", 
+                          &log_pnorms,
+                          &means,
+                          &icovars,
+                          &tmp_lnprob,
+                          &pars,
+                          &use,
+                          &dolog)) {
+        return NULL;
+    }
 
-        }
 
+    if (!gmixnd_get_prob_args_check(log_pnorms,
+                                    means,
+                                    icovars,
+                                    tmp_lnprob,
+                                    pars,
+                                    &n_gauss,
+                                    &n_dim)) {
+        return NULL;
     }
 
-admom_multi_bail:
-
-    res->nimage=nimage;
+    tmp_lnprob_ptr = (double *) PyArray_DATA(tmp_lnprob);
 
-    res->numiter = i;
-    if (res->flags != 0) {
-        // we exited with a goto
-        res->numiter+=1;
+    if (use != Py_None) {
+        use_ptr = (npy_int32 *) PyArray_DATA(use);
     }
 
-    if (res->numiter==self->maxit) {
-        res->flags = ADMOM_MAXIT;
-    }
+    for (i=0; i<n_gauss; i++) {
 
-    return;
-}
+        logpnorm = *(double *) PyArray_GETPTR1(log_pnorms, i);
 
+        for (idim1=0; idim1<n_dim; idim1++) {
+            par=*(double *) PyArray_GETPTR1(pars, idim1);
+            mean=*(double *) PyArray_GETPTR2(means, i, idim1);
 
+            xdiff[idim1] = par-mean;
+        }
 
+        chi2=0;
+        for (idim1=0; idim1<n_dim; idim1++) {
+            for (idim2=0; idim2<n_dim; idim2++) {
+                icov=*(double *) PyArray_GETPTR3(icovars, i, idim1, idim2);
 
-static void admom_multi_deconv_nocheck(
+                chi2 += xdiff[idim1]*xdiff[idim2]*icov;
+            }
+        }
 
-          const struct Admom *self,
+        lnp = -0.5*chi2 + logpnorm;
+        if (lnp > lnpmax) {
+            lnpmax=lnp;
+        }
+        tmp_lnprob_ptr[i] = lnp;
+    }    
 
-          // eventually will be lists of images, jacobians, and psfs
-          const PyObject** im_list,
-          const PyObject** ivarim_list,
-          const struct PyGMix_Gauss2D** psf_list,
-          const struct PyGMix_Jacobian** jacob_list,
-          int nimage,
+    p=0;
+    for (i=0; i<n_gauss; i++) {
 
-          // weight should initially hold the guess
-          const struct PyGMix_Gauss2D *wtin,
+        if (use == Py_None || use_ptr[i]) {
+            p += exp(tmp_lnprob_ptr[i] - lnpmax);
+        }
+    }
 
-          struct AdmomResult *res
-	)
+    if (dolog) {
+        retval = log(p) + lnpmax;
+    } else {
+        retval = p*exp(lnpmax);
+    }
 
-{
+    return PyFloat_FromDouble(retval);
 
-    struct PyGMix_Gauss2D wt={0};
-    double 
-        roworig=0, colorig=0,
-        e1old=-9999, e2old=-9999, Told=-9999.0,
-        Irr=0, Irc=0, Icc,
-        //M1=0, M2=0,
-        T=0, e1=0, e2=0,
-        M1sum=0, M2sum=0, Tsum=0, Fsum=0,
-        tIrrsum=0, tIrcsum=0, tIccsum=0,
-        Irrsum0=0, Ircsum0=0, Iccsum0=0;
+}
 
-    int i=0, j=0, nuse=0;
 
-    wt = *wtin;
+/*
+   vectorized evaluation of an nd gaussian mixture at many points
 
-    res->flags=0;
+   The covariances are represented by the inverse of their lower
+   cholesky factors, ichol, so that chi^2 = |ichol (x-mean)|^2, and
+   log_pnorms includes the weights and log determinants.  means is
+   [n_gauss, n_dim], ichol [n_gauss, n_dim, n_dim] and the points are
+   [n_points, n_dim], all contiguous
 
-    roworig=wt.row;
-    colorig=wt.col;
+   The points are processed in blocks; for each component the quadratic
+   form is computed for all points in the block in a simd loop, and the
+   log sum over components is accumulated online with a running maximum
+   so no per-component scratch is needed
 
-    for (i=0; i<self->maxit; i++) {
+   The kernel is specialized for small n_dim by calling it with constant
+   dimensions, see gmixnd_lnprob_range
+*/
 
+#define GMIXND_BLOCK 64
+
+static inline __attribute__((always_inline))
+void gmixnd_lnprob_block_kernel(const double *log_pnorms,
+                                const double *means,
+                                const double *ichol,
+                                const npy_int32 *use,
+                                npy_intp n_gauss,
+                                const int n_dim,
+                                const double *x,
+                                npy_intp n_points,
+                                int dolog,
+                                double *out)
+{
+    double lnpmax[GMIXND_BLOCK], psum[GMIXND_BLOCK], lnp[GMIXND_BLOCK];
+    const double *mean=NULL, *L=NULL;
+    double diff=0;
+    npy_intp igauss=0, k=0;
 
-        // First the center, using overall sums to get the center in sky coords
+    for (k=0; k<n_points; k++) {
+        lnpmax[k] = -INFINITY;
+        psum[k] = 0.0;
+    }
 
-        admom_clear_result(res);
+    for (igauss=0; igauss<n_gauss; igauss++) {
 
-        for (j=0; j<nimage; j++) {
-            admom_convolve(&wt, psf_list[j]);
+        if (use && !use[igauss]) {
+            continue;
+        }
 
-            // we won't need to test these again during this iteration
-            if (!admom_set_norm(&wt) ) {
-                res->flags |= ADMOM_DET;
-                goto admom_bail;
+        mean = &means[igauss*n_dim];
+        L = &ichol[igauss*n_dim*n_dim];
+
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (k=0; k<n_points; k++) {
+            const double *tx=&x[k*n_dim];
+            double chi2=0, t=0;
+            int a=0, b=0;
+
+            for (a=0; a<n_dim; a++) {
+                t=0;
+                for (b=0; b<=a; b++) {
+                    t += L[a*n_dim+b]*(tx[b]-mean[b]);
+                }
+                chi2 += t*t;
             }
 
-            admom_censums(self, im_list[j], jacob_list[j], &wt, res);
-            admom_deconvolve(&wt, psf_list[j]);
+            lnp[k] = log_pnorms[igauss] - 0.5*chi2;
         }
 
-        if (res->sums[5] <= 0.0) {
-            res->flags |= ADMOM_FAINT;
-            goto admom_bail;
+        for (k=0; k<n_points; k++) {
+            if (lnp[k] > lnpmax[k]) {
+                diff = lnpmax[k]-lnp[k];
+                psum[k] = psum[k]*exp(diff) + 1.0;
+                lnpmax[k] = lnp[k];
+            } else if (lnpmax[k] > -INFINITY) {
+                // the check avoids -inf - -inf for zero weights
+                psum[k] += exp(lnp[k]-lnpmax[k]);
+            }
         }
+    }
 
-        wt.row = res->sums[0]/res->sums[5];
-        wt.col = res->sums[1]/res->sums[5];
-
-        // bail if the center shifted too far
-        if ( ( fabs(wt.row-roworig) > self->shiftmax)
-             ||
-             ( fabs(wt.col-colorig) > self->shiftmax)
-             ) {
-            res->flags |= ADMOM_SHIFT;
-            goto admom_bail;
+    for (k=0; k<n_points; k++) {
+        if (psum[k] == 0.0) {
+            // no components were used
+            out[k] = dolog ? -INFINITY : 0.0;
+        } else if (dolog) {
+            out[k] = lnpmax[k] + log(psum[k]);
+        } else {
+            out[k] = psum[k]*exp(lnpmax[k]);
         }
+    }
+}
 
-        // now the rest of the moment sums. This will require
-        // some intermediate values for each image to be
-        // calculated and averaged
-
-        Irrsum0=Ircsum0=Iccsum0=0;
-        M1sum=M2sum=Tsum=Fsum=0;
-        nuse=0;
-
-        for (j=0; j<nimage; j++) {
-            admom_clear_result(res);
-
-            admom_convolve(&wt, psf_list[j]);
-            admom_set_norm(&wt);
+static void gmixnd_lnprob_block(const double *log_pnorms,
+                                const double *means,
+                                const double *ichol,
+                                const npy_int32 *use,
+                                npy_intp n_gauss,
+                                int n_dim,
+                                const double *x,
+                                npy_intp n_points,
+                                int dolog,
+                                double *out)
+{
 
-            admom_momsums(self,
-                          im_list[j], ivarim_list[j], jacob_list[j],
-                          &wt, res);
+// the kernel is inlined with a constant n_dim in each case
+#define _GMIXND_CASE(ndim)                                                  \
+    case ndim:                                                              \
+        gmixnd_lnprob_block_kernel(log_pnorms, means, ichol, use, n_gauss,  \
+                                   ndim, x, n_points, dolog, out);          \
+        break
+
+    switch (n_dim) {
+        _GMIXND_CASE(1);
+        _GMIXND_CASE(2);
+        _GMIXND_CASE(3);
+        _GMIXND_CASE(4);
+        _GMIXND_CASE(5);
+        _GMIXND_CASE(6);
+        default:
+            gmixnd_lnprob_block_kernel(log_pnorms, means, ichol, use, n_gauss,
+                                       n_dim, x, n_points, dolog, out);
+            break;
+    }
 
-            if (res->sums[5] < 0.0) {
-                printf("Fsum: %g\n", res->sums[5]);
-                continue;
-            }
+#undef _GMIXND_CASE
+}
 
-            // we need normalized moments to psf correct
-            /*
-            if (res->sums[5] <= 0.0) {
-                res->flags = ADMOM_FAINT;
-                goto admom_bail;
-            }
-            */
+/*
+   log_pnorms, means, ichol, points, output, use, dolog, nthreads
 
-            M1sum += res->sums[2];
-            M2sum += res->sums[3];
-            Tsum  += res->sums[4];
-            Fsum  += res->sums[5];
+   points is [n_points, n_dim] and output [n_points]; use is None or an
+   int32 array of length n_gauss, and only components with use != 0 are
+   included
+*/
+static 
+PyObject * PyGMix_gmixnd_get_prob_array(PyObject* self, PyObject* args) {
+
+    PyObject* log_pnorms_obj=NULL;
+    PyObject* means_obj=NULL;
+    PyObject* ichol_obj=NULL;
+    PyObject* points_obj=NULL;
+    PyObject* output_obj=NULL;
+    PyObject* use_obj=NULL;
+    int dolog=0, nthreads=0;
+
+    const double *log_pnorms=NULL, *means=NULL, *ichol=NULL, *points=NULL;
+    const npy_int32 *use=NULL;
+    double *output=NULL;
+
+    npy_intp n_gauss=0, n_points=0, iblock=0, n_blocks=0;
+    int n_dim=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOii", 
+                          &log_pnorms_obj,
+                          &means_obj,
+                          &ichol_obj,
+                          &points_obj,
+                          &output_obj,
+                          &use_obj,
+                          &dolog,
+                          &nthreads)) {
+        return NULL;
+    }
 
-            // now deconvolved covar, which we will average over
-            // the exposures, for the adaptive step
+    if (PyArray_NDIM(means_obj) != 2 || PyArray_NDIM(ichol_obj) != 3
+            || PyArray_NDIM(points_obj) != 2) {
+        PyErr_Format(GMixFatalError,
+                     "means, ichol and points must be 2, 3 and 2 dimensional");
+        return NULL;
+    }
 
-            /*
-            M1 = res->sums[2]/res->sums[5];
-            M2 = res->sums[3]/res->sums[5];
-            T  = res->sums[4]/res->sums[5];
-            res->flags = admom_get_deconvolved_moments_nocheck(
-                &wt, psf_list[j],
-                M1, M2, T,
-                &Irr, &Irc, &Icc
-            );
-            */
-            res->flags = admom_get_deconvolved_moments_nocheck(
-                &wt, psf_list[j],
-                res->sums[2], res->sums[3], res->sums[4],
-                //M1, M2, T,
-                //1.0,
-                res->sums[5],
-                &tIrrsum, &tIrcsum, &tIccsum
-            );
+    n_gauss=PyArray_SIZE(log_pnorms_obj);
+    n_dim=PyArray_DIM(means_obj,1);
+    n_points=PyArray_DIM(points_obj,0);
 
-            if (res->flags!=0) {
-                goto admom_bail;
-            }
+    if (PyArray_DIM(means_obj,0) != n_gauss
+            || PyArray_DIM(ichol_obj,0) != n_gauss
+            || PyArray_DIM(ichol_obj,1) != n_dim
+            || PyArray_DIM(ichol_obj,2) != n_dim
+            || PyArray_DIM(points_obj,1) != n_dim
+            || PyArray_SIZE(output_obj) != n_points) {
+        PyErr_Format(GMixFatalError,
+                     "inconsistent shapes for n_gauss %ld n_dim %d "
+                     "n_points %ld", n_gauss, n_dim, n_points);
+        return NULL;
+    }
 
-            Irrsum0 += tIrrsum;
-            Ircsum0 += tIrcsum;
-            Iccsum0 += tIccsum;
+    if (use_obj != Py_None) {
+        if (PyArray_SIZE(use_obj) != n_gauss) {
+            PyErr_Format(GMixFatalError,
+                         "use has %ld entries, expected %ld",
+                         PyArray_SIZE(use_obj), n_gauss);
+            return NULL;
+        }
+        use = (const npy_int32 *) PyArray_DATA(use_obj);
+    }
 
-            admom_deconvolve(&wt, psf_list[j]);
+    log_pnorms = (const double *) PyArray_DATA(log_pnorms_obj);
+    means = (const double *) PyArray_DATA(means_obj);
+    ichol = (const double *) PyArray_DATA(ichol_obj);
+    points = (const double *) PyArray_DATA(points_obj);
+    output = (double *) PyArray_DATA(output_obj);
+    nthreads=pygmix_get_nthreads(nthreads);
 
-            nuse +=1;
-        }
+    n_blocks = (n_points + GMIXND_BLOCK - 1)/GMIXND_BLOCK;
 
-        if (Fsum <= 0.0) {
-            res->flags = ADMOM_FAINT;
-            goto admom_bail;
-        }
-        if (Tsum <= 0.0) {
-            res->flags = ADMOM_SMALL;
-            goto admom_bail;
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(nthreads) if(n_blocks > 1)
+#endif
+    for (iblock=0; iblock<n_blocks; iblock++) {
+        npy_intp start=iblock*GMIXND_BLOCK;
+        npy_intp nb=n_points-start;
+        if (nb > GMIXND_BLOCK) {
+            nb=GMIXND_BLOCK;
         }
 
-        // look for convergence in mean of the convolved
-        // moments, since T could be zero for the deconvolved
-        // moments
+        gmixnd_lnprob_block(log_pnorms, means, ichol, use, n_gauss, n_dim,
+                            &points[start*n_dim], nb, dolog,
+                            &output[start]);
+    }
+    Py_END_ALLOW_THREADS
 
-        e1 = M1sum/Tsum;
-        e2 = M2sum/Tsum;
-        T  = Tsum/Fsum;
+    Py_RETURN_NONE;
+}
 
-        if ( 
-                ( fabs(e1-e1old) < self->etol)
-                &&
-                ( fabs(e2-e2old) < self->etol)
-                &&
-                ( fabs(T/Told-1.) < self->Ttol)
-           )  {
 
-            // deconvolved weight
-            res->pars[0] = wt.row;
-            res->pars[1] = wt.col;
-            res->pars[2] = wt.icc - wt.irr;
-            res->pars[3] = 2.0*wt.irc;
-            res->pars[4] = wt.icc + wt.irr;
-            res->pars[5] = res->sums[5]/res->wsum;
+/*
+   multilinear interpolation of a function tabulated on a regular grid
 
-            break;
+   grid is C-contiguous with shape dims[n_dim]; node i along dimension d
+   is at xmin[d] + i*dx[d].  Points outside the grid get outval
 
-        } else {
+   returns the interpolated value
+*/
+static double grid_interp_point(const double *grid,
+                                const npy_intp *dims,
+                                const npy_intp *strides,
+                                const double *xmin,
+                                const double *dx,
+                                int n_dim,
+                                const double *x,
+                                double outval)
+{
+    double frac[PYGMIX_GRID_MAXDIM];
+    double t=0, w=0, val=0;
+    npy_intp i0=0, base=0, off=0;
+    int d=0, corner=0, ncorner=1<<n_dim;
+
+    for (d=0; d<n_dim; d++) {
+        t = (x[d]-xmin[d])/dx[d];
+        if (!(t >= 0.0 && t <= dims[d]-1)) {
+            // also catches nan
+            return outval;
+        }
 
-            // use mean of the deconvolved, adaptive stepped moments
-            // from each image
+        i0 = (npy_intp) t;
+        if (i0 > dims[d]-2) {
+            // exactly on the last node
+            i0 = dims[d]-2;
+        }
+        frac[d] = t - i0;
+        base += i0*strides[d];
+    }
 
-            Irr = Irrsum0/Fsum;
-            Irc = Ircsum0/Fsum;
-            Icc = Iccsum0/Fsum;
-            //Irr = Irrsum0/nuse;
-            //Irc = Ircsum0/nuse;
-            //Icc = Iccsum0/nuse;
-            gauss2d_set(&wt, 1.0, wt.row, wt.col, Irr, Irc, Icc);
+    for (corner=0; corner<ncorner; corner++) {
+        w=1.0;
+        off=base;
+        for (d=0; d<n_dim; d++) {
+            if (corner & (1<<d)) {
+                w *= frac[d];
+                off += strides[d];
+            } else {
+                w *= 1.0-frac[d];
+            }
+        }
+        val += w*grid[off];
+    }
 
-            e1old=e1;
-            e2old=e2;
-            Told=T;
+    return val;
+}
 
-        }
+/*
+   grid, dims, xmin, dx, points, output, dolog, nthreads
 
+   interpolate the gridded density at each of the points [n_points, n_dim];
+   with dolog the log of the interpolated value is returned.  Points off
+   the grid, or with non-positive density, get 0 or -inf for the log
+*/
+static 
+PyObject * PyGMix_grid_interp(PyObject* self, PyObject* args) {
+
+    PyObject* grid_obj=NULL;
+    PyObject* dims_obj=NULL;
+    PyObject* xmin_obj=NULL;
+    PyObject* dx_obj=NULL;
+    PyObject* points_obj=NULL;
+    PyObject* output_obj=NULL;
+    int dolog=0, nthreads=0;
+
+    const double *grid=NULL, *xmin=NULL, *dx=NULL, *points=NULL;
+    const npy_int64 *dims64=NULL;
+    double *output=NULL;
+    npy_intp dims[PYGMIX_GRID_MAXDIM], strides[PYGMIX_GRID_MAXDIM];
+    npy_intp n_points=0, i=0, size=1;
+    int n_dim=0, d=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOOOii", 
+                          &grid_obj,
+                          &dims_obj,
+                          &xmin_obj,
+                          &dx_obj,
+                          &points_obj,
+                          &output_obj,
+                          &dolog,
+                          &nthreads)) {
+        return NULL;
     }
 
-admom_bail:
+    n_dim=PyArray_SIZE(dims_obj);
+    if (n_dim < 1 || n_dim > PYGMIX_GRID_MAXDIM) {
+        PyErr_Format(GMixFatalError,
+                     "grid must have 1 to %d dims, got %d",
+                     PYGMIX_GRID_MAXDIM, n_dim);
+        return NULL;
+    }
+    if (PyArray_SIZE(xmin_obj) != n_dim || PyArray_SIZE(dx_obj) != n_dim
+            || PyArray_NDIM(points_obj) != 2
+            || PyArray_DIM(points_obj,1) != n_dim
+            || PyArray_SIZE(output_obj) != PyArray_DIM(points_obj,0)) {
+        PyErr_Format(GMixFatalError,
+                     "inconsistent shapes for %d dim grid", n_dim);
+        return NULL;
+    }
 
-    res->nimage=nimage;
+    dims64=(const npy_int64 *) PyArray_DATA(dims_obj);
+    for (d=0; d<n_dim; d++) {
+        dims[d] = (npy_intp) dims64[d];
+        if (dims[d] < 2) {
+            PyErr_Format(GMixFatalError,
+                         "grid needs at least 2 nodes per dim, got %ld",
+                         dims[d]);
+            return NULL;
+        }
+        size *= dims[d];
+    }
+    if (PyArray_SIZE(grid_obj) != size) {
+        PyErr_Format(GMixFatalError,
+                     "grid has %ld elements, expected %ld",
+                     PyArray_SIZE(grid_obj), size);
+        return NULL;
+    }
 
-    res->numiter = i;
-    if (res->flags != 0) {
-        // we exited with a goto
-        res->numiter+=1;
+    // C order
+    strides[n_dim-1]=1;
+    for (d=n_dim-2; d>=0; d--) {
+        strides[d] = strides[d+1]*dims[d+1];
     }
 
-    if (res->numiter==self->maxit) {
-        res->flags = ADMOM_MAXIT;
+    grid=(const double *) PyArray_DATA(grid_obj);
+    xmin=(const double *) PyArray_DATA(xmin_obj);
+    dx=(const double *) PyArray_DATA(dx_obj);
+    points=(const double *) PyArray_DATA(points_obj);
+    output=(double *) PyArray_DATA(output_obj);
+    n_points=PyArray_DIM(points_obj,0);
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(nthreads)
+#endif
+    for (i=0; i<n_points; i++) {
+        double val = grid_interp_point(grid, dims, strides, xmin, dx, n_dim,
+                                       &points[i*n_dim], 0.0);
+        if (dolog) {
+            output[i] = (val > 0.0) ? log(val) : -INFINITY;
+        } else {
+            output[i] = (val > 0.0) ? val : 0.0;
+        }
     }
+    Py_END_ALLOW_THREADS
 
-    return;
+    Py_RETURN_NONE;
 }
 
 
+/*
 
+   copy the mean and inverse covariance of the likelihood into
+   contiguous buffers, so the sums below can be run without the GIL
 
-static PyObject * PyGMix_admom(PyObject* self, PyObject* args) {
+   mean is [PYGMIX_MAXDIMS], icovar is [PYGMIX_MAXDIMS*PYGMIX_MAXDIMS]
+   and is indexed as icovar[dim1*ndim + dim2]
 
-    PyObject* admom_obj=NULL;
+*/
+static void get_mom_like(const PyObject* mean_obj,
+                         const PyObject* icovar_obj,
+                         npy_intp ndim,
+                         double *mean,
+                         double *icovar)
+{
+    npy_intp dim1=0, dim2=0;
+    for (dim1=0; dim1<ndim; dim1++) {
+        mean[dim1] = *(double *)PyArray_GETPTR1(mean_obj, dim1);
+        for (dim2=0; dim2<ndim; dim2++) {
+            icovar[dim1*ndim + dim2] = *(double *) PyArray_GETPTR2(icovar_obj, dim1, dim2);
+        }
+    }
+}
 
-    // the weight gaussian
-    PyObject* wt_obj=NULL;
+/*
 
-    PyObject* image_obj=NULL;
-    PyObject* ivarim_obj=NULL;
-    PyObject* jacob_obj=NULL;
+   Difference between mean of the distribution
+   and parameters from the template set
 
-    PyObject* res_obj=NULL;
+       mean - template_pars
 
-    struct PyGMix_Gauss2D *wt=NULL;
+*/
+static void get_mom_xdiff(const double *mean,
+                          const PyObject* pars_obj,
+                          npy_intp i,
+                          double *xdiff,
+                          npy_intp ndim)
+{
+    npy_intp dim=0;
+    double par=0;
+    for (dim=0; dim<ndim; dim++) {
 
-    struct PyGMix_Jacobian *jacob=NULL;
+        par  = *(double *)PyArray_GETPTR2(pars_obj, i, dim);
 
-    struct Admom *admom_conf =NULL;
-    struct AdmomResult *res=NULL;
+        xdiff[dim] = mean[dim]-par;
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOO", 
-                          &admom_obj,
-                          &image_obj,
-                          &ivarim_obj,
-                          &jacob_obj,
-                          &wt_obj,
-                          &res_obj)) {
-        return NULL;
     }
+}
 
-    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
-    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
-    jacob=(struct PyGMix_Jacobian* ) PyArray_DATA(jacob_obj);
-    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
+// xdiff should already be filled out for the non-sheared pars
+// only the slots for M1,M2,T are updated
+static void get_mom_xdiff_sheared(const double *mean,
+                                  const PyObject* sheared_pars_obj,
+                                  npy_intp i,
+                                  double *xdiff)
+{
+    npy_intp dim=0;
+    double par=0;
+    for (dim=PYGMIX_DOFFSET; dim<PYGMIX_DOFFSET+3; dim++) {
 
-    admom(admom_conf, image_obj, ivarim_obj, jacob, wt, res);
+        par  = *(double *)PyArray_GETPTR2(sheared_pars_obj, i, dim-PYGMIX_DOFFSET);
 
-    Py_RETURN_NONE;
+        xdiff[dim] = mean[dim]-par;
+    }
 }
 
-static PyObject * PyGMix_admom_multi_deconv(PyObject* self, PyObject* args) {
-
-    PyObject* admom_obj=NULL;
-
-    // the weight gaussian
-    PyObject* wt_obj=NULL;
-    PyObject* psfs_obj=NULL;
 
-    PyObject* image_obj=NULL;
-    PyObject* ivarim_obj=NULL;
-    PyObject* jacob_obj=NULL;
+/*
 
-    PyObject* res_obj=NULL;
+   (xmean - x) C^{-1} (xmean - x)
 
-    struct PyGMix_Gauss2D *wt=NULL;
-    struct PyGMix_Jacobian *tjacob=NULL;
+*/
+static double get_mom_chi2(const double *icovar,
+                           const double *xdiff,
+                           npy_intp ndim)
+{
+    npy_intp dim1=0, dim2=0;
+    double icov=0, chi2=0, tchi2=0;
 
-    struct Admom *admom_conf =NULL;
-    struct AdmomResult *res=NULL;
+    for (dim1=0; dim1<ndim; dim1++) {
+        for (dim2=0; dim2<ndim; dim2++) {
+            icov=icovar[dim1*ndim + dim2];
 
-    // just for packing in pointers from the python lists
-    PyObject* tmp=NULL;
-    struct PyGMix_Gauss2D *tgauss=NULL;
+            tchi2 = xdiff[dim1]*xdiff[dim2]*icov;
+            chi2 += tchi2;
+        }
+    }
 
-    const PyObject* im_list[1000]={0};
-    const PyObject* ivarim_list[1000]={0};
-    const struct PyGMix_Gauss2D* psf_list[1000]={0};
-    const struct PyGMix_Jacobian* jacob_list[1000]={0};
+    return chi2;
+}
 
-    Py_ssize_t nimage=0, i=0;
+/*
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOO", 
-                          &admom_obj,
-                          &image_obj,
-                          &ivarim_obj,
-                          &psfs_obj,
-                          &jacob_obj,
-                          &wt_obj,
-                          &res_obj)) {
-        return NULL;
-    }
+   use nsigma to limit the range evaluated,
+   saves time calling exp
 
-    nimage = PyList_Size(image_obj);
+   if dolog is true, the points are always evaluated
+   and nsigma is ignored. Also norm is log(norm)
 
-    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
-    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
-    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
 
-    for (i=0; i<nimage; i++) {
-        tmp = PyList_GetItem(image_obj, i);
-        im_list[i] = tmp;
+   all error checking should be done in python
+*/
+static 
+PyObject * PyGMix_mvn_calc_prob(PyObject* self, PyObject* args) {
 
-        tmp = PyList_GetItem(ivarim_obj, i);
-        ivarim_list[i] = tmp;
+    PyObject* mean_obj=NULL;
+    PyObject* icovar_obj=NULL;
+    double nsigma=0, nsigma2=0, norm=0;
+    int dolog=0;
+    PyObject* allpars_obj=NULL;
+    PyObject* prob_obj=NULL;
 
-        tmp = PyList_GetItem(psfs_obj, i);
-        tgauss=(struct PyGMix_Gauss2D* ) PyArray_DATA(tmp);
-        psf_list[i] = tgauss;
+    // up to 10 dimensions
+    double xdiff[PYGMIX_MAXDIMS];
+    double mean[PYGMIX_MAXDIMS], icovar[PYGMIX_MAXDIMS*PYGMIX_MAXDIMS];
+    double chi2=0, arg=0;
+    double prob=0, *ptr=NULL;
+    npy_intp ndim=0, npoints=0, i=0;
 
-        tmp = PyList_GetItem(jacob_obj, i);
-        tjacob = (struct PyGMix_Jacobian* ) PyArray_DATA(tmp);
-        jacob_list[i] = tjacob;
+    // weight object is currently ignored
+    if (!PyArg_ParseTuple(args, (char*)"OOddOiO", 
+                          &mean_obj,
+                          &icovar_obj,
+                          &norm,
+                          &nsigma,
+                          &allpars_obj,
+                          &dolog,
+                          &prob_obj)) {
+        return NULL;
     }
 
+    nsigma2=nsigma*nsigma;
+ 
+    ndim=PyArray_SIZE(mean_obj);
+    npoints = PyArray_DIM(allpars_obj,0);
 
-    //admom_multi_deconv(
-    admom_multi_deconv_nocheck(
-        admom_conf,
-        im_list,
-        ivarim_list,
-        psf_list,
-        jacob_list,
-        (int)nimage,
-        wt,
-        res
-   );
+    get_mom_like(mean_obj, icovar_obj, ndim, mean, icovar);
 
-    Py_RETURN_NONE;
-}
+    for (i=0; i<npoints; i++) {
+        get_mom_xdiff(mean, allpars_obj,i,xdiff,ndim);
 
+        chi2=get_mom_chi2(icovar,xdiff,ndim);
 
+        arg = -0.5*chi2;
 
+        if (dolog) {
+            // norm is really log(norm)
+            // and this is really the log prob
+            prob = norm + arg;
+        } else {
+            if (chi2 < nsigma2) {
+                prob = norm*exp(arg);
+            } else {
+                prob = 0.0;
+            }
+        }
 
+        ptr = PyArray_GETPTR1(prob_obj,i);
+        *ptr = prob;
 
-static PyObject * PyGMix_admom_multi(PyObject* self, PyObject* args) {
+    }
 
-    PyObject* admom_obj=NULL;
+    Py_RETURN_NONE;
+}
 
-    // the weight gaussian
-    PyObject* wt_obj=NULL;
+static void get_mom_Qsums(const double *icovar,
+                          const PyObject* Qderiv,
+                          const double *xdiff,
+                          npy_intp ndim,
+                          double prob,
+                          npy_intp i,
+                          double *icov_dot_Qd_1, // [PYGMIX_MAXDIMS]
+                          double *icov_dot_Qd_2, // [PYGMIX_MAXDIMS]
+                          double *Q1sum,
+                          double *Q2sum) {
 
-    PyObject* image_obj=NULL;
-    PyObject* ivarim_obj=NULL;
-    PyObject* jacob_obj=NULL;
+    npy_intp dim1=1,dim2=0;
+    double icov=0, deriv1=0, deriv2=0;
 
-    PyObject* res_obj=NULL;
+    *Q1sum=0;
+    *Q2sum=0;
 
-    struct PyGMix_Gauss2D *wt=NULL;
-    struct PyGMix_Jacobian *tjacob=NULL;
+    memset(icov_dot_Qd_1, 0, ndim*sizeof(double));
+    memset(icov_dot_Qd_2, 0, ndim*sizeof(double));
 
-    struct Admom *admom_conf =NULL;
-    struct AdmomResult *res=NULL;
+    // Q1temp3 = Cinv dot derivatives
+    for (dim1=0; dim1<ndim; dim1++) {
 
-    // just for packing in pointers from the python lists
-    PyObject* tmp=NULL;
+        for (dim2=0; dim2<ndim; dim2++) {
 
-    const PyObject* im_list[1000]={0};
-    const PyObject* ivarim_list[1000]={0};
-    const struct PyGMix_Jacobian* jacob_list[1000]={0};
+            if (dim2 >= 2 && dim2 <= 4) {
+                // derivatives non-zero for these dimensions
+                icov=icovar[dim1*ndim + dim2];
 
-    Py_ssize_t nimage=0, i=0;
+                deriv1 = *(double *)PyArray_GETPTR3(Qderiv, i, dim2-PYGMIX_DOFFSET, 0);
+                deriv2 = *(double *)PyArray_GETPTR3(Qderiv, i, dim2-PYGMIX_DOFFSET, 1);
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOO", 
-                          &admom_obj,
-                          &image_obj,
-                          &ivarim_obj,
-                          &jacob_obj,
-                          &wt_obj,
-                          &res_obj)) {
-        return NULL;
+                icov_dot_Qd_1[dim1] += deriv1*icov;
+                icov_dot_Qd_2[dim1] += deriv2*icov;
+            }
+        } 
+    }
+    // xdiff dot Q1temp3
+    for (dim1=0; dim1<ndim; dim1++) {
+        *Q1sum += xdiff[dim1]*icov_dot_Qd_1[dim1];
+        *Q2sum += xdiff[dim1]*icov_dot_Qd_2[dim1];
     }
 
-    nimage = PyList_Size(image_obj);
-
-    admom_conf=(struct Admom* ) PyArray_DATA(admom_obj);
-    wt=(struct PyGMix_Gauss2D* ) PyArray_DATA(wt_obj);
-    res=(struct AdmomResult* ) PyArray_DATA(res_obj);
-
-    for (i=0; i<nimage; i++) {
-        tmp = PyList_GetItem(image_obj, i);
-        im_list[i] = tmp;
+    *Q1sum *= prob;
+    *Q2sum *= prob;
 
-        tmp = PyList_GetItem(ivarim_obj, i);
-        ivarim_list[i] = tmp;
+}
 
-        tmp = PyList_GetItem(jacob_obj, i);
-        tjacob = (struct PyGMix_Jacobian* ) PyArray_DATA(tmp);
-        jacob_list[i] = tjacob;
-    }
+/*
+   currently only implements the d^2L/d^2M terms
+*/
+static void get_mom_Rsums(const double *icovar,
+                          const PyObject* Qderiv,
+                          const PyObject* Rderiv,
+                          const double *xdiff,
+                          npy_intp ndim,
+                          const double *icov_dot_Qd_1,
+                          const double *icov_dot_Qd_2,
+                          double prob,
+                          npy_intp i,
+                          double *R11sum,
+                          double *R12sum,
+                          double *R22sum) {
 
+    double R11temp3[PYGMIX_MAXDIMS]={0};
+    double R12temp3[PYGMIX_MAXDIMS]={0};
+    double R22temp3[PYGMIX_MAXDIMS]={0};
+    npy_intp dim1=1,dim2=0;
+    double icov=0,
+           deriv1=0, deriv2=0,
+           deriv11=0, deriv12=0,deriv22;
 
-    admom_multi(
-        admom_conf,
-        im_list,
-        ivarim_list,
-        jacob_list,
-        (int)nimage,
-        wt,
-        res
-   );
+    *R11sum=0;
+    *R12sum=0;
+    *R22sum=0;
 
-    Py_RETURN_NONE;
-}
+    // R11temp3 = Cinv dot derivatives
+    for (dim1=0; dim1<ndim; dim1++) {
 
+        for (dim2=0; dim2<3; dim2++) {
 
+            if (dim2 >= 2 && dim2 <= 4) {
+                // derivatives are only non-zero for a subset of the dimensions
 
+                icov=icovar[dim1*ndim + dim2];
 
+                deriv11 = *(double *)PyArray_GETPTR4(Rderiv, i, dim2-PYGMIX_DOFFSET, 0, 0);
+                deriv12 = *(double *)PyArray_GETPTR4(Rderiv, i, dim2-PYGMIX_DOFFSET, 0, 1);
+                deriv22 = *(double *)PyArray_GETPTR4(Rderiv, i, dim2-PYGMIX_DOFFSET, 1, 1);
 
+                R11temp3[dim1] += icov*deriv11;
+                R12temp3[dim1] += icov*deriv12;
+                R22temp3[dim1] += icov*deriv22;
+            }
+        } 
+    }
+    for (dim1=0; dim1<ndim; dim1++) {
 
+        // xdiff dot R11temp3
+        *R11sum += xdiff[dim1]*R11temp3[dim1];
+        *R12sum += xdiff[dim1]*R12temp3[dim1];
+        *R22sum += xdiff[dim1]*R22temp3[dim1];
 
+        // Qderiv dot icov_dot_Qd
+        if (dim1 >= 2 && dim1 <= 4) {
+            // derivatives non-zero for these dimensions
+            deriv1 = *(double *)PyArray_GETPTR3(Qderiv, i, dim1-PYGMIX_DOFFSET, 0);
+            deriv2 = *(double *)PyArray_GETPTR3(Qderiv, i, dim1-PYGMIX_DOFFSET, 1);
 
+            *R11sum += deriv1*icov_dot_Qd_1[dim1];
+            *R12sum += deriv1*icov_dot_Qd_2[dim1];
+            *R22sum += deriv2*icov_dot_Qd_2[dim1];
+        }
+    }
 
+    *R11sum *= prob;
+    *R12sum *= prob;
+    *R22sum *= prob;
 
+}
 
+/*
+   sums for the pqr calculation using the templates and the
+   shear derivatives
+*/
+struct PQRSums {
+    double P;
+    double Q1, Q2;
+    double R11, R12, R22;
+    double Pmax;
+    long nuse;
+};
 
 /*
-   convert log pars to linear pars
-   pars 4: are converted
+   sums for the pqr calculation using sheared templates, for
+   numerical derivatives
 */
-static 
-PyObject * PyGMix_convert_simple_double_logpars(PyObject* self, PyObject* args) {
+struct PQRFullSums {
+    double P;
+    double P_p0, P_m0;
+    double P_0p, P_0m;
+    double P_pp, P_mm;
+    double Pmax;
+    long nuse;
+};
 
-    PyObject* logpars_obj=NULL;
-    PyObject* pars_obj=NULL;
-    int i, npars;
-    double *logpars=NULL, *pars=NULL;
+/*
+   add template i to the sums if it is within nsigma
+*/
+static void pqr_templates_add(const double *mean,
+                              const double *icovar,
+                              const PyObject* templates_obj,
+                              const PyObject* Qderiv_obj,
+                              const PyObject* Rderiv_obj,
+                              double norm,
+                              double nsigma2,
+                              npy_intp ndim,
+                              npy_intp i,
+                              struct PQRSums *sums)
+{
+    double xdiff[PYGMIX_MAXDIMS]={0};
+    double icov_dot_Qd_1[PYGMIX_MAXDIMS]={0};
+    double icov_dot_Qd_2[PYGMIX_MAXDIMS]={0};
+    double chi2=0, prob=0;
+    double Q1sum=0, Q2sum=0;
+    double R11sum=0, R12sum=0, R22sum=0;
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OO", 
-                          &logpars_obj,
-                          &pars_obj)) {
-        return NULL;
-    }
+    get_mom_xdiff(mean,templates_obj,i,xdiff,ndim);
 
-    logpars=PyArray_DATA(logpars_obj);
-    pars=PyArray_DATA(pars_obj);
+    chi2=get_mom_chi2(icovar, xdiff, ndim);
 
-    npars=PyArray_SIZE(logpars_obj);
+    if (chi2 < nsigma2) {
+        sums->nuse += 1;
+        prob = norm*exp(-0.5*chi2);
 
-    for (i=0; i<npars; i++) {
-        if (i < 4) {
-        //if (i != 4) {
-            pars[i] = logpars[i];
-        } else {
-            pars[i] = pow(10.0, logpars[i]);
+        if (prob > sums->Pmax) {
+            sums->Pmax=prob;
         }
+
+        sums->P += prob;
+
+        get_mom_Qsums(icovar,
+                      Qderiv_obj,
+                      xdiff,
+                      ndim,
+                      prob,
+                      i,
+                      icov_dot_Qd_1,
+                      icov_dot_Qd_2,
+                      &Q1sum,&Q2sum);
+
+        sums->Q1 += Q1sum;
+        sums->Q2 += Q2sum;
+
+        get_mom_Rsums(icovar,
+                      Qderiv_obj,
+                      Rderiv_obj,
+                      xdiff,
+                      ndim,
+                      icov_dot_Qd_1,
+                      icov_dot_Qd_2,
+                      prob,
+                      i,
+                      &R11sum,&R12sum,&R22sum);
+
+        sums->R11 += R11sum;
+        sums->R12 += R12sum;
+        sums->R22 += R22sum;
     }
-    Py_RETURN_NONE;
 }
 
-/*
-   convert log pars to linear pars, pulling out a specific band
-
-   no error checking done here
-*/
-static 
-PyObject * PyGMix_convert_simple_double_logpars_band(PyObject* self, PyObject* args) {
-
-    PyObject* logpars_obj=NULL;
-    PyObject* pars_obj=NULL;
-    int band=0;
-    double *logpars=NULL, *pars=NULL;
-
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOi", 
-                          &logpars_obj,
-                          &pars_obj,
-                          &band)) {
-        return NULL;
-    }
+static void pqr_templates_copy_sums(const struct PQRSums *sums,
+                                    PyObject *P_obj,
+                                    PyObject *Q_obj,
+                                    PyObject *R_obj)
+{
+    *(double *) PyArray_GETPTR1(P_obj,0) += sums->P;
 
-    logpars=PyArray_DATA(logpars_obj);
-    pars=PyArray_DATA(pars_obj);
+    *(double *) PyArray_GETPTR1(Q_obj,0) += sums->Q1;
+    *(double *) PyArray_GETPTR1(Q_obj,1) += sums->Q2;
 
-    pars[0] = logpars[0];
-    pars[1] = logpars[1];
-    pars[2] = logpars[2];
-    pars[3] = logpars[3];
-    pars[4] = exp( logpars[4] );
-    pars[5] = exp( logpars[5+band] );
-    //pars[5] = logpars[5+band];
+    *(double *) PyArray_GETPTR2(R_obj,0,0) += sums->R11;
+    *(double *) PyArray_GETPTR2(R_obj,0,1) += sums->R12;
+    *(double *) PyArray_GETPTR2(R_obj,1,1) += sums->R22;
 
-    Py_RETURN_NONE;
+    *(double *) PyArray_GETPTR2(R_obj,1,0) = *(double *) PyArray_GETPTR2(R_obj,0,1);
 }
 
-
 /*
-   convert eta pars to g1,g2 pars
+   add template i to the sums if it is within nsigma
 
-   no error checking done here
+   sheared holds the p0, m0, 0p, 0m, pp, mm sheared M1,M2,T
 */
-static 
-PyObject * PyGMix_convert_simple_eta2g_band(PyObject* self, PyObject* args) {
-
-    PyObject* etapars_obj=NULL;
-    PyObject* gpars_obj=NULL;
-    int band=0;
-    double *etapars=NULL, *gpars=NULL;
-    double g1=0, g2=0;
-    int status=0;
+static void pqr_templates_full_add(const double *mean,
+                                   const double *icovar,
+                                   const PyObject* templates_obj,
+                                   PyObject* const *sheared,
+                                   double norm,
+                                   double nsigma2,
+                                   npy_intp ndim,
+                                   npy_intp i,
+                                   struct PQRFullSums *sums)
+{
+    double xdiff[PYGMIX_MAXDIMS]={0};
+    double chi2=0, prob=0;
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOi", 
-                          &etapars_obj,
-                          &gpars_obj,
-                          &band)) {
-        return NULL;
-    }
+    get_mom_xdiff(mean,templates_obj,i,xdiff,ndim);
 
-    etapars=PyArray_DATA(etapars_obj);
-    gpars=PyArray_DATA(gpars_obj);
+    chi2=get_mom_chi2(icovar, xdiff, ndim);
 
-    status=eta1eta2_to_g1g2(etapars[2], etapars[3], &g1, &g2);
+    if (chi2 < nsigma2 && isfinite(chi2)) {
+        sums->nuse += 1;
+        prob = norm*exp(-0.5*chi2);
 
+        if (prob > sums->Pmax) {
+            sums->Pmax=prob;
+        }
 
-    gpars[0] = etapars[0];
-    gpars[1] = etapars[1];
-    gpars[2] = g1;
-    gpars[3] = g2;
-    gpars[4] = etapars[4];
-    gpars[5] = etapars[5+band];
+        sums->P += prob;
 
-    return Py_BuildValue("i", status);
-}
+        // These calls only update the parameters that respond to shear
 
+        get_mom_xdiff_sheared(mean,sheared[0],i,xdiff);
+        chi2=get_mom_chi2(icovar, xdiff, ndim);
+        sums->P_p0 += norm*exp(-0.5*chi2);
 
+        get_mom_xdiff_sheared(mean,sheared[1],i,xdiff);
+        chi2=get_mom_chi2(icovar, xdiff, ndim);
+        sums->P_m0 += norm*exp(-0.5*chi2);
 
-/*
+        get_mom_xdiff_sheared(mean,sheared[2],i,xdiff);
+        chi2=get_mom_chi2(icovar, xdiff, ndim);
+        sums->P_0p += norm*exp(-0.5*chi2);
 
-   full-covariance, nd-gaussian evaluations
+        get_mom_xdiff_sheared(mean,sheared[3],i,xdiff);
+        chi2=get_mom_chi2(icovar, xdiff, ndim);
+        sums->P_0m += norm*exp(-0.5*chi2);
 
-   can do either log or linear
-       log_pnorms, means, icovars, tmp_lnprob, x, dolog
+        get_mom_xdiff_sheared(mean,sheared[4],i,xdiff);
+        chi2=get_mom_chi2(icovar, xdiff, ndim);
+        sums->P_pp += norm*exp(-0.5*chi2);
 
-   make sure they are arrays from python
-*/
+        get_mom_xdiff_sheared(mean,sheared[5],i,xdiff);
+        chi2=get_mom_chi2(icovar, xdiff, ndim);
+        sums->P_mm += norm*exp(-0.5*chi2);
+    }
+}
 
-static int gmixnd_get_prob_args_check(PyObject* log_pnorms,
-                                      PyObject* means,
-                                      PyObject* icovars,
-                                      PyObject* tmp_lnprob,
-                                      PyObject* pars,
-                                      npy_intp *n_gauss,
-                                      int *n_dim)
+static void pqr_templates_full_copy_sums(const struct PQRFullSums *sums,
+                                         double h,
+                                         PyObject *P_obj,
+                                         PyObject *Q_obj,
+                                         PyObject *R_obj)
 {
-    int status=0, n_dim_means=0, n_dim_icovars=0;
-    npy_intp n_pars=0, n_tmp=0;
-
-    n_dim_means=PyArray_NDIM(means);
-    if (n_dim_means != 2) {
-        PyErr_Format(GMixFatalError, "means dim must be 2, got %d", n_dim_means);
-        goto _gmixnd_get_prob_args_check_bail;
-    }
-    n_dim_icovars=PyArray_NDIM(icovars);
-    if (n_dim_icovars != 3) {
-        PyErr_Format(GMixFatalError, "icovars dim must be 3, got %d", n_dim_icovars);
-        goto _gmixnd_get_prob_args_check_bail;
-    }
+    double h2inv=1.0/(2.0*h), hsqinv=1.0/(h*h);
+    double P=sums->P, *R12ptr=NULL;
 
-    (*n_gauss)=PyArray_SIZE(log_pnorms);
-    (*n_dim)=PyArray_DIM(means,1);
+    *(double *) PyArray_GETPTR1(P_obj,0) = P;
 
-    if (*n_dim > 10) {
-        PyErr_Format(GMixFatalError, "dim must be <= 10, got %d", *n_dim);
-        goto _gmixnd_get_prob_args_check_bail;
-    }
+    *(double *) PyArray_GETPTR1(Q_obj,0) = (sums->P_p0 - sums->P_m0)*h2inv;
+    *(double *) PyArray_GETPTR1(Q_obj,1) = (sums->P_0p - sums->P_0m)*h2inv;
 
-    n_pars=PyArray_SIZE(pars);
-    if (n_pars != (*n_dim)) {
-        PyErr_Format(GMixFatalError, "n_dim is %d but n_pars is %ld",
-                     (*n_dim), n_pars);
-        goto _gmixnd_get_prob_args_check_bail;
-    }
-    n_tmp=PyArray_SIZE(tmp_lnprob);
-    if (n_tmp != (*n_gauss)) {
-        PyErr_Format(GMixFatalError, "n_gauss is %ld but n_tmp_lnprob is %ld",
-                     (*n_gauss), n_tmp);
-        goto _gmixnd_get_prob_args_check_bail;
-    }
+    R12ptr=PyArray_GETPTR2(R_obj,0,1);
+    *(double *) PyArray_GETPTR2(R_obj,0,0) = (sums->P_p0 - 2*P + sums->P_m0)*hsqinv;
+    *R12ptr = (sums->P_pp - sums->P_p0 - sums->P_0p + 2*P
+               - sums->P_m0 - sums->P_0m + sums->P_mm)*hsqinv*0.5;
+    *(double *) PyArray_GETPTR2(R_obj,1,1) = (sums->P_0p - 2*P + sums->P_0m)*hsqinv;
 
-    status=1;
-_gmixnd_get_prob_args_check_bail:
-    return status;
+    *(double *) PyArray_GETPTR2(R_obj,1,0) = *R12ptr;
 }
 
-static 
-PyObject * PyGMix_gmixnd_get_prob_scalar(PyObject* self, PyObject* args) {
 
-    PyObject* log_pnorms=NULL;
-    PyObject* means=NULL;
-    PyObject* icovars=NULL;
-    PyObject* tmp_lnprob=NULL;
-    PyObject* pars=NULL;
-    PyObject* use=NULL; // which components to include
+/*
+ 
+   k-d tree over the templates
 
-    double* tmp_lnprob_ptr=NULL;
-    npy_int32* use_ptr=NULL;
+   The tree is balanced and stored implicitly: the children of node k are
+   2k+1 and 2k+2, and node k covers templates [bounds[k,0], bounds[k,1])
+   of the permuted template list, with bounding box lo[k], hi[k].  The
+   arrays are allocated in python, see PQRTemplateIndex
 
-    // up to 10 dims allowed
-    double xdiff[10];
-    int dolog=0;
-    npy_intp i=0, n_gauss=0;
-    double p=0.0, retval=0;
-    double lnpmax=-9.99e9, logpnorm=0, chi2=0, lnp=0, par=0, mean=0, icov=0;
-    int n_dim=0, idim1=0, idim2=0;
+*/
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOOOOOi", 
-                          &log_pnorms,
-                          &means,
-                          &icovars,
-                          &tmp_lnprob,
-                          &pars,
-                          &use,
-                          &dolog)) {
-        return NULL;
-    }
+struct PQRIndex {
+    const double *lo;         // [nnodes, ndim]
+    const double *hi;         // [nnodes, ndim]
+    const npy_int64 *bounds;  // [nnodes, 2]
+    npy_intp nnodes;
+    npy_intp ndim;
+};
 
+// the tree depth is at most log2(number of templates)
+#define PQR_INDEX_MAXSTACK 128
 
-    if (!gmixnd_get_prob_args_check(log_pnorms,
-                                    means,
-                                    icovars,
-                                    tmp_lnprob,
-                                    pars,
-                                    &n_gauss,
-                                    &n_dim)) {
-        return NULL;
-    }
+struct PQRIndexIter {
+    const struct PQRIndex *index;
+    const double *boxlo;
+    const double *boxhi;
+    npy_intp stack[PQR_INDEX_MAXSTACK];
+    int nstack;
+};
 
-    tmp_lnprob_ptr = (double *) PyArray_DATA(tmp_lnprob);
+static void pqr_index_set(struct PQRIndex *self,
+                          PyObject* lo_obj,
+                          PyObject* hi_obj,
+                          PyObject* bounds_obj)
+{
+    self->lo=(const double *) PyArray_DATA(lo_obj);
+    self->hi=(const double *) PyArray_DATA(hi_obj);
+    self->bounds=(const npy_int64 *) PyArray_DATA(bounds_obj);
+    self->nnodes=PyArray_DIM(lo_obj,0);
+    self->ndim=PyArray_DIM(lo_obj,1);
+}
 
-    if (use != Py_None) {
-        use_ptr = (npy_int32 *) PyArray_DATA(use);
+static void pqr_index_iter_init(struct PQRIndexIter *self,
+                                const struct PQRIndex *index,
+                                const double *boxlo,
+                                const double *boxhi)
+{
+    self->index=index;
+    self->boxlo=boxlo;
+    self->boxhi=boxhi;
+    self->stack[0]=0;
+    self->nstack=1;
+}
+
+static inline int pqr_index_node_overlaps(const struct PQRIndexIter *self,
+                                          npy_intp node)
+{
+    const double *lo=&self->index->lo[node*self->index->ndim];
+    const double *hi=&self->index->hi[node*self->index->ndim];
+    npy_intp dim=0;
+
+    for (dim=0; dim<self->index->ndim; dim++) {
+        if (lo[dim] > self->boxhi[dim] || hi[dim] < self->boxlo[dim]) {
+            return 0;
+        }
     }
+    return 1;
+}
 
-    for (i=0; i<n_gauss; i++) {
+/*
+   get the template range of the next leaf overlapping the box
 
-        logpnorm = *(double *) PyArray_GETPTR1(log_pnorms, i);
+   returns 0 when there are no more leaves
+*/
+static int pqr_index_next_leaf(struct PQRIndexIter *self,
+                               npy_intp *start,
+                               npy_intp *end)
+{
+    npy_intp node=0, child=0;
 
-        for (idim1=0; idim1<n_dim; idim1++) {
-            par=*(double *) PyArray_GETPTR1(pars, idim1);
-            mean=*(double *) PyArray_GETPTR2(means, i, idim1);
+    while (self->nstack > 0) {
+        self->nstack -= 1;
+        node=self->stack[self->nstack];
 
-            xdiff[idim1] = par-mean;
+        if (!pqr_index_node_overlaps(self, node)) {
+            continue;
         }
 
-        chi2=0;
-        for (idim1=0; idim1<n_dim; idim1++) {
-            for (idim2=0; idim2<n_dim; idim2++) {
-                icov=*(double *) PyArray_GETPTR3(icovars, i, idim1, idim2);
+        child = 2*node+1;
+        if (child >= self->index->nnodes) {
+            *start = (npy_intp) self->index->bounds[2*node];
+            *end = (npy_intp) self->index->bounds[2*node+1];
+            return 1;
+        }
 
-                chi2 += xdiff[idim1]*xdiff[idim2]*icov;
+        // right pushed first so the left is visited first
+        self->stack[self->nstack] = child+1;
+        self->stack[self->nstack+1] = child;
+        self->nstack += 2;
+    }
+
+    return 0;
+}
+
+/*
+   reorder perm[start:end] so the element at kth has the kth smallest
+   value of templates[:,dim], smaller values before and larger after
+*/
+static void pqr_index_select(const double *templates,
+                             npy_intp ndim,
+                             npy_intp dim,
+                             npy_int64 *perm,
+                             npy_intp start,
+                             npy_intp end,
+                             npy_intp kth)
+{
+    npy_intp left=start, right=end-1, i=0, store=0;
+    npy_int64 tmp=0;
+    double pivot=0;
+
+#define _PQR_VAL(j) templates[perm[j]*ndim + dim]
+#define _PQR_SWAP(a,b) do { tmp=perm[a]; perm[a]=perm[b]; perm[b]=tmp; } while(0)
+
+    while (right > left) {
+        // median of three pivot, placed at right
+        i = left + (right-left)/2;
+        if (_PQR_VAL(i) < _PQR_VAL(left)) _PQR_SWAP(i,left);
+        if (_PQR_VAL(right) < _PQR_VAL(left)) _PQR_SWAP(right,left);
+        if (_PQR_VAL(i) < _PQR_VAL(right)) _PQR_SWAP(i,right);
+        pivot = _PQR_VAL(right);
+
+        store=left;
+        for (i=left; i<right; i++) {
+            if (_PQR_VAL(i) < pivot) {
+                _PQR_SWAP(i,store);
+                store++;
             }
         }
+        _PQR_SWAP(store,right);
 
-        lnp = -0.5*chi2 + logpnorm;
-        if (lnp > lnpmax) {
-            lnpmax=lnp;
+        if (store == kth) {
+            break;
+        } else if (kth < store) {
+            right=store-1;
+        } else {
+            left=store+1;
         }
-        tmp_lnprob_ptr[i] = lnp;
-    }    
+    }
 
-    p=0;
-    for (i=0; i<n_gauss; i++) {
+#undef _PQR_VAL
+#undef _PQR_SWAP
+}
 
-        if (use == Py_None || use_ptr[i]) {
-            p += exp(tmp_lnprob_ptr[i] - lnpmax);
+static void pqr_index_build_node(const double *templates,
+                                 npy_intp ndim,
+                                 npy_int64 *perm,
+                                 double *lo,
+                                 double *hi,
+                                 npy_int64 *bounds,
+                                 npy_intp nnodes,
+                                 npy_intp node,
+                                 npy_intp start,
+                                 npy_intp end)
+{
+    double *tlo=&lo[node*ndim], *thi=&hi[node*ndim];
+    double val=0, spread=0, maxspread=-1;
+    npy_intp i=0, dim=0, splitdim=0, mid=0, child=2*node+1;
+
+    bounds[2*node] = start;
+    bounds[2*node+1] = end;
+
+    // empty nodes never overlap
+    for (dim=0; dim<ndim; dim++) {
+        tlo[dim] = INFINITY;
+        thi[dim] = -INFINITY;
+    }
+    for (i=start; i<end; i++) {
+        for (dim=0; dim<ndim; dim++) {
+            val = templates[perm[i]*ndim + dim];
+            if (val < tlo[dim]) tlo[dim]=val;
+            if (val > thi[dim]) thi[dim]=val;
         }
     }
 
-    if (dolog) {
-        retval = log(p) + lnpmax;
-    } else {
-        retval = p*exp(lnpmax);
+    if (child >= nnodes) {
+        return;
     }
 
-    return PyFloat_FromDouble(retval);
+    for (dim=0; dim<ndim; dim++) {
+        spread = thi[dim]-tlo[dim];
+        if (spread > maxspread) {
+            maxspread=spread;
+            splitdim=dim;
+        }
+    }
 
-}
+    mid = start + (end-start)/2;
+    if (maxspread > 0) {
+        // otherwise all are the same and any split will do
+        pqr_index_select(templates, ndim, splitdim, perm, start, end, mid);
+    }
 
+    pqr_index_build_node(templates, ndim, perm, lo, hi, bounds, nnodes,
+                         child, start, mid);
+    pqr_index_build_node(templates, ndim, perm, lo, hi, bounds, nnodes,
+                         child+1, mid, end);
+}
 
 /*
+   templates, perm, lo, hi, bounds
 
-   Difference between mean of the distribution
-   and parameters from the template set
-
-       mean - template_pars
-
+   build the k-d tree; perm should be 0..n-1 on input and holds the
+   order of the templates in the tree on output.  The number of nodes
+   is taken from lo, and must be 2^(depth+1)-1
 */
-static void get_mom_xdiff(const PyObject* mean_obj,
-                          const PyObject* pars_obj,
-                          npy_intp i,
-                          double *xdiff,
-                          npy_intp ndim)
-{
-    npy_intp dim=0;
-    double mean=0, par=0;
-    for (dim=0; dim<ndim; dim++) {
+static 
+PyObject * PyGMix_pqr_index_build(PyObject* self, PyObject* args) {
 
-        mean = *(double *)PyArray_GETPTR1(mean_obj, dim);
-        par  = *(double *)PyArray_GETPTR2(pars_obj, i, dim);
+    PyObject* templates_obj=NULL;
+    PyObject* perm_obj=NULL;
+    PyObject* lo_obj=NULL;
+    PyObject* hi_obj=NULL;
+    PyObject* bounds_obj=NULL;
+    npy_intp ntemplates=0, ndim=0, nnodes=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOOO", 
+                          &templates_obj,
+                          &perm_obj,
+                          &lo_obj,
+                          &hi_obj,
+                          &bounds_obj)) {
+        return NULL;
+    }
 
-        xdiff[dim] = mean-par;
+    ntemplates=PyArray_DIM(templates_obj,0);
+    ndim=PyArray_DIM(templates_obj,1);
+    nnodes=PyArray_DIM(lo_obj,0);
 
+    if (PyArray_SIZE(perm_obj) != ntemplates
+            || PyArray_DIM(lo_obj,1) != ndim
+            || PyArray_DIM(hi_obj,0) != nnodes
+            || PyArray_DIM(hi_obj,1) != ndim
+            || PyArray_SIZE(bounds_obj) != 2*nnodes
+            || ((nnodes+1) & nnodes) != 0) {
+        PyErr_Format(GMixFatalError, "inconsistent index arrays");
+        return NULL;
     }
+
+    Py_BEGIN_ALLOW_THREADS
+    pqr_index_build_node((const double *) PyArray_DATA(templates_obj),
+                         ndim,
+                         (npy_int64 *) PyArray_DATA(perm_obj),
+                         (double *) PyArray_DATA(lo_obj),
+                         (double *) PyArray_DATA(hi_obj),
+                         (npy_int64 *) PyArray_DATA(bounds_obj),
+                         nnodes,
+                         0, 0, ntemplates);
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
 }
 
-// xdiff should already be filled out for the non-sheared pars
-// only the slots for M1,M2,T are updated
-static void get_mom_xdiff_sheared(const PyObject* mean_obj,
-                                  const PyObject* sheared_pars_obj,
-                                  npy_intp i,
-                                  double *xdiff)
+/*
+   box around the mean, mean-width to mean+width, that contains
+   the nsigma ellipse
+*/
+static void pqr_index_get_box(const PyObject* mean_obj,
+                              const PyObject* width_obj,
+                              npy_intp ndim,
+                              double *boxlo,
+                              double *boxhi)
 {
+    double mean=0, width=0;
     npy_intp dim=0;
-    double mean=0, par=0;
-    for (dim=PYGMIX_DOFFSET; dim<PYGMIX_DOFFSET+3; dim++) {
 
+    for (dim=0; dim<ndim; dim++) {
         mean = *(double *)PyArray_GETPTR1(mean_obj, dim);
-        par  = *(double *)PyArray_GETPTR2(sheared_pars_obj, i, dim-PYGMIX_DOFFSET);
-
-        xdiff[dim] = mean-par;
+        width = *(double *)PyArray_GETPTR1(width_obj, dim);
+        boxlo[dim] = mean-width;
+        boxhi[dim] = mean+width;
     }
 }
 
 
 /*
 
-   (xmean - x) C^{-1} (xmean - x)
+   Philox4x32-10 counter based random numbers, Salmon et al. 2011
+
+   The output is a pure function of the counter and key, with no state
+   shared between calls, so it is safe to use from threads and the
+   results do not depend on the order of the calls.  The key holds the
+   seed and the counter the object id and stream, see pqr_order_init
 
 */
-static double get_mom_chi2(const PyObject* icovar_obj,
-                           const double *xdiff,
-                           npy_intp ndim)
-{
-    npy_intp dim1=0, dim2=0;
-    double icov=0, chi2=0, tchi2=0;
 
-    for (dim1=0; dim1<ndim; dim1++) {
-        for (dim2=0; dim2<ndim; dim2++) {
-            icov=*(double *) PyArray_GETPTR2(icovar_obj, dim1, dim2);
+#define PYGMIX_PHILOX_M0 0xD2511F53U
+#define PYGMIX_PHILOX_M1 0xCD9E8D57U
+#define PYGMIX_PHILOX_W0 0x9E3779B9U
+#define PYGMIX_PHILOX_W1 0xBB67AE85U
+#define PYGMIX_PHILOX_NROUNDS 10
 
-            tchi2 = xdiff[dim1]*xdiff[dim2]*icov;
-            chi2 += tchi2;
+static void pygmix_philox4x32(const uint32_t *ctr,
+                              const uint32_t *key,
+                              uint32_t *out)
+{
+    uint32_t c0=ctr[0], c1=ctr[1], c2=ctr[2], c3=ctr[3];
+    uint32_t k0=key[0], k1=key[1];
+    uint64_t prod0=0, prod1=0;
+    int round=0;
+
+    for (round=0; round<PYGMIX_PHILOX_NROUNDS; round++) {
+        if (round > 0) {
+            k0 += PYGMIX_PHILOX_W0;
+            k1 += PYGMIX_PHILOX_W1;
         }
+
+        prod0 = (uint64_t) PYGMIX_PHILOX_M0 * c0;
+        prod1 = (uint64_t) PYGMIX_PHILOX_M1 * c2;
+
+        c0 = (uint32_t) (prod1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t) (prod0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) prod1;
+        c3 = (uint32_t) prod0;
     }
 
-    return chi2;
+    out[0]=c0;
+    out[1]=c1;
+    out[2]=c2;
+    out[3]=c3;
 }
 
 /*
-
-   use nsigma to limit the range evaluated,
-   saves time calling exp
-
-   if dolog is true, the points are always evaluated
-   and nsigma is ignored. Also norm is log(norm)
-
-
-   all error checking should be done in python
+   ctr[4], key[2], out[4] all uint32 arrays
 */
 static 
-PyObject * PyGMix_mvn_calc_prob(PyObject* self, PyObject* args) {
+PyObject * PyGMix_philox4x32(PyObject* self, PyObject* args) {
 
-    PyObject* mean_obj=NULL;
-    PyObject* icovar_obj=NULL;
-    double nsigma=0, nsigma2=0, norm=0;
-    int dolog=0;
-    PyObject* allpars_obj=NULL;
-    PyObject* prob_obj=NULL;
-
-    // up to 10 dimensions
-    double xdiff[10];
-    double chi2=0, arg=0;
-    double prob=0, *ptr=NULL;
-    npy_intp ndim=0, npoints=0, i=0;
+    PyObject *ctr_obj=NULL, *key_obj=NULL, *out_obj=NULL;
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOddOiO", 
-                          &mean_obj,
-                          &icovar_obj,
-                          &norm,
-                          &nsigma,
-                          &allpars_obj,
-                          &dolog,
-                          &prob_obj)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOO", &ctr_obj, &key_obj, &out_obj)) {
         return NULL;
     }
 
-    nsigma2=nsigma*nsigma;
- 
-    ndim=PyArray_SIZE(mean_obj);
-    npoints = PyArray_DIM(allpars_obj,0);
+    pygmix_philox4x32((const uint32_t *) PyArray_DATA(ctr_obj),
+                      (const uint32_t *) PyArray_DATA(key_obj),
+                      (uint32_t *) PyArray_DATA(out_obj));
 
-    for (i=0; i<npoints; i++) {
-        get_mom_xdiff(mean_obj, allpars_obj,i,xdiff,ndim);
+    Py_RETURN_NONE;
+}
 
-        chi2=get_mom_chi2(icovar_obj,xdiff,ndim);
+/*
 
-        arg = -0.5*chi2;
+   order in which the templates are visited
 
-        if (dolog) {
-            // norm is really log(norm)
-            // and this is really the log prob
-            prob = norm + arg;
-        } else {
-            if (chi2 < nsigma2) {
-                prob = norm*exp(arg);
-            } else {
-                prob = 0.0;
-            }
-        }
+   The templates are split into blocks of blocksize, and the blocks are
+   visited in a random order while the templates within a block are
+   visited in order.  This keeps memory access sequential, but the early
+   stopping when neff > neff_max does not favor the templates at the
+   start of the list.
 
-        ptr = PyArray_GETPTR1(prob_obj,i);
-        *ptr = prob;
+   The block order is a random bijection of [0, nblocks), a four round
+   Feistel network keyed by (seed, id) using philox as the round
+   function, with cycle walking to map the power of two domain onto
+   nblocks.  Nothing is allocated and each object id gets its own
+   order regardless of which thread runs it.
 
-    }
+   With blocksize <= 0 the templates are visited in order
 
-    Py_RETURN_NONE;
-}
+*/
 
-static void get_mom_Qsums(const PyObject* icovar,
-                          const PyObject* Qderiv,
-                          const double *xdiff,
-                          npy_intp ndim,
-                          double prob,
-                          npy_intp i,
-                          double *icov_dot_Qd_1, // [PYGMIX_MAXDIMS]
-                          double *icov_dot_Qd_2, // [PYGMIX_MAXDIMS]
-                          double *Q1sum,
-                          double *Q2sum) {
+#define PQR_ORDER_NROUNDS 4
 
-    npy_intp dim1=1,dim2=0;
-    double icov=0, deriv1=0, deriv2=0;
+// stream for the template order; other random numbers for the same
+// object should use a different stream
+#define PQR_RNG_STREAM_ORDER 1
 
-    *Q1sum=0;
-    *Q2sum=0;
+struct PQROrder {
+    npy_intp npoints;
+    npy_intp blocksize;
+    npy_intp nblocks;
 
-    memset(icov_dot_Qd_1, 0, ndim*sizeof(double));
-    memset(icov_dot_Qd_2, 0, ndim*sizeof(double));
+    int halfbits;
+    uint32_t halfmask;
 
-    // Q1temp3 = Cinv dot derivatives
-    for (dim1=0; dim1<ndim; dim1++) {
+    uint32_t key[2];
+    uint32_t ctr[4];
+};
 
-        for (dim2=0; dim2<ndim; dim2++) {
+static void pqr_order_init(struct PQROrder *self,
+                           npy_intp npoints,
+                           npy_intp blocksize,
+                           uint64_t seed,
+                           uint64_t id)
+{
+    npy_intp n=0;
+    int nbits=0;
 
-            if (dim2 >= 2 && dim2 <= 4) {
-                // derivatives non-zero for these dimensions
-                icov=*(double *) PyArray_GETPTR2(icovar, dim1, dim2);
+    memset(self, 0, sizeof(struct PQROrder));
 
-                deriv1 = *(double *)PyArray_GETPTR3(Qderiv, i, dim2-PYGMIX_DOFFSET, 0);
-                deriv2 = *(double *)PyArray_GETPTR3(Qderiv, i, dim2-PYGMIX_DOFFSET, 1);
+    self->npoints=npoints;
+    if (blocksize <= 0 || blocksize >= npoints) {
+        self->blocksize=npoints;
+        self->nblocks = (npoints > 0) ? 1 : 0;
+        return;
+    }
 
-                icov_dot_Qd_1[dim1] += deriv1*icov;
-                icov_dot_Qd_2[dim1] += deriv2*icov;
-            }
-        } 
+    self->blocksize=blocksize;
+    self->nblocks = (npoints + blocksize - 1)/blocksize;
+
+    // bits needed to represent nblocks-1, rounded up to even
+    for (n=self->nblocks-1; n > 0; n >>= 1) {
+        nbits++;
     }
-    // xdiff dot Q1temp3
-    for (dim1=0; dim1<ndim; dim1++) {
-        *Q1sum += xdiff[dim1]*icov_dot_Qd_1[dim1];
-        *Q2sum += xdiff[dim1]*icov_dot_Qd_2[dim1];
+    self->halfbits = (nbits+1)/2;
+    if (self->halfbits < 1) {
+        self->halfbits=1;
     }
+    self->halfmask = (uint32_t) ((1ULL << self->halfbits) - 1);
 
-    *Q1sum *= prob;
-    *Q2sum *= prob;
+    self->key[0] = (uint32_t) seed;
+    self->key[1] = (uint32_t) (seed >> 32);
+
+    // ctr[0] holds the value being permuted, ctr[1] the stream and round
+    self->ctr[2] = (uint32_t) id;
+    self->ctr[3] = (uint32_t) (id >> 32);
+}
+
+static npy_intp pqr_order_feistel(const struct PQROrder *self, npy_intp x)
+{
+    uint32_t left=0, right=0, tmp=0;
+    uint32_t ctr[4]={0}, out[4]={0};
+    int round=0;
 
+    left  = (uint32_t) (x >> self->halfbits) & self->halfmask;
+    right = (uint32_t) x & self->halfmask;
+
+    ctr[2]=self->ctr[2];
+    ctr[3]=self->ctr[3];
+    for (round=0; round<PQR_ORDER_NROUNDS; round++) {
+        ctr[0]=right;
+        ctr[1]=(PQR_RNG_STREAM_ORDER << 8) | round;
+        pygmix_philox4x32(ctr, self->key, out);
+
+        tmp=right;
+        right = left ^ (out[0] & self->halfmask);
+        left=tmp;
+    }
+
+    return ((npy_intp) left << self->halfbits) | (npy_intp) right;
 }
 
 /*
-   currently only implements the d^2L/d^2M terms
+   get the template range [start, end) of the k'th block to visit
 */
-static void get_mom_Rsums(const PyObject* icovar,
-                          const PyObject* Qderiv,
-                          const PyObject* Rderiv,
-                          const double *xdiff,
-                          npy_intp ndim,
-                          const double *icov_dot_Qd_1,
-                          const double *icov_dot_Qd_2,
-                          double prob,
-                          npy_intp i,
-                          double *R11sum,
-                          double *R12sum,
-                          double *R22sum) {
+static void pqr_order_get_block(const struct PQROrder *self,
+                                npy_intp k,
+                                npy_intp *start,
+                                npy_intp *end)
+{
+    npy_intp block=k;
+
+    if (self->nblocks > 1) {
+        // cycle walk until we land in [0, nblocks); the domain is
+        // less than 4*nblocks so this is short
+        block=pqr_order_feistel(self, k);
+        while (block >= self->nblocks) {
+            block=pqr_order_feistel(self, block);
+        }
+    }
+
+    *start = block*self->blocksize;
+    *end = *start + self->blocksize;
+    if (*end > self->npoints) {
+        *end=self->npoints;
+    }
+}
+
+/*
+   npoints, blocksize, seed, id, order[npoints] i8
+
+   fill the order in which templates are visited, for testing
+*/
+static 
+PyObject * PyGMix_pqr_get_order(PyObject* self, PyObject* args) {
+
+    npy_intp npoints=0, blocksize=0;
+    unsigned long long seed=0, id=0;
+    PyObject *order_obj=NULL;
+
+    struct PQROrder order={0};
+    npy_int64 *optr=NULL;
+    npy_intp k=0, i=0, start=0, end=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"nnKKO",
+                          &npoints, &blocksize, &seed, &id, &order_obj)) {
+        return NULL;
+    }
 
-    double R11temp3[PYGMIX_MAXDIMS]={0};
-    double R12temp3[PYGMIX_MAXDIMS]={0};
-    double R22temp3[PYGMIX_MAXDIMS]={0};
-    npy_intp dim1=1,dim2=0;
-    double icov=0,
-           deriv1=0, deriv2=0,
-           deriv11=0, deriv12=0,deriv22;
+    pqr_order_init(&order, npoints, blocksize, seed, id);
 
-    *R11sum=0;
-    *R12sum=0;
-    *R22sum=0;
+    optr=(npy_int64 *) PyArray_DATA(order_obj);
+    for (k=0; k<order.nblocks; k++) {
+        pqr_order_get_block(&order, k, &start, &end);
+        for (i=start; i<end; i++) {
+            *optr = i;
+            optr++;
+        }
+    }
 
-    // R11temp3 = Cinv dot derivatives
-    for (dim1=0; dim1<ndim; dim1++) {
+    Py_RETURN_NONE;
+}
 
-        for (dim2=0; dim2<3; dim2++) {
+/*
+   sum over the templates in the given order, stopping once more than
+   nmin have been checked and neff > neff_max
 
-            if (dim2 >= 2 && dim2 <= 4) {
-                // derivatives are only non-zero for a subset of the dimensions
+   does not use the python api, so can be run without the GIL
+*/
+static void pqr_templates_sum(const double *mean,
+                              const double *icovar,
+                              double norm,
+                              double nsigma2,
+                              npy_intp nmin,
+                              double neff_max,
+                              const PyObject* templates_obj,
+                              const PyObject* Qderiv_obj,
+                              const PyObject* Rderiv_obj,
+                              const struct PQROrder *order,
+                              struct PQRSums *sums,
+                              double *neff)
+{
+    npy_intp ndim=PyArray_DIM(templates_obj,1);
+    npy_intp k=0, i=0, ii=0, start=0, end=0;
 
-                icov=*(double *) PyArray_GETPTR2(icovar, dim1, dim2);
+    *neff=0;
+    for (k=0; k<order->nblocks; k++) {
+        pqr_order_get_block(order, k, &start, &end);
 
-                deriv11 = *(double *)PyArray_GETPTR4(Rderiv, i, dim2-PYGMIX_DOFFSET, 0, 0);
-                deriv12 = *(double *)PyArray_GETPTR4(Rderiv, i, dim2-PYGMIX_DOFFSET, 0, 1);
-                deriv22 = *(double *)PyArray_GETPTR4(Rderiv, i, dim2-PYGMIX_DOFFSET, 1, 1);
+        for (i=start; i<end; i++) {
+            pqr_templates_add(mean, icovar, templates_obj,
+                              Qderiv_obj, Rderiv_obj,
+                              norm, nsigma2, ndim, i, sums);
 
-                R11temp3[dim1] += icov*deriv11;
-                R12temp3[dim1] += icov*deriv12;
-                R22temp3[dim1] += icov*deriv22;
+            *neff = sums->P/sums->Pmax;
+            if ( (ii > nmin) && (*neff > neff_max) ) {
+                return;
             }
-        } 
+            ii++;
+        }
     }
-    for (dim1=0; dim1<ndim; dim1++) {
+}
 
-        // xdiff dot R11temp3
-        *R11sum += xdiff[dim1]*R11temp3[dim1];
-        *R12sum += xdiff[dim1]*R12temp3[dim1];
-        *R22sum += xdiff[dim1]*R22temp3[dim1];
+/*
+   as pqr_templates_sum for the sheared templates
+*/
+static void pqr_templates_full_sum(const double *mean,
+                                   const double *icovar,
+                                   double norm,
+                                   double nsigma2,
+                                   npy_intp nmin,
+                                   double neff_max,
+                                   const PyObject* templates_obj,
+                                   PyObject* const *sheared,
+                                   const struct PQROrder *order,
+                                   struct PQRFullSums *sums,
+                                   double *neff)
+{
+    npy_intp ndim=PyArray_DIM(templates_obj,1);
+    npy_intp k=0, i=0, ii=0, start=0, end=0;
 
-        // Qderiv dot icov_dot_Qd
-        if (dim1 >= 2 && dim1 <= 4) {
-            // derivatives non-zero for these dimensions
-            deriv1 = *(double *)PyArray_GETPTR3(Qderiv, i, dim1-PYGMIX_DOFFSET, 0);
-            deriv2 = *(double *)PyArray_GETPTR3(Qderiv, i, dim1-PYGMIX_DOFFSET, 1);
+    *neff=0;
+    for (k=0; k<order->nblocks; k++) {
+        pqr_order_get_block(order, k, &start, &end);
 
-            *R11sum += deriv1*icov_dot_Qd_1[dim1];
-            *R12sum += deriv1*icov_dot_Qd_2[dim1];
-            *R22sum += deriv2*icov_dot_Qd_2[dim1];
+        for (i=start; i<end; i++) {
+            pqr_templates_full_add(mean, icovar, templates_obj, sheared,
+                                   norm, nsigma2, ndim, i, sums);
+
+            // P is sum(prob)
+            *neff = sums->P/sums->Pmax;
+            if ( (ii > nmin) && (*neff > neff_max) ) {
+                return;
+            }
+            ii++;
         }
     }
-
-    *R11sum *= prob;
-    *R12sum *= prob;
-    *R22sum *= prob;
-
 }
 
-/* Returns an integer in the range [0, n).
- *
- * Uses rand(), and so is affected-by/affects the same seed.
- */
-
 /*
-static int randint(int n) {
-  if ((n - 1) == RAND_MAX) {
-    return rand();
-  } else {
-    // Chop off all of the values that would cause skew...
-    long end = RAND_MAX / n; // truncate skew
-    assert (end > 0L);
-    end *= n;
-
-    // ... and ignore results from rand() that fall above that limit.
-    // (Worst case the loop condition should succeed 50% of the time,
-    // so we can expect to bail out of this loop pretty quickly.)
-    int r;
-    while ((r = rand()) >= end);
+   mean, icovar, ierror, norm, nsigma, nmin, neff_max, templates,
+   Qderiv, Rderiv, seed, id, blocksize, P, Q, R
 
-    return r % n;
-  }
-}
+   ierror is currently ignored.  The templates are visited in the order
+   given by (seed, id, blocksize), see PQROrder; blocksize <= 0 means in
+   order
 */
-
 static 
 PyObject * PyGMix_mvn_calc_pqr_templates(PyObject* self, PyObject* args) {
 
     PyObject* mean_obj=NULL;
     PyObject *icovar_obj=NULL, *ierror_obj=NULL;
     double nsigma=0, nsigma2=0, norm=0;
-    int nmin=0, seed=0;
+    npy_intp nmin=0, blocksize=0;
+    unsigned long long seed=0, id=0;
     double neff_max=0;
     PyObject *Qderiv_obj=NULL, *Rderiv_obj=NULL;
     PyObject *templates_obj=NULL;
     PyObject *P_obj=NULL, *Q_obj=NULL, *R_obj=NULL;
 
-    double *Pptr=NULL,
-           *Q1ptr=NULL, *Q2ptr=NULL,
-           *R11ptr=NULL,*R12ptr=NULL,
-           *R21ptr=NULL,*R22ptr=NULL;
-
-    double xdiff[PYGMIX_MAXDIMS]={0};
-    double icov_dot_Qd_1[PYGMIX_MAXDIMS]={0};
-    double icov_dot_Qd_2[PYGMIX_MAXDIMS]={0};
-
-    double chi2=0, prob=0;
-    npy_intp ndim=0, npoints=0, i=0, ii=0;
-    double Q1sum=0, Q2sum=0;
-    double R11sum=0, R12sum=0, R22sum=0;
-
-    double Pmax=0, neff=0;
+    struct PQRSums sums={0};
+    struct PQROrder order={0};
+    double mean[PYGMIX_MAXDIMS]={0};
+    double icovar[PYGMIX_MAXDIMS*PYGMIX_MAXDIMS]={0};
+    npy_intp ndim=0;
 
-    long nuse=0;
+    double neff=0;
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOOddidOOOiOOO", 
+    if (!PyArg_ParseTuple(args, (char*)"OOOddndOOOKKnOOO", 
                           &mean_obj,
                           &icovar_obj,
                           &ierror_obj,
@@ -5984,102 +10795,216 @@ PyObject * PyGMix_mvn_calc_pqr_templates(PyObject* self, PyObject* args) {
                           &Qderiv_obj,
                           &Rderiv_obj,
                           &seed,
+                          &id,
+                          &blocksize,
                           &P_obj,
                           &Q_obj,
                           &R_obj)) {
         return NULL;
     }
 
-    if (seed > 0) {
-        srand(seed);
-    }
-
     nsigma2=nsigma*nsigma;
  
     ndim=PyArray_SIZE(mean_obj);
-    npoints = PyArray_DIM(templates_obj,0);
+    get_mom_like(mean_obj, icovar_obj, ndim, mean, icovar);
 
-    Pptr=PyArray_GETPTR1(P_obj,0);
+    pqr_order_init(&order, PyArray_DIM(templates_obj,0), blocksize, seed, id);
 
-    Q1ptr=PyArray_GETPTR1(Q_obj,0);
-    Q2ptr=PyArray_GETPTR1(Q_obj,1);
+    Py_BEGIN_ALLOW_THREADS
+    pqr_templates_sum(mean, icovar, norm, nsigma2, nmin, neff_max,
+                      templates_obj, Qderiv_obj, Rderiv_obj,
+                      &order, &sums, &neff);
+    Py_END_ALLOW_THREADS
 
-    R11ptr=PyArray_GETPTR2(R_obj,0,0);
-    R12ptr=PyArray_GETPTR2(R_obj,0,1);
-    R21ptr=PyArray_GETPTR2(R_obj,1,0);
-    R22ptr=PyArray_GETPTR2(R_obj,1,1);
-
-    for (ii=0; ii<npoints; ii++) {
-        
-        // randomizing seriously messes up the cache locality
-        // but if we are stopping early for neff cut it is probably ok
-        //
-        // check a random template, since we might bail early
-        // if our neff. check is met
-        //i=randint(npoints);
-        i=ii;
-        get_mom_xdiff(mean_obj,templates_obj,i,xdiff,ndim);
-
-        chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-
-        if (chi2 < nsigma2) {
-            nuse += 1;
-            prob = norm*exp(-0.5*chi2);
-
-            if (prob > Pmax) {
-                Pmax=prob;
+    pqr_templates_copy_sums(&sums, P_obj, Q_obj, R_obj);
+
+    return Py_BuildValue("ld", sums.nuse, neff);
+}
+
+/*
+   means[nobj,ndim], icovars[nobj,ndim,ndim], norms[nobj], nsigma,
+   nmin, neff_max, templates, Qderiv, Rderiv, seed, ids[nobj] i8,
+   blocksize, P[nobj], Q[nobj,2], R[nobj,2,2], nuse[nobj] i8,
+   neff[nobj], nthreads
+
+   mvn_calc_pqr_templates for a catalog of objects, split over nthreads.
+   Object i uses the template order keyed by (seed, ids[i]), so the
+   results do not depend on the number of threads or the scheduling.
+   The output arrays must be contiguous
+*/
+static 
+PyObject * PyGMix_mvn_calc_pqr_templates_batch(PyObject* self, PyObject* args) {
+
+    PyObject *means_obj=NULL, *icovars_obj=NULL, *norms_obj=NULL;
+    double nsigma=0, nsigma2=0;
+    npy_intp nmin=0, blocksize=0;
+    unsigned long long seed=0;
+    double neff_max=0;
+    PyObject *templates_obj=NULL, *Qderiv_obj=NULL, *Rderiv_obj=NULL;
+    PyObject *ids_obj=NULL;
+    PyObject *P_obj=NULL, *Q_obj=NULL, *R_obj=NULL;
+    PyObject *nuse_obj=NULL, *neff_obj=NULL;
+    int nthreads=1;
+
+    npy_intp nobj=0, ndim=0, npoints=0, iobj=0;
+    double *Pptr=NULL, *Qptr=NULL, *Rptr=NULL, *neffptr=NULL;
+    npy_int64 *nuseptr=NULL;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOdndOOOKOnOOOOOi", 
+                          &means_obj,
+                          &icovars_obj,
+                          &norms_obj,
+                          &nsigma,
+                          &nmin,
+                          &neff_max,
+                          &templates_obj,
+                          &Qderiv_obj,
+                          &Rderiv_obj,
+                          &seed,
+                          &ids_obj,
+                          &blocksize,
+                          &P_obj,
+                          &Q_obj,
+                          &R_obj,
+                          &nuse_obj,
+                          &neff_obj,
+                          &nthreads)) {
+        return NULL;
+    }
+
+    nsigma2=nsigma*nsigma;
+    nobj=PyArray_DIM(means_obj,0);
+    ndim=PyArray_DIM(means_obj,1);
+    npoints=PyArray_DIM(templates_obj,0);
+
+    Pptr=(double *) PyArray_DATA(P_obj);
+    Qptr=(double *) PyArray_DATA(Q_obj);
+    Rptr=(double *) PyArray_DATA(R_obj);
+    nuseptr=(npy_int64 *) PyArray_DATA(nuse_obj);
+    neffptr=(double *) PyArray_DATA(neff_obj);
+
+    nthreads=pygmix_get_nthreads(nthreads);
+
+    Py_BEGIN_ALLOW_THREADS
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+#endif
+    for (iobj=0; iobj<nobj; iobj++) {
+        struct PQRSums sums={0};
+        struct PQROrder order={0};
+        double mean[PYGMIX_MAXDIMS]={0};
+        double icovar[PYGMIX_MAXDIMS*PYGMIX_MAXDIMS]={0};
+        double norm=0, neff=0;
+        npy_int64 id=0;
+        npy_intp dim1=0, dim2=0;
+
+        for (dim1=0; dim1<ndim; dim1++) {
+            mean[dim1] = *(double *) PyArray_GETPTR2(means_obj, iobj, dim1);
+            for (dim2=0; dim2<ndim; dim2++) {
+                icovar[dim1*ndim + dim2] =
+                    *(double *) PyArray_GETPTR3(icovars_obj, iobj, dim1, dim2);
             }
+        }
+        norm = *(double *) PyArray_GETPTR1(norms_obj, iobj);
+        id = *(npy_int64 *) PyArray_GETPTR1(ids_obj, iobj);
 
-            *Pptr += prob;
-
-            get_mom_Qsums(icovar_obj,
-                          Qderiv_obj,
-                          xdiff,
-                          ndim,
-                          prob,
-                          i,
-                          icov_dot_Qd_1,
-                          icov_dot_Qd_2,
-                          &Q1sum,&Q2sum);
-
-            *Q1ptr += Q1sum;
-            *Q2ptr += Q2sum;
-
-            get_mom_Rsums(icovar_obj,
-                          Qderiv_obj,
-                          Rderiv_obj,
-                          xdiff,
-                          ndim,
-                          icov_dot_Qd_1,
-                          icov_dot_Qd_2,
-                          prob,
-                          i,
-                          &R11sum,&R12sum,&R22sum);
-
-            *R11ptr += R11sum;
-            *R12ptr += R12sum;
-            *R22ptr += R22sum;
-        }
-
-        neff = *Pptr/Pmax;
-        if ( (i > nmin) && (neff > neff_max) ) {
-            break;
+        pqr_order_init(&order, npoints, blocksize, seed, (uint64_t) id);
+
+        pqr_templates_sum(mean, icovar, norm, nsigma2, nmin, neff_max,
+                          templates_obj, Qderiv_obj, Rderiv_obj,
+                          &order, &sums, &neff);
+
+        Pptr[iobj] = sums.P;
+        Qptr[2*iobj + 0] = sums.Q1;
+        Qptr[2*iobj + 1] = sums.Q2;
+        Rptr[4*iobj + 0] = sums.R11;
+        Rptr[4*iobj + 1] = sums.R12;
+        Rptr[4*iobj + 2] = sums.R12;
+        Rptr[4*iobj + 3] = sums.R22;
+        nuseptr[iobj] = sums.nuse;
+        neffptr[iobj] = neff;
+    }
+
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+/*
+   mean, icovar, norm, nsigma, templates, Qderiv, Rderiv,
+   index_lo, index_hi, index_bounds, width, P, Q, R
+
+   As mvn_calc_pqr_templates but only templates in leaves of the k-d tree
+   that overlap the box mean +/- width are checked; width should bound the
+   nsigma ellipse, nsigma*sqrt(diag(cov)).  The templates and derivatives
+   must be in the order of the tree.  All templates within nsigma are
+   used, there is no early stopping
+*/
+static 
+PyObject * PyGMix_mvn_calc_pqr_templates_index(PyObject* self, PyObject* args) {
+
+    PyObject* mean_obj=NULL;
+    PyObject *icovar_obj=NULL;
+    double nsigma=0, nsigma2=0, norm=0;
+    PyObject *Qderiv_obj=NULL, *Rderiv_obj=NULL;
+    PyObject *templates_obj=NULL;
+    PyObject *lo_obj=NULL, *hi_obj=NULL, *bounds_obj=NULL, *width_obj=NULL;
+    PyObject *P_obj=NULL, *Q_obj=NULL, *R_obj=NULL;
+
+    struct PQRSums sums={0};
+    struct PQRIndex index={0};
+    struct PQRIndexIter iter={0};
+    double boxlo[PYGMIX_MAXDIMS]={0}, boxhi[PYGMIX_MAXDIMS]={0};
+    double mean[PYGMIX_MAXDIMS]={0};
+    double icovar[PYGMIX_MAXDIMS*PYGMIX_MAXDIMS]={0};
+    npy_intp ndim=0, i=0, start=0, end=0;
+    double neff=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOddOOOOOOOOOO", 
+                          &mean_obj,
+                          &icovar_obj,
+                          &norm,
+                          &nsigma,
+                          &templates_obj,
+                          &Qderiv_obj,
+                          &Rderiv_obj,
+                          &lo_obj,
+                          &hi_obj,
+                          &bounds_obj,
+                          &width_obj,
+                          &P_obj,
+                          &Q_obj,
+                          &R_obj)) {
+        return NULL;
+    }
+
+    nsigma2=nsigma*nsigma;
+    ndim=PyArray_SIZE(mean_obj);
+
+    get_mom_like(mean_obj, icovar_obj, ndim, mean, icovar);
+
+    pqr_index_set(&index, lo_obj, hi_obj, bounds_obj);
+    pqr_index_get_box(mean_obj, width_obj, ndim, boxlo, boxhi);
+    pqr_index_iter_init(&iter, &index, boxlo, boxhi);
+
+    Py_BEGIN_ALLOW_THREADS
+    while (pqr_index_next_leaf(&iter, &start, &end)) {
+        for (i=start; i<end; i++) {
+            pqr_templates_add(mean, icovar, templates_obj,
+                              Qderiv_obj, Rderiv_obj,
+                              norm, nsigma2, ndim, i, &sums);
         }
     }
-    *R21ptr = *R12ptr;
+    Py_END_ALLOW_THREADS
 
-    /*
-    *Q1ptr *= -1;
-    *Q2ptr *= -1;
-    *R11ptr *= -1;
-    *R12ptr *= -1;
-    *R21ptr *= -1;
-    *R22ptr *= -1;
-    */
+    if (sums.nuse > 0) {
+        neff = sums.P/sums.Pmax;
+    }
 
+    pqr_templates_copy_sums(&sums, P_obj, Q_obj, R_obj);
 
-    //Py_RETURN_NONE;
-    return Py_BuildValue("ld", nuse, neff);
+    return Py_BuildValue("ld", sums.nuse, neff);
 }
 
 /*
@@ -6182,202 +11107,560 @@ _bail:
 }
 */             
 
-static 
-PyObject * PyGMix_mvn_calc_pqr_templates_full(PyObject* self, PyObject* args) {
+/*
+   mean, icovar, norm, nsigma, nmin, neff_max, templates, sheared_p0,
+   sheared_m0, sheared_0p, sheared_0m, sheared_pp, sheared_mm, h,
+   seed, id, blocksize, P, Q, R
+
+   The templates are visited in the order given by (seed, id,
+   blocksize), see PQROrder
+*/
+static 
+PyObject * PyGMix_mvn_calc_pqr_templates_full(PyObject* self, PyObject* args) {
+
+    PyObject* mean_obj=NULL;
+    PyObject *icovar_obj=NULL;
+    double nsigma=0, nsigma2=0, norm=0;
+    npy_intp nmin=0, blocksize=0;
+    unsigned long long seed=0, id=0;
+    double h=0;
+    double neff_max=0;
+    PyObject *sheared[6]={NULL};
+
+    PyObject *templates_obj=NULL;
+    PyObject *P_obj=NULL, *Q_obj=NULL, *R_obj=NULL;
+
+    struct PQRFullSums sums={0};
+    struct PQROrder order={0};
+    double mean[PYGMIX_MAXDIMS]={0};
+    double icovar[PYGMIX_MAXDIMS*PYGMIX_MAXDIMS]={0};
+    npy_intp ndim=0;
+    double neff=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOddndOOOOOOOdKKnOOO", 
+                          &mean_obj,
+                          &icovar_obj,
+                          &norm,
+                          &nsigma,
+                          &nmin,  // always sample from at least this many
+                          &neff_max,  // stop if neff > this number
+                          &templates_obj,
+                          &sheared[0], // p0
+                          &sheared[1], // m0
+                          &sheared[2], // 0p
+                          &sheared[3], // 0m
+                          &sheared[4], // pp
+                          &sheared[5], // mm
+                          &h,
+                          &seed,
+                          &id,
+                          &blocksize,
+                          &P_obj,
+                          &Q_obj,
+                          &R_obj)) {
+        return NULL;
+    }
+
+    nsigma2=nsigma*nsigma;
+ 
+    ndim=PyArray_SIZE(mean_obj);
+    get_mom_like(mean_obj, icovar_obj, ndim, mean, icovar);
+
+    pqr_order_init(&order, PyArray_DIM(templates_obj,0), blocksize, seed, id);
+
+    Py_BEGIN_ALLOW_THREADS
+    pqr_templates_full_sum(mean, icovar, norm, nsigma2, nmin, neff_max,
+                           templates_obj, sheared,
+                           &order, &sums, &neff);
+    Py_END_ALLOW_THREADS
+
+    pqr_templates_full_copy_sums(&sums, h, P_obj, Q_obj, R_obj);
+
+    return Py_BuildValue("ld", sums.nuse, neff);
+}
+
+/*
+   mean, icovar, norm, nsigma, templates, sheared_p0, sheared_m0,
+   sheared_0p, sheared_0m, sheared_pp, sheared_mm, h,
+   index_lo, index_hi, index_bounds, width, P, Q, R
+
+   As mvn_calc_pqr_templates_full but only templates in leaves of the k-d
+   tree that overlap the box mean +/- width are checked, see
+   mvn_calc_pqr_templates_index
+*/
+static 
+PyObject * PyGMix_mvn_calc_pqr_templates_full_index(PyObject* self, PyObject* args) {
+
+    PyObject* mean_obj=NULL;
+    PyObject *icovar_obj=NULL;
+    double nsigma=0, nsigma2=0, norm=0, h=0;
+    PyObject *sheared[6]={NULL};
+    PyObject *templates_obj=NULL;
+    PyObject *lo_obj=NULL, *hi_obj=NULL, *bounds_obj=NULL, *width_obj=NULL;
+    PyObject *P_obj=NULL, *Q_obj=NULL, *R_obj=NULL;
+
+    struct PQRFullSums sums={0};
+    struct PQRIndex index={0};
+    struct PQRIndexIter iter={0};
+    double boxlo[PYGMIX_MAXDIMS]={0}, boxhi[PYGMIX_MAXDIMS]={0};
+    double mean[PYGMIX_MAXDIMS]={0};
+    double icovar[PYGMIX_MAXDIMS*PYGMIX_MAXDIMS]={0};
+    npy_intp ndim=0, i=0, start=0, end=0;
+    double neff=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOddOOOOOOOdOOOOOOO", 
+                          &mean_obj,
+                          &icovar_obj,
+                          &norm,
+                          &nsigma,
+                          &templates_obj,
+                          &sheared[0], // p0
+                          &sheared[1], // m0
+                          &sheared[2], // 0p
+                          &sheared[3], // 0m
+                          &sheared[4], // pp
+                          &sheared[5], // mm
+                          &h,
+                          &lo_obj,
+                          &hi_obj,
+                          &bounds_obj,
+                          &width_obj,
+                          &P_obj,
+                          &Q_obj,
+                          &R_obj)) {
+        return NULL;
+    }
+
+    nsigma2=nsigma*nsigma;
+    ndim=PyArray_SIZE(mean_obj);
+
+    get_mom_like(mean_obj, icovar_obj, ndim, mean, icovar);
+
+    pqr_index_set(&index, lo_obj, hi_obj, bounds_obj);
+    pqr_index_get_box(mean_obj, width_obj, ndim, boxlo, boxhi);
+    pqr_index_iter_init(&iter, &index, boxlo, boxhi);
+
+    Py_BEGIN_ALLOW_THREADS
+    while (pqr_index_next_leaf(&iter, &start, &end)) {
+        for (i=start; i<end; i++) {
+            pqr_templates_full_add(mean, icovar, templates_obj,
+                                   sheared, norm, nsigma2, ndim, i, &sums);
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    if (sums.nuse > 0) {
+        neff = sums.P/sums.Pmax;
+    }
+
+    pqr_templates_full_copy_sums(&sums, h, P_obj, Q_obj, R_obj);
+
+    return Py_BuildValue("ld", sums.nuse, neff);
+}
+
+
+
+static PyObject * PyGMix_test(PyObject* self, PyObject* args) {
+    PyErr_Format(GMixRangeError, "testing GMixRangeError");
+    return NULL;
+}
+
+static PyObject* PyGMix_erf(PyObject* self, PyObject* args)
+{
+    double val=0, out=0;
+    long double lval=0;
+    if (!PyArg_ParseTuple(args, (char*)"d", &val)) {
+        return NULL;
+    }
+
+    lval=(long double) val;
+
+    out=(double)erfl(lval);
+
+    return Py_BuildValue("d", out);
+
+}
+static PyObject* PyGMix_erf_array(PyObject* self, PyObject* args)
+{
+    PyObject *arr=NULL, *out=NULL;
+    double *pin=NULL, *pout=NULL, tmp=0;
+    npy_intp num=0, i=0;
+    long double lval=0;
+    if (!PyArg_ParseTuple(args, (char*)"OO", &arr, &out)) {
+        return NULL;
+    }
+
+    num=PyArray_SIZE(arr);
+    for (i=0; i<num; i++) {
+        pin = PyArray_GETPTR1( arr, i );
+        pout = PyArray_GETPTR1( out, i );
+
+        lval=(long double) (*pin);
+        tmp=(double) erfl(lval);
+
+        *pout = tmp;
+    }
 
-    PyObject* mean_obj=NULL;
-    PyObject *icovar_obj=NULL;
-    double nsigma=0, nsigma2=0, norm=0;
-    int nmin=0, seed=0;
-    double h=0, h2inv=0, hsqinv=0;
-    double neff_max=0;
-    PyObject *sheared_p0=NULL,
-             *sheared_m0=NULL,
-             *sheared_0m=NULL,
-             *sheared_0p=NULL,
-             *sheared_pp=NULL,
-             *sheared_mm=NULL;
+    return Py_BuildValue("");
 
-    PyObject *templates_obj=NULL;
-    PyObject *P_obj=NULL, *Q_obj=NULL, *R_obj=NULL;
+}
 
-    double *Pptr=NULL,
-           *Q1ptr=NULL, *Q2ptr=NULL,
-           *R11ptr=NULL,*R12ptr=NULL,
-           *R21ptr=NULL,*R22ptr=NULL;
 
-    double xdiff[PYGMIX_MAXDIMS]={0};
+/*
+ *
+ * C prior descriptors
+ *
+ * Each PyGMix_Prior is one term of a separable prior, evaluated at
+ * pars[index] (and pars[index+1] for the 2-d types).  An array of them
+ * describes a joint prior such as PriorSimpleSep, so the full prior can
+ * be evaluated without calling back into python
+ *
+ */
 
-    double chi2=0;
-    double prob=0;
-    double P=0,
-           P_p0=0, P_m0=0,
-           P_0p=0, P_0m=0,
-           P_pp=0, P_mm=0;
-    npy_intp ndim=0, npoints=0, i=0, ii=0;
-    double Pmax=0, neff=0;
+/*
+   evaluate a single prior term
 
-    //int used=0;
-    long nuse=0;
+   lnp is filled with one value, or two for Normal2D which is separable;
+   nlnp is set to the number filled
 
-    // weight object is currently ignored
-    if (!PyArg_ParseTuple(args, (char*)"OOddidOOOOOOOdiOOO", 
-                          &mean_obj,
-                          &icovar_obj,
-                          &norm,
-                          &nsigma,
-                          &nmin,  // always sample from at least this many
-                          &neff_max,  // stop if neff > this number
-                          &templates_obj,
-                          &sheared_p0,
-                          &sheared_m0,
-                          &sheared_0p,
-                          &sheared_0m,
-                          &sheared_pp,
-                          &sheared_mm,
-                          &h,
-                          &seed,
-                          &P_obj,
-                          &Q_obj,
-                          &R_obj)) {
-        return NULL;
-    }
+   returns 0 if the parameters are out of bounds, 1 otherwise
+*/
+static int prior_eval(const struct PyGMix_Prior *self,
+                      const double *pars,
+                      double *lnp,
+                      int *nlnp)
+{
+    // local copy, the struct is packed
+    double p[PYGMIX_PRIOR_NPARS]={0};
+    double x=pars[self->index], y=0, diff=0, gsq=0, omgsq=0, prob=0;
+    int i=0;
 
-    if (seed > 0) {
-        srand(seed);
+    for (i=0; i<PYGMIX_PRIOR_NPARS; i++) {
+        p[i] = self->pars[i];
     }
 
-    nsigma2=nsigma*nsigma;
-    h2inv=1.0/(2.0*h);
-    hsqinv=1.0/(h*h);
- 
-    ndim=PyArray_SIZE(mean_obj);
-    npoints = PyArray_DIM(templates_obj,0);
-
-    Pptr=PyArray_GETPTR1(P_obj,0);
+    *nlnp=1;
 
-    Q1ptr=PyArray_GETPTR1(Q_obj,0);
-    Q2ptr=PyArray_GETPTR1(Q_obj,1);
+    switch (self->type) {
+        case PYGMIX_PRIOR_NORMAL:
+            // cen, s2inv
+            diff = p[0]-x;
+            lnp[0] = -0.5*diff*diff*p[1];
+            break;
 
-    R11ptr=PyArray_GETPTR2(R_obj,0,0);
-    R12ptr=PyArray_GETPTR2(R_obj,0,1);
-    R21ptr=PyArray_GETPTR2(R_obj,1,0);
-    R22ptr=PyArray_GETPTR2(R_obj,1,1);
+        case PYGMIX_PRIOR_NORMAL2D:
+            // cen1, cen2, s2inv1, s2inv2
+            y = pars[self->index+1];
+            diff = p[0]-x;
+            lnp[0] = -0.5*diff*diff*p[2];
+            diff = p[1]-y;
+            lnp[1] = -0.5*diff*diff*p[3];
+            *nlnp=2;
+            break;
 
-    for (ii=0; ii<npoints; ii++) {
-        // check a random template, since we might bail early
-        // if our neff. check is met
-        //i=randint(npoints);
-        i=ii;
+        case PYGMIX_PRIOR_ZDISK2D:
+            // radius_sq
+            y = pars[self->index+1];
+            if (x*x + y*y >= p[0]) {
+                return 0;
+            }
+            lnp[0] = 0.0;
+            break;
 
-        get_mom_xdiff(mean_obj,templates_obj,i,xdiff,ndim);
+        case PYGMIX_PRIOR_GBA:
+            // sig2inv
+            y = pars[self->index+1];
+            gsq = x*x + y*y;
+            omgsq = 1.0 - gsq;
+            if (omgsq <= 0.0) {
+                return 0;
+            }
+            lnp[0] = 2*log(omgsq) - 0.5*gsq*p[0];
+            break;
 
-        chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
+        case PYGMIX_PRIOR_FLAT:
+            // minval, maxval
+            if (x < p[0] || x > p[1]) {
+                return 0;
+            }
+            lnp[0] = 0.0;
+            break;
 
-        if (chi2 < nsigma2 && isfinite(chi2)) {
-            nuse += 1;
-            prob = norm*exp(-0.5*chi2);
+        case PYGMIX_PRIOR_TWOSIDED_ERF:
+            // minval, width_at_min, maxval, width_at_max
+            prob  = 0.5*(double)erfl( (long double) ((p[2]-x)/p[3]) );
+            prob += 0.5*(double)erfl( (long double) ((x-p[0])/p[1]) );
+            if (prob <= 0.0) {
+                lnp[0] = -INFINITY;
+            } else {
+                lnp[0] = log(prob);
+            }
+            break;
 
-            if (prob > Pmax) {
-                Pmax=prob;
+        case PYGMIX_PRIOR_LOGNORMAL:
+            // shift, logmean, logivar, lnprob_max
+            x -= p[0];
+            if (x <= 0) {
+                return 0;
             }
+            y = log(x);
+            diff = y-p[1];
+            lnp[0] = -0.5*p[2]*diff*diff - y - p[3];
+            break;
+
+        default:
+            // types are checked on entry
+            lnp[0] = 0.0;
+            break;
+    }
+
+    return 1;
+}
 
-            P += prob;
+/*
+   sum of ln(prob) over all terms
+
+   returns 0 if any parameter is out of bounds
+*/
+static int prior_get_lnprob(const struct PyGMix_Prior *self,
+                            npy_intp nprior,
+                            const double *pars,
+                            double *lnprob)
+{
+    double lnp[2]={0};
+    npy_intp i=0;
+    int nlnp=0, j=0;
 
-            // These calls only update the parameters that respond to shear
+    *lnprob=0.0;
+    for (i=0; i<nprior; i++) {
+        if (!prior_eval(&self[i], pars, lnp, &nlnp)) {
+            return 0;
+        }
+        for (j=0; j<nlnp; j++) {
+            *lnprob += lnp[j];
+        }
+    }
 
-            get_mom_xdiff_sheared(mean_obj,sheared_p0,i,xdiff);
-            chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-            P_p0 += norm*exp(-0.5*chi2);
+    return 1;
+}
 
-            get_mom_xdiff_sheared(mean_obj,sheared_m0,i,xdiff);
-            chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-            P_m0 += norm*exp(-0.5*chi2);
+/*
+   fill sqrt(-2 ln(p)) ~ (model-data)/err for each term, as in
+   PriorSimpleSep.fill_fdiff
 
-            get_mom_xdiff_sheared(mean_obj,sheared_0p,i,xdiff);
-            chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-            P_0p += norm*exp(-0.5*chi2);
+   returns 0 if any parameter is out of bounds
+*/
+static int prior_fill_fdiff(const struct PyGMix_Prior *self,
+                            npy_intp nprior,
+                            const double *pars,
+                            double *fdiff,
+                            npy_intp *nfilled)
+{
+    double lnp[2]={0}, chi2=0;
+    npy_intp i=0, index=0;
+    int nlnp=0, j=0;
 
-            get_mom_xdiff_sheared(mean_obj,sheared_0m,i,xdiff);
-            chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-            P_0m += norm*exp(-0.5*chi2);
+    for (i=0; i<nprior; i++) {
+        if (!prior_eval(&self[i], pars, lnp, &nlnp)) {
+            return 0;
+        }
+        for (j=0; j<nlnp; j++) {
+            chi2 = -2*lnp[j];
+            if (chi2 < 0.0) {
+                chi2=0.0;
+            }
+            fdiff[index] = sqrt(chi2);
+            index += 1;
+        }
+    }
 
-            get_mom_xdiff_sheared(mean_obj,sheared_pp,i,xdiff);
-            chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-            P_pp += norm*exp(-0.5*chi2);
+    *nfilled=index;
+    return 1;
+}
 
-            get_mom_xdiff_sheared(mean_obj,sheared_mm,i,xdiff);
-            chi2=get_mom_chi2(icovar_obj, xdiff, ndim);
-            P_mm += norm*exp(-0.5*chi2);
+/*
+   number of fdiff entries filled by the prior
+*/
+static npy_intp prior_get_nfdiff(const struct PyGMix_Prior *self,
+                                 npy_intp nprior)
+{
+    npy_intp i=0, n=0;
+    for (i=0; i<nprior; i++) {
+        n += (self[i].type == PYGMIX_PRIOR_NORMAL2D) ? 2 : 1;
+    }
+    return n;
+}
 
+/*
+   check the types and indices against the number of parameters
+*/
+static int prior_check(PyObject* prior_obj, npy_intp npars)
+{
+    const struct PyGMix_Prior *prior=NULL;
+    npy_intp i=0, nprior=0;
+    int ndim=0;
+
+    prior=(const struct PyGMix_Prior* ) PyArray_DATA(prior_obj);
+    nprior=PyArray_SIZE(prior_obj);
+
+    for (i=0; i<nprior; i++) {
+        switch (prior[i].type) {
+            case PYGMIX_PRIOR_NORMAL:
+            case PYGMIX_PRIOR_FLAT:
+            case PYGMIX_PRIOR_TWOSIDED_ERF:
+            case PYGMIX_PRIOR_LOGNORMAL:
+                ndim=1;
+                break;
+            case PYGMIX_PRIOR_NORMAL2D:
+            case PYGMIX_PRIOR_ZDISK2D:
+            case PYGMIX_PRIOR_GBA:
+                ndim=2;
+                break;
+            default:
+                PyErr_Format(GMixFatalError,
+                             "bad prior type: %d", prior[i].type);
+                return 0;
         }
 
-        // P is sum(prob)
-        neff = P/Pmax;
-        if ( (i > nmin) && (neff > neff_max) ) {
-            break;
+        if (prior[i].index < 0 || prior[i].index + ndim > npars) {
+            PyErr_Format(GMixFatalError,
+                         "prior index %d out of bounds for %ld pars",
+                         prior[i].index, npars);
+            return 0;
         }
     }
 
-    *Pptr=P;
+    return 1;
+}
+
+/*
+   prior, pars
+
+   returns the sum of ln(prob), raising GMixRangeError if pars are out of
+   bounds
+*/
+static PyObject * PyGMix_prior_get_lnprob(PyObject* self, PyObject* args) {
+
+    PyObject* prior_obj=NULL;
+    PyObject* pars_obj=NULL;
+    double lnprob=0;
 
-    *Q1ptr = (P_p0 - P_m0)*h2inv;
-    *Q2ptr = (P_0p - P_0m)*h2inv;
+    if (!PyArg_ParseTuple(args, (char*)"OO", &prior_obj, &pars_obj)) {
+        return NULL;
+    }
 
-    *R11ptr = (P_p0 - 2*P + P_m0)*hsqinv;
-    *R12ptr = (P_pp - P_p0 - P_0p + 2*P - P_m0 - P_0m + P_mm)*hsqinv*0.5;
-    *R22ptr = (P_0p - 2*P + P_0m)*hsqinv;
+    if (!prior_check(prior_obj, PyArray_SIZE(pars_obj))) {
+        return NULL;
+    }
 
-    *R21ptr = *R12ptr;
+    if (!prior_get_lnprob((const struct PyGMix_Prior* ) PyArray_DATA(prior_obj),
+                          PyArray_SIZE(prior_obj),
+                          (const double *) PyArray_DATA(pars_obj),
+                          &lnprob)) {
+        PyErr_Format(GMixRangeError, "prior parameters out of bounds");
+        return NULL;
+    }
 
-    return Py_BuildValue("ld", nuse, neff);
+    return PyFloat_FromDouble(lnprob);
 }
 
+/*
+   prior, pars, fdiff
 
+   fill the start of fdiff with sqrt(-2 ln(p)) and return the number of
+   entries filled, raising GMixRangeError if pars are out of bounds
+*/
+static PyObject * PyGMix_prior_fill_fdiff(PyObject* self, PyObject* args) {
 
-static PyObject * PyGMix_test(PyObject* self, PyObject* args) {
-    PyErr_Format(GMixRangeError, "testing GMixRangeError");
-    return NULL;
-}
+    PyObject* prior_obj=NULL;
+    PyObject* pars_obj=NULL;
+    PyObject* fdiff_obj=NULL;
+    const struct PyGMix_Prior *prior=NULL;
+    npy_intp nprior=0, nfilled=0;
 
-static PyObject* PyGMix_erf(PyObject* self, PyObject* args)
-{
-    double val=0, out=0;
-    long double lval=0;
-    if (!PyArg_ParseTuple(args, (char*)"d", &val)) {
+    if (!PyArg_ParseTuple(args, (char*)"OOO",
+                          &prior_obj, &pars_obj, &fdiff_obj)) {
         return NULL;
     }
 
-    lval=(long double) val;
+    if (!prior_check(prior_obj, PyArray_SIZE(pars_obj))) {
+        return NULL;
+    }
 
-    out=(double)erfl(lval);
+    prior=(const struct PyGMix_Prior* ) PyArray_DATA(prior_obj);
+    nprior=PyArray_SIZE(prior_obj);
 
-    return Py_BuildValue("d", out);
+    if (prior_get_nfdiff(prior, nprior) > PyArray_SIZE(fdiff_obj)) {
+        PyErr_Format(GMixFatalError, "fdiff too small for prior");
+        return NULL;
+    }
+
+    if (!prior_fill_fdiff(prior, nprior,
+                          (const double *) PyArray_DATA(pars_obj),
+                          (double *) PyArray_DATA(fdiff_obj),
+                          &nfilled)) {
+        PyErr_Format(GMixRangeError, "prior parameters out of bounds");
+        return NULL;
+    }
 
+    return PyLong_FromLong( (long) nfilled );
 }
-static PyObject* PyGMix_erf_array(PyObject* self, PyObject* args)
-{
-    PyObject *arr=NULL, *out=NULL;
-    double *pin=NULL, *pout=NULL, tmp=0;
-    npy_intp num=0, i=0;
-    long double lval=0;
-    if (!PyArg_ParseTuple(args, (char*)"OO", &arr, &out)) {
+
+/*
+   prior, pars[N, npars], lnprob[N]
+
+   add ln(prob) of the prior to lnprob; rows with pars out of bounds are
+   set to -inf
+*/
+static PyObject * PyGMix_prior_add_lnprob_array(PyObject* self, PyObject* args) {
+
+    PyObject* prior_obj=NULL;
+    PyObject* pars_obj=NULL;
+    PyObject* lnprob_obj=NULL;
+    const struct PyGMix_Prior *prior=NULL;
+    const double *pars=NULL;
+    double *lnprob=NULL, lnp=0;
+    npy_intp nprior=0, n=0, npars=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOO",
+                          &prior_obj, &pars_obj, &lnprob_obj)) {
         return NULL;
     }
 
-    num=PyArray_SIZE(arr);
-    for (i=0; i<num; i++) {
-        pin = PyArray_GETPTR1( arr, i );
-        pout = PyArray_GETPTR1( out, i );
+    if (PyArray_NDIM(pars_obj) != 2) {
+        PyErr_Format(GMixFatalError, "pars must be 2 dimensional");
+        return NULL;
+    }
 
-        lval=(long double) (*pin);
-        tmp=(double) erfl(lval);
+    n=PyArray_DIM(pars_obj,0);
+    npars=PyArray_DIM(pars_obj,1);
 
-        *pout = tmp;
+    if (PyArray_SIZE(lnprob_obj) != n) {
+        PyErr_Format(GMixFatalError,
+                     "lnprob has size %ld, expected %ld",
+                     PyArray_SIZE(lnprob_obj), n);
+        return NULL;
+    }
+    if (!prior_check(prior_obj, npars)) {
+        return NULL;
     }
 
-    return Py_BuildValue("");
+    prior=(const struct PyGMix_Prior* ) PyArray_DATA(prior_obj);
+    nprior=PyArray_SIZE(prior_obj);
+    pars=(const double *) PyArray_DATA(pars_obj);
+    lnprob=(double *) PyArray_DATA(lnprob_obj);
+
+    Py_BEGIN_ALLOW_THREADS
+    for (i=0; i<n; i++) {
+        if (prior_get_lnprob(prior, nprior, &pars[i*npars], &lnp)) {
+            lnprob[i] += lnp;
+        } else {
+            lnprob[i] = -INFINITY;
+        }
+    }
+    Py_END_ALLOW_THREADS
 
+    Py_RETURN_NONE;
 }
 
 
@@ -6390,19 +11673,25 @@ static PyMethodDef pygauss2d_funcs[] = {
     {"get_model_s2n_Tvar_sums_altweight", (PyCFunction)PyGMix_get_model_s2n_Tvar_sums_altweight,  METH_VARARGS,  "calculate the s/n of the model\n"},
 
     {"get_weighted_moments", (PyCFunction)PyGMix_get_weighted_moments,  METH_VARARGS,  "calculate weighted moments\n"},
+    {"get_weighted_moments_multi", (PyCFunction)PyGMix_get_weighted_moments_multi,  METH_VARARGS,  "calculate weighted moments for multiple weights\n"},
     {"get_weighted_gmix_moments", (PyCFunction)PyGMix_get_weighted_gmix_moments,  METH_VARARGS,  "calculate weighted moments of one gmix with another\n"},
 
     {"get_unweighted_moments", (PyCFunction)PyGMix_get_unweighted_moments,  METH_VARARGS,  "calculate unweighted moments\n"},
 
     {"get_kweighted_moments_image", (PyCFunction)PyGMix_get_kweighted_moments_image,  METH_VARARGS,  "calculate unweighted moments in k space\n"},
+    {"get_kweighted_moments_image_half", (PyCFunction)PyGMix_get_kweighted_moments_image_half,  METH_VARARGS,  "calculate unweighted moments in k space for a Hermitian half plane\n"},
 
     {"get_kweighted_moments_gauss", (PyCFunction)PyGMix_get_kweighted_moments_gauss,  METH_VARARGS,  "calculate weighted moments\n"},
     {"get_kweighted_moments_2gauss", (PyCFunction)PyGMix_get_kweighted_moments_2gauss,  METH_VARARGS,  "calculate weighted moments\n"},
 
     {"get_ksigma_weighted_moments", (PyCFunction)PyGMix_get_ksigma_weighted_moments,  METH_VARARGS,  "calculate weighted moments\n"},
+    {"get_ksigma_weighted_moments_half", (PyCFunction)PyGMix_get_ksigma_weighted_moments_half,  METH_VARARGS,  "calculate weighted moments for a Hermitian half plane\n"},
+    {"get_ksigma_weighted_moments_multi", (PyCFunction)PyGMix_get_ksigma_weighted_moments_multi,  METH_VARARGS,  "calculate weighted moments for a set of images on the same k grid\n"},
     {"get_ksigma_weighted_moments_ps", (PyCFunction)PyGMix_get_ksigma_weighted_moments_ps,  METH_VARARGS,  "calculate weighted moments\n"},
 
     {"get_loglike", (PyCFunction)PyGMix_get_loglike,  METH_VARARGS,  "calculate likelihood\n"},
+    {"fill_pixels", (PyCFunction)PyGMix_fill_pixels,  METH_VARARGS,  "fill the pixels with nonzero weight\n"},
+    {"get_loglike_batch", (PyCFunction)PyGMix_get_loglike_batch,  METH_VARARGS,  "add the likelihood for many mixtures, using the pixels\n"},
     {"get_loglike_gauleg", (PyCFunction)PyGMix_get_loglike_gauleg,  METH_VARARGS,  "calculate likelihood, integrating model over the pixels\n"},
 
     {"get_loglike_images_margsky", (PyCFunction)PyGMix_get_loglike_images_margsky,  METH_VARARGS,  "calculate likelihood between images, subtracting mean\n"},
@@ -6417,7 +11706,9 @@ static PyMethodDef pygauss2d_funcs[] = {
     {"fill_fdiff_sub",  (PyCFunction)PyGMix_fill_fdiff_sub,  METH_VARARGS,  "fill fdiff for LM with sub-pixel integration\n"},
 
     {"fill_fdiffk",  (PyCFunction)PyGMix_fill_fdiffk,  METH_VARARGS,  "fill fdiff for LM\n"},
+    {"fill_fdiffk_half",  (PyCFunction)PyGMix_fill_fdiffk_half,  METH_VARARGS,  "fill fdiff for LM for a Hermitian half plane\n"},
     {"get_loglikek",  (PyCFunction)PyGMix_get_loglikek,  METH_VARARGS,  "get log likelihood in k space\n"},
+    {"get_loglikek_half",  (PyCFunction)PyGMix_get_loglikek_half,  METH_VARARGS,  "get log likelihood in k space for a Hermitian half plane\n"},
 
 
     {"render",      (PyCFunction)PyGMix_render, METH_VARARGS,  "render without jacobian\n"},
@@ -6432,13 +11723,25 @@ static PyMethodDef pygauss2d_funcs[] = {
     {"gmix_fill_cm",(PyCFunction)PyGMix_gmix_fill_cm, METH_VARARGS,  "Fill the input gmix with the input pars\n"},
 
     {"convolve_fill",(PyCFunction)PyGMix_convolve_fill, METH_VARARGS,  "convolve gaussian with psf and store in output\n"},
+    {"prepare_psf",(PyCFunction)PyGMix_prepare_psf, METH_VARARGS,  "prepare a psf for repeated convolutions\n"},
+    {"convolve_fill_prepared",(PyCFunction)PyGMix_convolve_fill_prepared, METH_VARARGS,  "convolve gaussian with a prepared psf and store in output\n"},
+    {"gmix_fill_convolve",(PyCFunction)PyGMix_gmix_fill_convolve, METH_VARARGS,  "fill a simple model convolved with a prepared psf\n"},
+    {"gmix_fill_cm_convolve",(PyCFunction)PyGMix_gmix_fill_cm_convolve, METH_VARARGS,  "fill a composite model convolved with a prepared psf, using a cached basis\n"},
+    {"cm_fill_fracdev_xy",(PyCFunction)PyGMix_cm_fill_fracdev_xy, METH_VARARGS,  "fill arrays for fitting fracdev linearly\n"},
+    {"gmix_fill_convolve_batch",(PyCFunction)PyGMix_gmix_fill_convolve_batch, METH_VARARGS,  "fill many simple models convolved with a prepared psf\n"},
     {"set_norms",(PyCFunction)PyGMix_gmix_set_norms, METH_VARARGS,  "set the normalizations used during evaluation of the gaussians\n"},
 
     {"em_run",(PyCFunction)PyGMix_em_run, METH_VARARGS,  "run the em algorithm\n"},
+    {"em_run_squarem",(PyCFunction)PyGMix_em_run_squarem, METH_VARARGS,  "run the em algorithm with SQUAREM acceleration\n"},
+    {"em_run_pixels",(PyCFunction)PyGMix_em_run_pixels, METH_VARARGS,  "run the em algorithm on the pixels with nonzero weight\n"},
+    {"em_run_batch",(PyCFunction)PyGMix_em_run_batch, METH_VARARGS,  "run the em algorithm on a stack of images\n"},
 
     {"admom",(PyCFunction)PyGMix_admom, METH_VARARGS,  "get adaptive moments\n"},
     {"admom_multi",(PyCFunction)PyGMix_admom_multi, METH_VARARGS,  "get adaptive moments\n"},
     {"admom_multi_deconv",(PyCFunction)PyGMix_admom_multi_deconv, METH_VARARGS,  "get adaptive moments\n"},
+    {"admom_multi_pixels",(PyCFunction)PyGMix_admom_multi_pixels, METH_VARARGS,  "get adaptive moments from pixels of multiple epochs\n"},
+    {"admom_batch",(PyCFunction)PyGMix_admom_batch, METH_VARARGS,  "get adaptive moments for a stack of stamps\n"},
+    {"admom_batch_windows",(PyCFunction)PyGMix_admom_batch_windows, METH_VARARGS,  "get adaptive moments for windows in an image\n"},
 
 
     {"get_cm_Tfactor",        (PyCFunction)PyGMix_get_cm_Tfactor,         METH_VARARGS,  "get T factor for composite model\n"},
@@ -6449,10 +11752,22 @@ static PyMethodDef pygauss2d_funcs[] = {
     {"convert_simple_eta2g_band",        (PyCFunction)PyGMix_convert_simple_eta2g_band,         METH_VARARGS,  "convert eta to g, band specified.\n"},
 
     {"gmixnd_get_prob_scalar",        (PyCFunction)PyGMix_gmixnd_get_prob_scalar,         METH_VARARGS,  "get prob or log prob for scalar arg, nd gaussian"},
+    {"gmixnd_get_prob_array",        (PyCFunction)PyGMix_gmixnd_get_prob_array,         METH_VARARGS,  "get prob or log prob for an array of points, nd gaussian"},
+    {"grid_interp",        (PyCFunction)PyGMix_grid_interp,         METH_VARARGS,  "multilinear interpolation of a function on a regular grid"},
 
     {"mvn_calc_prob",        (PyCFunction)PyGMix_mvn_calc_prob,         METH_VARARGS,  "get prob for the specified multivariate gaussian"},
     {"mvn_calc_pqr_templates",        (PyCFunction)PyGMix_mvn_calc_pqr_templates,         METH_VARARGS,  "get pqr for specified likelihood and templates"},
     {"mvn_calc_pqr_templates_full",        (PyCFunction)PyGMix_mvn_calc_pqr_templates_full,         METH_VARARGS,  "get pqr for specified likelihood and templates"},
+    {"mvn_calc_pqr_templates_index",        (PyCFunction)PyGMix_mvn_calc_pqr_templates_index,         METH_VARARGS,  "get pqr for specified likelihood and templates, using the k-d tree"},
+    {"mvn_calc_pqr_templates_full_index",        (PyCFunction)PyGMix_mvn_calc_pqr_templates_full_index,         METH_VARARGS,  "get pqr for specified likelihood and templates, using the k-d tree"},
+    {"pqr_index_build",        (PyCFunction)PyGMix_pqr_index_build,         METH_VARARGS,  "build a k-d tree over the pqr templates"},
+    {"mvn_calc_pqr_templates_batch",        (PyCFunction)PyGMix_mvn_calc_pqr_templates_batch,         METH_VARARGS,  "get pqr for a catalog of likelihoods, using threads"},
+    {"pqr_get_order",        (PyCFunction)PyGMix_pqr_get_order,         METH_VARARGS,  "get the order in which the pqr templates are visited"},
+    {"philox4x32",        (PyCFunction)PyGMix_philox4x32,         METH_VARARGS,  "philox4x32-10 counter based random numbers"},
+
+    {"prior_get_lnprob",        (PyCFunction)PyGMix_prior_get_lnprob,         METH_VARARGS,  "get ln(prob) for the C prior descriptor"},
+    {"prior_fill_fdiff",        (PyCFunction)PyGMix_prior_fill_fdiff,         METH_VARARGS,  "fill sqrt(-2 ln(prob)) for the C prior descriptor"},
+    {"prior_add_lnprob_array",        (PyCFunction)PyGMix_prior_add_lnprob_array,         METH_VARARGS,  "add ln(prob) for the C prior descriptor to an array"},
 
     {"test",        (PyCFunction)PyGMix_test,         METH_VARARGS,  "test\n\nprint and return."},
     {"erf",         (PyCFunction)PyGMix_erf,         METH_VARARGS,  "erf with better precision."},
@@ -6468,6 +11783,22 @@ static PyMethodDef pygauss2d_funcs[] = {
  *
  */
 
+/*
+   check that the array arguments for the prior array methods have the
+   same size; they are assumed to be contiguous float64
+*/
+static int prior_check_arrays(PyObject* xobj, PyObject* yobj, PyObject* outobj)
+{
+    npy_intp n=PyArray_SIZE(outobj);
+
+    if (PyArray_SIZE(xobj) != n || (yobj && PyArray_SIZE(yobj) != n)) {
+        PyErr_Format(GMixFatalError,
+                     "input and output arrays must be the same size");
+        return 0;
+    }
+    return 1;
+}
+
 /* class representing a 1-d normal distribution */
 
 struct PyGMixNormal {
@@ -6519,10 +11850,58 @@ static PyObject* PyGMixNormal_get_prob_scalar(struct PyGMixNormal* self,
 
 }
 
+/*
+   x, output
+*/
+static PyObject* PyGMixNormal_fill_array(struct PyGMixNormal* self,
+                                         PyObject *args,
+                                         int dolog)
+{
+    PyObject *xobj=NULL, *outobj=NULL;
+    const double *x=NULL;
+    double *out=NULL, diff=0;
+    npy_intp n=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OO", &xobj, &outobj)) {
+        return NULL;
+    }
+    if (!prior_check_arrays(xobj, NULL, outobj)) {
+        return NULL;
+    }
+
+    n=PyArray_SIZE(xobj);
+    x=(const double *) PyArray_DATA(xobj);
+    out=(double *) PyArray_DATA(outobj);
+
+    for (i=0; i<n; i++) {
+        diff = self->cen-x[i];
+        out[i] = -0.5*diff*diff*self->s2inv;
+    }
+    if (!dolog) {
+        for (i=0; i<n; i++) {
+            out[i] = exp(out[i]);
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+static PyObject* PyGMixNormal_get_lnprob_array(struct PyGMixNormal* self,
+                                               PyObject *args)
+{
+    return PyGMixNormal_fill_array(self, args, 1);
+}
+static PyObject* PyGMixNormal_get_prob_array(struct PyGMixNormal* self,
+                                             PyObject *args)
+{
+    return PyGMixNormal_fill_array(self, args, 0);
+}
+
 
 static PyMethodDef PyGMixNormal_methods[] = {
     {"get_lnprob_scalar", (PyCFunction)PyGMixNormal_get_lnprob_scalar, METH_VARARGS, "nget ln(prob) for the input x value."},
     {"get_prob_scalar", (PyCFunction)PyGMixNormal_get_prob_scalar, METH_VARARGS, "get prob for the input x value."},
+    {"get_lnprob_array", (PyCFunction)PyGMixNormal_get_lnprob_array, METH_VARARGS, "fill ln(prob) for the input x array."},
+    {"get_prob_array", (PyCFunction)PyGMixNormal_get_prob_array, METH_VARARGS, "fill prob for the input x array."},
     {NULL}  /* Sentinel */
 };
 
@@ -6656,11 +12035,61 @@ static PyObject* PyGMixNormal2D_get_lnprob_scalar_sep(struct PyGMixNormal2D* sel
     return retval;
 }
 
+/*
+   x1, x2, output
+*/
+static PyObject* PyGMixNormal2D_fill_array(struct PyGMixNormal2D* self,
+                                           PyObject *args,
+                                           int dolog)
+{
+    PyObject *x1obj=NULL, *x2obj=NULL, *outobj=NULL;
+    const double *x1=NULL, *x2=NULL;
+    double *out=NULL, d1=0, d2=0;
+    npy_intp n=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOO", &x1obj, &x2obj, &outobj)) {
+        return NULL;
+    }
+    if (!prior_check_arrays(x1obj, x2obj, outobj)) {
+        return NULL;
+    }
+
+    n=PyArray_SIZE(x1obj);
+    x1=(const double *) PyArray_DATA(x1obj);
+    x2=(const double *) PyArray_DATA(x2obj);
+    out=(double *) PyArray_DATA(outobj);
+
+    for (i=0; i<n; i++) {
+        d1 = self->cen1-x1[i];
+        d2 = self->cen2-x2[i];
+        out[i] = -0.5*d1*d1*self->s2inv1 - 0.5*d2*d2*self->s2inv2;
+    }
+    if (!dolog) {
+        for (i=0; i<n; i++) {
+            out[i] = exp(out[i]);
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+static PyObject* PyGMixNormal2D_get_lnprob_array(struct PyGMixNormal2D* self,
+                                                 PyObject *args)
+{
+    return PyGMixNormal2D_fill_array(self, args, 1);
+}
+static PyObject* PyGMixNormal2D_get_prob_array(struct PyGMixNormal2D* self,
+                                               PyObject *args)
+{
+    return PyGMixNormal2D_fill_array(self, args, 0);
+}
+
 
 static PyMethodDef PyGMixNormal2D_methods[] = {
     {"get_lnprob_scalar", (PyCFunction)PyGMixNormal2D_get_lnprob_scalar, METH_VARARGS, "nget ln(prob) for the input location."},
     {"get_prob_scalar", (PyCFunction)PyGMixNormal2D_get_prob_scalar, METH_VARARGS, "get prob for the input location."},
     {"get_lnprob_scalar_sep", (PyCFunction)PyGMixNormal2D_get_lnprob_scalar_sep, METH_VARARGS, "get prob for the input location, separately for each dimension."},
+    {"get_lnprob_array", (PyCFunction)PyGMixNormal2D_get_lnprob_array, METH_VARARGS, "fill ln(prob) for the input location arrays."},
+    {"get_prob_array", (PyCFunction)PyGMixNormal2D_get_prob_array, METH_VARARGS, "fill prob for the input location arrays."},
     {NULL}  /* Sentinel */
 };
 
@@ -6803,34 +12232,83 @@ static PyObject* PyGMixZDisk2D_get_prob_scalar2d(struct PyGMixZDisk2D* self,
     return PyFloat_FromDouble(retval);
 }
 
-static PyObject* PyGMixZDisk2D_get_prob_array2d(struct PyGMixZDisk2D* self,
-                                                PyObject *args)
+/*
+   fill 1 inside the disk and 0 outside, or 0 and -inf for the log
+
+   r2 is the radius squared; for the 2-d versions it is calculated
+   from the x, y arrays
+*/
+static PyObject* PyGMixZDisk2D_fill_array(struct PyGMixZDisk2D* self,
+                                          PyObject *args,
+                                          int is2d,
+                                          int dolog)
 {
-    PyObject *xobj=NULL, *yobj=NULL, *probobj=NULL;
-    npy_intp nx=0, i=0;
-    double x=0, y=0, r2=0, *probptr=0;
-    if (!PyArg_ParseTuple(args, (char*)"OOO", &xobj, &yobj, &probobj)) {
+    PyObject *xobj=NULL, *yobj=NULL, *outobj=NULL;
+    const double *x=NULL, *y=NULL;
+    double *out=NULL, r2=0, inval=0, outval=0;
+    npy_intp n=0, i=0;
+
+    if (is2d) {
+        if (!PyArg_ParseTuple(args, (char*)"OOO", &xobj, &yobj, &outobj)) {
+            return NULL;
+        }
+    } else {
+        if (!PyArg_ParseTuple(args, (char*)"OO", &xobj, &outobj)) {
+            return NULL;
+        }
+    }
+    if (!prior_check_arrays(xobj, yobj, outobj)) {
         return NULL;
     }
 
-    nx=PyArray_SIZE(xobj);
-
-    for (i=0; i<nx; i++) {
-        x= *( (double*) PyArray_GETPTR1(xobj, i) );
-        y= *( (double*) PyArray_GETPTR1(yobj, i) );
-        probptr = (double*) PyArray_GETPTR1(probobj, i);
+    n=PyArray_SIZE(xobj);
+    x=(const double *) PyArray_DATA(xobj);
+    out=(double *) PyArray_DATA(outobj);
 
-        r2 = x*x + y*y;
+    if (dolog) {
+        inval=0.0;
+        outval=-INFINITY;
+    } else {
+        inval=1.0;
+        outval=0.0;
+    }
 
-        if (r2 >= self->radius_sq) {
-            *probptr=0.0; 
-        } else {
-            *probptr=1.0; 
+    if (is2d) {
+        y=(const double *) PyArray_DATA(yobj);
+        for (i=0; i<n; i++) {
+            r2 = x[i]*x[i] + y[i]*y[i];
+            out[i] = (r2 >= self->radius_sq) ? outval : inval;
+        }
+    } else {
+        for (i=0; i<n; i++) {
+            out[i] = (x[i] >= self->radius) ? outval : inval;
         }
     }
+
     Py_RETURN_NONE;
 }
 
+static PyObject* PyGMixZDisk2D_get_prob_array1d(struct PyGMixZDisk2D* self,
+                                                PyObject *args)
+{
+    return PyGMixZDisk2D_fill_array(self, args, 0, 0);
+}
+static PyObject* PyGMixZDisk2D_get_lnprob_array1d(struct PyGMixZDisk2D* self,
+                                                  PyObject *args)
+{
+    return PyGMixZDisk2D_fill_array(self, args, 0, 1);
+}
+static PyObject* PyGMixZDisk2D_get_prob_array2d(struct PyGMixZDisk2D* self,
+                                                PyObject *args)
+{
+    return PyGMixZDisk2D_fill_array(self, args, 1, 0);
+}
+static PyObject* PyGMixZDisk2D_get_lnprob_array2d(struct PyGMixZDisk2D* self,
+                                                  PyObject *args)
+{
+    return PyGMixZDisk2D_fill_array(self, args, 1, 1);
+}
+
 
 static PyMethodDef PyGMixZDisk2D_methods[] = {
     {"get_lnprob_scalar1d", (PyCFunction)PyGMixZDisk2D_get_lnprob_scalar1d, METH_VARARGS, "0 inside disk, throw exception outside"},
@@ -6838,7 +12316,10 @@ static PyMethodDef PyGMixZDisk2D_methods[] = {
 
     {"get_lnprob_scalar2d", (PyCFunction)PyGMixZDisk2D_get_lnprob_scalar2d, METH_VARARGS, "0 inside disk, throw exception outside"},
     {"get_prob_scalar2d", (PyCFunction)PyGMixZDisk2D_get_prob_scalar2d, METH_VARARGS, "1 inside disk, 0 outside"},
+    {"get_prob_array1d", (PyCFunction)PyGMixZDisk2D_get_prob_array1d, METH_VARARGS, "1 inside disk, 0 outside"},
+    {"get_lnprob_array1d", (PyCFunction)PyGMixZDisk2D_get_lnprob_array1d, METH_VARARGS, "0 inside disk, -inf outside"},
     {"get_prob_array2d", (PyCFunction)PyGMixZDisk2D_get_prob_array2d, METH_VARARGS, "1 inside disk, 0 outside"},
+    {"get_lnprob_array2d", (PyCFunction)PyGMixZDisk2D_get_lnprob_array2d, METH_VARARGS, "0 inside disk, -inf outside"},
     {NULL}  /* Sentinel */
 };
 
@@ -7003,6 +12484,9 @@ init_gmix(void)
 
 
 
+    // tabulate the sersic mixtures on the fine grid
+    sersic_init_table();
+
     // for numpy
     import_array();
 
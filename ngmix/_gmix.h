@@ -3,6 +3,22 @@
 
 #define PYGMIX_LOW_DETVAL 1.0e-200
 
+// sersic mixtures are tabulated for this range of n
+#define PYGMIX_SERSIC_NGAUSS 10
+#define PYGMIX_SERSIC_NNODES 14
+#define PYGMIX_SERSIC_NMIN 0.75
+#define PYGMIX_SERSIC_NMAX 6.0
+#define PYGMIX_SERSIC_DN 0.005
+#define PYGMIX_SERSIC_NFINE 1051
+
+// block sizes for the batched likelihood: pixels in a tile stay in cache
+// while they are used for each sample in a block.  The number of samples
+// in a block is reduced for large mixtures so the block of mixtures also
+// stays in cache
+#define PYGMIX_BATCH_NPIX_TILE 256
+#define PYGMIX_BATCH_NSAMPLE_BLOCK 8
+#define PYGMIX_BATCH_GMIX_BYTES 16384
+
 enum PyGMix_Models {
     PyGMIX_GMIX_FULL=0,
     PyGMIX_GMIX_GAUSS=1,
@@ -48,6 +64,44 @@ struct __attribute__((__packed__)) PyGMixCM {
     struct PyGMix_Gauss2D gmix[16];
 };
 
+/*
+   a psf mixture prepared for repeated convolutions: weights are normalized
+   by the total flux and positions are relative to the psf center
+*/
+struct __attribute__((__packed__)) PyGMix_PreparedPSF {
+    double p;
+    double drow;
+    double dcol;
+
+    double irr;
+    double irc;
+    double icc;
+};
+
+/*
+   a pixel with nonzero weight, with the jacobian applied
+*/
+struct __attribute__((__packed__)) PyGMix_Pixel {
+    double u;
+    double v;
+    double val;
+    double ivar;
+};
+
+/*
+   header for a cached psf-convolved exp and dev basis for the composite
+   model.  The pars the basis was made for are stored so it is only
+   remade when they change
+*/
+struct __attribute__((__packed__)) PyGMixCMBasis {
+    double row;
+    double col;
+    double g1;
+    double g2;
+    double T;
+    int32_t valid;
+};
+
 //struct PyGMix_Jacobian {
 struct __attribute__((__packed__)) PyGMix_Jacobian {
     double row0;
@@ -62,16 +116,36 @@ struct __attribute__((__packed__)) PyGMix_Jacobian {
     double sdet;
 };
 
-struct __attribute__((__packed__)) PyGMix_EM_Sums {
-    double gi;
+// the per-pixel scratch is kept separately by em_run
+#define PYGMIX_EM_MAXGAUSS 64
+
+// max number of weight functions for get_weighted_moments_multi
+#define PYGMIX_WMOM_MAXWEIGHTS 64
 
-    // scratch on a given pixel
-    double trowsum;
-    double tcolsum;
-    double tu2sum;
-    double tuvsum;
-    double tv2sum;
+// max number of dimensions for grid_interp
+#define PYGMIX_GRID_MAXDIM 6
 
+// types for the C prior descriptors, see prior_eval in _gmix.c
+#define PYGMIX_PRIOR_NORMAL 1
+#define PYGMIX_PRIOR_NORMAL2D 2
+#define PYGMIX_PRIOR_ZDISK2D 3
+#define PYGMIX_PRIOR_GBA 4
+#define PYGMIX_PRIOR_FLAT 5
+#define PYGMIX_PRIOR_TWOSIDED_ERF 6
+#define PYGMIX_PRIOR_LOGNORMAL 7
+
+#define PYGMIX_PRIOR_NPARS 4
+
+struct __attribute__((__packed__)) PyGMix_Prior {
+    int32_t type;
+
+    // index of the first parameter
+    int32_t index;
+
+    double pars[PYGMIX_PRIOR_NPARS];
+};
+
+struct __attribute__((__packed__)) PyGMix_EM_Sums {
     // sums over all pixels
     double pnew;
     double rowsum;
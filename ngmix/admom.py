@@ -2,12 +2,19 @@ from __future__ import print_function
 import numpy
 from numpy import array, diag
 
-from .gmix import GMix, GMixModel
-from .shape import e1e2_to_g1g2
+from .gmix import GMix, GMixModel, _gauss2d_dtype
+from .jacobian import _jacobian_dtype
+from .shape import e1e2_to_g1g2, g1g2_to_e1e2
 from .observation import Observation, ObsList, MultiBandObsList
+from .observation import _pixels_dtype
 from . import _gmix
 from .gexceptions import GMixRangeError
 
+try:
+    xrange=xrange
+except:
+    xrange=range
+
 def run_admom(obs, guess, **kw):
     am=Admom(obs, **kw)
 
@@ -35,22 +42,37 @@ class Admom(object):
         Largest allowed shift in the centroid, relative to
         the initial guess.  Default 5.0 (5 pixels if the jacobian
         scale is 1)
+    accelerate: bool, optional
+        If True, use Anderson acceleration of the adaptive step,
+        falling back to the plain step when the accelerated weight
+        is not valid.  Default False
+    nthreads: int, optional
+        Number of threads over which to split the epochs when
+        there are multiple observations; values <= 0 mean use the
+        OpenMP default.  Default 1
     """
 
     def __init__(self, obs, maxiter=200, shiftmax=5.0,
                  etol=1.0e-5, Ttol=0.001,
                  rng=None,
                  deconv=False,
+                 accelerate=False,
+                 nthreads=1,
                  **unused_keys):
 
         self._set_obs(obs, deconv)
-        self._set_conf(maxiter, shiftmax, etol, Ttol)
+        self._set_conf(maxiter, shiftmax, etol, Ttol, accelerate)
 
         self.rng=rng
+        self.nthreads=nthreads
 
     def get_result(self):
         """
         get the result
+
+        info_flags has 0x1 set if the window over which the weight was
+        evaluated was clipped by the edge of an image; this does not
+        cause the measurement to fail
         """
 
         if not hasattr(self,'result'):
@@ -111,6 +133,8 @@ class Admom(object):
                     self._jlist,
                     guess_gmix._data,
                     ares,
+                    self._get_epoch_scratch(),
+                    self.nthreads,
                 )
             else:
                 if len(self._imlist) > 1:
@@ -122,6 +146,8 @@ class Admom(object):
                         self._jlist,
                         guess_gmix._data,
                         ares,
+                        self._get_epoch_scratch(),
+                        self.nthreads,
                     )
                 else:
                     #print("using single")
@@ -202,21 +228,23 @@ class Admom(object):
                 raise ValueError("admom found wt <= 0.0")
 
 
-    def _set_conf(self, maxiter, shiftmax, etol, Ttol):
-        dt=numpy.dtype(_admom_conf_dtype, align=True)
-        conf=numpy.zeros(1, dtype=dt)
-
-        conf['maxit']=maxiter
-        conf['shiftmax']=shiftmax
-        conf['etol']=etol
-        conf['Ttol']=Ttol
-
-        self.conf=conf
+    def _set_conf(self, maxiter, shiftmax, etol, Ttol, accelerate):
+        self.conf=_make_conf(maxiter, shiftmax, etol, Ttol, accelerate)
 
     def _get_am_result(self):
         dt=numpy.dtype(_admom_result_dtype, align=True)
         return numpy.zeros(1, dtype=dt)
 
+    def _get_epoch_scratch(self):
+        """
+        scratch space for the sums from each epoch
+        """
+        if not hasattr(self, '_epoch_scratch'):
+            dt=numpy.dtype(_admom_result_dtype, align=True)
+            self._epoch_scratch=numpy.zeros(len(self._jlist), dtype=dt)
+
+        return self._epoch_scratch
+
     def _get_rng(self):
         if self.rng is None:
             self.rng = numpy.random.RandomState()
@@ -237,6 +265,335 @@ class Admom(object):
 
         return GMixModel(pars, "gauss")
 
+class AdmomContext(Admom):
+    """
+    Multi-epoch adaptive moments that keeps the compacted pixels of all
+    epochs, with fields u,v,val,ivar as made by Observation.get_pixels(),
+    between calls.  For repeated measurements on images with the same
+    geometry, e.g. metacal variants, use update_images() to refill the
+    pixel values rather than creating a new object
+
+    Only pixels with nonzero weight are used; the ADMOM_EDGE info flag
+    is not set since the pixels carry no stamp geometry
+
+    parameters
+    ----------
+    obs: Observation, ObsList or MultiBandObsList
+        The observations
+    maxiter, shiftmax, etol, Ttol, rng, accelerate:
+        See Admom
+    nthreads: int, optional
+        Number of threads over which to split the epochs; values <= 0
+        mean use the OpenMP default.  Default 1
+    """
+    def __init__(self, obs, **kw):
+        kw['deconv']=False
+        super(AdmomContext,self).__init__(obs, **kw)
+
+    def update_images(self, obs):
+        """
+        refill the pixel values from new observations, which must
+        have the same number of epochs and the same weight maps and
+        jacobians as the originals
+        """
+        obslist=self._get_flat_obslist(obs)
+        if len(obslist) != len(self._jlist):
+            raise ValueError("expected %d observations, "
+                             "got %d" % (len(self._jlist), len(obslist)))
+
+        for i,tobs in enumerate(obslist):
+            pixels=self._pixels[self._offsets[i]:self._offsets[i+1]]
+            npix=_gmix.fill_pixels(
+                pixels,
+                numpy.ascontiguousarray(tobs.image, dtype='f8'),
+                numpy.ascontiguousarray(tobs.weight, dtype='f8'),
+                tobs.jacobian._data,
+            )
+            if npix != pixels.size:
+                raise ValueError("observation %d has %d pixels with "
+                                 "nonzero weight, expected "
+                                 "%d" % (i, npix, pixels.size))
+
+    def _go(self, guess_gmix):
+
+        ares=self._get_am_result()
+
+        try:
+            _gmix.admom_multi_pixels(
+                self.conf,
+                self._pixels,
+                self._offsets,
+                guess_gmix._data,
+                ares,
+                self._get_epoch_scratch(),
+                self.nthreads,
+            )
+        except GMixRangeError as err:
+            print("caught admom exception: '%s'" % str(err))
+            pass
+
+        self.result = copy_result(ares)
+
+    def _get_flat_obslist(self, obs):
+        if isinstance(obs,MultiBandObsList):
+            obslist=[tobs for tobslist in obs for tobs in tobslist]
+        elif isinstance(obs, ObsList):
+            obslist=list(obs)
+        elif isinstance(obs, Observation):
+            obslist=[obs]
+        else:
+            raise ValueError("obs is type '%s' but should be "
+                             "Observation, ObsList, or "
+                             "MultiBandObsList" % type(obs))
+
+        return obslist
+
+    def _set_obs(self, obs, deconv):
+        self._deconv=False
+
+        obslist=self._get_flat_obslist(obs)
+        nimage=len(obslist)
+
+        if nimage > 1000:
+            raise ValueError("currently limited to 1000 "
+                             "images, got %d" % nimage)
+
+        pixlist=[tobs.get_pixels() for tobs in obslist]
+
+        offsets=numpy.zeros(nimage+1, dtype='i8')
+        offsets[1:] = numpy.cumsum([p.size for p in pixlist])
+
+        if offsets[-1] == 0:
+            raise ValueError("no pixels with nonzero weight")
+
+        self._pixels=numpy.zeros(offsets[-1], dtype=_pixels_dtype)
+        for i,pixels in enumerate(pixlist):
+            self._pixels[offsets[i]:offsets[i+1]] = pixels
+
+        self._offsets=offsets
+        self._jlist=[tobs.jacobian._data for tobs in obslist]
+
+class AdmomBatch(object):
+    """
+    Measure adaptive moments for many objects at once.  The objects are
+    split between threads, and the GIL is released
+
+    parameters
+    ----------
+    maxiter, shiftmax, etol, Ttol, rng, accelerate:
+        See Admom
+    nthreads: int, optional
+        Number of threads; values <= 0 mean use the OpenMP default.
+        Default 0
+    """
+    def __init__(self, maxiter=200, shiftmax=5.0,
+                 etol=1.0e-5, Ttol=0.001,
+                 rng=None,
+                 accelerate=False,
+                 nthreads=0):
+
+        self.conf=_make_conf(maxiter, shiftmax, etol, Ttol, accelerate)
+        self.rng=rng
+        self.nthreads=nthreads
+
+    def get_result(self):
+        """
+        get the result structured array, one entry per object
+        """
+        if not hasattr(self,'result'):
+            raise RuntimeError("run go() first")
+
+        return self.result
+
+    def get_result_dict(self, i):
+        """
+        get the result for object i as a dict, as returned
+        by Admom.get_result()
+        """
+        res=self.get_result()
+        return copy_result(res[i:i+1])
+
+    def get_gmix(self, i):
+        """
+        get a gmix representing the best fit for object i, normalized
+        """
+        pars=self.get_result()['pars'][i].copy()
+        pars[5]=1.0
+
+        e1 = pars[2]/pars[4]
+        e2 = pars[3]/pars[4]
+
+        g1,g2 = e1e2_to_g1g2(e1, e2)
+        pars[2] = g1
+        pars[3] = g2
+
+        return GMixModel(pars, "gauss")
+
+    def go(self, images, weights, jacobians, guess):
+        """
+        run adaptive moments on a set of postage stamps
+
+        parameters
+        ----------
+        images: array
+            [N, nrow, ncol] stack of images
+        weights: array
+            [N, nrow, ncol] stack of weight maps, all must be > 0
+        jacobians: sequence
+            A Jacobian for each image
+        guess: number, array or sequence of GMix
+            A guess for T, the same for all objects or one per
+            object, or a gaussian mixture for each object.  See
+            Admom.go
+        """
+
+        images=numpy.array(images, dtype='f8', ndmin=3, copy=False)
+        weights=numpy.array(weights, dtype='f8', ndmin=3, copy=False)
+        if weights.shape != images.shape:
+            raise ValueError("weights shape %s does not match "
+                             "images shape %s" % (weights.shape,images.shape))
+
+        self._check_weights(weights)
+
+        nobj=images.shape[0]
+        jdata=self._get_jdata(jacobians, nobj)
+        wts=self._get_guesses(guess, jdata)
+
+        ares=self._get_am_result(nobj)
+
+        _gmix.admom_batch(
+            self.conf,
+            images,
+            weights,
+            jdata,
+            wts,
+            ares,
+            self.nthreads,
+        )
+
+        self.result=ares
+
+    def go_windows(self, image, weight, windows, jacobians, guess):
+        """
+        run adaptive moments on objects in a single large image
+
+        parameters
+        ----------
+        image: array
+            The image
+        weight: array
+            The weight map, all must be > 0
+        windows: array
+            [N, 4] array holding rowmin, colmin, nrow, ncol of the region
+            to use for each object.  Windows are clipped to the image
+        jacobians: sequence
+            A Jacobian for each object, with the center relative to the
+            full image
+        guess: number, array or sequence of GMix
+            See go()
+        """
+
+        image=numpy.array(image, dtype='f8', ndmin=2, copy=False)
+        weight=numpy.array(weight, dtype='f8', ndmin=2, copy=False)
+        if weight.shape != image.shape:
+            raise ValueError("weight shape %s does not match "
+                             "image shape %s" % (weight.shape,image.shape))
+
+        self._check_weights(weight)
+
+        windows=numpy.array(windows, dtype='i8', ndmin=2, copy=True)
+        nobj=windows.shape[0]
+        if windows.shape[1] != 4:
+            raise ValueError("windows should be shape [N,4], "
+                             "got %s" % str(windows.shape))
+
+        jdata=self._get_jdata(jacobians, nobj)
+        wts=self._get_guesses(guess, jdata)
+
+        ares=self._get_am_result(nobj)
+
+        _gmix.admom_batch_windows(
+            self.conf,
+            image,
+            weight,
+            windows,
+            jdata,
+            wts,
+            ares,
+            self.nthreads,
+        )
+
+        self.result=ares
+
+    def _check_weights(self, weights):
+        if numpy.any(weights <= 0.0):
+            raise ValueError("admom found wt <= 0.0")
+
+    def _get_jdata(self, jacobians, nobj):
+        if len(jacobians) != nobj:
+            raise ValueError("got %d jacobians for "
+                             "%d objects" % (len(jacobians), nobj))
+
+        jdata=numpy.zeros(nobj, dtype=_jacobian_dtype)
+        for i,jacob in enumerate(jacobians):
+            jdata[i] = jacob._data[0]
+
+        return jdata
+
+    def _get_guesses(self, guess, jdata):
+        nobj=jdata.size
+        wts=numpy.zeros(nobj, dtype=_gauss2d_dtype)
+
+        if isinstance(guess,GMix):
+            guess=[guess]*nobj
+
+        if (isinstance(guess,(list,tuple))
+                and len(guess) > 0 and isinstance(guess[0],GMix)):
+
+            if len(guess) != nobj:
+                raise ValueError("got %d guesses for "
+                                 "%d objects" % (len(guess), nobj))
+            for i,gm in enumerate(guess):
+                wts[i] = gm._data[0]
+        else:
+            Tguess=numpy.zeros(nobj) + guess
+            self._generate_guesses(Tguess, jdata, wts)
+
+        return wts
+
+    def _generate_guesses(self, Tguess, jdata, wts):
+        """
+        as in Admom._generate_guess, for each object
+        """
+        rng=self._get_rng()
+
+        nobj=Tguess.size
+        scale=jdata['sdet']
+
+        cen = rng.uniform(low=-0.5, high=0.5, size=(nobj,2))
+        g = rng.uniform(low=-0.3, high=0.3, size=(nobj,2))
+        T = Tguess*(1.0 + rng.uniform(low=-0.1, high=0.1, size=nobj))
+
+        e1,e2 = g1g2_to_e1e2(g[:,0], g[:,1])
+
+        wts['p']   = 1.0
+        wts['row'] = cen[:,0]*scale
+        wts['col'] = cen[:,1]*scale
+        wts['irr'] = 0.5*T*(1-e1)
+        wts['irc'] = 0.5*T*e2
+        wts['icc'] = 0.5*T*(1+e1)
+        wts['det'] = wts['irr']*wts['icc'] - wts['irc']**2
+
+    def _get_am_result(self, nobj):
+        dt=numpy.dtype(_admom_result_dtype, align=True)
+        return numpy.zeros(nobj, dtype=dt)
+
+    def _get_rng(self):
+        if self.rng is None:
+            self.rng = numpy.random.RandomState()
+
+        return self.rng
+
 def get_ratio_error(a, b, var_a, var_b, cov_ab):
     """
     get a/b and error on a/b
@@ -374,15 +731,31 @@ def copy_result(ares):
 
     return res
 
+def _make_conf(maxiter, shiftmax, etol, Ttol, accelerate=False):
+    dt=numpy.dtype(_admom_conf_dtype, align=True)
+    conf=numpy.zeros(1, dtype=dt)
+
+    conf['maxit']=maxiter
+    conf['shiftmax']=shiftmax
+    conf['etol']=etol
+    conf['Ttol']=Ttol
+    conf['accelerate']=int(accelerate)
+
+    return conf
+
 _admom_conf_dtype=[
     ('maxit','i4'),
     ('shiftmax','f8'),
     ('etol','f8'),
     ('Ttol','f8'),
+    ('accelerate','i4'),
 ]
 _admom_result_dtype=[
     ('flags','i4'),
 
+    # non-fatal, e.g. 0x1 when the weight window was clipped by the edge
+    ('info_flags','i4'),
+
     ('numiter','i4'),
 
     ('nimage','i4'),
@@ -398,7 +771,7 @@ _admom_result_dtype=[
 
 _admom_flagmap={
     0:'ok',
-    0x1:'edge hit', # not currently used
+    0x1:'edge hit', # only set in info_flags
     0x2:'center shifted too far',
     0x4:'flux < 0',
     0x8:'T < 0',
@@ -406,3 +779,114 @@ _admom_flagmap={
     0x20:'maxit reached',
     0x40:'zero var',
 }
+
+def test_accelerate(nobj=1000, dim=48, noise=0.01, maxiter=200,
+                    seed=None, nthreads=0):
+    """
+    Compare the plain and Anderson accelerated adaptive steps on
+    simulated populations of psf convolved exponential disks, printing
+    the iteration counts, flags and timing for each
+
+    The nominal population spans a range of sizes, ellipticities up to
+    0.7, and s/n.  The hard population has ellipticities 0.9 to 0.99
+    and s/n of about 5 to 15, where a fraction of the objects reach
+    maxiter and many more fail
+
+    Both solvers start from the same guesses for each population
+    """
+
+    rng=numpy.random.RandomState(seed)
+
+    regimes=[
+        ('nominal', dict(gmin=0.0, gmax=0.7, fmin=5.0, fmax=100.0)),
+        ('high e, low s/n', dict(gmin=0.9, gmax=0.99, fmin=0.02, fmax=0.08)),
+    ]
+
+    for name, pars in regimes:
+        images, weights, jacobians, Tguess = _make_accelerate_sim(
+            rng, nobj, dim, noise, **pars
+        )
+
+        # the same guesses for both solvers
+        guess_seed=rng.randint(0,2**30)
+
+        print("population:",name)
+        for accelerate in [False, True]:
+            am=AdmomBatch(
+                maxiter=maxiter,
+                accelerate=accelerate,
+                rng=numpy.random.RandomState(guess_seed),
+                nthreads=nthreads,
+            )
+            _run_accelerate(am, images, weights, jacobians, Tguess)
+
+def _make_accelerate_sim(rng, nobj, dim, noise, gmin, gmax, fmin, fmax):
+    """
+    simulate the population for test_accelerate
+    """
+    from .jacobian import DiagonalJacobian
+
+    scale=0.263
+    cen=(dim-1)/2.0
+
+    psf=GMixModel([0.0, 0.0, 0.0, 0.02, 0.35, 1.0], "turb")
+
+    images=numpy.zeros( (nobj, dim, dim) )
+    weights=numpy.zeros( (nobj, dim, dim) ) + 1.0/noise**2
+    jacobians=[]
+    Tguess=numpy.zeros(nobj)
+
+    for i in xrange(nobj):
+        jacob=DiagonalJacobian(
+            row=cen + rng.uniform(low=-0.5, high=0.5),
+            col=cen + rng.uniform(low=-0.5, high=0.5),
+            scale=scale,
+        )
+
+        gtot=rng.uniform(low=gmin, high=gmax)
+        theta=rng.uniform(low=0.0, high=numpy.pi)
+        g1=gtot*numpy.cos(2*theta)
+        g2=gtot*numpy.sin(2*theta)
+        T=rng.uniform(low=0.05, high=2.0)
+        flux=rng.uniform(low=fmin, high=fmax)
+
+        gm0=GMixModel([0.0, 0.0, g1, g2, T, flux], "exp")
+        gm=gm0.convolve(psf)
+
+        im=gm.make_image( (dim,dim), jacobian=jacob)
+        images[i] = im + rng.normal(scale=noise, size=im.shape)
+
+        jacobians.append(jacob)
+        Tguess[i] = T + psf.get_T()
+
+    return images, weights, jacobians, Tguess
+
+def _run_accelerate(am, images, weights, jacobians, Tguess):
+    """
+    run the batch and print iteration counts, flags and timing
+    """
+    import time
+
+    nobj=images.shape[0]
+
+    tm0=time.time()
+    am.go(images, weights, jacobians, Tguess)
+    tm=time.time()-tm0
+
+    res=am.get_result()
+    numiter=res['numiter']
+    flags=res['flags']
+    w,=numpy.where(flags==0)
+
+    print("    accelerate:",am.conf['accelerate'][0] != 0)
+    print("        time: %g seconds" % tm)
+    print("        numiter mean: %g median: %g 99%%: %g max: %d" % \
+          (numiter.mean(), numpy.median(numiter),
+           numpy.percentile(numiter, 99), numiter.max()))
+    if w.size > 0:
+        print("        numiter mean for ok: %g" % numiter[w].mean())
+    for flag in sorted(_admom_flagmap):
+        nflag=( (flags & flag) != 0).sum()
+        if flag != 0 and nflag > 0:
+            print("        %s: %d" % (_admom_flagmap[flag], nflag))
+    print("        ok: %d/%d" % (w.size, nobj))
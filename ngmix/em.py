@@ -13,7 +13,7 @@ from . import _gmix
 from .gexceptions import GMixRangeError, GMixMaxIterEM
 from .priors import srandu
 
-from .jacobian import Jacobian
+from .jacobian import Jacobian, _jacobian_dtype
 
 from .observation import Observation
 
@@ -74,12 +74,30 @@ class GMixEM(object):
 
         The image should not have zero or negative pixels. You can
         use the prep_image() function to ensure this.
+    use_weight: bool, optional
+        If True, only pixels with weight > 0 are used, from a
+        compact list of those pixels.  The part of the mixture
+        outside of these pixels, masked or off the stamp, is filled
+        in from the model so masked pixels do not bias the fit.
+        Default False
+    ivar_weighted: bool, optional
+        If True, also weight the data in each pixel by the weight
+        map; this is best for weight maps that vary slowly.  Implies
+        use_weight.  Default False
     """
-    def __init__(self, obs):
+    def __init__(self, obs, use_weight=False, ivar_weighted=False):
 
         self._obs=obs
 
-        self._counts=obs.image.sum()
+        self._ivar_weighted = ivar_weighted
+        self._use_weight = use_weight or ivar_weighted
+
+        if self._use_weight:
+            self._pixels=obs.get_pixels()
+            self._counts=self._pixels['val'].sum()
+        else:
+            self._pixels=None
+            self._counts=obs.image.sum()
 
         self._gm        = None
         self._sums      = None
@@ -108,7 +126,8 @@ class GMixEM(object):
             im *= (counts/im.sum())
         return im
 
-    def run_em(self, gmix_guess, sky_guess, maxiter=100, tol=1.e-6):
+    def run_em(self, gmix_guess, sky_guess, maxiter=100, tol=1.e-6,
+               nthreads=1, accelerate=False):
         """
         Run the em algorithm from the input starting guesses
 
@@ -124,6 +143,15 @@ class GMixEM(object):
         tol: number, optional
             The tolerance in the moments that implies convergence,
             default 1.e-6
+        nthreads: int, optional
+            Number of threads to split the rows of the image over
+            for each iteration.  Values <= 0 mean use the OpenMP
+            default.  Default 1
+        accelerate: bool, optional
+            If True, use SQUAREM extrapolation to speed up convergence.
+            Each iteration then makes three or four passes over the
+            image; the number of passes is in the result as 'npass'.
+            Default False
         """
 
         if hasattr(self,'_gm'):
@@ -140,14 +168,43 @@ class GMixEM(object):
         # we handle below
         flags=0
         try:
-            numiter, fdiff = _gmix.em_run(gmtmp._data,
-                                          self._obs.image,
-                                          self._obs.jacobian._data,
-                                          self._sums,
-                                          self._sky_guess,
-                                          self._counts,
-                                          self._tol,
-                                          self._maxiter)
+            if self._use_weight:
+                numiter, fdiff, npass = _gmix.em_run_pixels(
+                    gmtmp._data,
+                    self._pixels,
+                    self._obs.jacobian._data,
+                    self._sums,
+                    self._sky_guess,
+                    self._tol,
+                    self._maxiter,
+                    int(self._ivar_weighted),
+                    int(accelerate),
+                    nthreads,
+                )
+            elif accelerate:
+                numiter, fdiff, npass = _gmix.em_run_squarem(
+                    gmtmp._data,
+                    self._obs.image,
+                    self._obs.jacobian._data,
+                    self._sums,
+                    self._sky_guess,
+                    self._counts,
+                    self._tol,
+                    self._maxiter,
+                    nthreads,
+                )
+            else:
+                numiter, fdiff = _gmix.em_run(gmtmp._data,
+                                              self._obs.image,
+                                              self._obs.jacobian._data,
+                                              self._sums,
+                                              self._sky_guess,
+                                              self._counts,
+                                              self._tol,
+                                              self._maxiter,
+                                              nthreads)
+                # one pass per iteration, plus the last if converged
+                npass = min(numiter+1, maxiter)
 
             # we have mutated the _data elements, we want to make
             # sure the pars are propagated.  Make a new full gm
@@ -159,6 +216,7 @@ class GMixEM(object):
 
             result={'flags':flags,
                     'numiter':numiter,
+                    'npass':npass,
                     'fdiff':fdiff}
 
         except GMixRangeError:
@@ -170,6 +228,170 @@ class GMixEM(object):
     # alias
     go=run_em
 
+class GMixEMBatch(object):
+    """
+    Fit a stack of images, e.g. the psf stars from an exposure, with
+    gaussian mixtures using the EM algorithm.  The images are split
+    between threads, and the GIL is released
+
+    parameters
+    ----------
+    images: array
+        [N, nrow, ncol] stack of images.  Each is prepared as in
+        prep_image(), so they need not be positive
+    jacobians: sequence
+        A Jacobian for each image
+    """
+    def __init__(self, images, jacobians):
+
+        images=numpy.array(images, dtype='f8', ndmin=3, copy=True)
+        nimage=images.shape[0]
+
+        if len(jacobians) != nimage:
+            raise ValueError("got %d jacobians for %d images" % \
+                             (len(jacobians), nimage))
+
+        # as in prep_image, for each image
+        im_min = images.min(axis=(1,2))
+        im_max = images.max(axis=(1,2))
+        sky = 0.001*(im_max-im_min)
+
+        images += (sky-im_min)[:,numpy.newaxis,numpy.newaxis]
+
+        jdata=numpy.zeros(nimage, dtype=_jacobian_dtype)
+        for i,jacob in enumerate(jacobians):
+            jdata[i] = jacob._data[0]
+
+        self._images    = images
+        self._jacobians = jacobians
+        self._jdata     = jdata
+        self._sky       = sky
+        self._counts    = images.sum(axis=(1,2))
+
+        self._gmdata = None
+        self._result = None
+
+    def __len__(self):
+        return self._images.shape[0]
+
+    def get_result(self):
+        """
+        Get the flags, numiter, npass and fdiff arrays
+        """
+        return self._result
+
+    def get_gmix(self, i):
+        """
+        Get the gaussian mixture for image i
+        """
+        gm=GMix(ngauss=self._gmdata.shape[1])
+        gm._data[:] = self._gmdata[i]
+        return gm
+
+    def get_gmix_list(self):
+        """
+        Get a list of the gaussian mixtures for all images
+        """
+        return [self.get_gmix(i) for i in xrange(len(self))]
+
+    def run_em(self, guess, maxiter=100, tol=1.e-6, accelerate=False,
+               warm_start=False, nthreads=0):
+        """
+        Run the em algorithm on all images
+
+        parameters
+        ----------
+        guess: GMix or sequence of GMix
+            A starting guess for all images, or one for each image
+        maxiter: number, optional
+            The maximum number of iterations, default 100
+        tol: number, optional
+            The tolerance in the moments that implies convergence,
+            default 1.e-6
+        accelerate: bool, optional
+            If True use SQUAREM, see GMixEM.run_em.  Default False
+        warm_start: bool, optional
+            If True, first fit the mean of the normalized images, using
+            the guess for the first image and the first jacobian.  If
+            that succeeds the result is the guess for all images.
+            The jacobians should be centered on the stars.  Default False
+        nthreads: int, optional
+            Number of threads; values <= 0 mean use the OpenMP default.
+            Default 0
+        """
+
+        nimage=len(self)
+
+        if isinstance(guess, GMix):
+            guesses = [guess]*nimage
+        else:
+            guesses = guess
+            if len(guesses) != nimage:
+                raise ValueError("got %d guesses for %d images" % \
+                                 (len(guesses), nimage))
+
+        if warm_start:
+            mean_guess = self._fit_mean(guesses[0], maxiter, tol, accelerate)
+            if mean_guess is not None:
+                guesses = [mean_guess]*nimage
+
+        ngauss=len(guesses[0])
+        gmdata=numpy.zeros( (nimage, ngauss), dtype=gmix._gauss2d_dtype)
+        for i,gm in enumerate(guesses):
+            gmdata[i] = gm._data
+
+        numiter = numpy.zeros(nimage, dtype='i8')
+        npass   = numpy.zeros(nimage, dtype='i8')
+        fdiff   = numpy.zeros(nimage, dtype='f8')
+        flags   = numpy.zeros(nimage, dtype='i4')
+
+        _gmix.em_run_batch(gmdata,
+                           self._images,
+                           self._jdata,
+                           self._sky,
+                           self._counts,
+                           tol,
+                           maxiter,
+                           int(accelerate),
+                           numiter,
+                           npass,
+                           fdiff,
+                           flags,
+                           nthreads)
+
+        flags[flags != 0] = EM_RANGE_ERROR
+        w,=numpy.where( (flags == 0) & (numiter >= maxiter) )
+        flags[w] = EM_MAXITER
+
+        self._gmdata = gmdata
+        self._result = {
+            'flags':flags,
+            'numiter':numiter,
+            'npass':npass,
+            'fdiff':fdiff,
+            'warm_start':warm_start,
+        }
+
+    # alias
+    go=run_em
+
+    def _fit_mean(self, guess, maxiter, tol, accelerate):
+        """
+        fit the mean of the normalized images
+        """
+        norm = 1.0/self._counts
+        image = (self._images*norm[:,numpy.newaxis,numpy.newaxis]).mean(axis=0)
+        sky = (self._sky*norm).mean()
+
+        obs = Observation(image, jacobian=self._jacobians[0])
+        fitter=GMixEM(obs)
+        fitter.go(guess, sky, maxiter=maxiter, tol=tol, accelerate=accelerate)
+
+        res=fitter.get_result()
+        if res['flags'] != 0:
+            return None
+        return fitter.get_gmix()
+
 class ApproxEMSimple(object):
     """
     Fit a set of observations with psfs/jacobians with 
@@ -230,15 +452,8 @@ class ApproxEMSimple(object):
     # alias
     go=run_em
     
-_sums_dtype=[('gi','f8'),
-             # scratch on a given pixel
-             ('trowsum','f8'),
-             ('tcolsum','f8'),
-             ('tu2sum','f8'),
-             ('tuvsum','f8'),
-             ('tv2sum','f8'),
-             # sums over all pixels
-             ('pnew','f8'),
+# sums over all pixels; the per-pixel scratch is kept in the C code
+_sums_dtype=[('pnew','f8'),
              ('rowsum','f8'),
              ('colsum','f8'),
              ('u2sum','f8'),
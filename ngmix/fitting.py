@@ -319,6 +319,122 @@ class FitterBase(object):
             else:
                 return lnprob
 
+    def calc_lnprob_array(self, pars, nthreads=0):
+        """
+        calculate the ln(prob) for an array of parameters, [N, npars]
+
+        For simple and sersic models with a psf, the models are filled,
+        convolved and compared to the data in C, with the GIL released and
+        using multiple threads.  Otherwise calc_lnprob is called for each
+        row.  Rows with pars out of range get LOWVAL
+
+        parameters
+        ----------
+        pars: array
+            [N, npars] array of parameters
+        nthreads: int, optional
+            Number of threads to use, default is the OpenMP default
+            which can be set with OMP_NUM_THREADS
+
+        returns
+        -------
+        lnprob: array
+            [N] array of ln(prob)
+        """
+
+        pars=numpy.array(pars, dtype='f8', ndmin=2)
+        n=pars.shape[0]
+
+        lnprob = zeros(n)
+
+        if self._gmix_all is None:
+            # the first row may be out of range
+            for i in xrange(n):
+                try:
+                    self._init_gmix_all(pars[i])
+                    break
+                except GMixRangeError:
+                    pass
+            else:
+                lnprob[:] = LOWVAL
+                return lnprob
+
+        if not self._can_batch_lnprob():
+            for i in xrange(n):
+                lnprob[i] = self.calc_lnprob(pars[i])
+            return lnprob
+
+        bad = zeros(n, dtype=bool)
+
+        pixels_all=self._get_pixels_all()
+        for band in xrange(self.nband):
+            band_pars=self._get_band_pars_array(pars, band)
+            model=self._gmix_all0[band][0]._model
+
+            for psf,pixels in zip(self._psf_all[band], pixels_all[band]):
+                data,flags=psf.fill_convolved_batch(band_pars, model,
+                                                    nthreads=nthreads)
+                _gmix.get_loglike_batch(data, flags, pixels, lnprob, nthreads)
+                bad |= (flags != 0)
+
+        if self.prior is not None:
+            cprior=self._get_cprior()
+            if cprior is not None:
+                # rows out of bounds are set to -inf
+                _gmix.prior_add_lnprob_array(cprior, pars, lnprob)
+            else:
+                for i in xrange(n):
+                    if not bad[i]:
+                        try:
+                            lnprob[i] += self._get_priors(pars[i])
+                        except GMixRangeError:
+                            bad[i]=True
+
+        lnprob[bad] = LOWVAL
+        return lnprob
+
+    def _can_batch_lnprob(self):
+        """
+        check if the batched likelihood supports this fitter's setup
+        """
+        if not getattr(self, '_fill_convolve', False):
+            return False
+        if self.model not in gmix._gmix_fill_convolve_models:
+            return False
+        if self.nsub > 1 or self.npoints is not None:
+            return False
+        if self.nu > 2.0 or self.margsky:
+            return False
+
+        for obs_list in self.obs:
+            for obs in obs_list:
+                if obs.has_aperture():
+                    return False
+
+        return True
+
+    def _get_band_pars_array(self, pars, band):
+        """
+        get linear pars for the band, one row for each row of pars
+        """
+        npars=self._band_pars.size
+        band_pars=zeros( (pars.shape[0], npars) )
+        for i in xrange(pars.shape[0]):
+            band_pars[i,:] = self.get_band_pars(pars[i], band)
+        return band_pars
+
+    def _get_pixels_all(self):
+        """
+        pixels with nonzero weight for each observation, made on
+        first use after _init_gmix_all
+        """
+        if self._pixels_all is None:
+            self._pixels_all = [
+                [obs.get_pixels() for obs in obs_list]
+                for obs_list in self.obs
+            ]
+        return self._pixels_all
+
     def get_fit_stats(self, pars):
         """
         Get some fit statistics for the input pars.
@@ -364,9 +480,14 @@ class FitterBase(object):
         gmix_all0 = MultiBandGMixList()
         gmix_all  = MultiBandGMixList()
 
+        # the psf does not change during the fit, so the center and
+        # normalization are calculated once here
+        psf_all = []
+
         for band,obs_list in enumerate(self.obs):
             gmix_list0=GMixList()
             gmix_list=GMixList()
+            psf_list=[]
 
             # pars for this band, in linear space
             band_pars=self.get_band_pars(pars, band)
@@ -374,8 +495,9 @@ class FitterBase(object):
             for obs in obs_list:
                 gm0 = self._make_model(band_pars)
                 if self.dopsf:
-                    psf_gmix=obs.psf.gmix
-                    gm=gm0.convolve(psf_gmix)
+                    psf=gmix.PreparedPSF(obs.psf.gmix)
+                    gm=gm0.convolve(psf)
+                    psf_list.append(psf)
                 else:
                     gm=gm0.copy()
 
@@ -384,15 +506,27 @@ class FitterBase(object):
 
             gmix_all0.append(gmix_list0)
             gmix_all.append(gmix_list)
+            psf_all.append(psf_list)
 
         self._gmix_all0 = gmix_all0
         self._gmix_all  = gmix_all
+        self._psf_all   = psf_all
+        self._pixels_all = None
+
+        # simple models are filled and convolved in a single call
+        self._fill_convolve = (
+            self.dopsf
+            and gmix_all0[0][0]._model in gmix._gmix_fill_convolve_models
+        )
 
     def _fill_gmix(self, gm, band_pars):
         _gmix.gmix_fill(gm._data, band_pars, gm._model)
 
-    def _convolve_gmix(self, gm, gm0, psf_gmix):
-        _gmix.convolve_fill(gm._data, gm0._data, psf_gmix._data)
+    def _convolve_gmix(self, gm, gm0, psf):
+        _gmix.convolve_fill_prepared(gm._data, gm0._data, psf._data)
+
+    def _fill_convolve_gmix(self, gm, gm0, band_pars, psf, band, iobs):
+        _gmix.gmix_fill_convolve(gm._data, band_pars, gm0._model, psf._data)
 
     def _fill_gmix_all(self, pars):
         """
@@ -408,22 +542,23 @@ class FitterBase(object):
         for band,obs_list in enumerate(self.obs):
             gmix_list0=self._gmix_all0[band]
             gmix_list=self._gmix_all[band]
+            psf_list=self._psf_all[band]
 
             # pars for this band, in linear space
             band_pars=self.get_band_pars(pars, band)
 
             for i,obs in enumerate(obs_list):
 
-                psf_gmix=obs.psf.gmix
+                psf=psf_list[i]
 
                 gm0=gmix_list0[i]
                 gm=gmix_list[i]
 
-                #gm0.fill(band_pars)
-                self._fill_gmix(gm0, band_pars)
-                #_gmix.gmix_fill(gm0._data, band_pars, gm0._model)
-                self._convolve_gmix(gm, gm0, psf_gmix)
-                #_gmix.convolve_fill(gm._data, gm0._data, psf_gmix._data)
+                if self._fill_convolve:
+                    self._fill_convolve_gmix(gm, gm0, band_pars, psf, band, i)
+                else:
+                    self._fill_gmix(gm0, band_pars)
+                    self._convolve_gmix(gm, gm0, psf)
 
     def _fill_gmix_all_nopsf(self, pars):
         """
@@ -453,12 +588,29 @@ class FitterBase(object):
         """
         get the sum of ln(prob) from the priors or 0.0 if
         no priors were sent
+
+        priors with a C descriptor are evaluated directly in C
         """
         if self.prior is None:
             return 0.0
+
+        cprior=self._get_cprior()
+        if cprior is not None:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_get_lnprob(cprior, pars)
         else:
             return self.prior.get_lnprob_scalar(pars)
 
+    def _get_cprior(self):
+        """
+        get the C descriptor for the prior, or None if there is no
+        prior or it has no C version
+        """
+        get_cprior=getattr(self.prior, 'get_cprior', None)
+        if get_cprior is None:
+            return None
+        return get_cprior()
+
     def plot_residuals(self, title=None, show=False,
                        width=1920, height=1200,**keys):
         import images
@@ -1804,7 +1956,12 @@ class LMSimple(FitterBase):
         """
 
         if self.prior is None:
-            nprior=0
+            return 0
+
+        cprior=self._get_cprior()
+        if cprior is not None:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            nprior=_gmix.prior_fill_fdiff(cprior, pars, fdiff)
         else:
             nprior=self.prior.fill_fdiff(pars, fdiff)
 
@@ -1814,6 +1971,12 @@ class LMSimple(FitterBase):
 class LMGaussK(LMSimple):
     """
     LM fitter in k space, just a gaussian for now, no deconvolution
+
+    Real space observations are converted with make_kobs, which draws
+    galsim interpolated images, or with use_fft=True using
+    make_kobs_fft, which does not need galsim.  The pad_factor and half
+    keywords are sent on to make_kobs_fft.  Hermitian half plane
+    KObservations are fit with the _half kernels
     """
     def __init__(self, obs,  **keys):
         model="gauss"
@@ -1825,13 +1988,27 @@ class LMGaussK(LMSimple):
         """
 
         if isinstance(obs_in, (Observation, ObsList, MultiBandObsList)):
-            kobs = observation.make_kobs(obs_in, **self.keys)
+            if self.keys.get('use_fft',False):
+                kobs = observation.make_kobs_fft(
+                    observation.get_mb_obs(obs_in),
+                    pad_factor=self.keys.get('pad_factor',2.0),
+                    half=self.keys.get('half',True),
+                )
+            else:
+                kobs = observation.make_kobs(obs_in, **self.keys)
         else:
             kobs = observation.get_kmb_obs(obs_in)
 
         self.mb_kobs = kobs
         self.nband=len(kobs)
 
+    def _get_kdata(self, kobs):
+        """
+        real and imaginary parts of the k image, and the weight
+        """
+        kimage=kobs.get_kimage_array()
+        return kimage.real, kimage.imag, kobs.get_weight_array()
+
     def _set_fdiff_size(self):
         # we have 2*totpix, since we use both real and imaginary 
         # parts
@@ -1961,15 +2138,28 @@ class LMGaussK(LMSimple):
                 for kobs,gm in zip(kobs_list, gmix_list):
 
                     gmdata=gm._get_gmix_data()
-                    tloglike, ts2n_sum, tnpix = _gmix.get_loglikek(
-                        gmdata,
-                        kobs.kr.array,
-                        kobs.ki.array,
-                        kobs.weight.array,
-                        kobs.jacobian._data,
-                        rowshift,
-                        colshift,
-                    )
+                    kr, ki, kweight = self._get_kdata(kobs)
+                    if kobs.is_half():
+                        tloglike, ts2n_sum, tnpix = _gmix.get_loglikek_half(
+                            gmdata,
+                            kr,
+                            ki,
+                            kweight,
+                            kobs.jacobian._data,
+                            rowshift,
+                            colshift,
+                            kobs.ncol_full,
+                        )
+                    else:
+                        tloglike, ts2n_sum, tnpix = _gmix.get_loglikek(
+                            gmdata,
+                            kr,
+                            ki,
+                            kweight,
+                            kobs.jacobian._data,
+                            rowshift,
+                            colshift,
+                        )
 
                     lnprob  += tloglike
                     s2n_sum += ts2n_sum
@@ -2027,24 +2217,39 @@ class LMGaussK(LMSimple):
                 for kobs,gm in zip(kobs_list, gmix_list):
 
                     gmdata=gm._get_gmix_data()
-                    ts2n_sum, tnpix = _gmix.fill_fdiffk(
-                        gmdata,
-                        kobs.kr.array,
-                        kobs.ki.array,
-                        kobs.weight.array,
-                        kobs.jacobian._data,
-                        fdiff,
-                        rowshift,
-                        colshift,
-                        start,
-                    )
+                    kr, ki, kweight = self._get_kdata(kobs)
+                    if kobs.is_half():
+                        ts2n_sum, tnpix = _gmix.fill_fdiffk_half(
+                            gmdata,
+                            kr,
+                            ki,
+                            kweight,
+                            kobs.jacobian._data,
+                            fdiff,
+                            rowshift,
+                            colshift,
+                            start,
+                            kobs.ncol_full,
+                        )
+                    else:
+                        ts2n_sum, tnpix = _gmix.fill_fdiffk(
+                            gmdata,
+                            kr,
+                            ki,
+                            kweight,
+                            kobs.jacobian._data,
+                            fdiff,
+                            rowshift,
+                            colshift,
+                            start,
+                        )
 
                     s2n_sum += ts2n_sum
                     npix += tnpix
 
                     # skip 2*image size since we account for both
                     # real and imaginary
-                    start += 2*kobs.kr.array.size
+                    start += 2*kr.size
 
         except GMixRangeError as err:
             fdiff[:] = LOWVAL
@@ -2085,7 +2290,7 @@ class LMGaussK(LMSimple):
             rowshift=pars_in[0]
             colshift=pars_in[1]
 
-            scale=self.mb_kobs[0][0].kr.scale
+            scale=self.mb_kobs[0][0].jacobian.scale
 
             pars[0] = 0.0
             pars[1] = 0.0
@@ -2111,24 +2316,39 @@ class LMGaussK(LMSimple):
                 for kobs,gm in zip(kobs_list, gmix_list):
 
                     gmdata=gm._get_gmix_data()
-                    ts2n_sum, tnpix = _gmix.fill_fdiffk(
-                        gmdata,
-                        kobs.kr.array,
-                        kobs.ki.array,
-                        kobs.weight.array,
-                        kobs.jacobian._data,
-                        fdiff,
-                        rowshift,
-                        colshift,
-                        start,
-                    )
+                    kr, ki, kweight = self._get_kdata(kobs)
+                    if kobs.is_half():
+                        ts2n_sum, tnpix = _gmix.fill_fdiffk_half(
+                            gmdata,
+                            kr,
+                            ki,
+                            kweight,
+                            kobs.jacobian._data,
+                            fdiff,
+                            rowshift,
+                            colshift,
+                            start,
+                            kobs.ncol_full,
+                        )
+                    else:
+                        ts2n_sum, tnpix = _gmix.fill_fdiffk(
+                            gmdata,
+                            kr,
+                            ki,
+                            kweight,
+                            kobs.jacobian._data,
+                            fdiff,
+                            rowshift,
+                            colshift,
+                            start,
+                        )
 
                     s2n_sum += ts2n_sum
                     npix += tnpix
 
                     # skip 2*image size since we account for both
                     # real and imaginary
-                    start += 2*kobs.kr.array.size
+                    start += 2*kr.size
 
         except GMixRangeError as err:
             fdiff[:] = LOWVAL
@@ -2168,7 +2388,7 @@ class LMGaussK(LMSimple):
         totpix=0
         for kobs_list in self.mb_kobs:
             for kobs in kobs_list:
-                shape=kobs.kr.array.shape
+                shape=kobs.get_kimage_array().shape
                 totpix += shape[0]*shape[1]
 
         self.totpix=totpix
@@ -2522,16 +2742,79 @@ class LMCoellip(LMSimple):
             pars[:] = pars_in[:]
         return pars
 
+class LMSersic(LMSimple):
+    """
+    Fit a sersic model using levenberg marquardt
+
+    pars are [cen1,cen2,g1,g2,T,fluxes...,n]
+    """
+    def __init__(self, obs, **keys):
+        super(LMSersic,self).__init__(obs, 'sersic', **keys)
+
+        if self.use_logpars:
+            raise ValueError("log pars not supported for sersic")
+
+        if self.prior is not None:
+            # one more for n
+            self.n_prior_pars += 1
+            self._set_fdiff_size()
+
+        self._band_pars=zeros(7)
+
+    def get_band_pars(self, pars_in, band):
+        """
+        Get linear pars for the specified band
+        """
+
+        pars=self._band_pars
+
+        pars[0:5] = pars_in[0:5]
+        pars[5] = pars_in[5+band]
+        pars[6] = pars_in[5+self.nband]
+
+        return pars
+
 
 class LMComposite(LMSimple):
     """
     exp+dev model with pre-determined fracdev and ratio Tdev/Texp
+
+    The psf-convolved exp and dev parts are cached for each observation,
+    so calls that only change the flux just rescale amplitudes.
+
+    If fit_fracdev=True, fracdev is instead fit linearly for each set of
+    parameters, using the inner products of the exp and dev models with
+    the data as in FracdevFitter.  T is still scaled using the Tfactor for
+    the input fracdev.  The result gets 'fracdev' and 'fracdev_err'
     """
-    def __init__(self, obs, fracdev, TdByTe, **keys):
+    def __init__(self, obs, fracdev, TdByTe, fit_fracdev=False, **keys):
         super(LMComposite,self).__init__(obs, 'cm', **keys)
 
         self.fracdev=fracdev
         self.TdByTe=TdByTe
+        self.fit_fracdev=fit_fracdev
+        self._Tfactor=_gmix.get_cm_Tfactor(fracdev, TdByTe)
+
+        if fit_fracdev:
+            self._fracdev_X=zeros(self.totpix)
+            self._fracdev_Y=zeros(self.totpix)
+            self._fracdev_fit=fracdev
+            self._fracdev_fit_err=9999.0
+
+    def run_lm(self, guess):
+        """
+        Run leastsq and set the result
+        """
+        super(LMComposite,self).run_lm(guess)
+
+        result=self._result
+        if self.fit_fracdev and result['flags']==0:
+            # get_fit_stats filled at the final pars
+            result['fracdev'] = self._fracdev_fit
+            result['fracdev_err'] = self._fracdev_fit_err
+
+    run_max=run_lm
+    go=run_lm
 
     def get_gmix(self, band=0):
         """
@@ -2540,22 +2823,125 @@ class LMComposite(LMSimple):
         """
         res=self.get_result()
         pars=self.get_band_pars(res['pars'], band)
-        return gmix.GMixCM(self.fracdev,
-                                  self.TdByTe,
-                                  pars)
+        return gmix.GMixCM(self._get_fracdev(),
+                           self.TdByTe,
+                           pars,
+                           Tfactor=self._Tfactor)
 
 
+    def _get_fracdev(self):
+        if self.fit_fracdev:
+            return self._fracdev_fit
+        else:
+            return self.fracdev
+
     def _make_model(self, band_pars):
-        gm0=gmix.GMixCM(self.fracdev, self.TdByTe, band_pars)
+        gm0=gmix.GMixCM(self._get_fracdev(), self.TdByTe, band_pars,
+                        Tfactor=self._Tfactor)
         return gm0
 
+    def _init_gmix_all(self, pars):
+        """
+        also make the cached exp/dev basis for each observation
+        """
+        super(LMComposite,self)._init_gmix_all(pars)
+
+        if self.fit_fracdev and not self.dopsf:
+            raise ValueError("fit_fracdev requires a psf")
+
+        self._cm_basis_all=[]
+        for psf_list in self._psf_all:
+            basis_list=[]
+            for psf in psf_list:
+                basis=zeros(1, dtype=gmix._cm_basis_dtype)
+                bgmix=zeros(16*len(psf), dtype=gmix._gauss2d_dtype)
+                basis_list.append( (basis,bgmix) )
+            self._cm_basis_all.append(basis_list)
+
+        self._fill_convolve=self.dopsf
+
+    def _fill_gmix_all(self, pars):
+        """
+        when fitting fracdev, first get the best fracdev for these pars
+        """
+        if self.fit_fracdev:
+            self._fit_fracdev_linear(pars)
+
+        super(LMComposite,self)._fill_gmix_all(pars)
+
+    def _fit_fracdev_linear(self, pars):
+        """
+        fill X, Y such that fdiff = fracdev*X - Y in one pass over the
+        pixels and solve for fracdev
+        """
+        X=self._fracdev_X
+        Y=self._fracdev_Y
+
+        start=0
+        for band,obs_list in enumerate(self.obs):
+            band_pars=self.get_band_pars(pars, band)
+
+            for i,obs in enumerate(obs_list):
+                basis,bgmix=self._cm_basis_all[band][i]
+                psf=self._psf_all[band][i]
+
+                _gmix.cm_fill_fracdev_xy(basis,
+                                         bgmix,
+                                         band_pars,
+                                         self.TdByTe,
+                                         self._Tfactor,
+                                         psf._data,
+                                         obs.image,
+                                         obs.weight,
+                                         obs.jacobian._data,
+                                         X,
+                                         Y,
+                                         start)
+                start += obs.image.size
+
+        xx=numpy.dot(X,X)
+        if xx <= 0.0:
+            raise GMixRangeError("no information for fracdev")
+
+        self._fracdev_fit = numpy.dot(X,Y)/xx
+        self._fracdev_fit_err = 1.0/sqrt(xx)
+
+    def _calc_fdiff(self, pars, more=False):
+        """
+        when fitting fracdev, the fdiff comes directly from X, Y
+        """
+        if not self.fit_fracdev or more:
+            return super(LMComposite,self)._calc_fdiff(pars, more=more)
+
+        fdiff=zeros(self.fdiff_size)
+
+        try:
+            self._fit_fracdev_linear(pars)
+            start=self._fill_priors(pars, fdiff)
+            fdiff[start:] = self._fracdev_fit*self._fracdev_X - self._fracdev_Y
+        except GMixRangeError as err:
+            fdiff[:] = LOWVAL
+
+        return fdiff
+
+    def _fill_convolve_gmix(self, gm, gm0, band_pars, psf, band, iobs):
+        basis,bgmix=self._cm_basis_all[band][iobs]
+        _gmix.gmix_fill_cm_convolve(gm._data,
+                                    basis,
+                                    bgmix,
+                                    band_pars,
+                                    self._get_fracdev(),
+                                    self.TdByTe,
+                                    self._Tfactor,
+                                    psf._data)
+
     def _fill_gmix(self, gm, band_pars):
         _gmix.gmix_fill_cm(gm._data, band_pars)
 
-    def _convolve_gmix(self, gm, gm0, psf_gmix):
-        _gmix.convolve_fill(gm._data,
-                            gm0._data['gmix'][0],
-                            psf_gmix._data)
+    def _convolve_gmix(self, gm, gm0, psf):
+        _gmix.convolve_fill_prepared(gm._data,
+                                     gm0._data['gmix'][0],
+                                     psf._data)
 
 
 NOTFINITE_BIT=11
@@ -3087,6 +3473,36 @@ class MCMCSimple(MCMCBase):
 
         return names
 
+class MCMCSersic(MCMCSimple):
+    """
+    MCMC for sersic models, pars are [cen1,cen2,g1,g2,T,fluxes...,n]
+    """
+    def __init__(self, obs, **keys):
+        super(MCMCSersic,self).__init__(obs, 'sersic', **keys)
+
+        if self.use_logpars:
+            raise ValueError("log pars not supported for sersic")
+
+        self._band_pars=zeros(7)
+
+    def get_band_pars(self, pars_in, band):
+        """
+        Get linear pars for the specified band
+        """
+
+        pars=self._band_pars
+
+        pars[0:5] = pars_in[0:5]
+        pars[5] = pars_in[5+band]
+        pars[6] = pars_in[5+self.nband]
+
+        return pars
+
+    def get_par_names(self, dolog=False):
+        names=super(MCMCSersic,self).get_par_names(dolog=dolog)
+        names += ['n']
+        return names
+
 
 
 class MH(object):
@@ -3678,9 +4094,17 @@ class PSampler(object):
         """
         return self._used_indices
 
-    def calc_loglikes(self, lnprob_func):
+    def calc_loglikes(self, lnprob_func, vectorized=False):
         """
         calculate the loglike for a subset of the points
+
+        parameters
+        ----------
+        lnprob_func: function or method
+            ln(prob) for a single set of pars
+        vectorized: bool, optional
+            If True, lnprob_func takes a [N, npars] array and returns
+            N values, e.g. FitterBase.calc_lnprob_array
         """
         res={'flags':0}
         self._result=res
@@ -3694,10 +4118,13 @@ class PSampler(object):
         else:
             used_samples = samples[w]
 
-            logl_vals = zeros(w.size)
-            for i in xrange(w.size):
-                tpars = used_samples[i,:]
-                logl_vals[i] = lnprob_func(tpars)
+            if vectorized:
+                logl_vals = lnprob_func(used_samples)
+            else:
+                logl_vals = zeros(w.size)
+                for i in xrange(w.size):
+                    tpars = used_samples[i,:]
+                    logl_vals[i] = lnprob_func(tpars)
 
             logl_max = logl_vals.max()
             logl_vals -= logl_max
@@ -3959,10 +4386,18 @@ class ISampler(object):
         """
         return self._iweights
 
-    def set_iweights(self, lnprob_func):
+    def set_iweights(self, lnprob_func, vectorized=False):
         """
         get importance sample weights for the input
         samples and lnprob function
+
+        parameters
+        ----------
+        lnprob_func: function or method
+            ln(prob) for a single set of pars
+        vectorized: bool, optional
+            If True, lnprob_func takes a [N, npars] array and returns
+            N values, e.g. FitterBase.calc_lnprob_array
         """
 
         proposed_lnprob = self.get_lnprob(self._trials)
@@ -3970,9 +4405,12 @@ class ISampler(object):
 
         samples = self._trials_orig
         nsample = samples.shape[0]
-        lnprob = zeros(nsample)
-        for i in xrange(nsample):
-            lnprob[i] = lnprob_func(samples[i,:])
+        if vectorized:
+            lnprob = lnprob_func(samples)
+        else:
+            lnprob = zeros(nsample)
+            for i in xrange(nsample):
+                lnprob[i] = lnprob_func(samples[i,:])
 
         lnpdiff = lnprob - proposed_lnprob - lndetjac
         lnpdiff -= lnpdiff.max()
@@ -346,7 +346,7 @@ class GalsimSimple(LMSimple):
         totpix=0
         for kobs_list in self.mb_kobs:
             for kobs in kobs_list:
-                totpix += kobs.kimage.array.size
+                totpix += kobs.get_kimage_array().size
 
         self.totpix=totpix
 
@@ -349,8 +349,11 @@ class GMix(object):
 
         parameters
         ----------
-        psf: GMix object
+        psf: GMix or PreparedPSF object
         """
+        if isinstance(psf, PreparedPSF):
+            return psf.convolve(self)
+
         if not isinstance(psf, GMix):
             raise TypeError("Can only convolve with another GMix "
                             " got type %s" % type(psf))
@@ -1065,6 +1068,76 @@ class GMixList(list):
         assert isinstance(gmix,GMix),"gmix should be of type GMix"
         super(GMixList,self).__setitem__(index, gmix)
 
+    def get_weighted_moments(self, obs, rmax=1.e20):
+        """
+        Get the raw weighted moments of the image for each mixture in the
+        list used as a weight function, in a single pass over the pixels.
+        For each weight the results are the same as from
+        GMix.get_weighted_moments
+
+        parameters
+        ----------
+        obs: Observation
+            The Observation to measure.  The Observation must have a
+            weight map set
+        rmax: float, optional
+            Only use pixels within this radius of the jacobian center
+
+        returns
+        --------
+        A dict with 'pars' [K,6], 'pars_cov' [K,6,6], and 'wsum',
+        's2n_numer_sum' and 's2n_denom_sum' with K entries, for K
+        weight functions; see GMix.get_weighted_moments
+        """
+
+        nweight=len(self)
+        if nweight == 0:
+            raise ValueError("no weight functions in list")
+
+        if obs.jacobian is not None:
+            assert isinstance(obs.jacobian,Jacobian)
+
+        gm=numpy.hstack([gmix._get_gmix_data() for gmix in self])
+
+        offsets=zeros(nweight+1, dtype='i8')
+        offsets[1:] = numpy.cumsum([len(gmix) for gmix in self])
+
+        pars=zeros( (nweight,6) )
+        pcov=zeros( (nweight,6,6) )
+        wsum=zeros(nweight)
+        s2n_numer=zeros(nweight)
+        s2n_denom=zeros(nweight)
+
+        flags=_gmix.get_weighted_moments_multi(
+            obs.image,
+            obs.weight,
+            obs.jacobian._data,
+            gm,
+            offsets,
+
+            pars, # these get modified internally
+            pcov,
+            wsum,
+            s2n_numer,
+            s2n_denom,
+            rmax,
+        )
+
+        flagstr=_moms_flagmap[flags]
+        return {
+            'flags':flags,
+            'flagstr':flagstr,
+
+            'pars':pars,
+            'pars_cov':pcov,
+
+            'wsum':wsum,
+            'npix':obs.image.size,
+
+            's2n_numer_sum':s2n_numer,
+            's2n_denom_sum':s2n_denom,
+        }
+
 class MultiBandGMixList(list):
     """
     Hold a list of lists of GMixList objects, each representing a filter
@@ -1091,6 +1164,110 @@ class MultiBandGMixList(list):
 
 
 
+class PreparedPSF(object):
+    """
+    A psf mixture prepared for repeated convolutions
+
+    The psf center and total flux are calculated once, and stored with
+    the normalized weights and covariances.  Use this when convolving
+    many models with the same psf, as during a fit.
+
+    parameters
+    ----------
+    psf: GMix
+        The psf mixture
+    """
+    def __init__(self, psf):
+        if not isinstance(psf, GMix):
+            raise TypeError("Can only prepare a GMix "
+                            " got type %s" % type(psf))
+
+        self._ngauss = len(psf)
+        self._data = zeros(self._ngauss, dtype=_prepared_psf_dtype)
+        _gmix.prepare_psf(self._data, psf._get_gmix_data())
+
+    def __len__(self):
+        return self._ngauss
+
+    def get_data(self):
+        """
+        get the underlying array
+        """
+        return self._data
+
+    def convolve(self, gm):
+        """
+        Get a new GMix that is the convolution of the input GMix
+        with this psf
+        """
+        output = GMix(ngauss=len(gm)*self._ngauss)
+        _gmix.convolve_fill_prepared(output._data,
+                                     gm._get_gmix_data(),
+                                     self._data)
+        return output
+
+    def fill_convolved(self, gm, pars, model):
+        """
+        fill the input GMix with the simple model convolved with this psf,
+        without creating the unconvolved mixture
+
+        parameters
+        ----------
+        gm: GMix
+            The output mixture, with ngauss(model)*len(self) elements
+        pars: array
+            The model parameters
+        model: string or int
+            A simple model: gauss, exp, dev or turb, or sersic
+        """
+        pars=array(pars, dtype='f8', copy=False)
+        _gmix.gmix_fill_convolve(gm._get_gmix_data(),
+                                 pars,
+                                 get_model_num(model),
+                                 self._data)
+
+    def fill_convolved_batch(self, pars, model, nthreads=0):
+        """
+        fill many simple models convolved with this psf, in parallel
+        over the rows of pars
+
+        parameters
+        ----------
+        pars: array
+            [N, npars] array of model parameters
+        model: string or int
+            A simple model: gauss, exp, dev or turb, or sersic
+        nthreads: int, optional
+            Number of threads to use, default is the OpenMP default
+            which can be set with OMP_NUM_THREADS
+
+        returns
+        -------
+        data, flags:
+            data is a [N, ngauss*len(self)] array of gaussians that can be
+            sent to the _gmix functions.  flags is nonzero for rows where
+            the pars were out of range; these rows are zeroed
+        """
+        pars=numpy.ascontiguousarray(pars, dtype='f8')
+        if len(pars.shape) != 2:
+            raise ValueError("pars should be 2-d, got shape %s" % (pars.shape,))
+
+        model=get_model_num(model)
+        n=pars.shape[0]
+        ngauss=_gmix_ngauss_dict[model]*self._ngauss
+
+        data=zeros( (n, ngauss), dtype=_gauss2d_dtype)
+        flags=zeros(n, dtype='i4')
+        _gmix.gmix_fill_convolve_batch(data,
+                                       pars,
+                                       model,
+                                       self._data,
+                                       flags,
+                                       nthreads)
+        return data, flags
+
+
+
 class GMixModel(GMix):
     """
     A two-dimensional gaussian mixture created from a set of model parameters
@@ -1181,12 +1358,17 @@ class GMixCM(GMix):
         on the model type.
     model: string or gmix type
         e.g. 'exp' or GMIX_EXP
+    Tfactor: float, optional
+        Factor to scale T; by default it is chosen such that the T of
+        the mixture is the input T
     """
-    def __init__(self, fracdev, TdByTe, pars):
+    def __init__(self, fracdev, TdByTe, pars, Tfactor=None):
 
         self._fracdev = fracdev
         self._TdByTe = TdByTe
-        self._Tfactor = _gmix.get_cm_Tfactor(fracdev, TdByTe)
+        if Tfactor is None:
+            Tfactor = _gmix.get_cm_Tfactor(fracdev, TdByTe)
+        self._Tfactor = Tfactor
 
         self._model      = _gmix_model_dict['fracdev']
         self._model_name = _gmix_string_dict[self._model]
@@ -1206,7 +1388,8 @@ class GMixCM(GMix):
         #gmix = GMixCM(self._exp_pars, self._dev_pars, self._fracdev)
         gmix = GMixCM(self._fracdev,
                       self._TdByTe,
-                      self._pars)
+                      self._pars,
+                      Tfactor=self._Tfactor)
         return gmix
 
     def reset(self):
@@ -1268,6 +1451,29 @@ def get_coellip_npars(ngauss):
 def get_coellip_ngauss(npars):
     return (npars-4)//2
 
+class GMixSersic(GMixModel):
+    """
+    A two-dimensional gaussian mixture approximating a sersic profile
+
+    The mixture coefficients are interpolated in the sersic index n from
+    tables in the C code, so filling is as fast as for exp or dev.
+
+    Inherits from the more general GMix class, and all its methods.
+
+    parameters
+    ----------
+    pars: array-like
+        [cen1,cen2,g1,g2,T,flux,n] with n in [0.75, 6]
+    """
+    def __init__(self, pars):
+        super(GMixSersic,self).__init__(pars, GMIX_SERSIC)
+
+    def copy(self):
+        """
+        Get a new GMix with the same parameters
+        """
+        return GMixSersic(self._pars)
+
 class GMixCoellip(GMixModel):
     """
     A two-dimensional gaussian mixture, each co-centeric and co-elliptical
@@ -1556,7 +1762,8 @@ _gmix_ngauss_dict={GMIX_GAUSS:1,
 
                    GMIX_BDC:16,
                    GMIX_BDF:16,
-                   GMIX_SERSIC:4,
+                   GMIX_SERSIC:10,
+                   'sersic':10,
                    GMIX_GAUSSMOM: 1,
 
                    'em1':1,
@@ -1581,11 +1788,31 @@ _gauss2d_dtype=[('p','f8'),
                 ('norm','f8'),
                 ('pnorm','f8')]
 
+_prepared_psf_dtype=[('p','f8'),
+                     ('drow','f8'),
+                     ('dcol','f8'),
+                     ('irr','f8'),
+                     ('irc','f8'),
+                     ('icc','f8')]
+
+# models that can be filled and convolved with a PreparedPSF in one call
+_gmix_fill_convolve_models=[GMIX_GAUSS, GMIX_EXP, GMIX_DEV, GMIX_TURB,
+                            GMIX_SERSIC]
+
 _cm_dtype=[('fracdev','f8'),
                   ('TdByTe','f8'), # ratio Tdev/Texp
                   ('Tfactor','f8'),
                   ('gmix',_gauss2d_dtype,16)]
 
+# header for the cached, psf-convolved exp and dev basis of a
+# composite model; the basis itself is a _gauss2d_dtype array
+_cm_basis_dtype=[('row','f8'),
+                 ('col','f8'),
+                 ('g1','f8'),
+                 ('g2','f8'),
+                 ('T','f8'),
+                 ('valid','i4')]
+
 def get_model_num(model):
     """
     Get the numerical identifier for the input model,
@@ -1759,37 +1986,21 @@ class GMixND(object):
         return p
 
 
-    def get_lnprob_array(self, pars):
-        """
-        array input
+    def get_lnprob_array(self, pars, nthreads=1):
         """
+        array input, shape [npoints, ndim] or [npoints] for ndim=1
 
-        if len(pars.shape) == 1:
-            pars = pars[:,numpy.newaxis]
-
-        n=pars.shape[0]
-        lnp=zeros(n)
-
-        for i in xrange(n):
-            lnp[i] = self.get_lnprob_scalar(pars[i,:])
-
-        return lnp
-
-    def get_prob_array(self, pars):
-        """
-        array input
+        the points are evaluated in a vectorized, threaded C loop
         """
+        return self._get_prob_array(pars, None, 1, nthreads)
 
-        if len(pars.shape) == 1:
-            pars = pars[:,numpy.newaxis]
-
-        n=pars.shape[0]
-        p=zeros(n)
-
-        for i in xrange(n):
-            p[i] = self.get_prob_scalar(pars[i,:])
+    def get_prob_array(self, pars, nthreads=1):
+        """
+        array input, shape [npoints, ndim] or [npoints] for ndim=1
 
-        return p
+        the points are evaluated in a vectorized, threaded C loop
+        """
+        return self._get_prob_array(pars, None, 0, nthreads)
 
     def get_prob_scalar_sub(self, pars_in, use=None):
         """
@@ -1811,21 +2022,38 @@ class GMixND(object):
                                        dolog)
         return p
 
-    def get_prob_array_sub(self, pars, use=None):
+    def get_prob_array_sub(self, pars, use=None, nthreads=1):
         """
-        array input
+        array input, only include certain components
         """
 
-        if len(pars.shape) == 1:
-            pars = pars[:,numpy.newaxis]
+        if use is not None:
+            use=numpy.array(use,dtype='i4')
+            assert use.size==self.ngauss
 
-        n=pars.shape[0]
-        p=zeros(n)
+        return self._get_prob_array(pars, use, 0, nthreads)
 
-        for i in xrange(n):
-            p[i] = self.get_prob_scalar_sub(pars[i,:], use=use)
+    def _get_prob_array(self, pars, use, dolog, nthreads):
+        """
+        evaluate at all points using the cholesky factors
+        """
+        pars=numpy.array(pars, dtype='f8', ndmin=1, order='C')
 
-        return p
+        if len(pars.shape) == 1:
+            pars = pars.reshape( (pars.size, 1) )
+
+        assert pars.shape[1]==self.ndim,"pars must have %d dims" % self.ndim
+
+        out=zeros(pars.shape[0])
+        _gmix.gmixnd_get_prob_array(self.log_pnorms,
+                                    self.means,
+                                    self.icholesky,
+                                    pars,
+                                    out,
+                                    use,
+                                    dolog,
+                                    nthreads)
+        return out
 
 
     def sample(self, n=None):
@@ -1891,7 +2119,8 @@ class GMixND(object):
 
     def _calc_icovars_and_norms(self):
         """
-        Calculate the normalizations and inverse covariance matrices
+        Calculate the normalizations, inverse covariance matrices and
+        inverse cholesky factors of the covariance matrices
         """
         from numpy import pi
 
@@ -1914,10 +2143,17 @@ class GMixND(object):
                 norms[i] = n
                 icovars[i,:,:] = icov
 
+        # lower triangular, such that icovar = icholesky^T icholesky
+        icholesky = zeros( (self.ngauss, self.ndim, self.ndim) )
+        for i in xrange(self.ngauss):
+            L = numpy.linalg.cholesky(self.covars[i,:,:])
+            icholesky[i,:,:] = numpy.tril( numpy.linalg.inv(L) )
+
         self.norms = norms
         self.pnorms = norms*self.weights
         self.log_pnorms = log(self.pnorms)
         self.icovars = icovars
+        self.icholesky = icholesky
 
     def plot_components(self, data=None, **keys):
         """
@@ -18,6 +18,7 @@ from . import priors
 from .priors import LOWVAL
 from . import gmix
 from .gmix import GMixND
+from . import _gmix
 
 
 class JointPriorTF(GMixND):
@@ -1079,6 +1080,9 @@ class PriorSimpleSep(object):
         Prior on T or some size parameter
     F_prior:
         Prior on Flux.  Can be a list for a multi-band prior.
+
+    When all the component priors have C versions, the scalar ln(prob) and
+    fdiff are calculated in C, see get_cprior
     """
 
     def __init__(self,
@@ -1101,6 +1105,41 @@ class PriorSimpleSep(object):
 
         self.F_priors=F_prior
 
+    def get_cprior(self):
+        """
+        get the C descriptor for the full prior, or None if any of
+        the component priors do not have a C version
+
+        The descriptor is made on first use; call reset_cprior if the
+        component priors are modified after that
+        """
+        if not hasattr(self, '_cprior'):
+            self._cprior = priors.make_joint_cprior(
+                self._get_priors_and_indices()
+            )
+        return self._cprior
+
+    def reset_cprior(self):
+        """
+        remake the C descriptor on next use
+        """
+        if hasattr(self, '_cprior'):
+            del self._cprior
+
+    def _get_priors_and_indices(self):
+        """
+        each prior and the index of its first parameter
+        """
+        plist = [
+            (self.cen_prior, 0),
+            (self.g_prior, 2),
+            (self.T_prior, 4),
+        ]
+        for i, F_prior in enumerate(self.F_priors):
+            plist.append( (F_prior, 5+i) )
+
+        return plist
+
     def get_widths(self, n=10000):
         """
         estimate the width in each dimension
@@ -1135,6 +1174,11 @@ class PriorSimpleSep(object):
         log probability for scalar input (meaning one point)
         """
 
+        cprior=self.get_cprior()
+        if cprior is not None and not keys:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_get_lnprob(cprior, pars)
+
         lnp = self.cen_prior.get_lnprob_scalar(pars[0],pars[1])
         lnp += self.g_prior.get_lnprob_scalar2d(pars[2],pars[3])
         lnp += self.T_prior.get_lnprob_scalar(pars[4], **keys)
@@ -1152,6 +1196,11 @@ class PriorSimpleSep(object):
         """
         set sqrt(-2ln(p)) ~ (model-data)/err
         """
+        cprior=self.get_cprior()
+        if cprior is not None and not keys:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_fill_fdiff(cprior, pars, fdiff)
+
         index=0
 
         #fdiff[index] = self.cen_prior.get_lnprob_scalar(pars[0],pars[1])
@@ -1264,11 +1313,35 @@ class PriorCoellipSame(PriorSimpleSep):
 
         self.ngauss=ngauss
 
+    def _get_priors_and_indices(self):
+        """
+        each prior and the index of its first parameter
+        """
+        ngauss=self.ngauss
+
+        plist = [
+            (self.cen_prior, 0),
+            (self.g_prior, 2),
+        ]
+        for i in xrange(ngauss):
+            plist.append( (self.T_prior, 4+i) )
+
+        F_prior=self.F_priors[0]
+        for i in xrange(ngauss):
+            plist.append( (F_prior, 4+ngauss+i) )
+
+        return plist
+
     def get_lnprob_scalar(self, pars, **keys):
         """
         log probability for scalar input (meaning one point)
         """
 
+        cprior=self.get_cprior()
+        if cprior is not None and not keys:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_get_lnprob(cprior, pars)
+
         ngauss=self.ngauss
 
         lnp = self.cen_prior.get_lnprob_scalar(pars[0],pars[1])
@@ -1287,6 +1360,10 @@ class PriorCoellipSame(PriorSimpleSep):
         """
         set sqrt(-2ln(p)) ~ (model-data)/err
         """
+        cprior=self.get_cprior()
+        if cprior is not None and not keys:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_fill_fdiff(cprior, pars, fdiff)
 
         ngauss=self.ngauss
 
@@ -1351,6 +1428,19 @@ class PriorSimpleSepRound(PriorSimpleSep):
 
         self.F_priors=F_prior
 
+    def _get_priors_and_indices(self):
+        """
+        each prior and the index of its first parameter
+        """
+        plist = [
+            (self.cen_prior, 0),
+            (self.T_prior, 2),
+        ]
+        for i, F_prior in enumerate(self.F_priors):
+            plist.append( (F_prior, 3+i) )
+
+        return plist
+
     def get_widths(self, n=10000):
         """
         estimate the width in each dimension
@@ -1370,6 +1460,11 @@ class PriorSimpleSepRound(PriorSimpleSep):
         log probability for scalar input (meaning one point)
         """
 
+        cprior=self.get_cprior()
+        if cprior is not None and not keys:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_get_lnprob(cprior, pars)
+
         lnp = self.cen_prior.get_lnprob_scalar(pars[0],pars[1])
         lnp += self.T_prior.get_lnprob_scalar(pars[2], **keys)
 
@@ -1383,6 +1478,11 @@ class PriorSimpleSepRound(PriorSimpleSep):
         """
         set sqrt(-2ln(p)) ~ (model-data)/err
         """
+        cprior=self.get_cprior()
+        if cprior is not None and not keys:
+            pars=numpy.ascontiguousarray(pars, dtype='f8')
+            return _gmix.prior_fill_fdiff(cprior, pars, fdiff)
+
         index=0
 
         #fdiff[index] = self.cen_prior.get_lnprob_scalar(pars[0],pars[1])
@@ -744,6 +744,61 @@ class OldDeriv(object):
 
 
 
+class PQRTemplateIndex(object):
+    """
+    k-d tree over a set of templates, used to find the templates
+    inside the nsigma ellipse of a likelihood without checking
+    every template
+
+    The tree is balanced, with the children of node k at 2k+1 and 2k+2.
+    It is built in C and can be reused for any number of queries.
+
+    parameters
+    ----------
+    templates: array
+        [N, ndim] array of template parameters
+    leafsize: int, optional
+        Target number of templates in each leaf, default 16
+
+    attributes
+    ----------
+    perm: array
+        The order of the templates in the tree; templates and any arrays
+        associated with them must be reordered with templates[perm] before
+        querying
+    lo, hi: arrays
+        [nnodes, ndim] bounding boxes of the nodes
+    bounds: array
+        [nnodes, 2] range of the reordered templates in each node
+    """
+    def __init__(self, templates, leafsize=16):
+        from ._gmix import pqr_index_build
+
+        templates=numpy.ascontiguousarray(templates, dtype='f8')
+        ntemplates, ndim = templates.shape
+
+        depth=0
+        while ntemplates > leafsize*2**depth:
+            depth += 1
+
+        nnodes = 2**(depth+1)-1
+
+        self.leafsize=leafsize
+        self.depth=depth
+        self.perm = numpy.arange(ntemplates, dtype='i8')
+        self.lo = numpy.zeros( (nnodes, ndim) )
+        self.hi = numpy.zeros( (nnodes, ndim) )
+        self.bounds = numpy.zeros( (nnodes, 2), dtype='i8')
+
+        pqr_index_build(templates, self.perm, self.lo, self.hi, self.bounds)
+
+    def get_width(self, cov, nsigma):
+        """
+        half widths of the box that bounds the nsigma ellipse
+        of the covariance
+        """
+        return nsigma*numpy.sqrt( numpy.diag(cov) )
+
 class PQRMomTemplatesBase(object):
     """
     calculate pqr from the input moments and a
@@ -752,6 +807,18 @@ class PQRMomTemplatesBase(object):
 
     random centers will be randomly placed in 
     a radius 
+
+    With use_index=True the templates are put into a k-d tree, see
+    PQRTemplateIndex, and each call only checks templates in the leaves
+    overlapping the nsigma ellipse of the likelihood.  All such templates
+    are used, so nmin and neff_max are ignored
+
+    With blocksize > 0 the templates are visited in blocks of that size,
+    in a random block order, so stopping early at neff_max does not
+    favor the start of the template list.  The order is a function of
+    (seed, id) only, with id the object id sent to calc_pqr, so results
+    are reproducible and do not depend on the call order or threading.
+    blocksize=0 visits the templates in order
     """
     def __init__(self,
                  templates,
@@ -762,9 +829,17 @@ class PQRMomTemplatesBase(object):
                  neff_max=100.0,
                  shear_expand=None,
                  h=1.0e-6, # when numerical deriv. are used
+                 use_index=False,
+                 leafsize=16,
+                 seed=None,
+                 blocksize=0,
                 ):
 
-        self.seed=numpy.random.randint(0,1000000)
+        if seed is None:
+            seed=numpy.random.randint(0,1000000)
+        self.seed=int(seed)
+        self.blocksize=blocksize
+        self._ncalls=0
 
         self.nsigma=nsigma
         self.templates_orig=templates
@@ -779,10 +854,31 @@ class PQRMomTemplatesBase(object):
         self.h2inv  = 1./(2.*h)
         self.hsqinv = 1./h**2
 
+        self.use_index=use_index
+        self.leafsize=leafsize
 
         self._set_templates()
+        if use_index:
+            self._set_index()
         self._prep_pqr()
 
+    def _get_id(self, id):
+        """
+        get the object id, defaulting to the number of calls so far
+        """
+        if id is None:
+            id=self._ncalls
+        self._ncalls += 1
+        return int(id)
+
+    def _set_index(self):
+        """
+        build the k-d tree and put the templates in tree order
+        """
+        print("building template index")
+        self.index = PQRTemplateIndex(self.templates, leafsize=self.leafsize)
+        self.templates = self.templates[self.index.perm]
+
     def _set_templates(self):
         """
         set the templates, trimming to the good ones
@@ -921,14 +1017,18 @@ class PQRMomTemplatesGauss(PQRMomTemplatesBase):
         """
         return self._result
 
-    def calc_pqr(self, mom, mom_cov):
+    def calc_pqr(self, mom, mom_cov, id=None):
         """
         calculate pqr sums assuming multivariate gaussian likelihood,
         equation 36 B&A 2014
+
+        id is used with the seed to set the order of the templates,
+        default is the number of calls so far
         """
         from ._gmix import mvn_calc_pqr_templates
         from numpy import sqrt
 
+        id=self._get_id(id)
         self._set_likelihood(mom,mom_cov)
         dist=self.dist
 
@@ -943,21 +1043,40 @@ class PQRMomTemplatesGauss(PQRMomTemplatesBase):
         #nmin = self.nmin
         #neff_max = self.neff_max
 
-        nuse,neff=mvn_calc_pqr_templates(dist.mean,
-                                         dist.icov,
-                                         ierrors,
-                                         dist.norm,
-                                         self.nsigma,
-                                         nmin,
-                                         neff_max,
-                                         self.templates,
-                                         self.Qderiv,
-                                         self.Rderiv,
-                                         self.seed,
-                                         P,Q,R)
-
-        # only seed the first call
-        self.seed=-1
+        if self.use_index:
+            from ._gmix import mvn_calc_pqr_templates_index
+
+            index=self.index
+            nuse,neff=mvn_calc_pqr_templates_index(
+                dist.mean,
+                dist.icov,
+                dist.norm,
+                self.nsigma,
+                self.templates,
+                self.Qderiv,
+                self.Rderiv,
+                index.lo,
+                index.hi,
+                index.bounds,
+                index.get_width(dist.cov, self.nsigma),
+                P,Q,R,
+            )
+        else:
+            nuse,neff=mvn_calc_pqr_templates(dist.mean,
+                                             dist.icov,
+                                             ierrors,
+                                             dist.norm,
+                                             self.nsigma,
+                                             nmin,
+                                             neff_max,
+                                             self.templates,
+                                             self.Qderiv,
+                                             self.Rderiv,
+                                             self.seed,
+                                             id,
+                                             self.blocksize,
+                                             P,Q,R)
+
         neff /= self.nrand_cen
         nuse /= self.nrand_cen
 
@@ -971,6 +1090,85 @@ class PQRMomTemplatesGauss(PQRMomTemplatesBase):
                       'nuse':nuse,
                       'neff':neff}
 
+    def get_batch_result(self):
+        """
+        get the result dict.  You need to run calc_pqr_batch first
+        """
+        return self._batch_result
+
+    def calc_pqr_batch(self, moms, mom_covs, ids=None, nthreads=1):
+        """
+        calculate pqr sums for a catalog, as calc_pqr
+
+        parameters
+        ----------
+        moms: array
+            [nobj, ndim] moments
+        mom_covs: array
+            [nobj, ndim, ndim] covariance of the moments
+        ids: array, optional
+            object ids used with the seed to set the template order,
+            default arange(nobj).  The results for an object only
+            depend on its id, not the number of threads
+        nthreads: int, optional
+            number of threads, <= 0 for the OpenMP default
+        """
+        from ._gmix import mvn_calc_pqr_templates_batch
+        from .priors import MultivariateNormal
+
+        if self.use_index:
+            raise ValueError("calc_pqr_batch does not support use_index")
+
+        moms=numpy.array(moms, dtype='f8', ndmin=2)
+        mom_covs=numpy.array(mom_covs, dtype='f8', ndmin=3)
+        nobj, ndim = moms.shape
+
+        if ids is None:
+            ids=numpy.arange(nobj)
+        ids=numpy.array(ids, dtype='i8', ndmin=1)
+        if ids.size != nobj or mom_covs.shape != (nobj, ndim, ndim):
+            raise ValueError("moms, mom_covs and ids must match, "
+                             "got %s %s %s" % (moms.shape,mom_covs.shape,ids.shape))
+
+        means = numpy.zeros( (nobj, ndim) )
+        icovs = numpy.zeros( (nobj, ndim, ndim) )
+        norms = numpy.zeros(nobj)
+        for i in xrange(nobj):
+            dist=MultivariateNormal(moms[i], mom_covs[i])
+            means[i,:] = dist.mean
+            icovs[i,:,:] = dist.icov
+            norms[i] = dist.norm
+
+        P = numpy.zeros(nobj)
+        Q = numpy.zeros( (nobj, 2) )
+        R = numpy.zeros( (nobj, 2, 2) )
+        nuse = numpy.zeros(nobj, dtype='i8')
+        neff = numpy.zeros(nobj)
+
+        mvn_calc_pqr_templates_batch(means,
+                                     icovs,
+                                     norms,
+                                     self.nsigma,
+                                     self.nmin*self.nrand_cen,
+                                     self.neff_max*self.nrand_cen,
+                                     self.templates,
+                                     self.Qderiv,
+                                     self.Rderiv,
+                                     self.seed,
+                                     ids,
+                                     self.blocksize,
+                                     P,Q,R,
+                                     nuse,
+                                     neff,
+                                     nthreads)
+
+        self._batch_result={'P':P,
+                            'Q':Q,
+                            'R':R,
+                            'nuse':nuse/self.nrand_cen,
+                            'neff':neff/self.nrand_cen,
+                            'ids':ids}
+
     def get_slow_result(self):
         """
         get the result dict.  You need to run calc_pqr first
@@ -1092,7 +1290,7 @@ class PQRMomTemplatesGaussFull(PQRMomTemplatesGauss):
     Assumes multi-variate gaussian for the likelihoods
     """
 
-    def calc_pqr(self, mom, mom_cov):
+    def calc_pqr(self, mom, mom_cov, id=None):
         """
         calculate pqr sums assuming multivariate gaussian likelihood,
         equation 36 B&A 2014
@@ -1100,9 +1298,13 @@ class PQRMomTemplatesGaussFull(PQRMomTemplatesGauss):
         This wrong because I pulled out a subset of the icov and data
         in that same range.  The terms with leading xdiff need contributions
         from other parameters
+
+        id is used with the seed to set the order of the templates,
+        default is the number of calls so far
         """
         from ._gmix import mvn_calc_pqr_templates_full
 
+        id=self._get_id(id)
         self._set_likelihood(mom,mom_cov)
 
         dist=self.dist
@@ -1114,29 +1316,52 @@ class PQRMomTemplatesGaussFull(PQRMomTemplatesGauss):
         nmin = self.nmin*self.nrand_cen
         neff_max = self.neff_max*self.nrand_cen
 
-        nuse,neff=mvn_calc_pqr_templates_full(dist.mean,
-                                              dist.icov,
-                                              dist.norm,
-                                              self.nsigma,
-                                              nmin,
-                                              neff_max,
-                                              self.templates,
-                                              self.sheared_p0,
-                                              self.sheared_m0,
-                                              self.sheared_0p,
-                                              self.sheared_0m,
-                                              self.sheared_pp,
-                                              self.sheared_mm,
-                                              self.h,
-                                              self.seed,
-                                              P,Q,R)
+        if self.use_index:
+            from ._gmix import mvn_calc_pqr_templates_full_index
+
+            index=self.index
+            nuse,neff=mvn_calc_pqr_templates_full_index(
+                dist.mean,
+                dist.icov,
+                dist.norm,
+                self.nsigma,
+                self.templates,
+                self.sheared_p0,
+                self.sheared_m0,
+                self.sheared_0p,
+                self.sheared_0m,
+                self.sheared_pp,
+                self.sheared_mm,
+                self.h,
+                index.lo,
+                index.hi,
+                index.bounds,
+                index.get_width(dist.cov, self.nsigma),
+                P,Q,R,
+            )
+        else:
+            nuse,neff=mvn_calc_pqr_templates_full(dist.mean,
+                                                  dist.icov,
+                                                  dist.norm,
+                                                  self.nsigma,
+                                                  nmin,
+                                                  neff_max,
+                                                  self.templates,
+                                                  self.sheared_p0,
+                                                  self.sheared_m0,
+                                                  self.sheared_0p,
+                                                  self.sheared_0m,
+                                                  self.sheared_pp,
+                                                  self.sheared_mm,
+                                                  self.h,
+                                                  self.seed,
+                                                  id,
+                                                  self.blocksize,
+                                                  P,Q,R)
 
         neff /= self.nrand_cen
         nuse = int( nuse/float(self.nrand_cen) )
 
-        # only seed the first call
-        self.seed=-1
-
         P=P[0]
 
         self._result={'mom':mom,
@@ -1262,7 +1487,8 @@ def test_mom():
     print_pars(md.d2M2ds1ds2z(), front="d2M2ds1ds2z:")
     print_pars(md.d2M2ds2ds2z(), front="d2M2ds2ds2z:")
 
-def test_pqr_moments(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=100, neff_max=1.0e9):
+def test_pqr_moments(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=100, neff_max=1.0e9,
+                     use_index=False):
     """
 
     note testing with neff_max=infinity in comparing to slow, so that we don't
@@ -1291,7 +1517,8 @@ def test_pqr_moments(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=100,
     pqrt = PQRMomTemplatesGauss(templates,
                                 cen_dist,
                                 nrand_cen,
-                                neff_max=neff_max)
+                                neff_max=neff_max,
+                                use_index=use_index)
 
     tm0=time.time()
     pqrt.calc_pqr(mean, cov)
@@ -1320,7 +1547,8 @@ def test_pqr_moments(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=100,
     print("time: ",tm)
     print("timec:",tmc)
 
-def test_pqr_moments_full(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=10):
+def test_pqr_moments_full(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=10,
+                          use_index=False):
     """
 
     note testing with neff_max=infinity in comparing to slow, so that we don't
@@ -1349,7 +1577,8 @@ def test_pqr_moments_full(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=
     pqrt = PQRMomTemplatesGaussFull(templates,
                                     cen_dist,
                                     nrand_cen,
-                                    neff_max=1.0e9)
+                                    neff_max=1.0e9,
+                                    use_index=use_index)
 
     tm0=time.time()
     pqrt.calc_pqr(mean, cov)
@@ -1366,3 +1595,72 @@ def test_pqr_moments_full(ntemplate=10000, seed=None, cen_radius=2.0, nrand_cen=
     print("nuse",pqr_res['nuse'])
     print("neff:",pqr_res['neff'])
     print("time: ",tm)
+
+def test_pqr_moments_batch(ntemplate=10000, nobj=100, seed=None, cen_radius=2.0,
+                           nrand_cen=100, neff_max=100.0, blocksize=1024,
+                           nthreads=2):
+    """
+    check calc_pqr_batch against calc_pqr for each object, and that the
+    results do not depend on the number of threads
+    """
+    from numpy import array
+    from .priors import MultivariateNormal, ZDisk2D
+    import time
+
+    numpy.random.seed(seed)
+
+    mean=array([0.15, -0.052, -1.96, 2.86, 4.85, 92.0])
+    cov=array([[+6.790897e-03, +1.451707e-03,  +1.860157e-03,  -1.059367e-03,  -1.901166e-03,  -1.461303e-03],
+               [+1.451707e-03, +4.352388e-03,  +6.346465e-04,  +3.439475e-04,  +5.323073e-04,  +6.906006e-03],
+               [+1.860157e-03,  +6.346465e-04,  +1.867478e-01,  -2.282856e-02,  -6.030356e-02,  -5.251863e-02],
+               [-1.059367e-03,  +3.439475e-04,  -2.282856e-02,  +2.054771e-01,  +1.194138e-01,  +3.461798e-01],
+               [-1.901166e-03,  +5.323073e-04,  -6.030356e-02,  +1.194138e-01,  +2.243873e-01,  +1.039051e+00],
+               [-1.461303e-03,  +6.906006e-03,  -5.251863e-02,  +3.461798e-01,  +1.039051e+00,  +1.063436e+01]])
+
+    mvn = MultivariateNormal(mean, cov)
+
+    templates = mvn.sample(ntemplate)
+    moms = mvn.sample(nobj)
+    mom_covs = numpy.zeros( (nobj,)+cov.shape )
+    mom_covs[:,:,:] = cov
+
+    cen_dist = ZDisk2D(cen_radius)
+    pqrt = PQRMomTemplatesGauss(templates,
+                                cen_dist,
+                                nrand_cen,
+                                neff_max=neff_max,
+                                blocksize=blocksize)
+
+    ids = numpy.arange(nobj) + 1000
+
+    tm0=time.time()
+    P = numpy.zeros(nobj)
+    Q = numpy.zeros( (nobj,2) )
+    R = numpy.zeros( (nobj,2,2) )
+    # reverse order to check the results don't depend on the call order
+    for i in reversed(xrange(nobj)):
+        pqrt.calc_pqr(moms[i], mom_covs[i], id=ids[i])
+        res=pqrt.get_result()
+        P[i], Q[i], R[i] = res['P'], res['Q'], res['R']
+    tm=time.time()-tm0
+
+    tm0=time.time()
+    pqrt.calc_pqr_batch(moms, mom_covs, ids=ids, nthreads=1)
+    res1=pqrt.get_batch_result()
+    tm1=time.time()-tm0
+
+    tm0=time.time()
+    pqrt.calc_pqr_batch(moms, mom_covs, ids=ids, nthreads=nthreads)
+    resn=pqrt.get_batch_result()
+    tmn=time.time()-tm0
+
+    for name, res in [('1 thread',res1), ('%d threads' % nthreads,resn)]:
+        print(name,
+              "max P diff:",numpy.abs(res['P']-P).max(),
+              "max Q diff:",numpy.abs(res['Q']-Q).max(),
+              "max R diff:",numpy.abs(res['R']-R).max())
+
+    print("mean neff:",res1['neff'].mean())
+    print("time serial: ",tm)
+    print("time batch 1 thread: ",tm1)
+    print("time batch %d threads: " % nthreads,tmn)
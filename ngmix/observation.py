@@ -5,6 +5,41 @@ import copy
 
 DEFAULT_XINTERP='lanczos15'
 
+_pixels_dtype=[('u','f8'),
+               ('v','f8'),
+               ('val','f8'),
+               ('ivar','f8')]
+
+def make_pixels(image, weight, jacobian):
+    """
+    make an array of the pixels with nonzero weight
+
+    parameters
+    ----------
+    image: ndarray
+        The image
+    weight: ndarray
+        The weight map, same shape as image
+    jacobian: Jacobian
+        The jacobian, used to set u,v for each pixel
+
+    returns
+    -------
+    pixels: array
+        array with fields u,v,val,ivar
+    """
+    from . import _gmix
+
+    image=numpy.ascontiguousarray(image, dtype='f8')
+    weight=numpy.ascontiguousarray(weight, dtype='f8')
+
+    npix = (weight > 0.0).sum()
+    pixels = numpy.zeros(npix, dtype=_pixels_dtype)
+
+    _gmix.fill_pixels(pixels, image, weight, jacobian._data)
+
+    return pixels
+
 class Observation(object):
     """
     Represent an observation with an image and possibly a
@@ -233,6 +268,15 @@ class Observation(object):
         """
         return hasattr(self,'aperture')
 
+    def get_pixels(self):
+        """
+        get an array of the pixels with nonzero weight, with
+        fields u,v,val,ivar.  The u,v are from the jacobian
+
+        This is the compact form used for the batched likelihood
+        """
+        return make_pixels(self.image, self.weight, self.jacobian)
+
     def get_s2n(self):
         """
         get the the simple s/n estimator
@@ -499,30 +543,70 @@ def get_mb_obs(obs_in):
 
 
 class KObservation(object):
+    """
+    Represent an observation in k space
+
+    parameters
+    ----------
+    kimage: galsim.Image or ndarray
+        The complex k space image.  If an ndarray is sent, the k space
+        jacobian must also be sent
+    weight: galsim.Image or ndarray, optional
+        Weight map, same shape as kimage
+    psf: KObservation, optional
+        Optional psf KObservation
+    meta: dict, optional
+        Optional dictionary
+    jacobian: Jacobian, optional
+        The k space jacobian, required for ndarray input.  For galsim
+        input the jacobian is always centered on the canonical center
+    ncol_full: int, optional
+        For a Hermitian half plane in real FFT layout (see make_kobs_fft),
+        the number of columns in the full plane.  Default 0, meaning the
+        full plane is stored
+    """
     def __init__(self,
                  kimage,
                  weight=None,
                  psf=None,
-                 meta=None):
+                 meta=None,
+                 jacobian=None,
+                 ncol_full=0):
+
+        self.ncol_full=ncol_full
 
         self._set_image(kimage)
         self._set_weight(weight)
-        self.set_psf(psf)
 
-        self._set_jacobian()
+        self._set_jacobian(jacobian)
+        self.set_psf(psf)
 
         self.meta={}
         if meta is not None:
             self.update_meta_data(meta)
 
+    def is_half(self):
+        """
+        True if we hold a Hermitian half plane
+        """
+        return self.ncol_full > 0
+
     def _set_image(self, kimage):
         """
         set the images, ensuring consistency
         """
+
+        if isinstance(kimage, numpy.ndarray):
+            if kimage.dtype != numpy.complex128:
+                raise ValueError("kimage must be complex")
+            assert len(kimage.shape)==2,"kimage must be 2d"
+            self.kimage=numpy.ascontiguousarray(kimage)
+            return
+
         import galsim
 
         if not isinstance(kimage,galsim.Image):
-            raise ValueError("kimage must be a galsim.Image")
+            raise ValueError("kimage must be a galsim.Image or ndarray")
         if kimage.array.dtype != numpy.complex128:
             raise ValueError("kimage must be complex")
 
@@ -533,6 +617,18 @@ class KObservation(object):
         set the weight, ensuring consistency with
         the images
         """
+
+        if isinstance(self.kimage, numpy.ndarray):
+            if weight is None:
+                weight = numpy.zeros(self.kimage.shape) + 1.0
+            else:
+                weight=numpy.ascontiguousarray(weight, dtype='f8')
+                if weight.shape!=self.kimage.shape:
+                    raise ValueError("weight kimage must have "
+                                     "same shape as kimage")
+            self.weight=weight
+            return
+
         import galsim
 
         if weight is None:
@@ -549,6 +645,32 @@ class KObservation(object):
 
         self.weight=weight
 
+    def get_kimage_array(self):
+        """
+        get the complex k image as an ndarray, for either galsim
+        or ndarray input
+        """
+        if isinstance(self.kimage, numpy.ndarray):
+            return self.kimage
+        else:
+            return self.kimage.array
+
+    def get_weight_array(self):
+        """
+        get the weight map as an ndarray, for either galsim
+        or ndarray input
+        """
+        if isinstance(self.weight, numpy.ndarray):
+            return self.weight
+        else:
+            return self.weight.array
+
+    def _get_kshape(self):
+        """
+        shape of the stored k image
+        """
+        return self.get_kimage_array().shape
+
     def set_psf(self, psf):
         """
         set the psf KObservation.  can be None
@@ -561,18 +683,24 @@ class KObservation(object):
 
         assert isinstance(psf, KObservation)
 
-        if psf.kimage.array.shape!=self.kimage.array.shape:
+        if psf._get_kshape()!=self._get_kshape():
             raise ValueError("psf kimage must have "
                              "same shape as kimage")
-        assert numpy.allclose(psf.kimage.scale,self.kimage.scale)
+        assert numpy.allclose(psf.jacobian.scale,self.jacobian.scale)
+        assert psf.ncol_full == self.ncol_full
 
-    def _set_jacobian(self):
+    def _set_jacobian(self, jacobian):
         """
-        center is always at the canonical center.
-
+        for galsim input, center is always at the canonical center and the
         scale is always the scale of the image
         """
 
+        if isinstance(self.kimage, numpy.ndarray):
+            assert isinstance(jacobian,Jacobian),\
+                    "send a k space Jacobian with ndarray input"
+            self.jacobian=jacobian
+            return
+
         scale=self.kimage.scale
 
         dims=self.kimage.array.shape
@@ -841,6 +969,297 @@ def make_kobs(mb_obs, **kw):
 
     return mb_kobs
 
+#
+# k space observations from FFTs of the real space stamps
+#
+
+_kfft_plan_cache={}
+
+def get_kfft_plan(dims, pad_factor=2.0, half=True):
+    """
+    get a KFFTPlan for stamps of the given shape, cached by the
+    shape, padding and layout
+
+    parameters
+    ----------
+    dims: sequence
+        The shape of the real space stamps
+    pad_factor: float, optional
+        Pad the stamps by at least this factor.  Default 2.0
+    half: bool, optional
+        If True, store the Hermitian half plane in real FFT layout.
+        Default True
+    """
+
+    key=(tuple(dims), pad_factor, half)
+
+    plan=_kfft_plan_cache.get(key, None)
+    if plan is None:
+        plan=KFFTPlan(dims, pad_factor=pad_factor, half=half)
+        _kfft_plan_cache[key]=plan
+
+    return plan
+
+class KFFTPlan(object):
+    """
+    Precomputed layout for transforming real space stamps of a given shape
+    into k space
+
+    The stamps are zero padded to a size with small prime factors.  For
+    half=True the k image holds the u >= 0 columns of the Hermitian plane in
+    real FFT layout, rows centered and column zero at u=0, which is the layout
+    expected by the _half k space kernels.  For half=False the full plane is
+    stored with the zero frequency at the canonical center.
+
+    parameters
+    ----------
+    dims: sequence
+        The shape of the real space stamps
+    pad_factor: float, optional
+        Pad the stamps by at least this factor.  Default 2.0
+    half: bool, optional
+        If True, store the Hermitian half plane in real FFT layout.
+        Default True
+    """
+    def __init__(self, dims, pad_factor=2.0, half=True):
+
+        assert len(dims)==2,"dims must be 2d"
+        assert pad_factor >= 1.0,"pad_factor must be >= 1"
+
+        self.dims=tuple(dims)
+        self.pad_factor=pad_factor
+        self.half=half
+
+        self.pad_dims=tuple(
+            [_get_good_fft_size(pad_factor*d) for d in self.dims]
+        )
+        nrow, ncol = self.pad_dims
+
+        # frequencies in radians per pixel, in the storage order
+        fft=numpy.fft
+        self.qrow = 2*numpy.pi*fft.fftshift(fft.fftfreq(nrow))
+        if half:
+            self.qcol = 2*numpy.pi*fft.rfftfreq(ncol)
+            self.ncol_full=ncol
+            self.kcen=(nrow//2, 0)
+        else:
+            self.qcol = 2*numpy.pi*fft.fftshift(fft.fftfreq(ncol))
+            self.ncol_full=0
+            self.kcen=(nrow//2, ncol//2)
+
+        self.kdims=(self.qrow.size, self.qcol.size)
+
+    def get_kjacobian(self, jacobian):
+        """
+        get the k space jacobian corresponding to the real space jacobian
+
+        With x = A p for pixel offsets p, the phase is k.x = (A^T k).p, so
+        the k for frequency q in radians per pixel is A^{-T} q
+        """
+
+        A=numpy.array([[jacobian.dvdrow, jacobian.dvdcol],
+                       [jacobian.dudrow, jacobian.dudcol]])
+        AinvT=numpy.linalg.inv(A).T
+
+        nrow, ncol = self.pad_dims
+        drow = 2*numpy.pi/nrow
+        dcol = 2*numpy.pi/ncol
+
+        return Jacobian(
+            row=self.kcen[0],
+            col=self.kcen[1],
+            dvdrow=AinvT[0,0]*drow,
+            dvdcol=AinvT[0,1]*dcol,
+            dudrow=AinvT[1,0]*drow,
+            dudcol=AinvT[1,1]*dcol,
+        )
+
+    def get_phase(self, jacobian):
+        """
+        phase to put the origin at the jacobian center rather than the first
+        pixel, times the pixel area so the k image approximates the
+        continuous transform of the surface brightness
+        """
+        row0, col0 = jacobian.get_cen()
+        prow = numpy.exp(1j*self.qrow*row0)
+        pcol = jacobian.det*numpy.exp(1j*self.qcol*col0)
+        return prow[:,numpy.newaxis]*pcol[numpy.newaxis,:]
+
+    def transform(self, images):
+        """
+        transform an image or a stack of images with shape [nimage, nrow,
+        ncol] and return the k images in the storage order, not yet phased
+        """
+
+        fft=numpy.fft
+        axes=(-2,-1)
+        if self.half:
+            kims = fft.rfft2(images, s=self.pad_dims, axes=axes)
+            kims = fft.fftshift(kims, axes=-2)
+        else:
+            kims = fft.fft2(images, s=self.pad_dims, axes=axes)
+            kims = fft.fftshift(kims, axes=axes)
+
+        return kims
+
+    def get_kweight(self, weight, jacobian):
+        """
+        the k space weight for a real space weight map
+
+        The noise in each k pixel has variance area^2 sum(var) over the real
+        space pixels.  As for make_kobs, the weight is half the inverse, since
+        each independent mode appears twice in the full plane
+        """
+        w=numpy.where(weight > 0.0)
+        if w[0].size == 0:
+            kivar=0.0
+        else:
+            kvar = jacobian.det**2 * (1.0/weight[w]).sum()
+            kivar = 0.5/kvar
+
+        return numpy.zeros(self.kdims) + kivar
+
+def make_kobs_fft(obs, pad_factor=2.0, half=True):
+    """
+    make k space observations from real space observations using FFTs
+    rather than drawing interpolated images with galsim
+
+    Stamps in an ObsList with the same image and psf shapes are transformed
+    together
+
+    parameters
+    ----------
+    obs: real space observations
+        Either Observation, ObsList or MultiBandObsList; the return
+        value is the corresponding KObservation, KObsList or
+        KMultiBandObsList
+    pad_factor: float, optional
+        Pad the stamps by at least this factor.  Default 2.0
+    half: bool, optional
+        If True, store the Hermitian half plane in real FFT layout,
+        as expected by the _half k space kernels.  Default True
+    """
+
+    if isinstance(obs, Observation):
+        obs_list=ObsList()
+        obs_list.append(obs)
+        kobs_list=make_kobs_fft(obs_list, pad_factor=pad_factor, half=half)
+        return kobs_list[0]
+
+    elif isinstance(obs, MultiBandObsList):
+        mb_kobs=KMultiBandObsList()
+        for obs_list in obs:
+            kobs_list=make_kobs_fft(
+                obs_list,
+                pad_factor=pad_factor,
+                half=half,
+            )
+            mb_kobs.append(kobs_list)
+        return mb_kobs
+
+    elif not isinstance(obs, ObsList):
+        raise ValueError("obs should be Observation, ObsList, or "
+                         "MultiBandObsList")
+
+    # group stamps by the image and psf shapes so each group is a single
+    # FFT call; the image and psf share a plan big enough for both
+    groups={}
+    for i,tobs in enumerate(obs):
+        key=(tobs.image.shape,)
+        if tobs.has_psf():
+            key += (tobs.psf.image.shape,)
+        groups.setdefault(key, []).append(i)
+
+    kobs_all=[None]*len(obs)
+    for key,indices in groups.items():
+        dims=tuple(int(d) for d in numpy.max(key, axis=0))
+        plan=get_kfft_plan(dims, pad_factor=pad_factor, half=half)
+
+        _make_kobs_fft_group(obs, indices, plan, kobs_all)
+
+    kobs_list=KObsList(meta=obs.meta)
+    for kobs in kobs_all:
+        kobs_list.append(kobs)
+
+    return kobs_list
+
+def _make_kobs_fft_group(obs_list, indices, plan, kobs_all):
+    """
+    transform the stamps with the given indices, all with the same
+    image shape and the same psf shape
+    """
+
+    ims=numpy.array([
+        _get_masked_image(obs_list[i].image, obs_list[i].weight)
+        for i in indices
+    ])
+    kims=plan.transform(ims)
+
+    has_psf=[obs_list[i].has_psf() for i in indices]
+    if all(has_psf):
+        psf_ims=numpy.array([
+            _get_masked_image(obs_list[i].psf.image, obs_list[i].psf.weight)
+            for i in indices
+        ])
+        # normalize so the psf k image is unity at k=0
+        psf_norms=psf_ims.sum(axis=(1,2))*numpy.array([
+            obs_list[i].psf.jacobian.det for i in indices
+        ])
+        psf_ims /= psf_norms[:,numpy.newaxis,numpy.newaxis]
+        psf_kims=plan.transform(psf_ims)
+    elif any(has_psf):
+        raise ValueError("either all or none of the observations "
+                         "should have a psf set")
+
+    for ii,i in enumerate(indices):
+        obs=obs_list[i]
+
+        kjacob=plan.get_kjacobian(obs.jacobian)
+
+        if has_psf[ii]:
+            psf=obs.psf
+
+            psf_kjacob=plan.get_kjacobian(psf.jacobian)
+            psf_kobs=KObservation(
+                psf_kims[ii]*plan.get_phase(psf.jacobian),
+                weight=plan.get_kweight(
+                    psf.weight*psf_norms[ii]**2,
+                    psf.jacobian,
+                ),
+                jacobian=psf_kjacob,
+                ncol_full=plan.ncol_full,
+            )
+        else:
+            psf_kobs=None
+
+        kobs_all[i]=KObservation(
+            kims[ii]*plan.get_phase(obs.jacobian),
+            weight=plan.get_kweight(obs.weight, obs.jacobian),
+            psf=psf_kobs,
+            jacobian=kjacob,
+            ncol_full=plan.ncol_full,
+        )
+
+def _get_masked_image(image, weight):
+    """
+    zero the pixels with zero weight
+    """
+    return numpy.where(weight > 0.0, image, 0.0)
+
+def _get_good_fft_size(size):
+    """
+    smallest integer >= size with no prime factors other than 2, 3 and 5
+    """
+    n=int(numpy.ceil(size))
+    while True:
+        m=n
+        for p in (2,3,5):
+            while m % p == 0:
+                m //= p
+        if m == 1:
+            return n
+        n += 1
+
 def get_kmb_obs(obs_in):
     """
     convert the input to a MultiBandObsList
@@ -44,6 +44,71 @@ def make_rng(rng=None):
 
     return rng
 
+# C prior descriptors, see PyGMix_Prior in _gmix.h
+_CPRIOR_NORMAL=1
+_CPRIOR_NORMAL2D=2
+_CPRIOR_ZDISK2D=3
+_CPRIOR_GBA=4
+_CPRIOR_FLAT=5
+_CPRIOR_TWOSIDED_ERF=6
+_CPRIOR_LOGNORMAL=7
+
+_cprior_npars=4
+_cprior_dtype=[
+    ('type','i4'),
+    ('index','i4'),
+    ('pars','f8',_cprior_npars),
+]
+
+def make_cprior(ptype, index, pars):
+    """
+    make a single element C prior descriptor
+
+    parameters
+    ----------
+    ptype: int
+        One of the _CPRIOR_* types
+    index: int
+        Index of the first parameter the prior applies to
+    pars: sequence
+        The parameters of the prior, at most 4
+    """
+    cprior=zeros(1, dtype=_cprior_dtype)
+    cprior['type'] = ptype
+    cprior['index'] = index
+    cprior['pars'][0,0:len(pars)] = pars
+    return cprior
+
+def _get_carray(x):
+    """
+    get a contiguous float64 version of the input, at least 1-d, for the
+    array methods of the C priors
+    """
+    return numpy.ascontiguousarray(x, dtype='f8')
+
+def make_joint_cprior(priors_and_indices):
+    """
+    combine priors into a single C descriptor for a separable prior
+
+    parameters
+    ----------
+    priors_and_indices: list
+        list of (prior, index) where index is the first parameter
+        the prior applies to
+
+    returns
+    -------
+    The descriptor array, or None if any of the priors do not
+    support a C version
+    """
+    cpriors=[]
+    for prior, index in priors_and_indices:
+        if not hasattr(prior, 'get_cprior'):
+            return None
+        cpriors.append( prior.get_cprior(index) )
+
+    return numpy.concatenate(cpriors)
+
 class PriorBase(object):
     def __init__(self, rng=None):
         self.rng=make_rng(rng=rng)
@@ -1434,6 +1499,12 @@ class GPriorBA(GPriorBase):
         self.sig2inv = 1./self.sig2
         self.sig4inv = 1./self.sig4
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index:index+2]
+        """
+        return make_cprior(_CPRIOR_GBA, index, [self.sig2inv])
+
     def get_lnprob_scalar2d(self, g1, g2):
         """
         Get the 2d log prob for the input g value
@@ -1880,6 +1951,12 @@ class FlatPrior(FlatPriorBase):
         self.minval=minval
         self.maxval=maxval
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index]
+        """
+        return make_cprior(_CPRIOR_FLAT, index, [self.minval, self.maxval])
+
     def get_prob_scalar(self, val):
         retval=1.0
         if val < self.minval or val > self.maxval:
@@ -1910,6 +1987,14 @@ class TwoSidedErf(PriorBase):
         self.maxval=maxval
         self.width_at_max=width_at_max
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index]
+        """
+        pars=[self.minval, self.width_at_min,
+              self.maxval, self.width_at_max]
+        return make_cprior(_CPRIOR_TWOSIDED_ERF, index, pars)
+
     def get_prob_scalar(self, val):
         """
         get the probability of the point
@@ -2881,6 +2966,30 @@ class Normal(_gmix.Normal):
 
         super(Normal,self).__init__(cen, sigma)
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index]
+        """
+        return make_cprior(_CPRIOR_NORMAL, index, [self.cen, 1.0/self.sigma**2])
+
+    def get_lnprob_array(self, x):
+        """
+        get ln(prob) for the input array
+        """
+        x=_get_carray(x)
+        out=numpy.zeros(x.shape)
+        super(Normal,self).get_lnprob_array(x, out)
+        return out
+
+    def get_prob_array(self, x):
+        """
+        get prob for the input array
+        """
+        x=_get_carray(x)
+        out=numpy.zeros(x.shape)
+        super(Normal,self).get_prob_array(x, out)
+        return out
+
     def sample(self, size=None):
         """
         Get samples.  Send no args to get a scalar.
@@ -2986,6 +3095,13 @@ class LogNormal(PriorBase):
 
         self.log_mode=log_mode
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index]
+        """
+        shift = 0.0 if self.shift is None else self.shift
+        pars=[shift, self.logmean, self.logivar, self.lnprob_max]
+        return make_cprior(_CPRIOR_LOGNORMAL, index, pars)
 
     def get_lnprob_scalar(self, x):
         """
@@ -4041,6 +4157,33 @@ class CenPrior(_gmix.Normal2D):
 
         super(CenPrior,self).__init__(cen1,cen2,sigma1,sigma2)
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index:index+2]
+        """
+        pars=[self.cen1, self.cen2, 1.0/self.sigma1**2, 1.0/self.sigma2**2]
+        return make_cprior(_CPRIOR_NORMAL2D, index, pars)
+
+    def get_lnprob_array(self, x1, x2):
+        """
+        get ln(prob) for the input arrays
+        """
+        x1=_get_carray(x1)
+        x2=_get_carray(x2)
+        out=numpy.zeros(x1.shape)
+        super(CenPrior,self).get_lnprob_array(x1, x2, out)
+        return out
+
+    def get_prob_array(self, x1, x2):
+        """
+        get prob for the input arrays
+        """
+        x1=_get_carray(x1)
+        x2=_get_carray(x2)
+        out=numpy.zeros(x1.shape)
+        super(CenPrior,self).get_prob_array(x1, x2, out)
+        return out
+
     def sample(self, n=None):
         """
         Get a single sample or arrays
@@ -4641,6 +4784,12 @@ class ZDisk2D(_gmix.ZDisk2D):
 
         super(ZDisk2D,self).__init__(radius, rng=rng)
 
+    def get_cprior(self, index):
+        """
+        get the C prior descriptor, applied to pars[index:index+2]
+        """
+        return make_cprior(_CPRIOR_ZDISK2D, index, [self.radius_sq])
+
     def sample1d(self, n=None):
         """
         Get samples in 1-d radius
@@ -4684,19 +4833,50 @@ class ZDisk2D(_gmix.ZDisk2D):
 
         return x,y
 
-    def get_prob_array2d(self, x, y):
+    def get_prob_array1d(self, r):
         """
-        probability, 1.0 inside disk, outside raises exception
+        probability, 1.0 inside disk, 0.0 outside
+        """
+        r=_get_carray(r)
+        out=numpy.zeros(r.shape)
+        super(ZDisk2D,self).get_prob_array1d(r,out)
+        return out
+
+    def get_lnprob_array1d(self, r):
+        """
+        ln(prob), 0.0 inside disk, LOWVAL outside
 
         does not raise an exception
         """
-        x=numpy.array(x, dtype='f8', ndmin=1, copy=False)
-        y=numpy.array(y, dtype='f8', ndmin=1, copy=False)
-        out=numpy.zeros(x.size, dtype='f8')
+        r=_get_carray(r)
+        out=numpy.zeros(r.shape)
+        super(ZDisk2D,self).get_lnprob_array1d(r,out)
+        return out
+
+    def get_prob_array2d(self, x, y):
+        """
+        probability, 1.0 inside disk, 0.0 outside
+        """
+        x=_get_carray(x)
+        y=_get_carray(y)
+        out=numpy.zeros(x.shape)
 
         super(ZDisk2D,self).get_prob_array2d(x,y,out)
         return out
 
+    def get_lnprob_array2d(self, x, y):
+        """
+        ln(prob), 0.0 inside disk, LOWVAL outside
+
+        does not raise an exception
+        """
+        x=_get_carray(x)
+        y=_get_carray(y)
+        out=numpy.zeros(x.shape)
+
+        super(ZDisk2D,self).get_lnprob_array2d(x,y,out)
+        return out
+
 class ZAnnulus(ZDisk2D):
     """
     uniform over an annulus
@@ -4889,15 +5069,54 @@ class UDisk2DCut(object):
         return self.get_lnprob_array1d(x)
 
 
+# maximum number of nodes for the FFT convolution of the binned KDE; the
+# FFTs use a few arrays of this size, a few hundred MB in total
+KDE_MAX_FFT_SIZE=2**23
+
+# maximum dimension for the binned KDE, PYGMIX_GRID_MAXDIM in _gmix.h
+KDE_MAX_BINNED_NDIM=6
+
 class KDE(object):
     """
     create a kde from the input data
 
     just a wrapper around scipy.stats.gaussian_kde to
     provide a uniform interface
+
+    parameters
+    ----------
+    data: array
+        [N] or [N, ndim] array of training points
+    kde_factor: number or string
+        Sent as bw_method to scipy.stats.gaussian_kde
+    binned: bool, optional
+        If True, the density is tabulated on a grid, by linear binning
+        the data and convolving with the kernel using FFTs.  Queries are
+        answered by multilinear interpolation of the grid in C, with cost
+        independent of the number of training points.  The grid extends
+        nsigma kernel widths past the data; the density is zero outside.
+        Default False, in which case the exact kde is evaluated.  At most
+        KDE_MAX_BINNED_NDIM dimensions are supported; a ValueError is
+        raised for more
+    ngrid: int or sequence, optional
+        Number of grid nodes in each dimension for the binned mode;
+        default 512 for 1-d, 256 for 2-d and 32 otherwise, reduced
+        where needed so the FFT convolution, the grid padded by the
+        kernel, has at most KDE_MAX_FFT_SIZE nodes.  A ValueError is
+        raised if the ngrid sent exceeds that.  The grid is coarse
+        beyond 2-d: for the test_kde_binned mixture the default has a
+        ~0.1% rms density error in 2-d but ~10% in 3-d (4% at ngrid=64)
+        and 14% in 4-d, and is useless in 6-d, where the exact kde
+        should be used.  See test_kde_binned for how the accuracy
+        depends on the grid size
+    nsigma: float, optional
+        Padding of the grid in kernel widths, default 5
+    nthreads: int, optional
+        Number of threads for binned queries, default 1
     """
 
-    def __init__(self, data, kde_factor):
+    def __init__(self, data, kde_factor,
+                 binned=False, ngrid=None, nsigma=5.0, nthreads=1):
         import scipy.stats
 
         if len(data.shape) == 1:
@@ -4910,6 +5129,175 @@ class KDE(object):
             bw_method=kde_factor,
         )
 
+        self.ndim=self.kde.d
+        self.binned=binned
+        self.nthreads=nthreads
+
+        if binned:
+            if self.ndim > KDE_MAX_BINNED_NDIM:
+                raise ValueError("binned kde supports at most %d "
+                                 "dimensions, got %d; use binned=False" % \
+                                 (KDE_MAX_BINNED_NDIM, self.ndim))
+            self._set_grid(ngrid, nsigma)
+
+    def get_prob_array(self, x):
+        """
+        get the density at the points
+
+        parameters
+        ----------
+        x: array
+            [N] array for 1-d or [N, ndim]
+        """
+        return self._get_prob_array(x, 0)
+
+    def get_lnprob_array(self, x):
+        """
+        get the log density at the points; zero density gives LOWVAL
+
+        parameters
+        ----------
+        x: array
+            [N] array for 1-d or [N, ndim]
+        """
+        return self._get_prob_array(x, 1)
+
+    def get_prob_scalar(self, x):
+        """
+        get the density at a single point
+        """
+        return self.get_prob_array(
+            numpy.array(x, dtype='f8', ndmin=1).reshape(1,self.ndim)
+        )[0]
+
+    def get_lnprob_scalar(self, x):
+        """
+        get the log density at a single point, raising GMixRangeError
+        if the density is zero
+        """
+        lnp=self.get_lnprob_array(
+            numpy.array(x, dtype='f8', ndmin=1).reshape(1,self.ndim)
+        )[0]
+        if lnp == LOWVAL:
+            raise GMixRangeError("zero density at %s" % x)
+        return lnp
+
+    def _get_prob_array(self, x, dolog):
+        """
+        evaluate on the grid or exactly
+        """
+        x=numpy.array(x, dtype='f8', ndmin=1, order='C')
+        if len(x.shape)==1:
+            x = x.reshape( (x.size, 1) )
+
+        assert x.shape[1]==self.ndim,"x must have %d dims" % self.ndim
+
+        if self.binned:
+            out=zeros(x.shape[0])
+            _gmix.grid_interp(self.grid,
+                              self.grid_dims,
+                              self.grid_min,
+                              self.grid_dx,
+                              x,
+                              out,
+                              dolog,
+                              self.nthreads)
+        else:
+            if dolog:
+                out=self.kde.logpdf(x.transpose())
+            else:
+                out=self.kde.evaluate(x.transpose())
+
+        return out
+
+    def _set_grid(self, ngrid, nsigma):
+        """
+        tabulate the density on a grid: linear binning of the data
+        followed by FFT convolution with the kernel
+        """
+        from scipy.signal import fftconvolve
+
+        ndim=self.ndim
+
+        data=self.kde.dataset.transpose()
+        cov=numpy.atleast_2d(self.kde.covariance)
+        sigmas=sqrt(diag(cov))
+
+        xmin=data.min(axis=0) - nsigma*sigmas
+        xmax=data.max(axis=0) + nsigma*sigmas
+
+        # kernel half width as a fraction of the grid extent
+        kfrac=nsigma*sigmas/(xmax-xmin)
+
+        if ngrid is None:
+            ngrid = {1:512, 2:256}.get(ndim, 32)
+
+            # fewer nodes in high dimensions, to stay within the budget
+            while (ngrid > 2
+                   and _get_kde_fft_size(ngrid, kfrac) > KDE_MAX_FFT_SIZE):
+                ngrid -= 1
+
+        dims=numpy.zeros(ndim, dtype='i8')
+        dims[:]=ngrid
+        assert dims.min() >= 2,"need at least 2 grid nodes"
+
+        fft_size=_get_kde_fft_size(dims, kfrac)
+        if fft_size > KDE_MAX_FFT_SIZE:
+            raise ValueError("kde grid %s needs %g nodes for the FFT "
+                             "convolution, more than "
+                             "KDE_MAX_FFT_SIZE=%d" % \
+                             (tuple(int(d) for d in dims), fft_size,
+                              KDE_MAX_FFT_SIZE))
+
+        dx=(xmax-xmin)/(dims-1)
+
+        # linear binning, the weight of each point is shared over
+        # the 2^ndim surrounding nodes
+        t=(data-xmin)/dx
+        i0=numpy.floor(t).astype('i8')
+        i0=i0.clip(min=0, max=dims-2)
+        frac=t-i0
+
+        counts=zeros(dims.prod())
+        for corner in xrange(2**ndim):
+            w=ones(data.shape[0])
+            idx=i0.copy()
+            for d in xrange(ndim):
+                if corner & (1<<d):
+                    w *= frac[:,d]
+                    idx[:,d] += 1
+                else:
+                    w *= 1.0-frac[:,d]
+
+            ind=numpy.ravel_multi_index(idx.transpose(), dims)
+            counts += numpy.bincount(ind, weights=w, minlength=counts.size)
+
+        counts=counts.reshape(dims)
+
+        # kernel on the grid offsets, truncated at nsigma
+        halfwidth=numpy.ceil(nsigma*sigmas/dx).astype('i8')
+        halfwidth=halfwidth.clip(max=dims-1)
+        offsets=[dx[d]*numpy.arange(-halfwidth[d], halfwidth[d]+1)
+                 for d in xrange(ndim)]
+        grids=numpy.meshgrid(*offsets, indexing='ij')
+        delta=numpy.array([g.ravel() for g in grids])
+
+        icov=numpy.linalg.inv(cov)
+        chi2=(delta*numpy.dot(icov, delta)).sum(axis=0)
+        norm=1.0/sqrt( (2*pi)**ndim * numpy.linalg.det(cov) )
+        kernel=norm*exp(-0.5*chi2).reshape(grids[0].shape)
+
+        grid=fftconvolve(counts, kernel, mode='same')
+        grid *= 1.0/self.kde.n
+
+        # round off from the FFTs
+        grid.clip(min=0.0, out=grid)
+
+        self.grid=numpy.ascontiguousarray(grid, dtype='f8')
+        self.grid_dims=dims
+        self.grid_min=xmin
+        self.grid_dx=dx
+
 
     def sample(self, n=None):
         """
@@ -4931,3 +5319,71 @@ class KDE(object):
 
         return r
 
+def _get_kde_fft_size(dims, kfrac):
+    """
+    number of nodes in the FFT convolution for the binned kde, the grid
+    padded by the kernel half width on each side.  kfrac is the kernel
+    half width as a fraction of the grid extent in each dimension
+    """
+    dims=numpy.zeros(len(kfrac)) + dims
+    halfwidth=numpy.ceil(kfrac*(dims-1)).clip(max=dims-1)
+    return (dims + 2*halfwidth).prod()
+
+def test_kde_binned(n=100000, ngrids=[32,64,128,256,512], ndim=2,
+                    nquery=2000, kde_factor='scott', seed=None):
+    """
+    compare the binned kde to the exact kde for a mixture of two gaussians,
+    printing the fractional error of the density and the timing for
+    each grid size
+
+    the queries are drawn from the data distribution.  Grid sizes over
+    KDE_MAX_FFT_SIZE are skipped, and ngrid None uses the default
+    """
+    import time
+
+    rng=numpy.random.RandomState(seed)
+
+    cov1=0.4*numpy.identity(ndim) + 0.6
+    mean2=zeros(ndim)
+    mean2[0:2]=[2.0, -1.0][0:ndim]
+    cov2=numpy.diag( ([0.2, 0.5]*ndim)[0:ndim] )
+
+    nhalf=n//2
+    data=zeros( (n,ndim) )
+    data[:nhalf,:] = rng.multivariate_normal(
+        zeros(ndim), cov1, size=nhalf,
+    )
+    data[nhalf:,:] = rng.multivariate_normal(
+        mean2, cov2, size=n-nhalf,
+    )
+
+    query=data[rng.randint(0, n, size=nquery)]
+    query += 0.1*rng.normal(size=query.shape)
+
+    kde=KDE(data, kde_factor)
+    tm0=time.time()
+    exact=kde.get_prob_array(query)
+    texact=time.time()-tm0
+
+    print("exact: %g seconds for %d queries" % (texact, nquery))
+    print("%8s %12s %12s %12s %12s" % ('ngrid','max frac err',
+                                         'rms frac err','setup (s)',
+                                         'query (s)'))
+    for ngrid in ngrids:
+        tm0=time.time()
+        try:
+            bkde=KDE(data, kde_factor, binned=True, ngrid=ngrid)
+        except ValueError as err:
+            print("%8s skipped: %s" % (ngrid, err))
+            continue
+        tsetup=time.time()-tm0
+
+        tm0=time.time()
+        binned=bkde.get_prob_array(query)
+        tquery=time.time()-tm0
+
+        frac=binned/exact-1.0
+        print("%8d %12.3g %12.3g %12.3g %12.3g" % (bkde.grid_dims[0],
+                                                   abs(frac).max(),
+                                                   sqrt( (frac**2).mean() ),
+                                                   tsetup, tquery))
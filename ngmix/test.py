@@ -13,14 +13,19 @@ from .priors import srandu
 from . import joint_prior
 from .fitting import *
 from .gexceptions import *
-from .jacobian import Jacobian, UnitJacobian
+from .jacobian import Jacobian, UnitJacobian, DiagonalJacobian
+from .observation import Observation, ObsList, make_kobs_fft
 from .bootstrap import Bootstrapper
 
 from . import em
 
 def test():
-    suite = unittest.TestLoader().loadTestsFromTestCase(TestFitting)
-    unittest.TextTestRunner(verbosity=2).run(suite)
+    suite_fitting = unittest.TestLoader().loadTestsFromTestCase(TestFitting)
+    suite_kobs = unittest.TestLoader().loadTestsFromTestCase(TestKObsFFT)
+    suite_kde = unittest.TestLoader().loadTestsFromTestCase(TestKDE)
+
+    alltests = unittest.TestSuite([suite_fitting, suite_kobs, suite_kde])
+    unittest.TextTestRunner(verbosity=2).run(alltests)
 
 class TestFitting(unittest.TestCase):
 
@@ -96,6 +101,125 @@ class TestFitting(unittest.TestCase):
             print_pars(res['pars_err'], front='pars err:  ')
             print('s2n:',res['s2n_w'])
 
+class TestKObsFFT(unittest.TestCase):
+
+    def setUp(self):
+        self.rng=numpy.random.RandomState(8312)
+
+    def make_obs(self, dims, psf_dims, scale=0.263):
+        """
+        gaussian object and psf with a jacobian centered off the
+        stamp center
+        """
+        rng=self.rng
+
+        psf_jacob=DiagonalJacobian(
+            row=(psf_dims[0]-1)/2.0 + rng.uniform(low=-0.5, high=0.5),
+            col=(psf_dims[1]-1)/2.0 + rng.uniform(low=-0.5, high=0.5),
+            scale=scale,
+        )
+        gm_psf=gmix.GMixModel([0.0, 0.0, 0.0, 0.05, 0.4, 1.0], 'gauss')
+        psf_im=gm_psf.make_image(psf_dims, jacobian=psf_jacob)
+        psf_obs=Observation(
+            psf_im,
+            weight=zeros(psf_dims) + 1.0e6,
+            jacobian=psf_jacob,
+        )
+
+        jacob=DiagonalJacobian(
+            row=(dims[0]-1)/2.0 + rng.uniform(low=-0.5, high=0.5),
+            col=(dims[1]-1)/2.0 + rng.uniform(low=-0.5, high=0.5),
+            scale=scale,
+        )
+        gm0=gmix.GMixModel([0.0, 0.0, 0.1, -0.2, 1.0, 100.0], 'gauss')
+        im=gm0.convolve(gm_psf).make_image(dims, jacobian=jacob)
+        im += rng.normal(scale=0.1, size=im.shape)
+
+        return Observation(
+            im,
+            weight=zeros(dims) + 100.0,
+            jacobian=jacob,
+            psf=psf_obs,
+        )
+
+    def check_kobs(self, kobs, kobs_single):
+        self.assertEqual(kobs.ncol_full, kobs_single.ncol_full)
+
+        kim=kobs.get_kimage_array()
+        kim_single=kobs_single.get_kimage_array()
+        self.assertEqual(kim.shape, kim_single.shape)
+
+        diff=abs(kim-kim_single).max()
+        self.assertTrue(diff <= 1.0e-12*abs(kim_single).max())
+
+        self.assertTrue(
+            numpy.all(kobs.get_weight_array() == kobs_single.get_weight_array())
+        )
+
+        j, js = kobs.jacobian, kobs_single.jacobian
+        self.assertEqual(j.get_cen(), js.get_cen())
+        self.assertEqual(j.det, js.det)
+
+    def testMixedShapes(self):
+        """
+        an ObsList with mixed image and psf shapes agrees with transforming
+        each observation by itself
+        """
+
+        shapes=[
+            # same image shape, different psf shapes
+            ((32,32), (25,25)),
+            ((32,32), (21,21)),
+            # different image shapes, same psf shape
+            ((32,32), (40,40)),
+            ((40,40), (40,40)),
+            # repeated, so some groups have more than one stamp
+            ((32,32), (25,25)),
+            ((33,29), (21,21)),
+        ]
+
+        obs_list=ObsList()
+        for dims, psf_dims in shapes:
+            obs_list.append( self.make_obs(dims, psf_dims) )
+
+        for half in [True, False]:
+            kobs_list=make_kobs_fft(obs_list, half=half)
+            self.assertEqual(len(kobs_list), len(obs_list))
+
+            for obs, kobs in zip(obs_list, kobs_list):
+                kobs_single=make_kobs_fft(obs, half=half)
+
+                self.check_kobs(kobs, kobs_single)
+                self.check_kobs(kobs.psf, kobs_single.psf)
+
+class TestKDE(unittest.TestCase):
+
+    def setUp(self):
+        self.rng=numpy.random.RandomState(2871)
+
+    def testBinnedMaxDim(self):
+        """
+        the binned kde works up to KDE_MAX_BINNED_NDIM dimensions, and
+        raises ValueError on construction beyond that
+        """
+        from .priors import KDE, KDE_MAX_BINNED_NDIM
+
+        ndim=KDE_MAX_BINNED_NDIM
+        data=self.rng.normal(size=(1000, ndim))
+        kde=KDE(data, 'scott', binned=True, ngrid=4)
+
+        vals=kde.get_prob_array(data[0:10])
+        self.assertTrue(numpy.all(numpy.isfinite(vals)))
+
+        data=self.rng.normal(size=(1000, ndim+1))
+        with self.assertRaises(ValueError):
+            KDE(data, 'scott', binned=True)
+
+        # the exact kde has no limit
+        kde=KDE(data, 'scott')
+        vals=kde.get_prob_array(data[0:10])
+        self.assertTrue(numpy.all(vals > 0))
+
 def make_test_observations(model,
                            g1_obj=0.1,
                            g2_obj=0.05,
@@ -1,3 +1,4 @@
+import os
 import distutils
 from distutils.core import setup, Extension, Command
 import numpy
@@ -5,13 +6,21 @@ import numpy
 sources=["ngmix/_gmix.c"]
 include_dirs=[numpy.get_include()]
 
-ext=Extension("ngmix._gmix", sources, include_dirs=include_dirs)
+# the batch kernels are threaded with OpenMP.  Set NGMIX_NO_OPENMP
+# for compilers without support, e.g. the default clang on OS X
+extra_compile_args=[]
+extra_link_args=[]
+if 'NGMIX_NO_OPENMP' not in os.environ:
+    extra_compile_args += ['-fopenmp']
+    extra_link_args += ['-fopenmp']
+
+ext=Extension("ngmix._gmix",
+              sources,
+              include_dirs=include_dirs,
+              extra_compile_args=extra_compile_args,
+              extra_link_args=extra_link_args)
 
 setup(name="ngmix", 
       packages=['ngmix'],
       version="0.9.0",
       ext_modules=[ext])
-
-
-
-
@@ -9,6 +9,7 @@
 
 #include <stdexcept>
 #include <vector>
+#include <array>
 #include <cmath>
 #include <cstdio>
 #include <sstream>
@@ -118,6 +119,125 @@ namespace NGMix {
 
 
 
+    /*
+
+       pixel loops shared by GMix and GMixModel<Model>.  The mixture type
+       only needs to provide operator()(u,v)
+
+    */
+
+    // render using the jacobian image transformation
+    template <class GMixType>
+    void gmix_render(const GMixType &gmix,
+                     image::Image &image,
+                     const jacobian::Jacobian &jacob,
+                     int nsub) {
+
+        double col0=jacob.col0;
+        double row0=jacob.row0;
+        double dudrow=jacob.dudrow;
+        double dudcol=jacob.dudcol;
+        double dvdrow=jacob.dvdrow;
+        double dvdcol=jacob.dvdcol;
+
+        double stepsize = 1./nsub;
+        double offset = (nsub-1)*stepsize/2.;
+        double areafac = 1./(nsub*nsub);
+
+        double ustepsize = stepsize*dudcol;
+        double vstepsize = stepsize*dvdcol;
+
+        long nrows=image.get_nrows();
+        long ncols=image.get_ncols();
+
+        for (long row=0; row<nrows; row++) {
+            for (long col=0; col<ncols; col++) {
+
+                double tval=0.0;
+                double trow = row-offset;
+                double lowcol = col-offset;
+
+                for (long irowsub=0; irowsub<nsub; irowsub++) {
+
+                    // always start from lowcol position, then step u,v later
+                    double u=dudrow*(trow - row0) + dudcol*(lowcol - col0);
+                    double v=dvdrow*(trow - row0) + dvdcol*(lowcol - col0);
+
+                    for (long icolsub=0; icolsub<nsub; icolsub++) {
+
+                        tval += gmix(u,v);
+
+                        u += ustepsize;
+                        v += vstepsize;
+                    }
+                    // step to next sub-row
+                    trow += stepsize;
+                }
+
+                tval *= areafac;
+                image(row,col) = tval;
+            }
+        }
+    }
+
+    /*
+       The model is evaluated at the jacobian (u,v) of each pixel, as in
+       gmix_render.  Before ea7c981 GMix::get_loglike evaluated it at the
+       raw (row,col), so results differ from older versions unless the
+       jacobian is the identity with center (0,0)
+    */
+    template <class GMixType>
+    void gmix_get_loglike(const GMixType &gmix,
+                          const image::Image &image,
+                          const image::Image &weight,
+                          const jacobian::Jacobian &jacob,
+                          double *loglike,
+                          double *s2n_numer,
+                          double *s2n_denom) {
+
+        double col0=jacob.col0;
+        double row0=jacob.row0;
+        double dudrow=jacob.dudrow;
+        double dudcol=jacob.dudcol;
+        double dvdrow=jacob.dvdrow;
+        double dvdcol=jacob.dvdcol;
+
+        *loglike=0;
+        *s2n_numer=0;
+        *s2n_denom=0;
+        long nrows=image.get_nrows();
+        long ncols=image.get_ncols();
+
+        for (long row=0; row<nrows; row++) {
+
+            // always start from lowcol position, then step u,v later
+            double u=dudrow*(row - row0) + dudcol*(0.0 - col0);
+            double v=dvdrow*(row - row0) + dvdcol*(0.0 - col0);
+
+            for (long col=0; col<ncols; col++, u += dudcol, v += dvdcol) {
+
+                double ivar=weight(row,col);
+                if (ivar <= 0.0) {
+                    continue;
+                }
+
+                double model_val = gmix(u,v);
+                double pixel_val = image(row,col);
+
+                double diff=model_val-pixel_val;
+
+                (*loglike) += diff*diff*ivar;
+                (*s2n_numer) += pixel_val*model_val*ivar;
+                (*s2n_denom) += model_val*model_val*ivar;
+
+            } // columns
+        } //rows
+
+        (*loglike) *= (-0.5);
+
+    } // get loglike
+
+
     class GMix {
         public:
             GMix() {
@@ -196,106 +316,18 @@ namespace NGMix {
             void render(image::Image &image,
                         const jacobian::Jacobian &jacob,
                         int nsub=1) const {
-
-                double col0=jacob.col0;
-                double row0=jacob.row0;
-                double dudrow=jacob.dudrow;
-                double dudcol=jacob.dudcol;
-                double dvdrow=jacob.dvdrow;
-                double dvdcol=jacob.dvdcol;
-
-                double stepsize = 1./nsub;
-                double offset = (nsub-1)*stepsize/2.;
-                double areafac = 1./(nsub*nsub);
-
-                double ustepsize = stepsize*dudcol;
-                double vstepsize = stepsize*dvdcol;
-
-                long nrows=image.get_nrows();
-                long ncols=image.get_ncols();
-
-                for (long row=0; row<nrows; row++) {
-                    for (long col=0; col<ncols; col++) {
-
-                        double tval=0.0;
-                        double trow = row-offset;
-                        double lowcol = col-offset;
-
-                        for (long irowsub=0; irowsub<nsub; irowsub++) {
-
-                            // always start from lowcol position, then step u,v later
-                            double u=dudrow*(trow - row0) + dudcol*(lowcol - col0);
-                            double v=dvdrow*(trow - row0) + dvdcol*(lowcol - col0);
-
-                            for (long icolsub=0; icolsub<nsub; icolsub++) {
-
-                                tval += (*this)(u,v);
-
-                                u += ustepsize;
-                                v += vstepsize;
-                            }
-                            // step to next sub-row
-                            trow += stepsize;
-                        }
-
-                        tval *= areafac;
-                        image(row,col) = tval;
-                    }
-                }
+                gmix_render(*this, image, jacob, nsub);
             }
 
-
             void get_loglike(const image::Image &image,
                              const image::Image &weight,
                              const jacobian::Jacobian &jacob,
                              double *loglike,
                              double *s2n_numer,
                              double *s2n_denom) const {
-
-                double col0=jacob.col0;
-                double row0=jacob.row0;
-                double dudrow=jacob.dudrow;
-                double dudcol=jacob.dudcol;
-                double dvdrow=jacob.dvdrow;
-                double dvdcol=jacob.dvdcol;
-
-                *loglike=0;
-                *s2n_numer=0;
-                *s2n_denom=0;
-                long nrows=image.get_nrows();
-                long ncols=image.get_ncols();
-
-                for (long row=0; row<nrows; row++) {
-
-                    // always start from lowcol position, then step u,v later
-                    double u=dudrow*(row - row0) + dudcol*(0.0 - col0);
-                    double v=dvdrow*(row - row0) + dvdcol*(0.0 - col0);
-
-                    for (long col=0; col<ncols; col++) {
-
-                        double ivar=weight(row,col);
-                        if (ivar <= 0.0) {
-                            continue;
-                        }
-
-                        double model_val = (*this)(row,col);
-                        double pixel_val = image(row,col);
-
-                        double diff=model_val-pixel_val;
-
-                        (*loglike) += diff*diff*ivar;
-                        (*s2n_numer) += pixel_val*model_val*ivar;
-                        (*s2n_denom) += model_val*model_val*ivar;
-
-                        u += dudcol;
-                        v += dvdcol;
-
-                    } // columns
-                } //rows
-
-                (*loglike) *= (-0.5);
-
-            } // get loglike
+                gmix_get_loglike(*this, image, weight, jacob,
+                                 loglike, s2n_numer, s2n_denom);
+            }
 
             void print() {
                 for (long i=0; i<ngauss_; i++) {
@@ -322,12 +354,12 @@ namespace NGMix {
 
     static const size_t SIMPLE_NPARS=6;
 
-    static const long GAUSS_NGAUSS=1;
-    static const double GAUSS_PVALS[] = {1.0};
-    static const double GAUSS_FVALS[] = {1.0};
+    static constexpr long GAUSS_NGAUSS=1;
+    static constexpr double GAUSS_PVALS[] = {1.0};
+    static constexpr double GAUSS_FVALS[] = {1.0};
 
-    static const long EXP_NGAUSS=6;
-    static const double EXP_PVALS[] = {
+    static constexpr long EXP_NGAUSS=6;
+    static constexpr double EXP_PVALS[] = {
         0.00061601229677880041, 
         0.0079461395724623237, 
         0.053280454055540001, 
@@ -335,7 +367,7 @@ namespace NGMix {
         0.45496740582554868, 
         0.26521634184240478
     };
-    static const double EXP_FVALS[] = {
+    static constexpr double EXP_FVALS[] = {
         0.002467115141477932, 
         0.018147435573256168, 
         0.07944063151366336, 
@@ -344,8 +376,8 @@ namespace NGMix {
         2.1623306025075739
         };
 
-    static const long DEV_NGAUSS=10;
-    static const double DEV_PVALS[] = {
+    static constexpr long DEV_NGAUSS=10;
+    static constexpr double DEV_PVALS[] = {
         6.5288960012625658e-05, 
         0.00044199216814302695, 
         0.0020859587871659754, 
@@ -357,7 +389,7 @@ namespace NGMix {
         0.29254151133139222, 
         0.28905301416582552
     };
-    static const double DEV_FVALS[] = {
+    static constexpr double DEV_FVALS[] = {
         3.068330909892871e-07,
         3.551788624668698e-06,
         2.542810833482682e-05,
@@ -371,14 +403,14 @@ namespace NGMix {
     };
 
 
-    static const long TURB_NGAUSS=3;
+    static constexpr long TURB_NGAUSS=3;
 
-    static const double TURB_PVALS[] = {
+    static constexpr double TURB_PVALS[] = {
         0.596510042804182,
         0.4034898268889178,
         1.303069003078001e-07
     };
-    static const double TURB_FVALS[] = {
+    static constexpr double TURB_FVALS[] = {
         0.5793612389470884,
         1.621860687127999,
         7.019347162356363
@@ -514,6 +546,197 @@ namespace NGMix {
     };
 
 
+
+    /*
+
+       Compile time specialization of the simple models
+
+       The Model traits give the number of gaussians and the p,f values as
+       constant expressions, so with GMixModel<Model> the component count is
+       known at compile time and there are no virtual calls.
+
+       The components of a simple model share the center and shape and
+       differ only in size, T_i = f_i T, so chi^2 for component i is that
+       of the unit component divided by f_i.  Each pixel therefore costs one
+       quadratic form plus a multiply and an exp per component.  The f
+       values are in increasing order, so the components are checked from
+       the widest down and the loop stops at the first one beyond
+       GAUSS_EXP_MAX_CHI2.
+
+       Usage is the same as for the GMixSimple classes, e.g.
+
+           GMixModel<ExpModel> gmix(pars);
+           gmix.render(image, jacob);
+
+    */
+
+    struct GaussModel {
+        static constexpr long ngauss=GAUSS_NGAUSS;
+        static constexpr double pval(long i) { return GAUSS_PVALS[i]; }
+        static constexpr double fval(long i) { return GAUSS_FVALS[i]; }
+    };
+    struct ExpModel {
+        static constexpr long ngauss=EXP_NGAUSS;
+        static constexpr double pval(long i) { return EXP_PVALS[i]; }
+        static constexpr double fval(long i) { return EXP_FVALS[i]; }
+    };
+    struct DevModel {
+        static constexpr long ngauss=DEV_NGAUSS;
+        static constexpr double pval(long i) { return DEV_PVALS[i]; }
+        static constexpr double fval(long i) { return DEV_FVALS[i]; }
+    };
+    struct TurbModel {
+        static constexpr long ngauss=TURB_NGAUSS;
+        static constexpr double pval(long i) { return TURB_PVALS[i]; }
+        static constexpr double fval(long i) { return TURB_FVALS[i]; }
+    };
+
+    // true if the f values of the model increase from index i on
+    template <class Model>
+    constexpr bool gmix_model_fvals_sorted(long i=1) {
+        return i >= Model::ngauss
+            || ( Model::fval(i-1) < Model::fval(i)
+                 && gmix_model_fvals_sorted<Model>(i+1) );
+    }
+
+    template <class Model>
+    class GMixModel {
+
+        static_assert(gmix_model_fvals_sorted<Model>(),
+                      "model f values must be increasing");
+
+        public:
+
+            static constexpr long ngauss=Model::ngauss;
+
+            GMixModel() {}
+            GMixModel(const vector<double> &pars) {
+                set_from_pars(pars);
+            }
+
+            long size() const {
+                return ngauss;
+            }
+
+            inline double operator()(double row, double col) const {
+                double u = row - row_;
+                double v = col - col_;
+
+                // chi^2 for the unit component, f=1
+                double chi2 =
+                    dcc_*u*u + drr_*v*v - 2.0*drc_*u*v;
+
+                double val=0.0;
+                for (long i=ngauss-1; i>=0; i--) {
+                    double chi2_i = chi2*ifvals_[i];
+                    if (chi2_i >= GAUSS_EXP_MAX_CHI2) {
+                        break;
+                    }
+                    val += pnorms_[i]*expd( -0.5*chi2_i );
+                }
+
+                return val;
+            }
+
+            void set_from_pars(const vector<double> &pars) {
+                if ( pars.size() != SIMPLE_NPARS ) {
+                    std::stringstream err;
+                    err << "GMix error: expected "<<SIMPLE_NPARS
+                        <<" pars but got "<<pars.size()<<"\n";
+                    throw std::runtime_error(err.str());
+                }
+
+                set_from_pars(pars[0], pars[1], pars[2],
+                              pars[3], pars[4], pars[5]);
+            }
+
+            void set_from_pars(double row, double col,
+                               double g1, double g2,
+                               double T, double counts) {
+
+                Shape shape(g1, g2);
+
+                double irr = 0.5*T*(1-shape.e1);
+                double irc = 0.5*T*shape.e2;
+                double icc = 0.5*T*(1+shape.e1);
+                double det = irr*icc - irc*irc;
+
+                if (det <= 0) {
+                    throw std::out_of_range("det <= 0");
+                }
+
+                row_ = row;
+                col_ = col;
+                T_ = T;
+                e1_ = shape.e1;
+                e2_ = shape.e2;
+
+                drr_ = irr/det;
+                drc_ = irc/det;
+                dcc_ = icc/det;
+
+                // det_i = f_i^2 det
+                double norm = 1./(TWO_PI*std::sqrt(det));
+                for (long i=0; i<ngauss; i++) {
+                    ifvals_[i] = 1.0/Model::fval(i);
+                    pnorms_[i] = counts*Model::pval(i)*norm*ifvals_[i];
+                }
+                counts_ = counts;
+            }
+
+            // This just creates a default jacobian
+            void render(image::Image &image, int nsub=1) const {
+                jacobian::Jacobian j;
+                render(image, j, nsub);
+            }
+
+            // render using the jacobian image transformation
+            void render(image::Image &image,
+                        const jacobian::Jacobian &jacob,
+                        int nsub=1) const {
+                gmix_render(*this, image, jacob, nsub);
+            }
+
+            void get_loglike(const image::Image &image,
+                             const image::Image &weight,
+                             const jacobian::Jacobian &jacob,
+                             double *loglike,
+                             double *s2n_numer,
+                             double *s2n_denom) const {
+                gmix_get_loglike(*this, image, weight, jacob,
+                                 loglike, s2n_numer, s2n_denom);
+            }
+
+            void print() const {
+                for (long i=0; i<ngauss; i++) {
+                    double T_i_2 = 0.5*T_*Model::fval(i);
+                    Gauss gauss(counts_*Model::pval(i),
+                                row_, col_,
+                                T_i_2*(1-e1_),
+                                T_i_2*e2_,
+                                T_i_2*(1+e1_));
+                    gauss.print();
+                }
+            }
+
+        protected:
+
+            double row_=0, col_=0;
+            double T_=0, counts_=0, e1_=0, e2_=0;
+
+            // for the unit component; component i has d_i = d/f_i
+            double drr_=0, drc_=0, dcc_=0;
+
+            std::array<double, Model::ngauss> ifvals_={}; // 1/f_i
+            std::array<double, Model::ngauss> pnorms_={}; // p_i counts norm_i
+
+    };
+
+    typedef GMixModel<GaussModel> GMixModelGauss;
+    typedef GMixModel<ExpModel> GMixModelExp;
+    typedef GMixModel<DevModel> GMixModelDev;
+    typedef GMixModel<TurbModel> GMixModelTurb;
+
 }
 
 #endif
@@ -0,0 +1,141 @@
+/*
+   compare the compile time specialized GMixModel<Model> with the
+   virtual dispatch GMixSimple classes, for correctness and speed
+*/
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include "gmix.h"
+#include "image.h"
+#include "mtrng.h"
+#include "jacobian.h"
+
+using namespace std;
+using namespace NGMix;
+
+using image::Image;
+using jacobian::Jacobian;
+
+template <class Model>
+double time_model(GMix &gmix,
+                  GMixModel<Model> &gmix_model,
+                  const vector<double> &pars,
+                  const char *name,
+                  long nrepeat)
+{
+
+    long nrows=48, ncols=48;
+    Image im(nrows, ncols), im_model(nrows, ncols), weight(nrows, ncols);
+    weight.add_scalar(1.0);
+
+    Jacobian jacob(24.0, 23.5, 0.0, 0.27, 0.27, 0.0);
+
+    // check they agree
+    gmix.set_from_pars(pars);
+    gmix_model.set_from_pars(pars);
+
+    gmix.render(im, jacob);
+    gmix_model.render(im_model, jacob);
+
+    double maxdiff=0.0;
+    for (long row=0; row<nrows; row++) {
+        for (long col=0; col<ncols; col++) {
+            double diff=std::fabs(im(row,col)-im_model(row,col));
+            if (diff > maxdiff) {
+                maxdiff=diff;
+            }
+        }
+    }
+
+    // virtual dispatch: set through the base class, as in a fitter
+    GMix *base=&gmix;
+
+    clock_t t1=clock();
+    for (long irep=0; irep<nrepeat; irep++) {
+        base->set_from_pars(pars);
+        base->render(im, jacob);
+    }
+    clock_t t2=clock();
+    double tvirt = (t2-t1)/( (double)CLOCKS_PER_SEC );
+
+    t1=clock();
+    for (long irep=0; irep<nrepeat; irep++) {
+        gmix_model.set_from_pars(pars);
+        gmix_model.render(im_model, jacob);
+    }
+    t2=clock();
+    double tmodel = (t2-t1)/( (double)CLOCKS_PER_SEC );
+
+    // vary the data so the loop can't be hoisted
+    double loglike=0, s2n_numer=0, s2n_denom=0, lsum=0;
+    t1=clock();
+    for (long irep=0; irep<nrepeat; irep++) {
+        im(0,0) = irep;
+        base->get_loglike(im, weight, jacob,
+                          &loglike, &s2n_numer, &s2n_denom);
+        lsum += loglike;
+    }
+    t2=clock();
+    double tvirt_loglike = (t2-t1)/( (double)CLOCKS_PER_SEC );
+
+    t1=clock();
+    for (long irep=0; irep<nrepeat; irep++) {
+        im(0,0) = irep;
+        gmix_model.get_loglike(im, weight, jacob,
+                               &loglike, &s2n_numer, &s2n_denom);
+        lsum += loglike;
+    }
+    t2=clock();
+    double tmodel_loglike = (t2-t1)/( (double)CLOCKS_PER_SEC );
+
+    printf("%-6s max diff: %-10.4g render virtual: %-7.4g s template: %-7.4g s "
+           "speedup: %-5.3g  loglike virtual: %-7.4g s template: %-7.4g s "
+           "speedup: %-5.3g (%g)\n",
+           name, maxdiff,
+           tvirt, tmodel, tvirt/tmodel,
+           tvirt_loglike, tmodel_loglike, tvirt_loglike/tmodel_loglike,
+           lsum);
+
+    return maxdiff;
+}
+
+int main(int argc, char **argv)
+{
+
+    long nrepeat=2000;
+
+    vector<double> pars;
+
+    pars.push_back(0.1);
+    pars.push_back(-0.2);
+    pars.push_back(0.2);
+    pars.push_back(0.1);
+    pars.push_back(8.0);
+    pars.push_back(100.0);
+
+    GMixGauss gauss_gmix;
+    GMixModel<GaussModel> gauss_model;
+
+    GMixTurb turb_gmix;
+    GMixModel<TurbModel> turb_model;
+
+    GMixExp exp_gmix;
+    GMixModel<ExpModel> exp_model;
+
+    GMixDev dev_gmix;
+    GMixModel<DevModel> dev_model;
+
+    double maxdiff=0;
+    maxdiff += time_model(gauss_gmix, gauss_model, pars, "gauss", nrepeat);
+    maxdiff += time_model(turb_gmix, turb_model, pars, "turb", nrepeat);
+    maxdiff += time_model(exp_gmix, exp_model, pars, "exp", nrepeat);
+    maxdiff += time_model(dev_gmix, dev_model, pars, "dev", nrepeat);
+
+    if (maxdiff > 1.0e-10) {
+        printf("error: models disagree\n");
+        return 1;
+    }
+
+    return 0;
+}